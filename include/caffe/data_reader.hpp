@@ -19,6 +19,10 @@ namespace caffe {
  * databases are read sequentially, and that each solver accesses a different
  * subset of the database. Data is distributed to solvers in a round-robin
  * way to keep parallel training deterministic.
+ *
+ * If data_param().num_shards() is larger than one, the reading thread instead
+ * hands out the records read by that many shard threads, each with its own
+ * cursor reading every num_shards-th record of the database.
  */
 template <typename T>
 class DataReader {
@@ -46,6 +50,26 @@ class DataReader {
   DISABLE_COPY_AND_ASSIGN(QueuePair);
   };
 
+  // A shard reads the records first, first + stride, ... of a database, going
+  // around its end.
+  class Shard : public InternalThread {
+   public:
+    Shard(db::DB* db, int first, int stride, QueuePair* qp);
+    virtual ~Shard();
+
+   protected:
+    void InternalThreadEntry();
+
+    db::DB* db_;
+    const int first_;
+    const int stride_;
+    // The queues the shard parses records into, possibly shared with the
+    // other shards.
+    QueuePair* qp_;
+
+  DISABLE_COPY_AND_ASSIGN(Shard);
+  };
+
   // A single body is created per source
   class Body : public InternalThread {
    public:
@@ -55,10 +79,21 @@ class DataReader {
    protected:
     void InternalThreadEntry();
     void read_one(db::Cursor* cursor, QueuePair* qp);
+    // Hand the next record read by the shards over to qp.
+    void forward_one(QueuePair* qp);
+    void StartShards(db::DB* db);
+    void StopShards();
 
     const LayerParameter param_;
     BlockingQueue<shared_ptr<QueuePair> > new_queue_pairs_;
 
+    // Used when reading with shards. With deterministic_shards, each shard
+    // has its own queue pair and they are read from in turn, otherwise all
+    // shards share a single one.
+    vector<shared_ptr<Shard> > shards_;
+    vector<shared_ptr<QueuePair> > shard_queue_pairs_;
+    int next_shard_;
+
     friend class DataReader;
 
   DISABLE_COPY_AND_ASSIGN(Body);
@@ -98,6 +98,10 @@ class DataTransformer {
       const AnnotatedDatum& anno_datum,
       const NormalizedBBox& crop_bbox, const bool do_mirror,
       RepeatedPtrField<AnnotationGroup>* transformed_anno_group_all);
+  void TransformAnnotation(
+      const RepeatedPtrField<AnnotationGroup>& anno_group_all,
+      const NormalizedBBox& crop_bbox, const bool do_mirror,
+      RepeatedPtrField<AnnotationGroup>* transformed_anno_group_all);
 
   /**
    * @brief Crops the datum according to bbox.
@@ -111,6 +115,28 @@ class DataTransformer {
   void CropImage(const AnnotatedDatum& anno_datum, const NormalizedBBox& bbox,
                  AnnotatedDatum* cropped_anno_datum);
 
+  /**
+   * @brief Crops the datum according to bbox and transforms the result, as
+   * CropImage() followed by Transform() would, without copying the datum.
+   * Encoded images are cropped after decoding and are not re-encoded.
+   */
+  void CropAndTransform(const Datum& datum, const NormalizedBBox& bbox,
+                        Blob<Dtype>* transformed_blob);
+
+  /**
+   * @brief Crops the datum and AnnotationGroup according to bbox and
+   * transforms the result, as CropImage() followed by Transform() would,
+   * without copying anno_datum.
+   */
+  void CropAndTransform(const AnnotatedDatum& anno_datum,
+                        const NormalizedBBox& bbox,
+                        Blob<Dtype>* transformed_blob,
+      RepeatedPtrField<AnnotationGroup>* transformed_anno_group_all);
+  void CropAndTransform(const AnnotatedDatum& anno_datum,
+                        const NormalizedBBox& bbox,
+                        Blob<Dtype>* transformed_blob,
+                        vector<AnnotationGroup>* transformed_anno_vec);
+
 #ifdef USE_OPENCV
   /**
    * @brief Applies the transformation defined in the data layer's
@@ -223,12 +249,20 @@ class DataTransformer {
   void Transform(const Datum& datum, Blob<Dtype>* transformed_blob,
                  NormalizedBBox* crop_bbox, bool* do_mirror);
 
+  // Crop, transform and return the transformation information.
+  void CropAndTransform(const Datum& datum, const NormalizedBBox& bbox,
+                        Blob<Dtype>* transformed_blob,
+                        NormalizedBBox* crop_bbox, bool* do_mirror);
+
   // Tranformation parameters
   TransformationParameter param_;
 
 
   shared_ptr<Caffe::RNG> rng_;
   Phase phase_;
+  // Scratch for the cropped annotation in CropAndTransform, reused across
+  // calls.
+  RepeatedPtrField<AnnotationGroup> cropped_anno_group_all_;
   Blob<Dtype> data_mean_;
   vector<Dtype> mean_values_;
 };
@@ -193,6 +193,14 @@ class Layer {
    */
   virtual void ToProto(LayerParameter* param, bool write_diff = false);
 
+  /**
+   * @brief Tells the layer that the data of its blobs was replaced, e.g. by
+   *        Net::CopyTrainedLayersFrom, so that it drops what it computed from
+   *        them, such as quantized weights. Code writing the blobs of a TEST
+   *        layer directly calls it too.
+   */
+  virtual void ParamsChanged() {}
+
   /**
    * @brief Returns the scalar loss associated with a top blob at a given index.
    */
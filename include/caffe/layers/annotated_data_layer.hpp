@@ -12,6 +12,7 @@
 #include "caffe/layers/base_data_layer.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/db.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
 
@@ -30,12 +31,35 @@ class AnnotatedDataLayer : public BasePrefetchingDataLayer<Dtype> {
 
  protected:
   virtual void load_batch(Batch<Dtype>* batch);
+  /// @brief Sample, crop and transform batch_datums_[item_id] into its slot.
+  void load_item(const int item_id, DataTransformer<Dtype>* data_transformer,
+      Blob<Dtype>* transformed_data, Dtype* top_data, Dtype* top_label);
+  /// @brief Load the items of worker worker_id, i.e. every num_threads-th
+  ///        item starting from worker_id, using the worker's own transformer
+  ///        and random stream.
+  void load_worker_items(const int worker_id, Dtype* top_data,
+      Dtype* top_label);
 
   DataReader<AnnotatedDatum> reader_;
   bool has_anno_type_;
   AnnotatedDatum_AnnotationType anno_type_;
   vector<BatchSampler> batch_samplers_;
   string label_map_file_;
+
+  // The datums of the batch being loaded and their transformed annotations.
+  // The annotations are cleared rather than freed between batches, so their
+  // groups are reused.
+  vector<AnnotatedDatum*> batch_datums_;
+  vector<RepeatedPtrField<AnnotationGroup> > batch_annos_;
+  // The largest number of bboxes the label blobs have been sized for.
+  int label_capacity_;
+
+  // State of the extra workers used when num_threads > 1.
+  vector<shared_ptr<DataTransformer<Dtype> > > worker_transformers_;
+  vector<shared_ptr<Blob<Dtype> > > worker_transformed_data_;
+  vector<shared_ptr<Caffe::RNG> > worker_rngs_;
+  // Declared last so that its threads stop before the state above goes away.
+  shared_ptr<ThreadPool> thread_pool_;
 };
 
 }  // namespace caffe
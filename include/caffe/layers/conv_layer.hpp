@@ -8,6 +8,7 @@
 #include "caffe/proto/caffe.pb.h"
 
 #include "caffe/layers/base_conv_layer.hpp"
+#include "caffe/util/quantization.hpp"
 
 namespace caffe {
 
@@ -56,13 +57,22 @@ class ConvolutionLayer : public BaseConvolutionLayer<Dtype> {
    *  output channels. Concretely 4 input channels, 8 output channels, and
    *  2 groups separate input channels 1-2 and output channels 1-4 into the
    *  first group and input channels 3-4 and output channels 5-8 into the second
-   *  group.
+   *  group. Depthwise 2D convolutions, with as many groups and outputs as
+   *  input channels, are computed directly on the CPU instead.
    *  - bias_term (\b optional, default true). Whether to have a bias.
-   *  - engine: convolution has CAFFE (matrix multiplication) and CUDNN (library
-   *    kernels + stream parallelism) engines.
+   *  - engine: convolution has CAFFE (matrix multiplication), CUDNN (library
+   *    kernels + stream parallelism) and WINOGRAD (CPU minimal filtering)
+   *    engines.
+   *
+   *  A 2D convolution without groups runs with int8 arithmetic in the TEST
+   *  phase on the CPU when quantization_param.bottom_max is set, see
+   *  QuantizationParameter.
    */
   explicit ConvolutionLayer(const LayerParameter& param)
       : BaseConvolutionLayer<Dtype>(param) {}
+  virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void ParamsChanged();
 
   virtual inline const char* type() const { return "Convolution"; }
 
@@ -77,6 +87,33 @@ class ConvolutionLayer : public BaseConvolutionLayer<Dtype> {
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
   virtual inline bool reverse_dimensions() { return false; }
   virtual void compute_output_shape();
+
+  // Direct depthwise convolution of one image, as forward_cpu_gemm,
+  // backward_cpu_gemm and weight_cpu_gemm do with im2col.
+  void depthwise_forward_cpu(const Dtype* input, const Dtype* weights,
+      Dtype* output);
+  void depthwise_backward_cpu(const Dtype* output, const Dtype* weights,
+      Dtype* input);
+  void depthwise_weight_cpu(const Dtype* input, const Dtype* output,
+      Dtype* weights);
+
+  /// @brief Whether each output channel only reads the input channel of the
+  ///        same index, so that the CPU convolves directly, without im2col.
+  inline bool is_depthwise() const {
+    return this->num_spatial_axes_ == 2 && !this->force_nd_im2col_ &&
+        this->group_ == this->channels_ && this->num_output_ == this->channels_;
+  }
+
+  /// @brief INT8 inference of Forward_cpu, with the weights quantized on the
+  ///        first call after SetUp() or ParamsChanged().
+  void int8_forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+
+  shared_ptr<Int8Gemm<Dtype> > int8_gemm_;
+  /// The quantized image, channel-last, and its patch for each output
+  /// position, as rows of the int8 matrix multiplication.
+  vector<uint8_t> int8_input_;
+  vector<uint8_t> int8_patches_;
 };
 
 }  // namespace caffe
@@ -15,6 +15,7 @@
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/bbox_util.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 using namespace boost::property_tree;  // NOLINT(build/namespaces)
 
@@ -73,6 +74,15 @@ class DetectionOutputLayer : public Layer<Dtype> {
     NOT_IMPLEMENTED;
   }
 
+  /// @brief Gather the confidences of image i and decode its bboxes which
+  ///        have a confidence above confidence_threshold_.
+  void DecodeImage(const Dtype* loc_data, const Dtype* conf_data, const int i);
+  /// @brief Do nms for image task / num_classes_ and class
+  ///        task % num_classes_.
+  void ApplyNMSToClass(const int task);
+  /// @brief Keep the keep_top_k_ highest scoring detections of image i.
+  void KeepTopKOfImage(const int i);
+
   int num_classes_;
   bool share_location_;
   int num_loc_classes_;
@@ -87,6 +97,16 @@ class DetectionOutputLayer : public Layer<Dtype> {
 
   float nms_threshold_;
   int top_k_;
+  NMSKernel nms_kernel_;
+
+  // Flat buffers used by Forward_cpu, kept to reuse their storage.
+  FlatBBoxes prior_bboxes_;
+  vector<float> prior_variances_;
+  vector<FlatBBoxes> all_decode_bboxes_;
+  vector<vector<float> > all_conf_scores_;
+  vector<vector<vector<int> > > all_indices_;
+  // Spreads decoding and nms over images and classes.
+  shared_ptr<ThreadPool> thread_pool_;
 
   bool need_save_;
   string output_directory_;
@@ -6,6 +6,7 @@
 #include "caffe/blob.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/quantization.hpp"
 
 namespace caffe {
 
@@ -13,6 +14,10 @@ namespace caffe {
  * @brief Also known as a "fully-connected" layer, computes an inner product
  *        with a set of learned weights, and (optionally) adds biases.
  *
+ * Without transposed weights, the layer runs with int8 arithmetic in the TEST
+ * phase on the CPU when quantization_param.bottom_max is set, see
+ * QuantizationParameter.
+ *
  * TODO(dox): thorough documentation for Forward, Backward, and proto params.
  */
 template <typename Dtype>
@@ -24,6 +29,7 @@ class InnerProductLayer : public Layer<Dtype> {
       const vector<Blob<Dtype>*>& top);
   virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
+  virtual void ParamsChanged();
 
   virtual inline const char* type() const { return "InnerProduct"; }
   virtual inline int ExactNumBottomBlobs() const { return 1; }
@@ -45,6 +51,10 @@ class InnerProductLayer : public Layer<Dtype> {
   bool bias_term_;
   Blob<Dtype> bias_multiplier_;
   bool transpose_;  ///< if true, assume transposed weights
+  /// Quantizes the weights on the first Forward_cpu() after SetUp() or
+  /// ParamsChanged().
+  shared_ptr<Int8Gemm<Dtype> > int8_gemm_;
+  vector<uint8_t> int8_input_;  ///< the quantized bottom rows
 };
 
 }  // namespace caffe
@@ -9,6 +9,7 @@
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/bbox_util.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 #include "caffe/layers/loss_layer.hpp"
 
@@ -46,6 +47,10 @@ class MultiBoxLossLayer : public LossLayer<Dtype> {
   virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 
+  /// @brief Match the priors or loc predictions of image i with its ground
+  ///        truth and mine its hard negatives.
+  void MatchImage(const Dtype* loc_data, const Dtype* conf_data, const int i);
+
   // The internal localization loss layer.
   shared_ptr<Layer<Dtype> > loc_loss_layer_;
   LocLossType loc_loss_type_;
@@ -85,6 +90,7 @@ class MultiBoxLossLayer : public LossLayer<Dtype> {
   bool do_neg_mining_;
   float neg_pos_ratio_;
   float neg_overlap_;
+  bool fast_max_conf_;
   CodeType code_type_;
   bool encode_variance_in_target_;
   bool map_object_to_agnostic_;
@@ -99,6 +105,14 @@ class MultiBoxLossLayer : public LossLayer<Dtype> {
   vector<map<int, vector<int> > > all_match_indices_;
   vector<vector<int> > all_neg_indices_;
 
+  // Buffers used by Forward_cpu, kept to reuse their storage.
+  map<int, vector<NormalizedBBox> > all_gt_bboxes_;
+  FlatBBoxes flat_prior_bboxes_;
+  vector<float> flat_prior_variances_;
+  vector<vector<float> > all_max_scores_;
+  // Spreads matching and negative mining over images.
+  shared_ptr<ThreadPool> thread_pool_;
+
   // How to normalize the loss.
   LossParameter_NormalizationMode normalization_;
 };
@@ -6,12 +6,17 @@
 #include "caffe/blob.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
 
 /**
  * @brief Permute the input blob by changing the memory order of the data.
  *
+ * Orders which keep the first axis and rotate the others, e.g. the
+ * (0, 2, 3, 1) of the SSD heads from NCHW to NHWC, transpose a matrix per
+ * item, which the CPU does in cache-sized tiles, spread over num_threads.
+ *
  * TODO(weiliu89): thorough documentation for Forward, Backward, and proto params.
  */
 
@@ -45,8 +50,18 @@ class PermuteLayer : public Layer<Dtype> {
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 
+  /// @brief Transpose one tile of a rows x cols matrix of each item.
+  void TransposeTile(const Dtype* source, const int rows, const int cols,
+      Dtype* destination, const int tile_id);
+
   int num_axes_;
   bool need_permute_;
+  /// The order rotates the axes after the first one: each item is a
+  /// transpose_rows_ x transpose_cols_ matrix to transpose.
+  bool transpose_;
+  int transpose_rows_;
+  int transpose_cols_;
+  shared_ptr<ThreadPool> thread_pool_;
 
   // Use Blob because it is convenient to be accessible in .cu file.
   Blob<int> permute_order_;
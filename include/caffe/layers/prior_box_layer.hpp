@@ -69,6 +69,15 @@ class PriorBoxLayer : public Layer<Dtype> {
   int num_priors_;
   bool clip_;
   vector<float> variance_;
+
+  // The priors only depend on the shapes of the bottoms, so they are kept
+  // along with the shapes they were generated for and reused until one of
+  // these changes.
+  Blob<Dtype> priors_;
+  int priors_layer_height_;
+  int priors_layer_width_;
+  int priors_img_height_;
+  int priors_img_width_;
 };
 
 }  // namespace caffe
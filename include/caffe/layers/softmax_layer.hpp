@@ -6,12 +6,18 @@
 #include "caffe/blob.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
 
 /**
  * @brief Computes the softmax function.
  *
+ * When the softmax axis is the last one, e.g. the class scores of each prior
+ * in the reshaped mbox_conf of SSD, the CPU computes the contiguous rows in
+ * blocks, exponentiated at once, spread over num_threads. With fast_exp, the
+ * blocks go through caffe_exp_nonpositive().
+ *
  * TODO(dox): thorough documentation for Forward, Backward, and proto params.
  */
 template <typename Dtype>
@@ -19,6 +25,8 @@ class SoftmaxLayer : public Layer<Dtype> {
  public:
   explicit SoftmaxLayer(const LayerParameter& param)
       : Layer<Dtype>(param) {}
+  virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
   virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
 
@@ -36,6 +44,12 @@ class SoftmaxLayer : public Layer<Dtype> {
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 
+  /// @brief Forward and backward of the rows of one task, for inner_num_ 1.
+  void ForwardRows(const Dtype* bottom_data, const int channels,
+      Dtype* top_data, const int task_id);
+  void BackwardRows(const Dtype* top_data, const Dtype* top_diff,
+      const int channels, Dtype* bottom_diff, const int task_id);
+
   int outer_num_;
   int inner_num_;
   int softmax_axis_;
@@ -43,6 +57,8 @@ class SoftmaxLayer : public Layer<Dtype> {
   Blob<Dtype> sum_multiplier_;
   /// scale is an intermediate Blob to hold temporary results.
   Blob<Dtype> scale_;
+  shared_ptr<ThreadPool> thread_pool_;
+  bool fast_exp_;
 };
 
 }  // namespace caffe
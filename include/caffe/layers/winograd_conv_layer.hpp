@@ -0,0 +1,64 @@
+#ifndef CAFFE_WINOGRAD_CONV_LAYER_HPP_
+#define CAFFE_WINOGRAD_CONV_LAYER_HPP_
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+#include "caffe/layers/conv_layer.hpp"
+
+namespace caffe {
+
+/*
+ * @brief Winograd implementation of the CPU forward pass of ConvolutionLayer.
+ *        Fallback to ConvolutionLayer for other shapes, the backward pass and
+ *        GPU mode.
+ *
+ * 2D 3x3 convolutions with stride and dilation 1 are computed with the
+ * minimal filtering algorithms F(2x2,3x3) or F(4x4,3x3) of Lavin and Gray,
+ * "Fast Algorithms for Convolutional Neural Networks", 2015, as chosen by
+ * winograd_tile. Each input tile of (tile + 2) x (tile + 2) pixels and each
+ * filter is transformed so that the convolution becomes one matrix
+ * multiplication per transformed pixel, which saves 2.25 or 4 times the
+ * multiplications of im2col and only expands the input by 4 / 2.25 or
+ * 36 / 16 instead of 9. The filters are transformed on every forward pass in
+ * the TRAIN phase, and in the TEST phase only on the first one after SetUp()
+ * or ParamsChanged(). F(4x4,3x3) is the faster of the two but loses a few more bits of
+ * precision.
+ */
+template <typename Dtype>
+class WinogradConvolutionLayer : public ConvolutionLayer<Dtype> {
+ public:
+  explicit WinogradConvolutionLayer(const LayerParameter& param)
+      : ConvolutionLayer<Dtype>(param) {}
+  virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void ParamsChanged();
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+
+  /// @brief Transform the filters, unless they are kept from the last call.
+  void TransformWeights();
+
+  bool use_winograd_;
+  int tile_;
+  int tiles_h_, tiles_w_;
+  /// The transformed filters, per group, transformed pixel, output and input
+  /// channel, and whether they are kept for the next forward pass.
+  Blob<Dtype> transformed_weights_;
+  bool keep_transformed_weights_;
+  /// The transformed input and output tiles of one image and group, per
+  /// transformed pixel, channel and tile.
+  Blob<Dtype> transformed_input_;
+  Blob<Dtype> transformed_output_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_WINOGRAD_CONV_LAYER_HPP_
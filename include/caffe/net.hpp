@@ -11,6 +11,8 @@
 #include "caffe/common.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/layer_scheduler.hpp"
+#include "caffe/util/net_profiler.hpp"
 
 namespace caffe {
 
@@ -210,11 +212,29 @@ class Net {
     return net_output_blob_indices_;
   }
   bool has_blob(const string& blob_name) const;
+  /**
+   * @brief Get a blob by name. With share_activation_memory, the blob gets
+   *        memory of its own, so that its data stays valid after it has been
+   *        used by the net.
+   */
   const shared_ptr<Blob<Dtype> > blob_by_name(const string& blob_name) const;
+  /// @brief The bytes of memory shared by the activations, see
+  ///        NetParameter.share_activation_memory.
+  inline size_t activation_memory_size() const {
+    return activation_memory_ ? activation_memory_->size() : 0;
+  }
   bool has_layer(const string& layer_name) const;
   const shared_ptr<Layer<Dtype> > layer_by_name(const string& layer_name) const;
 
   void set_debug_info(const bool value) { debug_info_ = value; }
+  /**
+   * @brief Record every layer pass of Forward and Backward with profiler,
+   *        or stop recording with NULL.
+   */
+  void set_profiler(const shared_ptr<NetProfiler>& profiler) {
+    profiler_ = profiler;
+  }
+  inline const shared_ptr<NetProfiler>& profiler() const { return profiler_; }
 
   // Helpers for Init.
   /**
@@ -241,6 +261,26 @@ class Net {
   void AppendParam(const NetParameter& param, const int layer_id,
                    const int param_id);
 
+  /// @brief Place the blobs whose lifetimes do not overlap in shared memory.
+  void ShareActivationMemory();
+  /// @brief Give blob_id, and the blobs sharing its data, memory of their own
+  ///        again.
+  void ReleaseActivationMemory(const int blob_id) const;
+
+  /// @brief Make the bottoms of Concat layers views of their regions of the
+  ///        top, see NetParameter.share_concat_memory.
+  void ShareConcatMemory();
+  /// @brief Point the views at the current memory of their tops.
+  void UpdateConcatViews() const;
+  /// @brief Give the bottoms whose region in the top moved with a reshape
+  ///        memory of their own again.
+  void CheckConcatViews();
+
+  /// @brief Run the forward pass of one layer, keeping its loss.
+  void ForwardLayer(const int layer_id);
+  /// @brief Find the layers each layer depends on, for forward_threads.
+  void InitLayerScheduler();
+
   /// @brief Helper for displaying debug info in Forward.
   void ForwardDebugInfo(const int layer_id);
   /// @brief Helper for displaying debug info in Backward.
@@ -303,8 +343,42 @@ class Net {
   vector<bool> has_params_decay_;
   /// The bytes of memory used by this net
   size_t memory_used_;
+  /// Whether the first Forward should share the memory of the activations,
+  /// and which blobs keep memory of their own. blob_by_name() adds to them.
+  bool activation_memory_pending_;
+  mutable vector<bool> blob_keeps_memory_;
+  /// The memory shared by the activations, and for each blob the data it
+  /// placed there, if any. blob_by_name() moves blobs out of it.
+  shared_ptr<SyncedMemory> activation_memory_;
+  mutable vector<shared_ptr<SyncedMemory> > shared_data_;
+  mutable vector<shared_ptr<SyncedMemory> > released_data_;
+  /// A bottom of a Concat layer whose data or diff is a view of its region of
+  /// the top, which it keeps alive.
+  struct ConcatView {
+    int layer_id;
+    int bottom_id;
+    bool diff;
+    shared_ptr<SyncedMemory> memory;
+    shared_ptr<SyncedMemory> top_memory;
+    size_t offset;
+  };
+  /// Whether the next full Forward should look for Concat layers whose
+  /// bottoms can be views of their top, and the views, outer ones first.
+  bool concat_memory_pending_;
+  vector<ConcatView> concat_views_;
+  /// The memory given back to bottoms which were views.
+  map<SyncedMemory*, shared_ptr<SyncedMemory> > concat_own_memory_;
   /// Whether to compute and display debug info for the net.
   bool debug_info_;
+  /// With forward_threads > 1, whether the first Forward should build the
+  /// layer_scheduler_ that runs the layers of the following ones, and their
+  /// losses to sum in order.
+  int forward_threads_;
+  bool layer_scheduler_pending_;
+  shared_ptr<LayerScheduler> layer_scheduler_;
+  vector<Dtype> layer_losses_;
+  /// Records the layer passes, if set.
+  shared_ptr<NetProfiler> profiler_;
   /// The root net that actually holds the shared layers in data parallelism
   const Net* const root_net_;
   DISABLE_COPY_AND_ASSIGN(Net);
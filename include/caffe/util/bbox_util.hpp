@@ -25,9 +25,30 @@ typedef PriorBoxParameter_CodeType CodeType;
 typedef MultiBoxLossParameter_MatchType MatchType;
 typedef MultiBoxLossParameter_LocLossType LocLossType;
 typedef MultiBoxLossParameter_ConfLossType ConfLossType;
+typedef NonMaximumSuppressionParameter_Kernel NMSKernel;
 
 typedef map<int, vector<NormalizedBBox> > LabelBBox;
 
+// Flat (struct of arrays) storage for a set of bboxes. It is used by the CPU
+// detection pipeline so that decoding and nms do not need to allocate a
+// NormalizedBBox for every prior.
+struct FlatBBoxes {
+  vector<float> xmin;
+  vector<float> ymin;
+  vector<float> xmax;
+  vector<float> ymax;
+  vector<float> size;
+
+  inline int num() const { return xmin.size(); }
+  inline void Resize(const int num) {
+    xmin.resize(num);
+    ymin.resize(num);
+    xmax.resize(num);
+    ymax.resize(num);
+    size.resize(num);
+  }
+};
+
 // Function used to sort NormalizedBBox, stored in STL container (e.g. vector),
 // in ascend order based on the score value.
 bool SortBBoxAscend(const NormalizedBBox& bbox1, const NormalizedBBox& bbox2);
@@ -48,6 +69,16 @@ template <typename T>
 bool SortScorePairDescend(const pair<float, T>& pair1,
                           const pair<float, T>& pair2);
 
+// Sort pair<float, T> in descend order based on the score (first) value and
+// keep at most top_k of them. Produces the same result as std::stable_sort
+// with SortScorePairDescend followed by resize, but only orders the kept
+// pairs, which is much cheaper when top_k is small compared to the input.
+//    top_k: if -1, keep all; otherwise, keep at most top_k.
+//    score_pairs: the pairs to sort, replaced by the top_k sorted pairs.
+template <typename T>
+void PartialSortScorePairDescend(const int top_k,
+      vector<pair<float, T> >* score_pairs);
+
 // Generate unit bbox [0, 0, 1, 1]
 NormalizedBBox UnitBBox();
 
@@ -77,6 +108,23 @@ bool ProjectBBox(const NormalizedBBox& src_bbox, const NormalizedBBox& bbox,
 float JaccardOverlap(const NormalizedBBox& bbox1, const NormalizedBBox& bbox2,
                      const bool normalized = true);
 
+// Compute the jaccard overlap between the i-th and j-th bbox of bboxes. It
+// gives the same result as JaccardOverlap() on the equivalent NormalizedBBox.
+float JaccardOverlap(const FlatBBoxes& bboxes, const int i, const int j);
+
+// Check if the running CPU supports the given nms kernel. AUTO and SCALAR are
+// always supported.
+bool NMSKernelSupported(const NMSKernel kernel);
+
+// Compute the jaccard overlap between the i-th bbox of bboxes and each bbox of
+// others in [start, end), several bboxes at a time.
+//    kernel: the instruction set to use. AUTO picks the widest supported one.
+//    overlaps: stores end - start overlaps. overlaps[j - start] is the same as
+//      JaccardOverlap() between others[j] and bboxes[i].
+void JaccardOverlaps(const FlatBBoxes& bboxes, const int i,
+    const FlatBBoxes& others, const int start, const int end,
+    const NMSKernel kernel, float* overlaps);
+
 // Compute the coverage of bbox1 by bbox2.
 float BBoxCoverage(const NormalizedBBox& bbox1, const NormalizedBBox& bbox2);
 
@@ -112,12 +160,59 @@ void DecodeBBoxesAll(const vector<LabelBBox>& all_loc_pred,
     const CodeType code_type, const bool variance_encoded_in_target,
     vector<LabelBBox>* all_decode_bboxes);
 
+// Decode the location predictions of one image into flat bboxes.
+//    loc_data: num_priors * num_loc_classes * 4 values of a single image.
+//    prior_bboxes: prior bboxes retrieved by GetPriorBBoxes().
+//    prior_variances: num_priors * 4 prior variances.
+//    num_loc_classes: number of location classes.
+//    loc_class: which location class to decode.
+//    decode_bboxes: stores the decoded bboxes and their sizes.
+template <typename Dtype>
+void DecodeBBoxes(const Dtype* loc_data, const FlatBBoxes& prior_bboxes,
+    const vector<float>& prior_variances, const CodeType code_type,
+    const bool variance_encoded_in_target, const int num_loc_classes,
+    const int loc_class, FlatBBoxes* decode_bboxes);
+
+// Decode only the location predictions of the priors in indices, e.g. those
+// found by GetCandidatePriors(). The bboxes of the other priors are left
+// unset.
+template <typename Dtype>
+void DecodeBBoxes(const Dtype* loc_data, const FlatBBoxes& prior_bboxes,
+    const vector<float>& prior_variances, const CodeType code_type,
+    const bool variance_encoded_in_target, const int num_loc_classes,
+    const int loc_class, const vector<int>& indices,
+    FlatBBoxes* decode_bboxes);
+
+// Get the priors of a single image which have a score above threshold, i.e.
+// the only ones whose bboxes ApplyNMSFast() looks at with that threshold.
+//    conf_scores: class major scores from GetConfidenceScores().
+//    num_priors: number of priors.
+//    num_classes: number of classes.
+//    background_label_id: class to skip if label is -1.
+//    label: the class to check, or -1 for all classes but the background.
+//    threshold: only priors with a score above it are kept.
+//    indices: stores the candidate priors in increasing order.
+void GetCandidatePriors(const float* conf_scores, const int num_priors,
+    const int num_classes, const int background_label_id, const int label,
+    const float threshold, vector<int>* indices);
+
 // Match prediction bboxes with ground truth bboxes.
 void MatchBBox(const vector<NormalizedBBox>& gt,
     const vector<NormalizedBBox>& pred_bboxes, const int label,
     const MatchType match_type, const float overlap_threshold,
     vector<int>* match_indices, vector<float>* match_overlaps);
 
+// Match flat prediction bboxes with flat ground truth bboxes. It gives the
+// same result as the NormalizedBBox version, but computes all the overlaps
+// with one JaccardOverlaps() call per ground truth.
+//    gt_labels: the label of each ground truth bbox.
+//    kernel: the instruction set used to compute the overlaps.
+void MatchBBox(const FlatBBoxes& gt_bboxes, const vector<int>& gt_labels,
+    const FlatBBoxes& pred_bboxes, const int label,
+    const MatchType match_type, const float overlap_threshold,
+    vector<int>* match_indices, vector<float>* match_overlaps,
+    const NMSKernel kernel = NonMaximumSuppressionParameter_Kernel_AUTO);
+
 // Retrieve bounding box ground truth from gt_data.
 //    gt_data: 1 x 1 x num_gt x 7 blob.
 //    num_gt: the number of ground truth.
@@ -176,6 +271,17 @@ void GetConfidenceScores(const Dtype* conf_data, const int num,
       const int num_preds_per_class, const int num_classes,
       const bool class_major, vector<map<int, vector<float> > >* conf_scores);
 
+// Get confidence predictions of a single image in class major order.
+//    conf_data: num_preds_per_class * num_classes values of a single image.
+//    num_preds_per_class: number of predictions per class.
+//    num_classes: number of classes.
+//    conf_scores: stores num_classes * num_preds_per_class scores, so that the
+//      scores of class c start at c * num_preds_per_class.
+template <typename Dtype>
+void GetConfidenceScores(const Dtype* conf_data,
+      const int num_preds_per_class, const int num_classes,
+      vector<float>* conf_scores);
+
 // Get max confidence scores for each prior from conf_data.
 //    conf_data: num x num_preds_per_class * num_classes blob.
 //    num: the number of images.
@@ -191,6 +297,18 @@ void GetMaxConfidenceScores(const Dtype* conf_data, const int num,
       const int background_label_id, const ConfLossType loss_type,
       vector<vector<float> >* all_max_scores);
 
+// Get max confidence scores for each prior of a single image.
+//    conf_data: num_preds_per_class * num_classes confidences of the image.
+//    fast_softmax: if true and loss_type is SOFTMAX, compute the softmax with
+//      a vectorized approximation of exp(), which is within a few ulps of the
+//      exact one.
+//    max_scores: stores num_preds_per_class max confidences.
+template <typename Dtype>
+void GetMaxConfidenceScores(const Dtype* conf_data,
+      const int num_preds_per_class, const int num_classes,
+      const int background_label_id, const ConfLossType loss_type,
+      const bool fast_softmax, float* max_scores);
+
 // Get prior bounding boxes from prior_data.
 //    prior_data: 1 x 2 x num_priors * 4 x 1 blob.
 //    num_priors: number of priors.
@@ -201,6 +319,15 @@ void GetPriorBBoxes(const Dtype* prior_data, const int num_priors,
       vector<NormalizedBBox>* prior_bboxes,
       vector<vector<float> >* prior_variances);
 
+// Get prior bounding boxes from prior_data into flat arrays.
+//    prior_data: 1 x 2 x num_priors * 4 x 1 blob.
+//    num_priors: number of priors.
+//    prior_bboxes: stores all the prior bboxes and their sizes.
+//    prior_variances: stores num_priors * 4 variances.
+template <typename Dtype>
+void GetPriorBBoxes(const Dtype* prior_data, const int num_priors,
+      FlatBBoxes* prior_bboxes, vector<float>* prior_variances);
+
 // Get detection results from det_data.
 //    det_data: 1 x 1 x num_det x 7 blob.
 //    num_det: the number of detections.
@@ -227,6 +354,15 @@ void GetTopKScoreIndex(const vector<float>& scores, const int top_k,
 void GetMaxScoreIndex(const vector<float>& scores, const float threshold,
       const int top_k, vector<pair<float, int> >* score_index_vec);
 
+// Get max scores with corresponding indices from a flat score array.
+//    scores: a set of num scores.
+//    threshold: only consider scores higher than the threshold.
+//    top_k: if -1, keep all; otherwise, keep at most top_k.
+//    score_index_vec: store the sorted (score, index) pair.
+void GetMaxScoreIndex(const float* scores, const int num,
+      const float threshold, const int top_k,
+      vector<pair<float, int> >* score_index_vec);
+
 // Do non maximum suppression given bboxes and scores.
 //    bboxes: a set of bounding boxes.
 //    scores: a set of corresponding confidences.
@@ -237,9 +373,12 @@ void GetMaxScoreIndex(const vector<float>& scores, const float threshold,
 //    overlaps: a temp place to optionally store the overlaps between pairs of
 //      bboxes if reuse_overlaps is true.
 //    indices: the kept indices of bboxes after nms.
+//    kernel: the CPU kernel used to compute overlaps if reuse_overlaps is
+//      false. SCALAR compares a single pair of bboxes at a time.
 void ApplyNMS(const vector<NormalizedBBox>& bboxes, const vector<float>& scores,
       const float threshold, const int top_k, const bool reuse_overlaps,
-      map<int, map<int, float> >* overlaps, vector<int>* indices);
+      map<int, map<int, float> >* overlaps, vector<int>* indices,
+      const NMSKernel kernel = NonMaximumSuppressionParameter_Kernel_AUTO);
 
 void ApplyNMS(const bool* overlapped, const int num, vector<int>* indices);
 
@@ -252,9 +391,21 @@ void ApplyNMS(const bool* overlapped, const int num, vector<int>* indices);
 //    nms_threshold: a threshold used in non maximum suppression.
 //    top_k: if not -1, keep at most top_k picked indices.
 //    indices: the kept indices of bboxes after nms.
+//    kernel: the CPU kernel used to compute overlaps. SCALAR compares a single
+//      pair of bboxes at a time.
 void ApplyNMSFast(const vector<NormalizedBBox>& bboxes,
       const vector<float>& scores, const float score_threshold,
-      const float nms_threshold, const int top_k, vector<int>* indices);
+      const float nms_threshold, const int top_k, vector<int>* indices,
+      const NMSKernel kernel = NonMaximumSuppressionParameter_Kernel_AUTO);
+
+// Do non maximum suppression given flat bboxes and scores. It keeps the same
+// indices as the NormalizedBBox version.
+//    bboxes: a set of flat bounding boxes.
+//    scores: bboxes.num() corresponding confidences.
+void ApplyNMSFast(const FlatBBoxes& bboxes, const float* scores,
+      const float score_threshold, const float nms_threshold, const int top_k,
+      vector<int>* indices,
+      const NMSKernel kernel = NonMaximumSuppressionParameter_Kernel_AUTO);
 
 // Compute cumsum of a set of pairs.
 void CumSum(const vector<pair<float, int> >& pairs, vector<int>* cumsum);
@@ -18,8 +18,23 @@ class Cursor {
   virtual void Next() = 0;
   virtual string key() = 0;
   virtual string value() = 0;
+  /**
+   * @brief Points *data at the *size bytes of the current value, without
+   *        copying them when the backend can expose its own storage.
+   *
+   * The bytes are only valid until the cursor moves or is destroyed. The
+   * default implementation keeps a copy of value().
+   */
+  virtual void value_data(const char** data, size_t* size) {
+    value_ = value();
+    *data = value_.data();
+    *size = value_.size();
+  }
   virtual bool valid() = 0;
 
+ private:
+  string value_;
+
   DISABLE_COPY_AND_ASSIGN(Cursor);
 };
 
@@ -34,6 +34,12 @@ class LMDBCursor : public Cursor {
     return string(static_cast<const char*>(mdb_value_.mv_data),
         mdb_value_.mv_size);
   }
+  // The value points into the memory map, which the read-only transaction
+  // keeps valid until the cursor is destroyed.
+  virtual void value_data(const char** data, size_t* size) {
+    *data = static_cast<const char*>(mdb_value_.mv_data);
+    *size = mdb_value_.mv_size;
+  }
   virtual bool valid() { return valid_; }
 
  private:
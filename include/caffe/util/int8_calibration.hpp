@@ -0,0 +1,33 @@
+#ifndef CAFFE_UTIL_INT8_CALIBRATION_HPP_
+#define CAFFE_UTIL_INT8_CALIBRATION_HPP_
+
+#include <string>
+#include <vector>
+
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+// Run iterations of the data of a TEST net through it in FP32, with the given
+// weights, and copy its NetParameter to int8_param, with the bottom_max of
+// the quantization_param of each Convolution and InnerProduct layer that
+// supports int8 set to the largest absolute value of its bottom.
+void CalibrateInt8(const NetParameter& net_param, const string& weights,
+    const int iterations, NetParameter* int8_param);
+
+// Test a TEST net as Solver::TestClassification and Solver::TestDetection
+// do, and return the mean of each output, or its mAP for the outputs of
+// DetectionEvaluate layers, which is_map tells apart.
+vector<float> TestNetOutputs(const NetParameter& net_param,
+    const string& weights, const int iterations, const string& ap_version,
+    vector<string>* output_names, vector<bool>* is_map);
+
+// Test the FP32 and INT8 nets, log their outputs, and return whether the
+// mAP of each DetectionEvaluate output dropped by at most max_map_drop.
+bool CheckInt8Accuracy(const NetParameter& net_param,
+    const NetParameter& int8_param, const string& weights,
+    const int iterations, const string& ap_version, const float max_map_drop);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_INT8_CALIBRATION_HPP_
@@ -0,0 +1,62 @@
+#ifndef CAFFE_UTIL_LAYER_SCHEDULER_HPP_
+#define CAFFE_UTIL_LAYER_SCHEDULER_HPP_
+
+#include <boost/function.hpp>
+
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/thread_pool.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Runs the layers of a net on a ThreadPool as soon as the layers they
+ *        depend on have run, so that independent branches run concurrently.
+ *
+ * Ready layers wait in one queue shared by the threads, which take the
+ * lowest layer id first, so that a net without independent branches runs in
+ * declaration order.
+ */
+class LayerScheduler {
+ public:
+  /**
+   * @param predecessors for each layer, the layers that must run before it,
+   *        all with lower ids.
+   */
+  LayerScheduler(const vector<vector<int> >& predecessors, int num_threads);
+
+  int num_threads() const { return pool_.num_threads(); }
+
+  /**
+   * @brief Call run_layer(i) once for start <= i <= end, after run_layer(p)
+   *        has returned for each of its predecessors p that is in the range,
+   *        and return once all the calls have.
+   */
+  void Run(int start, int end, const boost::function<void(int)>& run_layer);
+
+ private:
+  class sync;
+
+  /// @brief Run ready layers until all the layers of the range have run.
+  void RunLayers(int thread_id);
+
+  vector<vector<int> > successors_;
+  ThreadPool pool_;
+  shared_ptr<sync> sync_;
+
+  // The current range, guarded by the mutex in sync_.
+  const boost::function<void(int)>* run_layer_;
+  int start_;
+  int end_;
+  vector<int> num_waiting_;
+  /// Min-heap of the layers whose predecessors have all run.
+  vector<int> ready_;
+  int num_unfinished_;
+
+DISABLE_COPY_AND_ASSIGN(LayerScheduler);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_LAYER_SCHEDULER_HPP_
@@ -88,6 +88,12 @@ void caffe_rng_bernoulli(const int n, const Dtype p, unsigned int* r);
 template <typename Dtype>
 void caffe_exp(const int n, const Dtype* a, Dtype* y);
 
+// Compute exp(x) in place for x <= 0, e.g. after subtracting the max in a
+// softmax. For floats it is a vectorized polynomial within a few ulps of
+// std::exp().
+template <typename Dtype>
+void caffe_exp_nonpositive(const int n, Dtype* x);
+
 template <typename Dtype>
 void caffe_log(const int n, const Dtype* a, Dtype* y);
 
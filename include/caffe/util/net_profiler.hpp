@@ -0,0 +1,96 @@
+#ifndef CAFFE_UTIL_NET_PROFILER_H_
+#define CAFFE_UTIL_NET_PROFILER_H_
+
+#include <stdint.h>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <string>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/layer.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Records the wall time of every layer pass of a Net, see
+ *        Net::set_profiler.
+ *
+ * Each Forward of the whole net starts a new iteration, and the Backward
+ * passes that follow belong to it. Along with the times, the profiler keeps
+ * the last blob shapes of each layer, the bytes of its tops and parameters,
+ * and an estimate of its FLOPs. The events can be written as a Chrome
+ * trace_event JSON file, to load in chrome://tracing, or as CSV, and are
+ * summarized by percentiles, as tail latency matters more than the mean.
+ *
+ * In GPU mode each layer pass is synchronized with the device, so that its
+ * time is the time of its kernels.
+ */
+class NetProfiler {
+ public:
+  enum Pass { FORWARD = 0, BACKWARD = 1 };
+  struct Event {
+    int layer_id;
+    Pass pass;
+    int iteration;
+    /// Microseconds since the profiler was created.
+    double start_us;
+    double duration_us;
+  };
+  struct LayerInfo {
+    string name;
+    string type;
+    vector<vector<int> > bottom_shapes;
+    vector<vector<int> > top_shapes;
+    /// The bytes allocated for the tops and parameters of the layer.
+    size_t bytes;
+    /// Estimated floating point operations of each pass. Backward counts
+    /// twice as many as forward for layers with parameters, whose gradients
+    /// are computed too.
+    int64_t flops[2];
+  };
+
+  NetProfiler();
+
+  /// @brief Start a new iteration; called by Net::ForwardFromTo(0, ...).
+  void NextIteration() { ++iteration_; }
+  /// @brief Start timing a layer pass.
+  void Begin();
+  /// @brief Record the layer pass started by Begin().
+  template <typename Dtype>
+  void End(const int layer_id, const Pass pass, Layer<Dtype>* layer,
+      const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top);
+  /// @brief Forget the recorded events, e.g. those of warm up iterations.
+  void Clear();
+
+  inline const vector<Event>& events() const { return events_; }
+  inline const vector<LayerInfo>& layers() const { return layers_; }
+
+  /**
+   * @brief The durations in microseconds of the passes of layer_id, one per
+   *        iteration that ran it; with layer_id -1, the total of all the
+   *        layers in each iteration.
+   */
+  vector<double> Durations(const int layer_id, const Pass pass) const;
+  /// @brief The p-th percentile, 0 < p <= 100, by nearest rank.
+  static double Percentile(const vector<double>& values, const double p);
+  static double Mean(const vector<double>& values);
+
+  /// @brief Write the events in the Chrome trace_event format.
+  void WriteChromeTrace(const string& filename) const;
+  /// @brief Write the events as CSV, one line per layer pass.
+  void WriteCSV(const string& filename) const;
+
+ protected:
+  const boost::posix_time::ptime origin_;
+  boost::posix_time::ptime start_;
+  int iteration_;
+  vector<Event> events_;
+  vector<LayerInfo> layers_;
+
+  DISABLE_COPY_AND_ASSIGN(NetProfiler);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_NET_PROFILER_H_
@@ -0,0 +1,22 @@
+#ifndef _CAFFE_UTIL_OPTIMIZE_NET_HPP_
+#define _CAFFE_UTIL_OPTIMIZE_NET_HPP_
+
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+// Copy a TEST NetParameter, already filtered by phase, with the layers which
+// only cost memory passes at inference removed:
+//  - BatchNorm (with global stats) and Scale layers following a Convolution
+//    or InnerProduct layer are folded into its weights and bias, provided the
+//    layers carry their blobs, e.g. as written by Net::ToProto;
+//  - Dropout layers, which copy their bottom in TEST, are dropped;
+//  - ReLU layers are made to work in place.
+// The names of the net inputs and outputs do not change, nor do the outputs
+// up to rounding.
+void OptimizeNetForInference(const NetParameter& param,
+    NetParameter* param_optimized);
+
+}  // namespace caffe
+
+#endif  // _CAFFE_UTIL_OPTIMIZE_NET_HPP_
@@ -0,0 +1,83 @@
+#ifndef CAFFE_UTIL_QUANTIZATION_H_
+#define CAFFE_UTIL_QUANTIZATION_H_
+
+#include <stdint.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+typedef QuantizationParameter_Kernel Int8Kernel;
+
+// Whether the running CPU can use the given kernel.
+bool Int8KernelSupported(const Int8Kernel kernel);
+
+/**
+ * @brief Matrix multiplication with int8 weights and activations, used for
+ *        the INT8 inference of ConvolutionLayer and InnerProductLayer, see
+ *        QuantizationParameter.
+ *
+ * The M x K weights are quantized once per output channel m, with the scale
+ * max_k |w[m][k]| / 127. The activations are quantized per tensor with the
+ * scale bottom_max / 127 and stored as uint8 with an offset of 128, the
+ * operand order of the AVX512 VNNI instructions; the offset is taken out of
+ * the int32 sums with the sum of each weight row. Rows of both operands are
+ * padded to padded_k() bytes, and the results are exact integers, so every
+ * kernel gives the same output.
+ */
+template <typename Dtype>
+class Int8Gemm {
+ public:
+  explicit Int8Gemm(const QuantizationParameter& param);
+
+  /**
+   * @brief Quantize the weights.
+   *
+   * The weights are M rows of K / spatial_dim channels by spatial_dim
+   * positions, and are quantized position-major, so that each row of the
+   * activations holds all the channels of a position together.
+   */
+  void SetWeights(const int M, const int K, const int spatial_dim,
+      const Dtype* weights);
+  /// @brief Whether SetWeights() was called since the last ClearWeights().
+  inline bool has_weights() const { return M_ > 0; }
+  inline void ClearWeights() { M_ = 0; }
+
+  inline int padded_k() const { return padded_k_; }
+  /// @brief The quantized activation of x, plus 128.
+  inline uint8_t Quantize(const Dtype x) const {
+    const float q = std::floor(static_cast<float>(x) * inv_scale_ + 0.5f);
+    return static_cast<uint8_t>(std::max(-127.f, std::min(127.f, q)) + 128);
+  }
+  /// @brief The activation byte of quantized zero, e.g. for padding.
+  inline uint8_t zero() const { return 128; }
+
+  /**
+   * @brief Multiply N rows of padded_k() quantized activations with the
+   *        weights, and write the result for activation row n and output
+   *        channel m to output[n * n_stride + m * m_stride], plus bias[m] if
+   *        bias is not NULL.
+   */
+  void Forward(const int N, const uint8_t* input, const Dtype* bias,
+      Dtype* output, const int n_stride, const int m_stride) const;
+
+ protected:
+  Int8Kernel kernel_;
+  float scale_, inv_scale_;
+  int M_, K_, padded_k_;
+  vector<int8_t> weights_;
+  /// Per output channel: the product of the weight and activation scales,
+  /// and the sum of the quantized weights.
+  vector<float> scales_;
+  vector<int32_t> sums_;
+
+  DISABLE_COPY_AND_ASSIGN(Int8Gemm);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_QUANTIZATION_H_
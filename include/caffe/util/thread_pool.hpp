@@ -0,0 +1,68 @@
+#ifndef CAFFE_UTIL_THREAD_POOL_HPP_
+#define CAFFE_UTIL_THREAD_POOL_HPP_
+
+#include <boost/function.hpp>
+
+#include <vector>
+
+#include "caffe/common.hpp"
+
+/**
+ Forward declare boost::thread instead of including boost/thread.hpp
+ to avoid a boost/NVCC issues (#1009, #1010) on OSX.
+ */
+namespace boost { class thread; }
+
+namespace caffe {
+
+/**
+ * @brief A fixed set of worker threads used to spread independent tasks of a
+ *        single call over several cores.
+ *
+ * The calling thread takes part in the work, so a pool of num_threads threads
+ * starts num_threads - 1 workers and a pool of one thread runs everything
+ * inline. Workers inherit the Caffe mode and solver state of the thread that
+ * created the pool, as InternalThread does.
+ */
+class ThreadPool {
+ public:
+  /// @brief num_threads <= 0 uses one thread per hardware core.
+  explicit ThreadPool(int num_threads);
+  ~ThreadPool();
+
+  int num_threads() const { return num_threads_; }
+
+  /**
+   * @brief Call func(0), ..., func(n - 1) and return once all of them have
+   *        finished. The order in which the calls run is unspecified, so each
+   *        call should only write its own outputs.
+   *
+   * Run must not be called concurrently, nor from within func.
+   */
+  void Run(int n, const boost::function<void(int)>& func);
+
+ private:
+  class sync;
+
+  void entry(Caffe::Brew mode, int solver_count, bool root_solver);
+  /// @brief Run the tasks of the current batch until none is left.
+  void RunTasks();
+
+  int num_threads_;
+  vector<shared_ptr<boost::thread> > threads_;
+  shared_ptr<sync> sync_;
+
+  // The current batch of tasks, guarded by the mutex in sync_.
+  const boost::function<void(int)>* func_;
+  int num_tasks_;
+  int next_task_;
+  int num_unfinished_;
+  int generation_;
+  bool stop_;
+
+DISABLE_COPY_AND_ASSIGN(ThreadPool);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_THREAD_POOL_HPP_
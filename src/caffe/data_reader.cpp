@@ -1,4 +1,5 @@
 #include <boost/thread.hpp>
+#include <algorithm>
 #include <map>
 #include <string>
 #include <vector>
@@ -25,6 +26,9 @@ map<const string, weak_ptr<DataReader<AnnotatedDatum>::Body> >
   DataReader<AnnotatedDatum>::bodies_
   = map<const string, weak_ptr<DataReader<AnnotatedDatum>::Body> >();
 static boost::mutex bodies_mutex_;
+// Creating a cursor is not thread safe for all backends, e.g. LMDB opens the
+// database handle each time.
+static boost::mutex cursors_mutex_;
 
 template <typename T>
 DataReader<T>::DataReader(const LayerParameter& param)
@@ -71,10 +75,57 @@ DataReader<T>::QueuePair::~QueuePair() {
   }
 }
 
+template <typename T>
+DataReader<T>::Shard::Shard(db::DB* db, int first, int stride,
+    QueuePair* qp)
+    : db_(db), first_(first), stride_(stride), qp_(qp) {
+  StartInternalThread();
+}
+
+template <typename T>
+DataReader<T>::Shard::~Shard() {
+  StopInternalThread();
+}
+
+// Move the cursor n records on, going around the end of the database.
+static void Advance(db::Cursor* cursor, int n) {
+  for (int i = 0; i < n; ++i) {
+    cursor->Next();
+    if (!cursor->valid()) {
+      cursor->SeekToFirst();
+    }
+  }
+}
+
+template <typename T>
+void DataReader<T>::Shard::InternalThreadEntry() {
+  shared_ptr<db::Cursor> cursor;
+  {
+    boost::mutex::scoped_lock lock(cursors_mutex_);
+    cursor.reset(db_->NewCursor());
+  }
+  try {
+    // The records in between are skipped without being parsed.
+    Advance(cursor.get(), first_);
+    while (!must_stop()) {
+      T* t = qp_->free_.pop();
+      const char* data;
+      size_t size;
+      cursor->value_data(&data, &size);
+      t->ParseFromArray(data, size);
+      qp_->full_.push(t);
+      Advance(cursor.get(), stride_);
+    }
+  } catch (boost::thread_interrupted&) {
+    // Interrupted exception is expected on shutdown
+  }
+}
+
 template <typename T>
 DataReader<T>::Body::Body(const LayerParameter& param)
     : param_(param),
-      new_queue_pairs_() {
+      new_queue_pairs_(),
+      next_shard_(0) {
   StartInternalThread();
 }
 
@@ -87,7 +138,12 @@ template <typename T>
 void DataReader<T>::Body::InternalThreadEntry() {
   shared_ptr<db::DB> db(db::GetDB(param_.data_param().backend()));
   db->Open(param_.data_param().source(), db::READ);
-  shared_ptr<db::Cursor> cursor(db->NewCursor());
+  shared_ptr<db::Cursor> cursor;
+  if (param_.data_param().num_shards() > 1) {
+    StartShards(db.get());
+  } else {
+    cursor.reset(db->NewCursor());
+  }
   vector<shared_ptr<QueuePair> > qps;
   try {
     int solver_count = param_.phase() == TRAIN ? Caffe::solver_count() : 1;
@@ -114,13 +170,84 @@ void DataReader<T>::Body::InternalThreadEntry() {
   } catch (boost::thread_interrupted&) {
     // Interrupted exception is expected on shutdown
   }
+  // The shards read from db, so stop them before it is closed.
+  StopShards();
+}
+
+template <typename T>
+void DataReader<T>::Body::StartShards(db::DB* db) {
+  int num_records = 0;
+  {
+    shared_ptr<db::Cursor> cursor(db->NewCursor());
+    for (; cursor->valid(); cursor->Next()) {
+      ++num_records;
+    }
+  }
+  CHECK_GT(num_records, 0) << "No records in " << param_.data_param().source();
+  const int num_shards = std::min<int>(param_.data_param().num_shards(),
+                                       num_records);
+  // Give each shard enough records to stay a batch ahead.
+  const int queue_size = param_.data_param().batch_size();
+  if (param_.data_param().deterministic_shards()) {
+    for (int i = 0; i < num_shards; ++i) {
+      shard_queue_pairs_.push_back(
+          shared_ptr<QueuePair>(new QueuePair(queue_size)));
+    }
+  } else {
+    shard_queue_pairs_.push_back(
+        shared_ptr<QueuePair>(new QueuePair(num_shards * queue_size)));
+  }
+  LOG(INFO) << "Reading " << num_records << " records of "
+            << param_.data_param().source() << " with " << num_shards
+            << " shards.";
+  // Shard i reads the records i, i + num_shards, ... of the database seen as
+  // a cycle, so that taking a record from each shard in turn follows the
+  // database order across passes, as a single cursor does.
+  for (int i = 0; i < num_shards; ++i) {
+    QueuePair* qp =
+        shard_queue_pairs_[i % shard_queue_pairs_.size()].get();
+    shards_.push_back(shared_ptr<Shard>(new Shard(db, i, num_shards, qp)));
+  }
+}
+
+template <typename T>
+void DataReader<T>::Body::StopShards() {
+  // Stop the threads first, the shards may be waiting on their queues.
+  shards_.clear();
+  shard_queue_pairs_.clear();
+}
+
+template <typename T>
+void DataReader<T>::Body::forward_one(QueuePair* qp) {
+  QueuePair* shard_qp = shard_queue_pairs_[next_shard_].get();
+  next_shard_ = (next_shard_ + 1) % shard_queue_pairs_.size();
+  T* t = qp->free_.pop();
+  T* shard_t;
+  {
+    // The shards are still running, so this wait ends even on shutdown, and
+    // t is not lost from the queues.
+    boost::this_thread::disable_interruption no_interruption;
+    shard_t = shard_qp->full_.pop();
+  }
+  // Swap rather than copy the record, the shard reuses what t held.
+  t->Swap(shard_t);
+  qp->full_.push(t);
+  shard_qp->free_.push(shard_t);
 }
 
 template <typename T>
 void DataReader<T>::Body::read_one(db::Cursor* cursor, QueuePair* qp) {
+  if (!shards_.empty()) {
+    forward_one(qp);
+    return;
+  }
   T* t = qp->free_.pop();
-  // TODO deserialize in-place instead of copy?
-  t->ParseFromString(cursor->value());
+  // Parse straight from the database's storage, e.g. LMDB's memory map,
+  // rather than from a copy of the value.
+  const char* data;
+  size_t size;
+  cursor->value_data(&data, &size);
+  t->ParseFromArray(data, size);
   qp->full_.push(t);
 
   // go to the next iter
@@ -4,6 +4,11 @@
 #include "caffe/util/im_transforms.hpp"
 #endif  // USE_OPENCV
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define USE_X86_TRANSFORM_KERNELS
+#endif
+
 #include <string>
 #include <vector>
 
@@ -279,43 +284,56 @@ void DataTransformer<Dtype>::TransformAnnotation(
     const NormalizedBBox& crop_bbox, const bool do_mirror,
     RepeatedPtrField<AnnotationGroup>* transformed_anno_group_all) {
   if (anno_datum.type() == AnnotatedDatum_AnnotationType_BBOX) {
-    // Go through each AnnotationGroup.
-    for (int g = 0; g < anno_datum.annotation_group_size(); ++g) {
-      const AnnotationGroup& anno_group = anno_datum.annotation_group(g);
-      AnnotationGroup transformed_anno_group;
-      // Go through each Annotation.
-      bool has_valid_annotation = false;
-      for (int a = 0; a < anno_group.annotation_size(); ++a) {
-        const Annotation& anno = anno_group.annotation(a);
-        const NormalizedBBox& bbox = anno.bbox();
-        if (param_.has_emit_constraint() &&
-            !MeetEmitConstraint(crop_bbox, bbox, param_.emit_constraint())) {
-          continue;
-        }
-        // Adjust bounding box annotation.
-        NormalizedBBox proj_bbox;
-        if (ProjectBBox(crop_bbox, bbox, &proj_bbox)) {
-          has_valid_annotation = true;
-          Annotation* transformed_anno =
-              transformed_anno_group.add_annotation();
-          transformed_anno->set_instance_id(anno.instance_id());
-          NormalizedBBox* transformed_bbox = transformed_anno->mutable_bbox();
-          transformed_bbox->CopyFrom(proj_bbox);
-          if (do_mirror) {
-            Dtype temp = transformed_bbox->xmin();
-            transformed_bbox->set_xmin(1 - transformed_bbox->xmax());
-            transformed_bbox->set_xmax(1 - temp);
-          }
-        }
+    TransformAnnotation(anno_datum.annotation_group(), crop_bbox, do_mirror,
+                        transformed_anno_group_all);
+  } else {
+    LOG(FATAL) << "Unknown annotation type.";
+  }
+}
+
+template<typename Dtype>
+void DataTransformer<Dtype>::TransformAnnotation(
+    const RepeatedPtrField<AnnotationGroup>& anno_group_all,
+    const NormalizedBBox& crop_bbox, const bool do_mirror,
+    RepeatedPtrField<AnnotationGroup>* transformed_anno_group_all) {
+  // Go through each AnnotationGroup of bbox annotations.
+  for (int g = 0; g < anno_group_all.size(); ++g) {
+    const AnnotationGroup& anno_group = anno_group_all.Get(g);
+    // Fill the group in place, so that groups cleared from
+    // transformed_anno_group_all are reused.
+    AnnotationGroup& transformed_anno_group =
+        *transformed_anno_group_all->Add();
+    // Go through each Annotation.
+    bool has_valid_annotation = false;
+    for (int a = 0; a < anno_group.annotation_size(); ++a) {
+      const Annotation& anno = anno_group.annotation(a);
+      const NormalizedBBox& bbox = anno.bbox();
+      if (param_.has_emit_constraint() &&
+          !MeetEmitConstraint(crop_bbox, bbox, param_.emit_constraint())) {
+        continue;
       }
-      // Save for output.
-      if (has_valid_annotation) {
-        transformed_anno_group.set_group_label(anno_group.group_label());
-        transformed_anno_group_all->Add()->CopyFrom(transformed_anno_group);
+      // Adjust bounding box annotation.
+      NormalizedBBox proj_bbox;
+      if (ProjectBBox(crop_bbox, bbox, &proj_bbox)) {
+        has_valid_annotation = true;
+        Annotation* transformed_anno =
+            transformed_anno_group.add_annotation();
+        transformed_anno->set_instance_id(anno.instance_id());
+        NormalizedBBox* transformed_bbox = transformed_anno->mutable_bbox();
+        transformed_bbox->CopyFrom(proj_bbox);
+        if (do_mirror) {
+          Dtype temp = transformed_bbox->xmin();
+          transformed_bbox->set_xmin(1 - transformed_bbox->xmax());
+          transformed_bbox->set_xmax(1 - temp);
+        }
       }
     }
-  } else {
-    LOG(FATAL) << "Unknown annotation type.";
+    // Save for output.
+    if (has_valid_annotation) {
+      transformed_anno_group.set_group_label(anno_group.group_label());
+    } else {
+      transformed_anno_group_all->RemoveLast();
+    }
   }
 }
 
@@ -405,6 +423,227 @@ void DataTransformer<Dtype>::CropImage(const AnnotatedDatum& anno_datum,
 }
 
 #ifdef USE_OPENCV
+// Get the region of an img_height x img_width image covered by bbox.
+static cv::Rect GetCropRect(const int img_height, const int img_width,
+                            const NormalizedBBox& bbox) {
+  NormalizedBBox clipped_bbox;
+  ClipBBox(bbox, &clipped_bbox);
+  NormalizedBBox scaled_bbox;
+  ScaleBBox(clipped_bbox, img_height, img_width, &scaled_bbox);
+  int w_off = static_cast<int>(scaled_bbox.xmin());
+  int h_off = static_cast<int>(scaled_bbox.ymin());
+  int width = static_cast<int>(scaled_bbox.xmax() - scaled_bbox.xmin());
+  int height = static_cast<int>(scaled_bbox.ymax() - scaled_bbox.ymin());
+  return cv::Rect(w_off, h_off, width, height);
+}
+#endif  // USE_OPENCV
+
+template<typename Dtype>
+void DataTransformer<Dtype>::CropAndTransform(const Datum& datum,
+                                              const NormalizedBBox& bbox,
+                                              Blob<Dtype>* transformed_blob,
+                                              NormalizedBBox* crop_bbox,
+                                              bool* do_mirror) {
+  // If datum is encoded, decode it and transform a view of the crop, so that
+  // the pixels are not encoded and decoded once more.
+  if (datum.encoded()) {
+#ifdef USE_OPENCV
+    CHECK(!(param_.force_color() && param_.force_gray()))
+        << "cannot set both force_color and force_gray";
+    cv::Mat cv_img;
+    if (param_.force_color() || param_.force_gray()) {
+      // If force_color then decode in color otherwise decode in gray.
+      cv_img = DecodeDatumToCVMat(datum, param_.force_color());
+    } else {
+      cv_img = DecodeDatumToCVMatNative(datum);
+    }
+    cv::Mat crop_img = cv_img(GetCropRect(cv_img.rows, cv_img.cols, bbox));
+    Transform(crop_img, transformed_blob, crop_bbox, do_mirror);
+    return;
+#else
+    LOG(FATAL) << "Encoded datum requires OpenCV; compile with USE_OPENCV.";
+#endif  // USE_OPENCV
+  }
+  // Otherwise only the cropped pixels are copied.
+  Datum crop_datum;
+  CropImage(datum, bbox, &crop_datum);
+  Transform(crop_datum, transformed_blob, crop_bbox, do_mirror);
+}
+
+template<typename Dtype>
+void DataTransformer<Dtype>::CropAndTransform(const Datum& datum,
+                                              const NormalizedBBox& bbox,
+                                              Blob<Dtype>* transformed_blob) {
+  NormalizedBBox crop_bbox;
+  bool do_mirror;
+  CropAndTransform(datum, bbox, transformed_blob, &crop_bbox, &do_mirror);
+}
+
+template<typename Dtype>
+void DataTransformer<Dtype>::CropAndTransform(
+    const AnnotatedDatum& anno_datum, const NormalizedBBox& bbox,
+    Blob<Dtype>* transformed_blob,
+    RepeatedPtrField<AnnotationGroup>* transformed_anno_group_all) {
+  CHECK_EQ(anno_datum.type(), AnnotatedDatum_AnnotationType_BBOX)
+      << "Unknown annotation type.";
+  // Crop and transform the datum.
+  NormalizedBBox crop_bbox;
+  bool do_mirror;
+  CropAndTransform(anno_datum.datum(), bbox, transformed_blob, &crop_bbox,
+                   &do_mirror);
+
+  // Project the annotation into the cropped region, then transform it.
+  NormalizedBBox clipped_bbox;
+  ClipBBox(bbox, &clipped_bbox);
+  cropped_anno_group_all_.Clear();
+  TransformAnnotation(anno_datum.annotation_group(), clipped_bbox, false,
+                      &cropped_anno_group_all_);
+  TransformAnnotation(cropped_anno_group_all_, crop_bbox, do_mirror,
+                      transformed_anno_group_all);
+}
+
+template<typename Dtype>
+void DataTransformer<Dtype>::CropAndTransform(
+    const AnnotatedDatum& anno_datum, const NormalizedBBox& bbox,
+    Blob<Dtype>* transformed_blob,
+    vector<AnnotationGroup>* transformed_anno_vec) {
+  RepeatedPtrField<AnnotationGroup> transformed_anno_group_all;
+  CropAndTransform(anno_datum, bbox, transformed_blob,
+                   &transformed_anno_group_all);
+  for (int g = 0; g < transformed_anno_group_all.size(); ++g) {
+    transformed_anno_vec->push_back(transformed_anno_group_all.Get(g));
+  }
+}
+
+#ifdef USE_OPENCV
+// Converts a row of width uint8 pixels with kChannels interleaved channels to
+// the channel planes of out, plane_size apart, computing
+// (pixel - mean[c]) * scale and reversing the row if kMirror.
+template <typename Dtype, int kChannels, bool kMirror>
+static void TransformRowHWC(const uchar* ptr, const int width,
+    const Dtype* mean, const Dtype scale, const int plane_size, Dtype* out) {
+  for (int c = 0; c < kChannels; ++c) {
+    const Dtype mean_c = mean[c];
+    const uchar* ptr_c = ptr + c;
+    Dtype* out_c = out + c * plane_size;
+    if (kMirror) {
+      out_c += width - 1;
+      for (int w = 0; w < width; ++w) {
+        out_c[-w] = (static_cast<Dtype>(ptr_c[w * kChannels]) - mean_c) * scale;
+      }
+    } else {
+      for (int w = 0; w < width; ++w) {
+        out_c[w] = (static_cast<Dtype>(ptr_c[w * kChannels]) - mean_c) * scale;
+      }
+    }
+  }
+}
+
+#ifdef USE_X86_TRANSFORM_KERNELS
+// Same as TransformRowHWC<float, 3, kMirror>, 16 pixels at a time.
+template <bool kMirror>
+__attribute__((target("sse4.1")))
+static void TransformRowHWC3SSE(const uchar* ptr, const int width,
+    const float* mean, const float scale, const int plane_size, float* out) {
+  // Gather the bytes of channel c from the three 16 byte loads of a block.
+  static const int8_t kShuffles[3][3][16] = {
+    {{0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+     {-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1},
+     {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13}},
+    {{1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+     {-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1},
+     {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14}},
+    {{2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+     {-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1},
+     {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15}}};
+  __m128i shuffles[3][3];
+  for (int c = 0; c < 3; ++c) {
+    for (int i = 0; i < 3; ++i) {
+      shuffles[c][i] = _mm_loadu_si128(
+          reinterpret_cast<const __m128i*>(kShuffles[c][i]));
+    }
+  }
+  const __m128 scale4 = _mm_set1_ps(scale);
+  int w = 0;
+  for (; w + 16 <= width; w += 16) {
+    const __m128i* block = reinterpret_cast<const __m128i*>(ptr + w * 3);
+    const __m128i a = _mm_loadu_si128(block);
+    const __m128i b = _mm_loadu_si128(block + 1);
+    const __m128i d = _mm_loadu_si128(block + 2);
+    for (int c = 0; c < 3; ++c) {
+      __m128i bytes = _mm_or_si128(
+          _mm_or_si128(_mm_shuffle_epi8(a, shuffles[c][0]),
+                       _mm_shuffle_epi8(b, shuffles[c][1])),
+          _mm_shuffle_epi8(d, shuffles[c][2]));
+      const __m128 mean4 = _mm_set1_ps(mean[c]);
+      float* out_c = out + c * plane_size;
+      for (int k = 0; k < 16; k += 4) {
+        __m128 pixels = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(bytes));
+        pixels = _mm_mul_ps(_mm_sub_ps(pixels, mean4), scale4);
+        if (kMirror) {
+          _mm_storeu_ps(out_c + width - 4 - w - k,
+                        _mm_shuffle_ps(pixels, pixels, 0x1B));
+        } else {
+          _mm_storeu_ps(out_c + w + k, pixels);
+        }
+        bytes = _mm_srli_si128(bytes, 4);
+      }
+    }
+  }
+  // The remaining pixels.
+  if (w < width) {
+    TransformRowHWC<float, 3, kMirror>(ptr + w * 3, width - w, mean, scale,
+        plane_size, kMirror ? out : out + w);
+  }
+}
+#endif  // USE_X86_TRANSFORM_KERNELS
+
+template <typename Dtype>
+struct TransformRowFunction {
+  typedef void (*type)(const uchar* ptr, const int width, const Dtype* mean,
+      const Dtype scale, const int plane_size, Dtype* out);
+};
+
+// Returns a SIMD row kernel supported by the CPU, or NULL if there is none.
+template <typename Dtype>
+static typename TransformRowFunction<Dtype>::type GetTransformRowHWCSIMD(
+    const int channels, const bool mirror) {
+  return NULL;
+}
+
+template <>
+TransformRowFunction<float>::type GetTransformRowHWCSIMD<float>(
+    const int channels, const bool mirror) {
+#ifdef USE_X86_TRANSFORM_KERNELS
+  static const bool has_sse41 = __builtin_cpu_supports("sse4.1");
+  if (channels == 3 && has_sse41) {
+    return mirror ? TransformRowHWC3SSE<true> : TransformRowHWC3SSE<false>;
+  }
+#endif  // USE_X86_TRANSFORM_KERNELS
+  return NULL;
+}
+
+// Returns the row kernel for the given channels, or NULL if there is none.
+template <typename Dtype>
+static typename TransformRowFunction<Dtype>::type GetTransformRowHWC(
+    const int channels, const bool mirror) {
+  typename TransformRowFunction<Dtype>::type simd =
+      GetTransformRowHWCSIMD<Dtype>(channels, mirror);
+  if (simd) {
+    return simd;
+  }
+  switch (channels) {
+    case 1:
+      return mirror ? TransformRowHWC<Dtype, 1, true>
+                    : TransformRowHWC<Dtype, 1, false>;
+    case 3:
+      return mirror ? TransformRowHWC<Dtype, 3, true>
+                    : TransformRowHWC<Dtype, 3, false>;
+    default:
+      return NULL;
+  }
+}
+
 template<typename Dtype>
 void DataTransformer<Dtype>::Transform(const vector<cv::Mat> & mat_vector,
                                        Blob<Dtype>* transformed_blob) {
@@ -523,6 +762,20 @@ void DataTransformer<Dtype>::Transform(const cv::Mat& cv_img,
   CHECK(cv_cropped_image.data);
 
   Dtype* transformed_data = transformed_blob->mutable_cpu_data();
+  // Without a mean file, the common channel counts have a row kernel that
+  // does the HWC to CHW conversion and normalization in one pass.
+  typename TransformRowFunction<Dtype>::type transform_row = has_mean_file ?
+      NULL : GetTransformRowHWC<Dtype>(img_channels, *do_mirror);
+  if (transform_row) {
+    const vector<Dtype> zero_mean(has_mean_values ? 0 : img_channels, 0);
+    const Dtype* mean_data =
+        has_mean_values ? mean_values_.data() : zero_mean.data();
+    for (int h = 0; h < height; ++h) {
+      transform_row(cv_cropped_image.ptr<uchar>(h), width, mean_data, scale,
+                    height * width, transformed_data + h * width);
+    }
+    return;
+  }
   int top_index;
   for (int h = 0; h < height; ++h) {
     const uchar* ptr = cv_cropped_image.ptr<uchar>(h);
@@ -641,23 +894,8 @@ template <typename Dtype>
 void DataTransformer<Dtype>::CropImage(const cv::Mat& img,
                                        const NormalizedBBox& bbox,
                                        cv::Mat* crop_img) {
-  const int img_height = img.rows;
-  const int img_width = img.cols;
-
-  // Get the bbox dimension.
-  NormalizedBBox clipped_bbox;
-  ClipBBox(bbox, &clipped_bbox);
-  NormalizedBBox scaled_bbox;
-  ScaleBBox(clipped_bbox, img_height, img_width, &scaled_bbox);
-
   // Crop the image using bbox.
-  int w_off = static_cast<int>(scaled_bbox.xmin());
-  int h_off = static_cast<int>(scaled_bbox.ymin());
-  int width = static_cast<int>(scaled_bbox.xmax() - scaled_bbox.xmin());
-  int height = static_cast<int>(scaled_bbox.ymax() - scaled_bbox.ymin());
-  cv::Rect bbox_roi(w_off, h_off, width, height);
-
-  img(bbox_roi).copyTo(*crop_img);
+  img(GetCropRect(img.rows, img.cols, bbox)).copyTo(*crop_img);
 }
 #endif  // USE_OPENCV
 
@@ -4,9 +4,10 @@
 #include <stdint.h>
 
 #include <algorithm>
-#include <map>
 #include <vector>
 
+#include "boost/bind.hpp"
+
 #include "caffe/data_transformer.hpp"
 #include "caffe/layers/annotated_data_layer.hpp"
 #include "caffe/util/benchmark.hpp"
@@ -17,7 +18,7 @@ namespace caffe {
 template <typename Dtype>
 AnnotatedDataLayer<Dtype>::AnnotatedDataLayer(const LayerParameter& param)
   : BasePrefetchingDataLayer<Dtype>(param),
-    reader_(param) {
+    reader_(param), label_capacity_(0) {
 }
 
 template <typename Dtype>
@@ -35,6 +36,20 @@ void AnnotatedDataLayer<Dtype>::DataLayerSetUp(
     batch_samplers_.push_back(anno_data_param.batch_sampler(i));
   }
   label_map_file_ = anno_data_param.label_map_file();
+  if (anno_data_param.num_threads() != 1) {
+    // Every worker gets its own transformer and random stream, seeded from
+    // this thread so that they are reproducible for a given seed.
+    thread_pool_.reset(new ThreadPool(anno_data_param.num_threads()));
+    for (int i = 0; i < thread_pool_->num_threads(); ++i) {
+      worker_transformers_.push_back(shared_ptr<DataTransformer<Dtype> >(
+          new DataTransformer<Dtype>(this->transform_param_, this->phase_)));
+      worker_transformers_[i]->InitRand();
+      worker_transformed_data_.push_back(
+          shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+      worker_rngs_.push_back(
+          shared_ptr<Caffe::RNG>(new Caffe::RNG(caffe_rng_rand())));
+    }
+  }
 
   // Read a data point, and use it to initialize the top blob.
   AnnotatedDatum& anno_datum = *(reader_.full().peek());
@@ -120,70 +135,40 @@ void AnnotatedDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
     top_label = batch->label_.mutable_cpu_data();
   }
 
-  // Store transformed annotation.
-  map<int, vector<AnnotationGroup> > all_anno;
-  int num_bboxes = 0;
-
+  // Get the anno_datums of the batch, in order.
+  timer.Start();
+  batch_datums_.resize(batch_size);
   for (int item_id = 0; item_id < batch_size; ++item_id) {
-    timer.Start();
-    // get a anno_datum
-    AnnotatedDatum& anno_datum = *(reader_.full().pop("Waiting for data"));
-    read_time += timer.MicroSeconds();
-    timer.Start();
-    AnnotatedDatum sampled_datum;
-    if (batch_samplers_.size() > 0) {
-      // Generate sampled bboxes from anno_datum.
-      vector<NormalizedBBox> sampled_bboxes;
-      GenerateBatchSamples(anno_datum, batch_samplers_, &sampled_bboxes);
-      if (sampled_bboxes.size() > 0) {
-        // Randomly pick a sampled bbox and crop the anno_datum.
-        int rand_idx = caffe_rng_rand() % sampled_bboxes.size();
-        this->data_transformer_->CropImage(anno_datum, sampled_bboxes[rand_idx],
-                                           &sampled_datum);
-      } else {
-        sampled_datum.CopyFrom(anno_datum);
-      }
-    } else {
-      sampled_datum.CopyFrom(anno_datum);
+    batch_datums_[item_id] = reader_.full().pop("Waiting for data");
+  }
+  read_time += timer.MicroSeconds();
+
+  // Sample and transform them, storing the transformed annotation.
+  timer.Start();
+  batch_annos_.resize(batch_size);
+  if (thread_pool_) {
+    for (int i = 0; i < worker_transformed_data_.size(); ++i) {
+      worker_transformed_data_[i]->ReshapeLike(this->transformed_data_);
     }
-    // Apply data transformations (mirror, scale, crop...)
-    int offset = batch->data_.offset(item_id);
-    this->transformed_data_.set_cpu_data(top_data + offset);
-    vector<AnnotationGroup> transformed_anno_vec;
-    if (this->output_labels_) {
-      if (has_anno_type_) {
-        // Make sure all data have same annotation type.
-        CHECK(sampled_datum.has_type()) << "Some datum misses AnnotationType.";
-        CHECK_EQ(anno_type_, sampled_datum.type()) <<
-            "Different AnnotationType.";
-        // Transform datum and annotation_group at the same time
-        transformed_anno_vec.clear();
-        this->data_transformer_->Transform(sampled_datum,
-                                           &(this->transformed_data_),
-                                           &transformed_anno_vec);
-        if (anno_type_ == AnnotatedDatum_AnnotationType_BBOX) {
-          // Count the number of bboxes.
-          for (int g = 0; g < transformed_anno_vec.size(); ++g) {
-            num_bboxes += transformed_anno_vec[g].annotation_size();
-          }
-        } else {
-          LOG(FATAL) << "Unknown annotation type.";
-        }
-        all_anno[item_id] = transformed_anno_vec;
-      } else {
-        this->data_transformer_->Transform(sampled_datum.datum(),
-                                           &(this->transformed_data_));
-        // Otherwise, store the label from datum.
-        CHECK(sampled_datum.datum().has_label()) << "Cannot find any label.";
-        top_label[item_id] = sampled_datum.datum().label();
-      }
-    } else {
-      this->data_transformer_->Transform(sampled_datum.datum(),
-                                         &(this->transformed_data_));
+    thread_pool_->Run(thread_pool_->num_threads(),
+        boost::bind(&AnnotatedDataLayer::load_worker_items, this, _1,
+                    top_data, top_label));
+  } else {
+    for (int item_id = 0; item_id < batch_size; ++item_id) {
+      load_item(item_id, this->data_transformer_.get(),
+                &(this->transformed_data_), top_data, top_label);
     }
-    trans_time += timer.MicroSeconds();
+  }
+  trans_time += timer.MicroSeconds();
 
-    reader_.free().push(const_cast<AnnotatedDatum*>(&anno_datum));
+  int num_bboxes = 0;
+  for (int item_id = 0; item_id < batch_size; ++item_id) {
+    const RepeatedPtrField<AnnotationGroup>& anno_groups =
+        batch_annos_[item_id];
+    for (int g = 0; g < anno_groups.size(); ++g) {
+      num_bboxes += anno_groups.Get(g).annotation_size();
+    }
+    reader_.free().push(batch_datums_[item_id]);
   }
 
   // Store "rich" annotation if needed.
@@ -199,15 +184,23 @@ void AnnotatedDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
         batch->label_.Reshape(label_shape);
         caffe_set<Dtype>(8, -1, batch->label_.mutable_cpu_data());
       } else {
-        // Reshape the label and store the annotation.
+        // Reshape the label and store the annotation. Grow the label storage
+        // geometrically, so that batches with a few more bboxes than seen
+        // so far do not reallocate it each time.
+        if (num_bboxes > label_capacity_) {
+          label_capacity_ = std::max(num_bboxes, 2 * label_capacity_);
+        }
+        label_shape[2] = label_capacity_;
+        batch->label_.Reshape(label_shape);
         label_shape[2] = num_bboxes;
         batch->label_.Reshape(label_shape);
         top_label = batch->label_.mutable_cpu_data();
         int idx = 0;
         for (int item_id = 0; item_id < batch_size; ++item_id) {
-          const vector<AnnotationGroup>& anno_vec = all_anno[item_id];
-          for (int g = 0; g < anno_vec.size(); ++g) {
-            const AnnotationGroup& anno_group = anno_vec[g];
+          const RepeatedPtrField<AnnotationGroup>& anno_groups =
+              batch_annos_[item_id];
+          for (int g = 0; g < anno_groups.size(); ++g) {
+            const AnnotationGroup& anno_group = anno_groups.Get(g);
             for (int a = 0; a < anno_group.annotation_size(); ++a) {
               const Annotation& anno = anno_group.annotation(a);
               const NormalizedBBox& bbox = anno.bbox();
@@ -234,6 +227,81 @@ void AnnotatedDataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
   DLOG(INFO) << "Transform time: " << trans_time / 1000 << " ms.";
 }
 
+template<typename Dtype>
+void AnnotatedDataLayer<Dtype>::load_item(const int item_id,
+    DataTransformer<Dtype>* data_transformer, Blob<Dtype>* transformed_data,
+    Dtype* top_data, Dtype* top_label) {
+  const AnnotatedDatum& anno_datum = *batch_datums_[item_id];
+  // Pick the region of anno_datum to use. The datum is never copied: it is
+  // cropped and transformed in one go straight into the batch.
+  bool do_crop = false;
+  NormalizedBBox sampled_bbox;
+  if (batch_samplers_.size() > 0) {
+    // Generate sampled bboxes from anno_datum.
+    vector<NormalizedBBox> sampled_bboxes;
+    GenerateBatchSamples(anno_datum, batch_samplers_, &sampled_bboxes);
+    if (sampled_bboxes.size() > 0) {
+      // Randomly pick a sampled bbox to crop the anno_datum with.
+      int rand_idx = caffe_rng_rand() % sampled_bboxes.size();
+      sampled_bbox = sampled_bboxes[rand_idx];
+      do_crop = true;
+    }
+  }
+  // Apply data transformations (mirror, scale, crop...)
+  const int offset = item_id * transformed_data->count();
+  transformed_data->set_cpu_data(top_data + offset);
+  RepeatedPtrField<AnnotationGroup>& transformed_anno_groups =
+      batch_annos_[item_id];
+  transformed_anno_groups.Clear();
+  if (this->output_labels_ && has_anno_type_) {
+    // Make sure all data have same annotation type.
+    CHECK(anno_datum.has_type()) << "Some datum misses AnnotationType.";
+    CHECK_EQ(anno_type_, anno_datum.type()) << "Different AnnotationType.";
+    if (anno_type_ != AnnotatedDatum_AnnotationType_BBOX) {
+      LOG(FATAL) << "Unknown annotation type.";
+    }
+    // Transform datum and annotation_group at the same time
+    if (do_crop) {
+      data_transformer->CropAndTransform(anno_datum, sampled_bbox,
+                                         transformed_data,
+                                         &transformed_anno_groups);
+    } else {
+      data_transformer->Transform(anno_datum, transformed_data,
+                                  &transformed_anno_groups);
+    }
+  } else {
+    const Datum& datum = anno_datum.datum();
+    if (do_crop) {
+      data_transformer->CropAndTransform(datum, sampled_bbox,
+                                         transformed_data);
+    } else {
+      data_transformer->Transform(datum, transformed_data);
+    }
+    if (this->output_labels_) {
+      // Otherwise, store the label from datum.
+      CHECK(datum.has_label()) << "Cannot find any label.";
+      top_label[item_id] = datum.label();
+    }
+  }
+}
+
+template<typename Dtype>
+void AnnotatedDataLayer<Dtype>::load_worker_items(const int worker_id,
+    Dtype* top_data, Dtype* top_label) {
+  // Draw from the worker's own random stream on whichever thread runs it.
+  Caffe::RNG& rng_stream = Caffe::rng_stream();
+  Caffe::RNG thread_rng(0);
+  thread_rng = rng_stream;
+  rng_stream = *worker_rngs_[worker_id];
+  const int num_workers = worker_rngs_.size();
+  for (int item_id = worker_id; item_id < batch_datums_.size();
+       item_id += num_workers) {
+    load_item(item_id, worker_transformers_[worker_id].get(),
+              worker_transformed_data_[worker_id].get(), top_data, top_label);
+  }
+  rng_stream = thread_rng;
+}
+
 INSTANTIATE_CLASS(AnnotatedDataLayer);
 REGISTER_LAYER_CLASS(AnnotatedData);
 
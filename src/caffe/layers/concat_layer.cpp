@@ -1,3 +1,4 @@
+#include <cstring>
 #include <vector>
 
 #include "caffe/layers/concat_layer.hpp"
@@ -5,6 +6,22 @@
 
 namespace caffe {
 
+// Copy a region, unless the source is already a view of the destination, see
+// NetParameter.share_concat_memory. A view the net has not yet moved after a
+// reshape may overlap its new region.
+template <typename Dtype>
+static void CopyRegion(const int count, const Dtype* source,
+    Dtype* destination) {
+  if (source == destination) {
+    return;
+  }
+  if (source < destination + count && destination < source + count) {
+    memmove(destination, source, sizeof(Dtype) * count);
+  } else {
+    caffe_copy(count, source, destination);
+  }
+}
+
 template <typename Dtype>
 void ConcatLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
@@ -64,7 +81,7 @@ void ConcatLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     const Dtype* bottom_data = bottom[i]->cpu_data();
     const int bottom_concat_axis = bottom[i]->shape(concat_axis_);
     for (int n = 0; n < num_concats_; ++n) {
-      caffe_copy(bottom_concat_axis * concat_input_size_,
+      CopyRegion(bottom_concat_axis * concat_input_size_,
           bottom_data + n * bottom_concat_axis * concat_input_size_,
           top_data + (n * top_concat_axis + offset_concat_axis)
               * concat_input_size_);
@@ -85,7 +102,7 @@ void ConcatLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     if (propagate_down[i]) {
       Dtype* bottom_diff = bottom[i]->mutable_cpu_diff();
       for (int n = 0; n < num_concats_; ++n) {
-        caffe_copy(bottom_concat_axis * concat_input_size_, top_diff +
+        CopyRegion(bottom_concat_axis * concat_input_size_, top_diff +
             (n * top_concat_axis + offset_concat_axis) * concat_input_size_,
             bottom_diff + n * bottom_concat_axis * concat_input_size_);
       }
@@ -1,9 +1,35 @@
+#include <algorithm>
+#include <cstring>
 #include <vector>
 
 #include "caffe/layers/conv_layer.hpp"
+#include "caffe/util/math_functions.hpp"
 
 namespace caffe {
 
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  BaseConvolutionLayer<Dtype>::LayerSetUp(bottom, top);
+  if (this->phase_ == TEST &&
+      this->layer_param_.quantization_param().has_bottom_max()) {
+    CHECK_EQ(this->num_spatial_axes_, 2)
+        << "INT8 convolution is only implemented for 2D.";
+    CHECK(!this->force_nd_im2col_)
+        << "INT8 convolution does not support force_nd_im2col.";
+    CHECK_EQ(this->group_, 1) << "INT8 convolution does not support groups.";
+    int8_gemm_.reset(
+        new Int8Gemm<Dtype>(this->layer_param_.quantization_param()));
+  }
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::ParamsChanged() {
+  if (int8_gemm_) {
+    int8_gemm_->ClearWeights();
+  }
+}
+
 template <typename Dtype>
 void ConvolutionLayer<Dtype>::compute_output_shape() {
   const int* kernel_shape_data = this->kernel_shape_.cpu_data();
@@ -21,16 +47,252 @@ void ConvolutionLayer<Dtype>::compute_output_shape() {
   }
 }
 
+// The range [*begin, *end) of outputs o < num_outputs whose input
+// o * stride + offset lies in [0, size).
+static inline void valid_outputs(const int offset, const int stride,
+    const int size, const int num_outputs, int* begin, int* end) {
+  *begin = offset >= 0 ? 0 : (stride - 1 - offset) / stride;
+  *end = size <= offset ? 0 :
+      std::min(num_outputs, (size - offset + stride - 1) / stride);
+  *begin = std::min(*begin, *end);
+}
+
+// The depthwise kernels go through the image by output rows, so that the
+// rows being read and written stay in cache for all kernel taps. The inner
+// loops run over contiguous columns when the stride is 1.
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::depthwise_forward_cpu(const Dtype* input,
+    const Dtype* weights, Dtype* output) {
+  const int height = this->conv_input_shape_.cpu_data()[1];
+  const int width = this->conv_input_shape_.cpu_data()[2];
+  const int kernel_h = this->kernel_shape_.cpu_data()[0];
+  const int kernel_w = this->kernel_shape_.cpu_data()[1];
+  const int pad_h = this->pad_.cpu_data()[0];
+  const int pad_w = this->pad_.cpu_data()[1];
+  const int stride_h = this->stride_.cpu_data()[0];
+  const int stride_w = this->stride_.cpu_data()[1];
+  const int dilation_h = this->dilation_.cpu_data()[0];
+  const int dilation_w = this->dilation_.cpu_data()[1];
+  const int output_h = this->output_shape_[0];
+  const int output_w = this->output_shape_[1];
+  vector<int> begin(kernel_w), end(kernel_w);
+  for (int j = 0; j < kernel_w; ++j) {
+    valid_outputs(j * dilation_w - pad_w, stride_w, width, output_w,
+        &begin[j], &end[j]);
+  }
+  caffe_set(this->channels_ * output_h * output_w, Dtype(0), output);
+  for (int c = 0; c < this->channels_; ++c) {
+    const Dtype* image = input + c * height * width;
+    const Dtype* kernel = weights + c * kernel_h * kernel_w;
+    for (int y = 0; y < output_h; ++y) {
+      Dtype* out = output + (c * output_h + y) * output_w;
+      for (int i = 0; i < kernel_h; ++i) {
+        const int in_y = y * stride_h + i * dilation_h - pad_h;
+        if (in_y < 0 || in_y >= height) {
+          continue;
+        }
+        for (int j = 0; j < kernel_w; ++j) {
+          const Dtype w = kernel[i * kernel_w + j];
+          const Dtype* in = image + in_y * width + j * dilation_w - pad_w;
+          if (stride_w == 1) {
+            for (int x = begin[j]; x < end[j]; ++x) {
+              out[x] += w * in[x];
+            }
+          } else {
+            for (int x = begin[j]; x < end[j]; ++x) {
+              out[x] += w * in[x * stride_w];
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::depthwise_backward_cpu(const Dtype* output,
+    const Dtype* weights, Dtype* input) {
+  const int height = this->conv_input_shape_.cpu_data()[1];
+  const int width = this->conv_input_shape_.cpu_data()[2];
+  const int kernel_h = this->kernel_shape_.cpu_data()[0];
+  const int kernel_w = this->kernel_shape_.cpu_data()[1];
+  const int pad_h = this->pad_.cpu_data()[0];
+  const int pad_w = this->pad_.cpu_data()[1];
+  const int stride_h = this->stride_.cpu_data()[0];
+  const int stride_w = this->stride_.cpu_data()[1];
+  const int dilation_h = this->dilation_.cpu_data()[0];
+  const int dilation_w = this->dilation_.cpu_data()[1];
+  const int output_h = this->output_shape_[0];
+  const int output_w = this->output_shape_[1];
+  vector<int> begin(kernel_w), end(kernel_w);
+  for (int j = 0; j < kernel_w; ++j) {
+    valid_outputs(j * dilation_w - pad_w, stride_w, width, output_w,
+        &begin[j], &end[j]);
+  }
+  caffe_set(this->channels_ * height * width, Dtype(0), input);
+  for (int c = 0; c < this->channels_; ++c) {
+    Dtype* image = input + c * height * width;
+    const Dtype* kernel = weights + c * kernel_h * kernel_w;
+    for (int y = 0; y < output_h; ++y) {
+      const Dtype* out = output + (c * output_h + y) * output_w;
+      for (int i = 0; i < kernel_h; ++i) {
+        const int in_y = y * stride_h + i * dilation_h - pad_h;
+        if (in_y < 0 || in_y >= height) {
+          continue;
+        }
+        for (int j = 0; j < kernel_w; ++j) {
+          const Dtype w = kernel[i * kernel_w + j];
+          Dtype* in = image + in_y * width + j * dilation_w - pad_w;
+          if (stride_w == 1) {
+            for (int x = begin[j]; x < end[j]; ++x) {
+              in[x] += w * out[x];
+            }
+          } else {
+            for (int x = begin[j]; x < end[j]; ++x) {
+              in[x * stride_w] += w * out[x];
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::depthwise_weight_cpu(const Dtype* input,
+    const Dtype* output, Dtype* weights) {
+  const int height = this->conv_input_shape_.cpu_data()[1];
+  const int width = this->conv_input_shape_.cpu_data()[2];
+  const int kernel_h = this->kernel_shape_.cpu_data()[0];
+  const int kernel_w = this->kernel_shape_.cpu_data()[1];
+  const int pad_h = this->pad_.cpu_data()[0];
+  const int pad_w = this->pad_.cpu_data()[1];
+  const int stride_h = this->stride_.cpu_data()[0];
+  const int stride_w = this->stride_.cpu_data()[1];
+  const int dilation_h = this->dilation_.cpu_data()[0];
+  const int dilation_w = this->dilation_.cpu_data()[1];
+  const int output_h = this->output_shape_[0];
+  const int output_w = this->output_shape_[1];
+  vector<int> begin(kernel_w), end(kernel_w);
+  for (int j = 0; j < kernel_w; ++j) {
+    valid_outputs(j * dilation_w - pad_w, stride_w, width, output_w,
+        &begin[j], &end[j]);
+  }
+  for (int c = 0; c < this->channels_; ++c) {
+    const Dtype* image = input + c * height * width;
+    Dtype* kernel = weights + c * kernel_h * kernel_w;
+    for (int y = 0; y < output_h; ++y) {
+      const Dtype* out = output + (c * output_h + y) * output_w;
+      for (int i = 0; i < kernel_h; ++i) {
+        const int in_y = y * stride_h + i * dilation_h - pad_h;
+        if (in_y < 0 || in_y >= height) {
+          continue;
+        }
+        for (int j = 0; j < kernel_w; ++j) {
+          const Dtype* in = image + in_y * width + j * dilation_w - pad_w;
+          Dtype sum = 0;
+          if (stride_w == 1) {
+            for (int x = begin[j]; x < end[j]; ++x) {
+              sum += in[x] * out[x];
+            }
+          } else {
+            for (int x = begin[j]; x < end[j]; ++x) {
+              sum += in[x * stride_w] * out[x];
+            }
+          }
+          kernel[i * kernel_w + j] += sum;
+        }
+      }
+    }
+  }
+}
+
+// The image is quantized channel-last, so that the patch of an output
+// position is gathered by copying all the channels of each kernel tap at
+// once, in the order Int8Gemm quantizes the weights.
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::int8_forward_cpu(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  if (!int8_gemm_->has_weights()) {
+    const Blob<Dtype>& weights = *this->blobs_[0];
+    int8_gemm_->SetWeights(weights.shape(0), weights.count(1),
+                           weights.count(2), weights.cpu_data());
+  }
+  const Dtype* bias = this->bias_term_ ? this->blobs_[1]->cpu_data() : NULL;
+  const int channels = this->channels_;
+  const int height = this->conv_input_shape_.cpu_data()[1];
+  const int width = this->conv_input_shape_.cpu_data()[2];
+  const int kernel_h = this->kernel_shape_.cpu_data()[0];
+  const int kernel_w = this->kernel_shape_.cpu_data()[1];
+  const int pad_h = this->pad_.cpu_data()[0];
+  const int pad_w = this->pad_.cpu_data()[1];
+  const int stride_h = this->stride_.cpu_data()[0];
+  const int stride_w = this->stride_.cpu_data()[1];
+  const int dilation_h = this->dilation_.cpu_data()[0];
+  const int dilation_w = this->dilation_.cpu_data()[1];
+  const int output_h = this->output_shape_[0];
+  const int output_w = this->output_shape_[1];
+  const int padded_k = int8_gemm_->padded_k();
+  const int patch_size = kernel_h * kernel_w * channels;
+  const uint8_t zero = int8_gemm_->zero();
+  int8_input_.resize(height * width * channels);
+  int8_patches_.resize(output_h * output_w * padded_k);
+  for (int i = 0; i < bottom.size(); ++i) {
+    const Dtype* bottom_data = bottom[i]->cpu_data();
+    Dtype* top_data = top[i]->mutable_cpu_data();
+    for (int n = 0; n < this->num_; ++n) {
+      const Dtype* image = bottom_data + n * this->bottom_dim_;
+      for (int c = 0; c < channels; ++c) {
+        for (int s = 0; s < height * width; ++s) {
+          int8_input_[s * channels + c] =
+              int8_gemm_->Quantize(image[c * height * width + s]);
+        }
+      }
+      uint8_t* patch = &int8_patches_[0];
+      for (int y = 0; y < output_h; ++y) {
+        for (int x = 0; x < output_w; ++x) {
+          for (int kh = 0; kh < kernel_h; ++kh) {
+            const int in_y = y * stride_h + kh * dilation_h - pad_h;
+            for (int kw = 0; kw < kernel_w; ++kw) {
+              const int in_x = x * stride_w + kw * dilation_w - pad_w;
+              if (in_y >= 0 && in_y < height && in_x >= 0 && in_x < width) {
+                memcpy(patch, &int8_input_[(in_y * width + in_x) * channels],
+                       channels);
+              } else {
+                memset(patch, zero, channels);
+              }
+              patch += channels;
+            }
+          }
+          memset(patch, zero, padded_k - patch_size);
+          patch += padded_k - patch_size;
+        }
+      }
+      int8_gemm_->Forward(output_h * output_w, &int8_patches_[0], bias,
+          top_data + n * this->top_dim_, 1, output_h * output_w);
+    }
+  }
+}
+
 template <typename Dtype>
 void ConvolutionLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
+  if (int8_gemm_) {
+    int8_forward_cpu(bottom, top);
+    return;
+  }
   const Dtype* weight = this->blobs_[0]->cpu_data();
   for (int i = 0; i < bottom.size(); ++i) {
     const Dtype* bottom_data = bottom[i]->cpu_data();
     Dtype* top_data = top[i]->mutable_cpu_data();
     for (int n = 0; n < this->num_; ++n) {
-      this->forward_cpu_gemm(bottom_data + n * this->bottom_dim_, weight,
-          top_data + n * this->top_dim_);
+      if (is_depthwise()) {
+        depthwise_forward_cpu(bottom_data + n * this->bottom_dim_, weight,
+            top_data + n * this->top_dim_);
+      } else {
+        this->forward_cpu_gemm(bottom_data + n * this->bottom_dim_, weight,
+            top_data + n * this->top_dim_);
+      }
       if (this->bias_term_) {
         const Dtype* bias = this->blobs_[1]->cpu_data();
         this->forward_cpu_bias(top_data + n * this->top_dim_, bias);
@@ -59,13 +321,23 @@ void ConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
       for (int n = 0; n < this->num_; ++n) {
         // gradient w.r.t. weight. Note that we will accumulate diffs.
         if (this->param_propagate_down_[0]) {
-          this->weight_cpu_gemm(bottom_data + n * this->bottom_dim_,
-              top_diff + n * this->top_dim_, weight_diff);
+          if (is_depthwise()) {
+            depthwise_weight_cpu(bottom_data + n * this->bottom_dim_,
+                top_diff + n * this->top_dim_, weight_diff);
+          } else {
+            this->weight_cpu_gemm(bottom_data + n * this->bottom_dim_,
+                top_diff + n * this->top_dim_, weight_diff);
+          }
         }
         // gradient w.r.t. bottom data, if necessary.
         if (propagate_down[i]) {
-          this->backward_cpu_gemm(top_diff + n * this->top_dim_, weight,
-              bottom_diff + n * this->bottom_dim_);
+          if (is_depthwise()) {
+            depthwise_backward_cpu(top_diff + n * this->top_dim_, weight,
+                bottom_diff + n * this->bottom_dim_);
+          } else {
+            this->backward_cpu_gemm(top_diff + n * this->top_dim_, weight,
+                bottom_diff + n * this->bottom_dim_);
+          }
         }
       }
     }
@@ -5,6 +5,7 @@
 #include <utility>
 #include <vector>
 
+#include "boost/bind.hpp"
 #include "boost/filesystem.hpp"
 #include "boost/foreach.hpp"
 
@@ -35,6 +36,10 @@ void DetectionOutputLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   if (detection_output_param.nms_param().has_top_k()) {
     top_k_ = detection_output_param.nms_param().top_k();
   }
+  nms_kernel_ = detection_output_param.nms_param().kernel();
+  CHECK(NMSKernelSupported(nms_kernel_))
+      << "The " << NonMaximumSuppressionParameter_Kernel_Name(nms_kernel_)
+      << " nms kernel is not supported by this CPU.";
   const SaveOutputParameter& save_output_param =
       detection_output_param.save_output_param();
   output_directory_ = save_output_param.output_directory();
@@ -96,6 +101,7 @@ void DetectionOutputLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
     need_save_ = false;
   }
   name_count_ = 0;
+  thread_pool_.reset(new ThreadPool(detection_output_param.num_threads()));
   visualize_ = detection_output_param.visualize();
   if (visualize_) {
     visualize_threshold_ = 0.6;
@@ -149,6 +155,88 @@ void DetectionOutputLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   top[0]->Reshape(top_shape);
 }
 
+template <typename Dtype>
+void DetectionOutputLayer<Dtype>::DecodeImage(const Dtype* loc_data,
+      const Dtype* conf_data, const int i) {
+  vector<float>& conf_scores = all_conf_scores_[i];
+  GetConfidenceScores(conf_data + i * num_priors_ * num_classes_,
+                      num_priors_, num_classes_, &conf_scores);
+  // Only decode the priors which nms can keep, i.e. those with a score above
+  // confidence_threshold_. With shared locations, a prior is decoded once
+  // for all classes.
+  const Dtype* cur_loc_data = loc_data + i * num_priors_ * num_loc_classes_ * 4;
+  vector<int> candidates;
+  for (int c = 0; c < num_loc_classes_; ++c) {
+    FlatBBoxes& decode_bboxes = all_decode_bboxes_[i * num_loc_classes_ + c];
+    int label = share_location_ ? -1 : c;
+    if (label == background_label_id_) {
+      // Ignore background class.
+      decode_bboxes.Resize(0);
+      continue;
+    }
+    GetCandidatePriors(conf_scores.data(), num_priors_, num_classes_,
+                       background_label_id_, label, confidence_threshold_,
+                       &candidates);
+    DecodeBBoxes(cur_loc_data, prior_bboxes_, prior_variances_, code_type_,
+                 variance_encoded_in_target_, num_loc_classes_, c, candidates,
+                 &decode_bboxes);
+  }
+}
+
+template <typename Dtype>
+void DetectionOutputLayer<Dtype>::ApplyNMSToClass(const int task) {
+  const int i = task / num_classes_;
+  const int c = task % num_classes_;
+  vector<int>& indices = all_indices_[i][c];
+  if (c == background_label_id_) {
+    // Ignore background class.
+    indices.clear();
+    return;
+  }
+  const float* scores = all_conf_scores_[i].data() + c * num_priors_;
+  const FlatBBoxes& bboxes =
+      all_decode_bboxes_[i * num_loc_classes_ + (share_location_ ? 0 : c)];
+  // Something bad happened if there are no predictions for current label.
+  CHECK_EQ(bboxes.num(), num_priors_)
+      << "Could not find location predictions for label " << c;
+  ApplyNMSFast(bboxes, scores, confidence_threshold_, nms_threshold_, top_k_,
+               &indices, nms_kernel_);
+}
+
+template <typename Dtype>
+void DetectionOutputLayer<Dtype>::KeepTopKOfImage(const int i) {
+  vector<vector<int> >& indices = all_indices_[i];
+  int num_det = 0;
+  for (int c = 0; c < num_classes_; ++c) {
+    num_det += indices[c].size();
+  }
+  if (num_det <= keep_top_k_) {
+    return;
+  }
+  const float* conf_scores = all_conf_scores_[i].data();
+  vector<pair<float, pair<int, int> > > score_index_pairs;
+  for (int label = 0; label < num_classes_; ++label) {
+    const vector<int>& label_indices = indices[label];
+    const float* scores = conf_scores + label * num_priors_;
+    for (int j = 0; j < label_indices.size(); ++j) {
+      int idx = label_indices[j];
+      score_index_pairs.push_back(std::make_pair(
+              scores[idx], std::make_pair(label, idx)));
+    }
+  }
+  // Keep top k results per image. The pairs are gathered in label order, so
+  // the result does not depend on how the classes were scheduled.
+  PartialSortScorePairDescend(keep_top_k_, &score_index_pairs);
+  // Store the new indices.
+  vector<vector<int> > new_indices(num_classes_);
+  for (int j = 0; j < score_index_pairs.size(); ++j) {
+    int label = score_index_pairs[j].second.first;
+    int idx = score_index_pairs[j].second.second;
+    new_indices[label].push_back(idx);
+  }
+  indices.swap(new_indices);
+}
+
 template <typename Dtype>
 void DetectionOutputLayer<Dtype>::Forward_cpu(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
@@ -157,91 +245,33 @@ void DetectionOutputLayer<Dtype>::Forward_cpu(
   const Dtype* prior_data = bottom[2]->cpu_data();
   const int num = bottom[0]->num();
 
-  // Retrieve all location predictions.
-  vector<LabelBBox> all_loc_preds;
-  GetLocPredictions(loc_data, num, num_priors_, num_loc_classes_,
-                    share_location_, &all_loc_preds);
-
-  // Retrieve all confidences.
-  vector<map<int, vector<float> > > all_conf_scores;
-  GetConfidenceScores(conf_data, num, num_priors_, num_classes_,
-                      &all_conf_scores);
-
   // Retrieve all prior bboxes. It is same within a batch since we assume all
   // images in a batch are of same dimension.
-  vector<NormalizedBBox> prior_bboxes;
-  vector<vector<float> > prior_variances;
-  GetPriorBBoxes(prior_data, num_priors_, &prior_bboxes, &prior_variances);
+  GetPriorBBoxes(prior_data, num_priors_, &prior_bboxes_, &prior_variances_);
 
-  // Decode all loc predictions to bboxes.
-  vector<LabelBBox> all_decode_bboxes;
-  DecodeBBoxesAll(all_loc_preds, prior_bboxes, prior_variances, num,
-                  share_location_, num_loc_classes_, background_label_id_,
-                  code_type_, variance_encoded_in_target_, &all_decode_bboxes);
+  // Retrieve all confidences and decode the loc predictions nms may keep to
+  // bboxes. Both are stored in flat arrays, indexed by
+  // [i * num_loc_classes_ + c] and [i].
+  all_decode_bboxes_.resize(num * num_loc_classes_);
+  all_conf_scores_.resize(num);
+  thread_pool_->Run(num, boost::bind(&DetectionOutputLayer::DecodeImage,
+      this, loc_data, conf_data, _1));
 
+  // Do nms for every (image, class) pair, then keep the top k per image.
+  all_indices_.resize(num);
+  for (int i = 0; i < num; ++i) {
+    all_indices_[i].resize(num_classes_);
+  }
+  thread_pool_->Run(num * num_classes_,
+      boost::bind(&DetectionOutputLayer::ApplyNMSToClass, this, _1));
+  if (keep_top_k_ > -1) {
+    thread_pool_->Run(num,
+        boost::bind(&DetectionOutputLayer::KeepTopKOfImage, this, _1));
+  }
   int num_kept = 0;
-  vector<map<int, vector<int> > > all_indices;
   for (int i = 0; i < num; ++i) {
-    const LabelBBox& decode_bboxes = all_decode_bboxes[i];
-    const map<int, vector<float> >& conf_scores = all_conf_scores[i];
-    map<int, vector<int> > indices;
-    int num_det = 0;
     for (int c = 0; c < num_classes_; ++c) {
-      if (c == background_label_id_) {
-        // Ignore background class.
-        continue;
-      }
-      if (conf_scores.find(c) == conf_scores.end()) {
-        // Something bad happened if there are no predictions for current label.
-        LOG(FATAL) << "Could not find confidence predictions for label " << c;
-      }
-      const vector<float>& scores = conf_scores.find(c)->second;
-      int label = share_location_ ? -1 : c;
-      if (decode_bboxes.find(label) == decode_bboxes.end()) {
-        // Something bad happened if there are no predictions for current label.
-        LOG(FATAL) << "Could not find location predictions for label " << label;
-        continue;
-      }
-      const vector<NormalizedBBox>& bboxes = decode_bboxes.find(label)->second;
-      ApplyNMSFast(bboxes, scores, confidence_threshold_, nms_threshold_,
-          top_k_, &(indices[c]));
-      num_det += indices[c].size();
-    }
-    if (keep_top_k_ > -1 && num_det > keep_top_k_) {
-      vector<pair<float, pair<int, int> > > score_index_pairs;
-      for (map<int, vector<int> >::iterator it = indices.begin();
-           it != indices.end(); ++it) {
-        int label = it->first;
-        const vector<int>& label_indices = it->second;
-        if (conf_scores.find(label) == conf_scores.end()) {
-          // Something bad happened for current label.
-          LOG(FATAL) << "Could not find location predictions for " << label;
-          continue;
-        }
-        const vector<float>& scores = conf_scores.find(label)->second;
-        for (int j = 0; j < label_indices.size(); ++j) {
-          int idx = label_indices[j];
-          CHECK_LT(idx, scores.size());
-          score_index_pairs.push_back(std::make_pair(
-                  scores[idx], std::make_pair(label, idx)));
-        }
-      }
-      // Keep top k results per image.
-      std::sort(score_index_pairs.begin(), score_index_pairs.end(),
-                SortScorePairDescend<pair<int, int> >);
-      score_index_pairs.resize(keep_top_k_);
-      // Store the new indices.
-      map<int, vector<int> > new_indices;
-      for (int j = 0; j < score_index_pairs.size(); ++j) {
-        int label = score_index_pairs[j].second.first;
-        int idx = score_index_pairs[j].second.second;
-        new_indices[label].push_back(idx);
-      }
-      all_indices.push_back(new_indices);
-      num_kept += keep_top_k_;
-    } else {
-      all_indices.push_back(indices);
-      num_kept += num_det;
+      num_kept += all_indices_[i][c].size();
     }
   }
 
@@ -261,26 +291,15 @@ void DetectionOutputLayer<Dtype>::Forward_cpu(
   int count = 0;
   boost::filesystem::path output_directory(output_directory_);
   for (int i = 0; i < num; ++i) {
-    const map<int, vector<float> >& conf_scores = all_conf_scores[i];
-    const LabelBBox& decode_bboxes = all_decode_bboxes[i];
-    for (map<int, vector<int> >::iterator it = all_indices[i].begin();
-         it != all_indices[i].end(); ++it) {
-      int label = it->first;
-      if (conf_scores.find(label) == conf_scores.end()) {
-        // Something bad happened if there are no predictions for current label.
-        LOG(FATAL) << "Could not find confidence predictions for " << label;
-        continue;
-      }
-      const vector<float>& scores = conf_scores.find(label)->second;
-      int loc_label = share_location_ ? -1 : label;
-      if (decode_bboxes.find(loc_label) == decode_bboxes.end()) {
-        // Something bad happened if there are no predictions for current label.
-        LOG(FATAL) << "Could not find location predictions for " << loc_label;
+    const float* conf_scores = all_conf_scores_[i].data();
+    for (int label = 0; label < num_classes_; ++label) {
+      const vector<int>& indices = all_indices_[i][label];
+      if (indices.empty()) {
         continue;
       }
-      const vector<NormalizedBBox>& bboxes =
-          decode_bboxes.find(loc_label)->second;
-      vector<int>& indices = it->second;
+      const float* scores = conf_scores + label * num_priors_;
+      const FlatBBoxes& bboxes = all_decode_bboxes_[
+          i * num_loc_classes_ + (share_location_ ? 0 : label)];
       if (need_save_) {
         CHECK(label_to_name_.find(label) != label_to_name_.end())
           << "Cannot find label: " << label << " in the label map.";
@@ -291,13 +310,21 @@ void DetectionOutputLayer<Dtype>::Forward_cpu(
         top_data[count * 7] = i;
         top_data[count * 7 + 1] = label;
         top_data[count * 7 + 2] = scores[idx];
-        NormalizedBBox clip_bbox;
-        ClipBBox(bboxes[idx], &clip_bbox);
-        top_data[count * 7 + 3] = clip_bbox.xmin();
-        top_data[count * 7 + 4] = clip_bbox.ymin();
-        top_data[count * 7 + 5] = clip_bbox.xmax();
-        top_data[count * 7 + 6] = clip_bbox.ymax();
+        // Clip the bbox such that the range for each corner is [0, 1].
+        const float clip_xmin = std::max(std::min(bboxes.xmin[idx], 1.f), 0.f);
+        const float clip_ymin = std::max(std::min(bboxes.ymin[idx], 1.f), 0.f);
+        const float clip_xmax = std::max(std::min(bboxes.xmax[idx], 1.f), 0.f);
+        const float clip_ymax = std::max(std::min(bboxes.ymax[idx], 1.f), 0.f);
+        top_data[count * 7 + 3] = clip_xmin;
+        top_data[count * 7 + 4] = clip_ymin;
+        top_data[count * 7 + 5] = clip_xmax;
+        top_data[count * 7 + 6] = clip_ymax;
         if (need_save_) {
+          NormalizedBBox clip_bbox;
+          clip_bbox.set_xmin(clip_xmin);
+          clip_bbox.set_ymin(clip_ymin);
+          clip_bbox.set_xmax(clip_xmax);
+          clip_bbox.set_ymax(clip_ymax);
           NormalizedBBox scale_bbox;
           ScaleBBox(clip_bbox, sizes_[name_count_].first,
                     sizes_[name_count_].second, &scale_bbox);
@@ -98,9 +98,7 @@ void DetectionOutputLayer<Dtype>::Forward_gpu(
         }
       }
       // Keep top k results per image.
-      std::sort(score_index_pairs.begin(), score_index_pairs.end(),
-                SortScorePairDescend<pair<int, int> >);
-      score_index_pairs.resize(keep_top_k_);
+      PartialSortScorePairDescend(keep_top_k_, &score_index_pairs);
       // Store the new indices.
       map<int, vector<int> > new_indices;
       for (int j = 0; j < score_index_pairs.size(); ++j) {
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <vector>
 
 #include "caffe/filler.hpp"
@@ -52,6 +53,13 @@ void InnerProductLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
     }
   }  // parameter initialization
   this->param_propagate_down_.resize(this->blobs_.size(), true);
+  if (this->phase_ == TEST &&
+      this->layer_param_.quantization_param().has_bottom_max()) {
+    CHECK(!transpose_)
+        << "INT8 inner product does not support transposed weights.";
+    int8_gemm_.reset(
+        new Int8Gemm<Dtype>(this->layer_param_.quantization_param()));
+  }
 }
 
 template <typename Dtype>
@@ -80,12 +88,37 @@ void InnerProductLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   }
 }
 
+template <typename Dtype>
+void InnerProductLayer<Dtype>::ParamsChanged() {
+  if (int8_gemm_) {
+    int8_gemm_->ClearWeights();
+  }
+}
+
 template <typename Dtype>
 void InnerProductLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
   const Dtype* weight = this->blobs_[0]->cpu_data();
+  if (int8_gemm_) {
+    if (!int8_gemm_->has_weights()) {
+      int8_gemm_->SetWeights(N_, K_, 1, weight);
+    }
+    const int padded_k = int8_gemm_->padded_k();
+    int8_input_.resize(M_ * padded_k);
+    for (int m = 0; m < M_; ++m) {
+      for (int k = 0; k < K_; ++k) {
+        int8_input_[m * padded_k + k] =
+            int8_gemm_->Quantize(bottom_data[m * K_ + k]);
+      }
+      std::fill(int8_input_.begin() + m * padded_k + K_,
+                int8_input_.begin() + (m + 1) * padded_k, int8_gemm_->zero());
+    }
+    int8_gemm_->Forward(M_, &int8_input_[0],
+        bias_term_ ? this->blobs_[1]->cpu_data() : NULL, top_data, N_, 1);
+    return;
+  }
   caffe_cpu_gemm<Dtype>(CblasNoTrans, transpose_ ? CblasNoTrans : CblasTrans,
       M_, N_, K_, (Dtype)1.,
       bottom_data, weight, (Dtype)0., top_data);
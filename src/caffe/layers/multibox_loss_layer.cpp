@@ -3,6 +3,8 @@
 #include <utility>
 #include <vector>
 
+#include "boost/bind.hpp"
+
 #include "caffe/layers/multibox_loss_layer.hpp"
 #include "caffe/util/math_functions.hpp"
 
@@ -37,6 +39,7 @@ void MultiBoxLossLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   do_neg_mining_ = multibox_loss_param.do_neg_mining();
   neg_pos_ratio_ = multibox_loss_param.neg_pos_ratio();
   neg_overlap_ = multibox_loss_param.neg_overlap();
+  fast_max_conf_ = multibox_loss_param.fast_max_conf();
   code_type_ = multibox_loss_param.code_type();
   encode_variance_in_target_ = multibox_loss_param.encode_variance_in_target();
   map_object_to_agnostic_ = multibox_loss_param.map_object_to_agnostic();
@@ -57,6 +60,8 @@ void MultiBoxLossLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
     normalization_ = this->layer_param_.loss_param().normalization();
   }
 
+  thread_pool_.reset(new ThreadPool(multibox_loss_param.num_threads()));
+
   if (do_neg_mining_) {
     CHECK(share_location_)
         << "Currently only support negative mining if share_location is true.";
@@ -146,6 +151,124 @@ void MultiBoxLossLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
       << "Number of priors must match number of confidence predictions.";
 }
 
+template <typename Dtype>
+void MultiBoxLossLayer<Dtype>::MatchImage(const Dtype* loc_data,
+      const Dtype* conf_data, const int i) {
+  // The results of this pass are appended after those of earlier passes.
+  const int offset = all_match_indices_.size() - num_;
+  map<int, vector<int> >& match_indices = all_match_indices_[offset + i];
+  vector<int>& neg_indices = all_neg_indices_[offset + i];
+  // Check if there is ground truth for current image.
+  map<int, vector<NormalizedBBox> >::const_iterator gt_it =
+      all_gt_bboxes_.find(i);
+  if (gt_it == all_gt_bboxes_.end()) {
+    // There is no gt for current image. All predictions are negative.
+    return;
+  }
+  // Find match between predictions and ground truth.
+  const vector<NormalizedBBox>& gt_bboxes = gt_it->second;
+  FlatBBoxes flat_gt_bboxes;
+  flat_gt_bboxes.Resize(gt_bboxes.size());
+  vector<int> gt_labels(gt_bboxes.size());
+  for (int g = 0; g < gt_bboxes.size(); ++g) {
+    flat_gt_bboxes.xmin[g] = gt_bboxes[g].xmin();
+    flat_gt_bboxes.ymin[g] = gt_bboxes[g].ymin();
+    flat_gt_bboxes.xmax[g] = gt_bboxes[g].xmax();
+    flat_gt_bboxes.ymax[g] = gt_bboxes[g].ymax();
+    flat_gt_bboxes.size[g] = BBoxSize(gt_bboxes[g]);
+    gt_labels[g] = gt_bboxes[g].label();
+  }
+  map<int, vector<float> > match_overlaps;
+  if (!use_prior_for_matching_) {
+    const Dtype* cur_loc_data = loc_data + i * num_priors_ * loc_classes_ * 4;
+    FlatBBoxes loc_bboxes;
+    for (int c = 0; c < loc_classes_; ++c) {
+      int label = share_location_ ? -1 : c;
+      if (!share_location_ && label == background_label_id_) {
+        // Ignore background loc predictions.
+        continue;
+      }
+      // Decode the prediction into bbox first.
+      DecodeBBoxes(cur_loc_data, flat_prior_bboxes_, flat_prior_variances_,
+                   code_type_, encode_variance_in_target_, loc_classes_, c,
+                   &loc_bboxes);
+      MatchBBox(flat_gt_bboxes, gt_labels, loc_bboxes, label, match_type_,
+                overlap_threshold_, &match_indices[label],
+                &match_overlaps[label]);
+    }
+  } else {
+    // Use prior bboxes to match against all ground truth.
+    vector<int> temp_match_indices;
+    vector<float> temp_match_overlaps;
+    const int label = -1;
+    MatchBBox(flat_gt_bboxes, gt_labels, flat_prior_bboxes_, label,
+              match_type_, overlap_threshold_, &temp_match_indices,
+              &temp_match_overlaps);
+    if (share_location_) {
+      match_indices[label] = temp_match_indices;
+      match_overlaps[label] = temp_match_overlaps;
+    } else {
+      // Distribute the matching results to different loc_class.
+      for (int c = 0; c < loc_classes_; ++c) {
+        if (c == background_label_id_) {
+          // Ignore background loc predictions.
+          continue;
+        }
+        match_indices[c].resize(temp_match_indices.size(), -1);
+        match_overlaps[c] = temp_match_overlaps;
+        for (int m = 0; m < temp_match_indices.size(); ++m) {
+          if (temp_match_indices[m] != -1) {
+            const int gt_idx = temp_match_indices[m];
+            CHECK_LT(gt_idx, gt_labels.size());
+            if (c == gt_labels[gt_idx]) {
+              match_indices[c][m] = gt_idx;
+            }
+          }
+        }
+      }
+    }
+  }
+  if (!do_neg_mining_) {
+    return;
+  }
+  // Retrieve max scores for each prior. Used in negative mining.
+  vector<float>& max_scores = all_max_scores_[i];
+  max_scores.resize(num_priors_);
+  GetMaxConfidenceScores(conf_data + i * num_priors_ * num_classes_,
+                         num_priors_, num_classes_, background_label_id_,
+                         conf_loss_type_, fast_max_conf_, max_scores.data());
+  for (map<int, vector<int> >::iterator it = match_indices.begin();
+       it != match_indices.end(); ++it) {
+    const int label = it->first;
+    // Get positive indices.
+    int num_pos = 0;
+    for (int m = 0; m < match_indices[label].size(); ++m) {
+      if (match_indices[label][m] != -1) {
+        ++num_pos;
+      }
+    }
+    const int max_num_neg = static_cast<int>(num_pos * neg_pos_ratio_);
+    if (max_num_neg <= 0) {
+      continue;
+    }
+    // Get max scores for all the non-matched priors.
+    vector<pair<float, int> > scores_indices;
+    for (int m = 0; m < match_indices[label].size(); ++m) {
+      if (match_indices[label][m] == -1 &&
+          match_overlaps[label][m] < neg_overlap_) {
+        scores_indices.push_back(std::make_pair(max_scores[m], m));
+      }
+    }
+    // Pick top num_neg negatives. Only those need to be sorted.
+    const int num_neg =
+        std::min(max_num_neg, static_cast<int>(scores_indices.size()));
+    PartialSortScorePairDescend(num_neg, &scores_indices);
+    for (int n = 0; n < num_neg; ++n) {
+      neg_indices.push_back(scores_indices[n].second);
+    }
+  }
+}
+
 template <typename Dtype>
 void MultiBoxLossLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
@@ -155,131 +278,45 @@ void MultiBoxLossLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   const Dtype* gt_data = bottom[3]->cpu_data();
 
   // Retrieve all ground truth.
-  map<int, vector<NormalizedBBox> > all_gt_bboxes;
   GetGroundTruth(gt_data, num_gt_, background_label_id_, use_difficult_gt_,
-                 &all_gt_bboxes);
+                 &all_gt_bboxes_);
 
   // Retrieve all prior bboxes. It is same within a batch since we assume all
-  // images in a batch are of same dimension.
+  // images in a batch are of same dimension. The flat copy is used for
+  // matching.
   vector<NormalizedBBox> prior_bboxes;
   vector<vector<float> > prior_variances;
   GetPriorBBoxes(prior_data, num_priors_, &prior_bboxes, &prior_variances);
+  GetPriorBBoxes(prior_data, num_priors_, &flat_prior_bboxes_,
+                 &flat_prior_variances_);
 
   // Retrieve all predictions.
   vector<LabelBBox> all_loc_preds;
   GetLocPredictions(loc_data, num_, num_priors_, loc_classes_, share_location_,
                     &all_loc_preds);
 
-  // Retrieve max scores for each prior. Used in negative mining.
-  vector<vector<float> > all_max_scores;
-  if (do_neg_mining_) {
-    GetMaxConfidenceScores(conf_data, num_, num_priors_, num_classes_,
-                           background_label_id_, conf_loss_type_,
-                           &all_max_scores);
-  }
-
+  // Match and mine the hard negatives of every image, then record the
+  // matching statistics. Like before, the results are appended, so only the
+  // first pass since the last backward is used for the loss.
+  const int offset = all_match_indices_.size();
+  all_match_indices_.resize(offset + num_);
+  all_neg_indices_.resize(offset + num_);
+  all_max_scores_.resize(num_);
+  thread_pool_->Run(num_, boost::bind(&MultiBoxLossLayer::MatchImage,
+      this, loc_data, conf_data, _1));
   num_matches_ = 0;
   int num_negs = 0;
-  for (int i = 0; i < num_; ++i) {
-    map<int, vector<int> > match_indices;
-    vector<int> neg_indices;
-    // Check if there is ground truth for current image.
-    if (all_gt_bboxes.find(i) == all_gt_bboxes.end()) {
-      // There is no gt for current image. All predictions are negative.
-      all_match_indices_.push_back(match_indices);
-      all_neg_indices_.push_back(neg_indices);
-      continue;
-    }
-    // Find match between predictions and ground truth.
-    const vector<NormalizedBBox>& gt_bboxes = all_gt_bboxes.find(i)->second;
-    map<int, vector<float> > match_overlaps;
-    if (!use_prior_for_matching_) {
-      for (int c = 0; c < loc_classes_; ++c) {
-        int label = share_location_ ? -1 : c;
-        if (!share_location_ && label == background_label_id_) {
-          // Ignore background loc predictions.
-          continue;
-        }
-        // Decode the prediction into bbox first.
-        vector<NormalizedBBox> loc_bboxes;
-        DecodeBBoxes(prior_bboxes, prior_variances,
-                     code_type_, encode_variance_in_target_,
-                     all_loc_preds[i][label], &loc_bboxes);
-        MatchBBox(gt_bboxes, loc_bboxes, label, match_type_,
-                  overlap_threshold_, &match_indices[label],
-                  &match_overlaps[label]);
-      }
-    } else {
-      // Use prior bboxes to match against all ground truth.
-      vector<int> temp_match_indices;
-      vector<float> temp_match_overlaps;
-      const int label = -1;
-      MatchBBox(gt_bboxes, prior_bboxes, label, match_type_, overlap_threshold_,
-                &temp_match_indices, &temp_match_overlaps);
-      if (share_location_) {
-        match_indices[label] = temp_match_indices;
-        match_overlaps[label] = temp_match_overlaps;
-      } else {
-        // Get ground truth label for each ground truth bbox.
-        vector<int> gt_labels;
-        for (int g = 0; g < gt_bboxes.size(); ++g) {
-          gt_labels.push_back(gt_bboxes[g].label());
-        }
-        // Distribute the matching results to different loc_class.
-        for (int c = 0; c < loc_classes_; ++c) {
-          if (c == background_label_id_) {
-            // Ignore background loc predictions.
-            continue;
-          }
-          match_indices[c].resize(temp_match_indices.size(), -1);
-          match_overlaps[c] = temp_match_overlaps;
-          for (int m = 0; m < temp_match_indices.size(); ++m) {
-            if (temp_match_indices[m] != -1) {
-              const int gt_idx = temp_match_indices[m];
-              CHECK_LT(gt_idx, gt_labels.size());
-              if (c == gt_labels[gt_idx]) {
-                match_indices[c][m] = gt_idx;
-              }
-            }
-          }
-        }
-      }
-    }
-    // Record matching statistics.
-    for (map<int, vector<int> >::iterator it = match_indices.begin();
-         it != match_indices.end(); ++it) {
-      const int label = it->first;
-      // Get positive indices.
-      int num_pos = 0;
-      for (int m = 0; m < match_indices[label].size(); ++m) {
-        if (match_indices[label][m] != -1) {
-          ++num_pos;
-        }
-      }
-      num_matches_ += num_pos;
-      if (do_neg_mining_) {
-        // Get max scores for all the non-matched priors.
-        vector<pair<float, int> > scores_indices;
-        int num_neg = 0;
-        for (int m = 0; m < match_indices[label].size(); ++m) {
-          if (match_indices[label][m] == -1 &&
-              match_overlaps[label][m] < neg_overlap_) {
-            scores_indices.push_back(std::make_pair(all_max_scores[i][m], m));
-            ++num_neg;
-          }
-        }
-        // Pick top num_neg negatives.
-        num_neg = std::min(static_cast<int>(num_pos * neg_pos_ratio_), num_neg);
-        std::sort(scores_indices.begin(), scores_indices.end(),
-                  SortScorePairDescend<int>);
-        for (int n = 0; n < num_neg; ++n) {
-          neg_indices.push_back(scores_indices[n].second);
+  for (int i = offset; i < offset + num_; ++i) {
+    for (map<int, vector<int> >::iterator it = all_match_indices_[i].begin();
+         it != all_match_indices_[i].end(); ++it) {
+      const vector<int>& match_index = it->second;
+      for (int m = 0; m < match_index.size(); ++m) {
+        if (match_index[m] != -1) {
+          ++num_matches_;
         }
-        num_negs += num_neg;
       }
     }
-    all_match_indices_.push_back(match_indices);
-    all_neg_indices_.push_back(neg_indices);
+    num_negs += all_neg_indices_[i].size();
   }
 
   if (num_matches_ >= 1) {
@@ -311,9 +348,9 @@ void MultiBoxLossLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
           loc_pred_data[count * 4 + 3] = loc_pred[j].ymax();
           // Store encoded ground truth.
           const int gt_idx = match_index[j];
-          CHECK(all_gt_bboxes.find(i) != all_gt_bboxes.end());
-          CHECK_LT(gt_idx, all_gt_bboxes[i].size());
-          const NormalizedBBox& gt_bbox = all_gt_bboxes[i][gt_idx];
+          CHECK(all_gt_bboxes_.find(i) != all_gt_bboxes_.end());
+          CHECK_LT(gt_idx, all_gt_bboxes_[i].size());
+          const NormalizedBBox& gt_bbox = all_gt_bboxes_[i][gt_idx];
           NormalizedBBox gt_encode;
           CHECK_LT(j, prior_bboxes.size());
           EncodeBBox(prior_bboxes[j], prior_variances[j], code_type_,
@@ -371,7 +408,7 @@ void MultiBoxLossLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     caffe_set(conf_gt_.count(), Dtype(background_label_id_), conf_gt_data);
     int count = 0;
     for (int i = 0; i < num_; ++i) {
-      if (all_gt_bboxes.find(i) != all_gt_bboxes.end()) {
+      if (all_gt_bboxes_.find(i) != all_gt_bboxes_.end()) {
         // Save matched (positive) bboxes scores and labels.
         const map<int, vector<int> >& match_indices = all_match_indices_[i];
         for (int j = 0; j < num_priors_; ++j) {
@@ -384,7 +421,7 @@ void MultiBoxLossLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
             }
             const int gt_label = map_object_to_agnostic_ ?
                 background_label_id_ + 1 :
-                all_gt_bboxes[i][match_index[j]].label();
+                all_gt_bboxes_[i][match_index[j]].label();
             int idx = do_neg_mining_ ? count : j;
             switch (conf_loss_type_) {
               case MultiBoxLossParameter_ConfLossType_SOFTMAX:
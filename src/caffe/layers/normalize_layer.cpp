@@ -3,6 +3,13 @@
 #include "caffe/filler.hpp"
 #include "caffe/layers/normalize_layer.hpp"
 
+// The AVX2 kernels are compiled with a function level target attribute and
+// picked at runtime, so no extra compiler flag is needed.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define USE_X86_NORMALIZE_KERNELS
+#endif
+
 namespace caffe {
 
 template <typename Dtype>
@@ -81,53 +88,155 @@ void NormalizeLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   }
 }
 
+// The per channel loops of the CPU passes without across_spatial, over the n
+// contiguous spatial positions of a channel. The float versions use AVX2 when
+// the CPU supports it, with the operations in the same order, so the results
+// do not depend on the kernel.
+
+// sum += a * b
+template <typename Dtype>
+static void AddProducts(const int n, const Dtype* a, const Dtype* b,
+    Dtype* sum) {
+  for (int s = 0; s < n; ++s) {
+    sum[s] += a[s] * b[s];
+  }
+}
+
+// y = x * inv_norm * alpha
+template <typename Dtype>
+static void ScaleByInvNorm(const int n, const Dtype* x, const Dtype* inv_norm,
+    const Dtype alpha, Dtype* y) {
+  for (int s = 0; s < n; ++s) {
+    y[s] = x[s] * inv_norm[s] * alpha;
+  }
+}
+
+// dx = (dy - x * coeff) / norm * alpha
+template <typename Dtype>
+static void NormalizeDiff(const int n, const Dtype* x, const Dtype* dy,
+    const Dtype* coeff, const Dtype* norm, const Dtype alpha, Dtype* dx) {
+  for (int s = 0; s < n; ++s) {
+    dx[s] = (dy[s] - x[s] * coeff[s]) / norm[s] * alpha;
+  }
+}
+
+#ifdef USE_X86_NORMALIZE_KERNELS
+static bool UseAVX2() {
+  static const bool use_avx2 = __builtin_cpu_supports("avx2");
+  return use_avx2;
+}
+
+__attribute__((target("avx2")))
+static void AddProductsAVX2(const int n, const float* a, const float* b,
+    float* sum) {
+  int s = 0;
+  for (; s + 8 <= n; s += 8) {
+    const __m256 p = _mm256_mul_ps(_mm256_loadu_ps(a + s),
+                                   _mm256_loadu_ps(b + s));
+    _mm256_storeu_ps(sum + s, _mm256_add_ps(_mm256_loadu_ps(sum + s), p));
+  }
+  AddProducts<float>(n - s, a + s, b + s, sum + s);
+}
+
+__attribute__((target("avx2")))
+static void ScaleByInvNormAVX2(const int n, const float* x,
+    const float* inv_norm, const float alpha, float* y) {
+  const __m256 alpha_v = _mm256_set1_ps(alpha);
+  int s = 0;
+  for (; s + 8 <= n; s += 8) {
+    const __m256 v = _mm256_mul_ps(_mm256_loadu_ps(x + s),
+                                   _mm256_loadu_ps(inv_norm + s));
+    _mm256_storeu_ps(y + s, _mm256_mul_ps(v, alpha_v));
+  }
+  ScaleByInvNorm<float>(n - s, x + s, inv_norm + s, alpha, y + s);
+}
+
+__attribute__((target("avx2")))
+static void NormalizeDiffAVX2(const int n, const float* x, const float* dy,
+    const float* coeff, const float* norm, const float alpha, float* dx) {
+  const __m256 alpha_v = _mm256_set1_ps(alpha);
+  int s = 0;
+  for (; s + 8 <= n; s += 8) {
+    const __m256 v = _mm256_sub_ps(_mm256_loadu_ps(dy + s), _mm256_mul_ps(
+        _mm256_loadu_ps(x + s), _mm256_loadu_ps(coeff + s)));
+    _mm256_storeu_ps(dx + s, _mm256_mul_ps(
+        _mm256_div_ps(v, _mm256_loadu_ps(norm + s)), alpha_v));
+  }
+  NormalizeDiff<float>(n - s, x + s, dy + s, coeff + s, norm + s, alpha,
+                       dx + s);
+}
+
+static void AddProducts(const int n, const float* a, const float* b,
+    float* sum) {
+  if (UseAVX2()) {
+    AddProductsAVX2(n, a, b, sum);
+  } else {
+    AddProducts<float>(n, a, b, sum);
+  }
+}
+
+static void ScaleByInvNorm(const int n, const float* x, const float* inv_norm,
+    const float alpha, float* y) {
+  if (UseAVX2()) {
+    ScaleByInvNormAVX2(n, x, inv_norm, alpha, y);
+  } else {
+    ScaleByInvNorm<float>(n, x, inv_norm, alpha, y);
+  }
+}
+
+static void NormalizeDiff(const int n, const float* x, const float* dy,
+    const float* coeff, const float* norm, const float alpha, float* dx) {
+  if (UseAVX2()) {
+    NormalizeDiffAVX2(n, x, dy, coeff, norm, alpha, dx);
+  } else {
+    NormalizeDiff<float>(n, x, dy, coeff, norm, alpha, dx);
+  }
+}
+#endif  // USE_X86_NORMALIZE_KERNELS
+
+// The CPU passes are fused: the forward pass reads the bottom once to sum the
+// squares and once to write the top, scaled by scale / norm; the backward pass
+// reads the bottom and top diff once to compute their dot product and once to
+// write the bottom diff.
 template <typename Dtype>
 void NormalizeLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
   const Dtype* scale = this->blobs_[0]->cpu_data();
-  Dtype* buffer_data = buffer_.mutable_cpu_data();
   Dtype* norm_data = norm_.mutable_cpu_data();
-  // add eps to avoid overflow
-  caffe_set<Dtype>(norm_.count(), Dtype(eps_), norm_data);
-  const Dtype* sum_channel_multiplier = sum_channel_multiplier_.cpu_data();
-  const Dtype* sum_spatial_multiplier = sum_spatial_multiplier_.cpu_data();
+  Dtype* inv_norm = buffer_spatial_.mutable_cpu_data();
   int num = bottom[0]->num();
   int dim = bottom[0]->count() / num;
   int spatial_dim = bottom[0]->height() * bottom[0]->width();
   int channels = bottom[0]->channels();
   for (int n = 0; n < num; ++n) {
-    caffe_sqr<Dtype>(dim, bottom_data, buffer_data);
     if (across_spatial_) {
       // add eps to avoid overflow
-      norm_data[n] = pow(caffe_cpu_asum<Dtype>(dim, buffer_data)+eps_,
-                         Dtype(0.5));
-      caffe_cpu_scale<Dtype>(dim, Dtype(1.0 / norm_data[n]), bottom_data,
-                             top_data);
+      norm_data[n] = sqrt(caffe_cpu_dot<Dtype>(dim, bottom_data, bottom_data)
+                          + eps_);
+      for (int c = 0; c < channels; ++c) {
+        caffe_cpu_scale<Dtype>(spatial_dim,
+            (channel_shared_ ? scale[0] : scale[c]) / norm_data[n],
+            bottom_data + c * spatial_dim, top_data + c * spatial_dim);
+      }
     } else {
-      caffe_cpu_gemv<Dtype>(CblasTrans, channels, spatial_dim, Dtype(1),
-                            buffer_data, sum_channel_multiplier, Dtype(1),
-                            norm_data);
-      // compute norm
-      caffe_powx<Dtype>(spatial_dim, norm_data, Dtype(0.5), norm_data);
-      // scale the layer
-      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, channels, spatial_dim,
-                            1, Dtype(1), sum_channel_multiplier, norm_data,
-                            Dtype(0), buffer_data);
-      caffe_div<Dtype>(dim, bottom_data, buffer_data, top_data);
+      // add eps to avoid overflow
+      caffe_set<Dtype>(spatial_dim, Dtype(eps_), norm_data);
+      for (int c = 0; c < channels; ++c) {
+        const Dtype* x = bottom_data + c * spatial_dim;
+        AddProducts(spatial_dim, x, x, norm_data);
+      }
+      for (int s = 0; s < spatial_dim; ++s) {
+        norm_data[s] = sqrt(norm_data[s]);
+        inv_norm[s] = Dtype(1) / norm_data[s];
+      }
+      for (int c = 0; c < channels; ++c) {
+        ScaleByInvNorm(spatial_dim, bottom_data + c * spatial_dim, inv_norm,
+            channel_shared_ ? scale[0] : scale[c], top_data + c * spatial_dim);
+      }
       norm_data += spatial_dim;
     }
-    // scale the output
-    if (channel_shared_) {
-      caffe_scal<Dtype>(dim, scale[0], top_data);
-    } else {
-      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, channels, spatial_dim,
-                            1, Dtype(1), scale, sum_spatial_multiplier,
-                            Dtype(0),
-                            buffer_data);
-      caffe_mul<Dtype>(dim, top_data, buffer_data, top_data);
-    }
     bottom_data += dim;
     top_data += dim;
   }
@@ -139,14 +248,9 @@ void NormalizeLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   const Dtype* top_diff = top[0]->cpu_diff();
   const Dtype* top_data = top[0]->cpu_data();
   const Dtype* bottom_data = bottom[0]->cpu_data();
-  Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
   const Dtype* scale = this->blobs_[0]->cpu_data();
   const Dtype* norm_data = norm_.cpu_data();
-  Dtype* buffer_data = buffer_.mutable_cpu_data();
-  Dtype* buffer_channel = buffer_channel_.mutable_cpu_data();
-  Dtype* buffer_spatial = buffer_spatial_.mutable_cpu_data();
-  const Dtype* sum_channel_multiplier = sum_channel_multiplier_.cpu_data();
-  const Dtype* sum_spatial_multiplier = sum_spatial_multiplier_.cpu_data();
+  Dtype* dot = buffer_spatial_.mutable_cpu_data();
   int count = top[0]->count();
   int num = top[0]->num();
   int dim = count / num;
@@ -161,61 +265,51 @@ void NormalizeLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
           caffe_cpu_dot<Dtype>(count, top_data, top_diff) / scale[0];
     } else {
       for (int n = 0; n < num; ++n) {
-        caffe_mul<Dtype>(dim, top_data+n*dim, top_diff+n*dim, buffer_data);
-        caffe_cpu_gemv<Dtype>(CblasNoTrans, channels, spatial_dim, Dtype(1),
-                              buffer_data, sum_spatial_multiplier, Dtype(0),
-                              buffer_channel);
-        // store a / scale[i] in buffer_data temporary
-        caffe_div<Dtype>(channels, buffer_channel, scale, buffer_channel);
-        caffe_add<Dtype>(channels, buffer_channel, scale_diff, scale_diff);
+        for (int c = 0; c < channels; ++c) {
+          const int offset = n * dim + c * spatial_dim;
+          scale_diff[c] += caffe_cpu_dot<Dtype>(spatial_dim,
+              top_data + offset, top_diff + offset) / scale[c];
+        }
       }
     }
   }
 
-  // Propagate to bottom
+  // Propagate to bottom: with a the dot product of the bottom data and top
+  // diff, bottom_diff = (top_diff - bottom_data * a / norm^2) / norm * scale.
   if (propagate_down[0]) {
+    Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
     for (int n = 0; n < num; ++n) {
       if (across_spatial_) {
-        Dtype a = caffe_cpu_dot<Dtype>(dim, bottom_data, top_diff);
-        caffe_cpu_scale<Dtype>(dim, a / norm_data[n] / norm_data[n],
-                               bottom_data, bottom_diff);
-        caffe_sub<Dtype>(dim, top_diff, bottom_diff, bottom_diff);
-        caffe_scal<Dtype>(dim, Dtype(1.0 / norm_data[n]), bottom_diff);
+        const Dtype a = caffe_cpu_dot<Dtype>(dim, bottom_data, top_diff);
+        const Dtype coeff = a / norm_data[n] / norm_data[n];
+        for (int c = 0; c < channels; ++c) {
+          const Dtype* x = bottom_data + c * spatial_dim;
+          const Dtype* dy = top_diff + c * spatial_dim;
+          Dtype* dx = bottom_diff + c * spatial_dim;
+          const Dtype channel_scale =
+              (channel_shared_ ? scale[0] : scale[c]) / norm_data[n];
+          for (int s = 0; s < spatial_dim; ++s) {
+            dx[s] = (dy[s] - x[s] * coeff) * channel_scale;
+          }
+        }
       } else {
-        // dot product between bottom_data and top_diff
-        caffe_mul<Dtype>(dim, bottom_data, top_diff, buffer_data);
-        caffe_cpu_gemv<Dtype>(CblasTrans, channels, spatial_dim, Dtype(1),
-                              buffer_data, sum_channel_multiplier, Dtype(0),
-                              buffer_spatial);
-        // scale bottom_diff
-        caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, channels, spatial_dim,
-                              1, Dtype(1), sum_channel_multiplier,
-                              buffer_spatial, Dtype(0), buffer_data);
-        caffe_mul<Dtype>(dim, bottom_data, buffer_data, bottom_diff);
-        // divide by square of norm
-        caffe_powx<Dtype>(spatial_dim, norm_data, Dtype(2), buffer_spatial);
-        caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, channels, spatial_dim,
-                              1, Dtype(1), sum_channel_multiplier,
-                              buffer_spatial, Dtype(0), buffer_data);
-        caffe_div<Dtype>(dim, bottom_diff, buffer_data, bottom_diff);
-        // subtract
-        caffe_sub<Dtype>(dim, top_diff, bottom_diff, bottom_diff);
-        // divide by norm
-        caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, channels, spatial_dim,
-                              1, Dtype(1), sum_channel_multiplier, norm_data,
-                              Dtype(0), buffer_data);
-        caffe_div<Dtype>(dim, bottom_diff, buffer_data, bottom_diff);
+        caffe_set<Dtype>(spatial_dim, Dtype(0), dot);
+        for (int c = 0; c < channels; ++c) {
+          AddProducts(spatial_dim, bottom_data + c * spatial_dim,
+                      top_diff + c * spatial_dim, dot);
+        }
+        // dot becomes a / norm^2, the coefficient of the bottom data.
+        for (int s = 0; s < spatial_dim; ++s) {
+          dot[s] /= norm_data[s] * norm_data[s];
+        }
+        for (int c = 0; c < channels; ++c) {
+          const int offset = c * spatial_dim;
+          NormalizeDiff(spatial_dim, bottom_data + offset, top_diff + offset,
+              dot, norm_data, channel_shared_ ? scale[0] : scale[c],
+              bottom_diff + offset);
+        }
         norm_data += spatial_dim;
       }
-      // scale the diff
-      if (channel_shared_) {
-        caffe_scal<Dtype>(dim, scale[0], bottom_diff);
-      } else {
-        caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, channels, spatial_dim,
-                              1, Dtype(1), scale, sum_spatial_multiplier,
-                              Dtype(0), buffer_data);
-        caffe_mul<Dtype>(dim, bottom_diff, buffer_data, bottom_diff);
-      }
       bottom_data += dim;
       top_diff += dim;
       bottom_diff += dim;
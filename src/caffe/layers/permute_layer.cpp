@@ -1,10 +1,112 @@
+#include <algorithm>
 #include <vector>
 
+#include "boost/bind.hpp"
+
 #include "caffe/layers/permute_layer.hpp"
 #include "caffe/util/math_functions.hpp"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define USE_X86_TRANSPOSE_KERNELS
+#endif
+
 namespace caffe {
 
+// The tiles of a transpose hold kTileSize x kTileSize values, 16 KB of floats
+// read and written, which stay in L1 cache.
+static const int kTileSize = 64;
+
+// Transpose rows [row_start, row_end) x columns [col_start, col_end) of the
+// rows x cols matrix source into the cols x rows matrix destination.
+template <typename Dtype>
+static void TransposeScalar(const Dtype* source, const int rows,
+    const int cols, const int row_start, const int row_end,
+    const int col_start, const int col_end, Dtype* destination) {
+  for (int c = col_start; c < col_end; ++c) {
+    for (int r = row_start; r < row_end; ++r) {
+      destination[c * rows + r] = source[r * cols + c];
+    }
+  }
+}
+
+#ifdef USE_X86_TRANSPOSE_KERNELS
+// Transpose the 8 x 8 blocks of the range with AVX in registers, and the
+// edges as above.
+__attribute__((target("avx2")))
+static void TransposeAVX2(const float* source, const int rows,
+    const int cols, const int row_start, const int row_end,
+    const int col_start, const int col_end, float* destination) {
+  int r = row_start;
+  for (; r + 8 <= row_end; r += 8) {
+    int c = col_start;
+    for (; c + 8 <= col_end; c += 8) {
+      const float* s = source + r * cols + c;
+      const __m256 r0 = _mm256_loadu_ps(s);
+      const __m256 r1 = _mm256_loadu_ps(s + cols);
+      const __m256 r2 = _mm256_loadu_ps(s + 2 * cols);
+      const __m256 r3 = _mm256_loadu_ps(s + 3 * cols);
+      const __m256 r4 = _mm256_loadu_ps(s + 4 * cols);
+      const __m256 r5 = _mm256_loadu_ps(s + 5 * cols);
+      const __m256 r6 = _mm256_loadu_ps(s + 6 * cols);
+      const __m256 r7 = _mm256_loadu_ps(s + 7 * cols);
+      const __m256 t0 = _mm256_unpacklo_ps(r0, r1);
+      const __m256 t1 = _mm256_unpackhi_ps(r0, r1);
+      const __m256 t2 = _mm256_unpacklo_ps(r2, r3);
+      const __m256 t3 = _mm256_unpackhi_ps(r2, r3);
+      const __m256 t4 = _mm256_unpacklo_ps(r4, r5);
+      const __m256 t5 = _mm256_unpackhi_ps(r4, r5);
+      const __m256 t6 = _mm256_unpacklo_ps(r6, r7);
+      const __m256 t7 = _mm256_unpackhi_ps(r6, r7);
+      const __m256 u0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+      const __m256 u1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+      const __m256 u2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+      const __m256 u3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+      const __m256 u4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0));
+      const __m256 u5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+      const __m256 u6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0));
+      const __m256 u7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+      float* d = destination + c * rows + r;
+      _mm256_storeu_ps(d, _mm256_permute2f128_ps(u0, u4, 0x20));
+      _mm256_storeu_ps(d + rows, _mm256_permute2f128_ps(u1, u5, 0x20));
+      _mm256_storeu_ps(d + 2 * rows, _mm256_permute2f128_ps(u2, u6, 0x20));
+      _mm256_storeu_ps(d + 3 * rows, _mm256_permute2f128_ps(u3, u7, 0x20));
+      _mm256_storeu_ps(d + 4 * rows, _mm256_permute2f128_ps(u0, u4, 0x31));
+      _mm256_storeu_ps(d + 5 * rows, _mm256_permute2f128_ps(u1, u5, 0x31));
+      _mm256_storeu_ps(d + 6 * rows, _mm256_permute2f128_ps(u2, u6, 0x31));
+      _mm256_storeu_ps(d + 7 * rows, _mm256_permute2f128_ps(u3, u7, 0x31));
+    }
+    TransposeScalar(source, rows, cols, r, r + 8, c, col_end, destination);
+  }
+  TransposeScalar(source, rows, cols, r, row_end, col_start, col_end,
+                  destination);
+}
+#endif  // USE_X86_TRANSPOSE_KERNELS
+
+template <typename Dtype>
+static void TransposeRange(const Dtype* source, const int rows,
+    const int cols, const int row_start, const int row_end,
+    const int col_start, const int col_end, Dtype* destination) {
+  TransposeScalar(source, rows, cols, row_start, row_end, col_start, col_end,
+                  destination);
+}
+
+template <>
+void TransposeRange(const float* source, const int rows, const int cols,
+    const int row_start, const int row_end, const int col_start,
+    const int col_end, float* destination) {
+#ifdef USE_X86_TRANSPOSE_KERNELS
+  static const bool use_avx2 = __builtin_cpu_supports("avx2");
+  if (use_avx2) {
+    TransposeAVX2(source, rows, cols, row_start, row_end, col_start, col_end,
+                  destination);
+    return;
+  }
+#endif  // USE_X86_TRANSPOSE_KERNELS
+  TransposeScalar(source, rows, cols, row_start, row_end, col_start, col_end,
+                  destination);
+}
+
 template <typename Dtype>
 void Permute(const int count, Dtype* bottom_data, const bool forward,
     const int* permute_order, const int* old_steps, const int* new_steps,
@@ -49,6 +151,13 @@ void PermuteLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
     }
   }
   CHECK_EQ(num_axes_, orders.size());
+  // The first axis is kept and axes k, ..., num_axes_ - 1, 1, ..., k - 1
+  // follow for some k.
+  transpose_ = num_axes_ > 2 && orders[0] == 0 && orders[1] != 1;
+  for (int i = 2; i < num_axes_ && transpose_; ++i) {
+    transpose_ = orders[i] == orders[i - 1] % (num_axes_ - 1) + 1;
+  }
+  thread_pool_.reset(new ThreadPool(permute_param.num_threads()));
   // Check if we need to reorder the data or keep it.
   need_permute_ = false;
   for (int i = 0; i < num_axes_; ++i) {
@@ -92,12 +201,40 @@ void PermuteLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
       new_steps_.mutable_cpu_data()[i] = top[0]->count(i + 1);
     }
   }
+  if (transpose_) {
+    const int first_col_axis = permute_order_.cpu_data()[1];
+    transpose_rows_ = bottom[0]->count(1, first_col_axis);
+    transpose_cols_ = bottom[0]->count(first_col_axis);
+  }
+}
+
+template <typename Dtype>
+void PermuteLayer<Dtype>::TransposeTile(const Dtype* source, const int rows,
+    const int cols, Dtype* destination, const int tile_id) {
+  const int row_tiles = (rows + kTileSize - 1) / kTileSize;
+  const int col_tiles = (cols + kTileSize - 1) / kTileSize;
+  const int item = tile_id / (row_tiles * col_tiles);
+  const int row_start = tile_id / col_tiles % row_tiles * kTileSize;
+  const int col_start = tile_id % col_tiles * kTileSize;
+  const int offset = item * rows * cols;
+  TransposeRange(source + offset, rows, cols, row_start,
+                 std::min(row_start + kTileSize, rows), col_start,
+                 std::min(col_start + kTileSize, cols), destination + offset);
 }
 
 template <typename Dtype>
 void PermuteLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
-  if (need_permute_) {
+  if (need_permute_ && transpose_) {
+    const int rows = transpose_rows_;
+    const int cols = transpose_cols_;
+    const int num_tiles = bottom[0]->shape(0) *
+        ((rows + kTileSize - 1) / kTileSize) *
+        ((cols + kTileSize - 1) / kTileSize);
+    thread_pool_->Run(num_tiles, boost::bind(&PermuteLayer::TransposeTile,
+        this, bottom[0]->cpu_data(), rows, cols, top[0]->mutable_cpu_data(),
+        _1));
+  } else if (need_permute_) {
     Dtype* bottom_data = bottom[0]->mutable_cpu_data();
     Dtype* top_data = top[0]->mutable_cpu_data();
     const int top_count = top[0]->count();
@@ -116,7 +253,20 @@ void PermuteLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
 template <typename Dtype>
 void PermuteLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
-  if (need_permute_) {
+  if (need_permute_ && transpose_) {
+    if (!propagate_down[0]) {
+      return;
+    }
+    // The inverse order transposes the cols x rows matrices of the top.
+    const int rows = transpose_cols_;
+    const int cols = transpose_rows_;
+    const int num_tiles = bottom[0]->shape(0) *
+        ((rows + kTileSize - 1) / kTileSize) *
+        ((cols + kTileSize - 1) / kTileSize);
+    thread_pool_->Run(num_tiles, boost::bind(&PermuteLayer::TransposeTile,
+        this, top[0]->cpu_diff(), rows, cols, bottom[0]->mutable_cpu_diff(),
+        _1));
+  } else if (need_permute_) {
     Dtype* top_diff = top[0]->mutable_cpu_diff();
     Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
     const int top_count = top[0]->count();
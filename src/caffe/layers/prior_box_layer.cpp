@@ -82,9 +82,19 @@ void PriorBoxLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   const int layer_height = bottom[0]->height();
   const int img_width = bottom[1]->width();
   const int img_height = bottom[1]->height();
+  // Reuse the priors of the previous pass if the shapes are the same.
+  if (priors_.count() == top[0]->count() &&
+      layer_height == priors_layer_height_ &&
+      layer_width == priors_layer_width_ &&
+      img_height == priors_img_height_ && img_width == priors_img_width_) {
+    caffe_copy(top[0]->count(), priors_.cpu_data(),
+               top[0]->mutable_cpu_data());
+    return;
+  }
   const float step_x = static_cast<float>(img_width) / layer_width;
   const float step_y = static_cast<float>(img_height) / layer_height;
-  Dtype* top_data = top[0]->mutable_cpu_data();
+  priors_.ReshapeLike(*top[0]);
+  Dtype* top_data = priors_.mutable_cpu_data();
   int dim = layer_height * layer_width * num_priors_ * 4;
   int idx = 0;
   for (int h = 0; h < layer_height; ++h) {
@@ -142,7 +152,7 @@ void PriorBoxLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     }
   }
   // set the variance.
-  top_data += top[0]->offset(0, 1);
+  top_data += priors_.offset(0, 1);
   if (variance_.size() == 1) {
     caffe_set<Dtype>(dim, Dtype(variance_[0]), top_data);
   } else {
@@ -158,6 +168,11 @@ void PriorBoxLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       }
     }
   }
+  priors_layer_height_ = layer_height;
+  priors_layer_width_ = layer_width;
+  priors_img_height_ = img_height;
+  priors_img_width_ = img_width;
+  caffe_copy(top[0]->count(), priors_.cpu_data(), top[0]->mutable_cpu_data());
 }
 
 INSTANTIATE_CLASS(PriorBoxLayer);
@@ -1,11 +1,27 @@
 #include <algorithm>
+#include <cfloat>
 #include <vector>
 
+#include "boost/bind.hpp"
+
 #include "caffe/layers/softmax_layer.hpp"
 #include "caffe/util/math_functions.hpp"
 
 namespace caffe {
 
+// The rows of a task, and of a block exponentiated at once, which stays in
+// cache for the sums that follow.
+static const int kRowsPerTask = 256;
+static const int kRowsPerBlock = 64;
+
+template <typename Dtype>
+void SoftmaxLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  thread_pool_.reset(
+      new ThreadPool(this->layer_param_.softmax_param().num_threads()));
+  fast_exp_ = this->layer_param_.softmax_param().fast_exp();
+}
+
 template <typename Dtype>
 void SoftmaxLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
@@ -23,6 +39,63 @@ void SoftmaxLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   scale_.Reshape(scale_dims);
 }
 
+template <typename Dtype>
+void SoftmaxLayer<Dtype>::ForwardRows(const Dtype* bottom_data,
+    const int channels, Dtype* top_data, const int task_id) {
+  const int row_end = std::min((task_id + 1) * kRowsPerTask, outer_num_);
+  for (int start = task_id * kRowsPerTask; start < row_end;
+       start += kRowsPerBlock) {
+    const int end = std::min(start + kRowsPerBlock, row_end);
+    for (int i = start; i < end; ++i) {
+      const Dtype* x = bottom_data + i * channels;
+      Dtype* y = top_data + i * channels;
+      Dtype maxval = -FLT_MAX;
+      for (int j = 0; j < channels; ++j) {
+        maxval = std::max(maxval, x[j]);
+      }
+      for (int j = 0; j < channels; ++j) {
+        y[j] = x[j] - maxval;
+      }
+    }
+    Dtype* block = top_data + start * channels;
+    if (fast_exp_) {
+      caffe_exp_nonpositive((end - start) * channels, block);
+    } else {
+      caffe_exp((end - start) * channels, block, block);
+    }
+    for (int i = start; i < end; ++i) {
+      Dtype* y = top_data + i * channels;
+      Dtype sum = 0;
+      for (int j = 0; j < channels; ++j) {
+        sum += y[j];
+      }
+      const Dtype inv_sum = Dtype(1) / sum;
+      for (int j = 0; j < channels; ++j) {
+        y[j] *= inv_sum;
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void SoftmaxLayer<Dtype>::BackwardRows(const Dtype* top_data,
+    const Dtype* top_diff, const int channels, Dtype* bottom_diff,
+    const int task_id) {
+  const int row_end = std::min((task_id + 1) * kRowsPerTask, outer_num_);
+  for (int i = task_id * kRowsPerTask; i < row_end; ++i) {
+    const Dtype* y = top_data + i * channels;
+    const Dtype* dy = top_diff + i * channels;
+    Dtype* dx = bottom_diff + i * channels;
+    Dtype dot = 0;
+    for (int j = 0; j < channels; ++j) {
+      dot += dy[j] * y[j];
+    }
+    for (int j = 0; j < channels; ++j) {
+      dx[j] = (dy[j] - dot) * y[j];
+    }
+  }
+}
+
 template <typename Dtype>
 void SoftmaxLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
@@ -30,6 +103,12 @@ void SoftmaxLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   Dtype* top_data = top[0]->mutable_cpu_data();
   Dtype* scale_data = scale_.mutable_cpu_data();
   int channels = bottom[0]->shape(softmax_axis_);
+  if (inner_num_ == 1) {
+    const int num_tasks = (outer_num_ + kRowsPerTask - 1) / kRowsPerTask;
+    thread_pool_->Run(num_tasks, boost::bind(&SoftmaxLayer::ForwardRows,
+        this, bottom_data, channels, top_data, _1));
+    return;
+  }
   int dim = bottom[0]->count() / outer_num_;
   caffe_copy(bottom[0]->count(), bottom_data, top_data);
   // We need to subtract the max to avoid numerical issues, compute the exp,
@@ -68,6 +147,12 @@ void SoftmaxLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
   Dtype* scale_data = scale_.mutable_cpu_data();
   int channels = top[0]->shape(softmax_axis_);
+  if (inner_num_ == 1) {
+    const int num_tasks = (outer_num_ + kRowsPerTask - 1) / kRowsPerTask;
+    thread_pool_->Run(num_tasks, boost::bind(&SoftmaxLayer::BackwardRows,
+        this, top_data, top_diff, channels, bottom_diff, _1));
+    return;
+  }
   int dim = top[0]->count() / outer_num_;
   caffe_copy(top[0]->count(), top_diff, bottom_diff);
   for (int i = 0; i < outer_num_; ++i) {
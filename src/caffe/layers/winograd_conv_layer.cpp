@@ -0,0 +1,315 @@
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "caffe/layers/winograd_conv_layer.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+// The transforms of F(m x m, 3x3) along one dimension, following Lavin and
+// Gray: the input transform B^T, the output transform A^T and the filter
+// transform G, whose points are 0, -1, 1 (and -2, 2 for m = 4).
+template <typename Dtype, int M>
+struct Winograd;
+
+template <typename Dtype>
+struct Winograd<Dtype, 2> {
+  static inline void Input(const Dtype* d, const int s, Dtype* v,
+      const int t) {
+    v[0] = d[0] - d[2 * s];
+    v[t] = d[s] + d[2 * s];
+    v[2 * t] = d[2 * s] - d[s];
+    v[3 * t] = d[s] - d[3 * s];
+  }
+  static inline void Output(const Dtype* m, const int s, Dtype* y,
+      const int t) {
+    y[0] = m[0] + m[s] + m[2 * s];
+    y[t] = m[s] - m[2 * s] - m[3 * s];
+  }
+  static inline void Filter(const double* g, const int s, double* u,
+      const int t) {
+    u[0] = g[0];
+    u[t] = (g[0] + g[s] + g[2 * s]) / 2;
+    u[2 * t] = (g[0] - g[s] + g[2 * s]) / 2;
+    u[3 * t] = g[2 * s];
+  }
+};
+
+template <typename Dtype>
+struct Winograd<Dtype, 4> {
+  static inline void Input(const Dtype* d, const int s, Dtype* v,
+      const int t) {
+    const Dtype d1 = d[s], d2 = d[2 * s], d3 = d[3 * s], d4 = d[4 * s];
+    v[0] = 4 * d[0] - 5 * d2 + d4;
+    v[t] = d3 + d4 - 4 * (d1 + d2);
+    v[2 * t] = d4 - d3 + 4 * (d1 - d2);
+    v[3 * t] = d4 - d2 + 2 * (d3 - d1);
+    v[4 * t] = d4 - d2 + 2 * (d1 - d3);
+    v[5 * t] = 4 * d1 - 5 * d3 + d[5 * s];
+  }
+  static inline void Output(const Dtype* m, const int s, Dtype* y,
+      const int t) {
+    const Dtype m1 = m[s], m2 = m[2 * s], m3 = m[3 * s], m4 = m[4 * s];
+    const Dtype sum12 = m1 + m2, diff12 = m1 - m2;
+    const Dtype sum34 = m3 + m4, diff34 = m3 - m4;
+    y[0] = m[0] + sum12 + sum34;
+    y[t] = diff12 + 2 * diff34;
+    y[2 * t] = sum12 + 4 * sum34;
+    y[3 * t] = diff12 + 8 * diff34 + m[5 * s];
+  }
+  static inline void Filter(const double* g, const int s, double* u,
+      const int t) {
+    u[0] = g[0] / 4;
+    u[t] = -(g[0] + g[s] + g[2 * s]) / 6;
+    u[2 * t] = -(g[0] - g[s] + g[2 * s]) / 6;
+    u[3 * t] = (g[0] + 2 * g[s] + 4 * g[2 * s]) / 24;
+    u[4 * t] = (g[0] - 2 * g[s] + 4 * g[2 * s]) / 24;
+    u[5 * t] = g[2 * s];
+  }
+};
+
+// Transform the input tiles of every channel, writing the transformed pixel
+// xi of tile t of channel c to output[(xi * channels + c) * num_tiles + t].
+// Tiles overlap by two pixels and read zeros outside of the image.
+template <typename Dtype, int M>
+static void WinogradInput(const Dtype* input, const int channels,
+    const int height, const int width, const int pad_h, const int pad_w,
+    const int tiles_h, const int tiles_w, Dtype* output) {
+  const int kAlpha = M + 2;
+  const int num_tiles = tiles_h * tiles_w;
+  const int plane = channels * num_tiles;
+  Dtype d[kAlpha * kAlpha], v[kAlpha * kAlpha];
+  for (int c = 0; c < channels; ++c) {
+    const Dtype* image = input + c * height * width;
+    for (int th = 0; th < tiles_h; ++th) {
+      const int y0 = th * M - pad_h;
+      for (int tw = 0; tw < tiles_w; ++tw) {
+        const int x0 = tw * M - pad_w;
+        if (y0 >= 0 && x0 >= 0 && y0 + kAlpha <= height &&
+            x0 + kAlpha <= width) {
+          for (int i = 0; i < kAlpha; ++i) {
+            memcpy(d + i * kAlpha, image + (y0 + i) * width + x0,
+                   kAlpha * sizeof(Dtype));
+          }
+        } else {
+          for (int i = 0; i < kAlpha; ++i) {
+            for (int j = 0; j < kAlpha; ++j) {
+              const int y = y0 + i, x = x0 + j;
+              d[i * kAlpha + j] = (y >= 0 && y < height && x >= 0 &&
+                  x < width) ? image[y * width + x] : Dtype(0);
+            }
+          }
+        }
+        // v = B^T d B, by columns and then by rows.
+        for (int j = 0; j < kAlpha; ++j) {
+          Winograd<Dtype, M>::Input(d + j, kAlpha, v + j, kAlpha);
+        }
+        Dtype* out = output + c * num_tiles + th * tiles_w + tw;
+        for (int i = 0; i < kAlpha; ++i) {
+          Winograd<Dtype, M>::Input(v + i * kAlpha, 1, d, 1);
+          for (int j = 0; j < kAlpha; ++j) {
+            out[(i * kAlpha + j) * plane] = d[j];
+          }
+        }
+      }
+    }
+  }
+}
+
+// The inverse of WinogradInput for the products of the transformed tiles and
+// filters: write the M x M output pixels of each tile that are in the image.
+template <typename Dtype, int M>
+static void WinogradOutput(const Dtype* input, const int channels,
+    const int height, const int width, const int tiles_h, const int tiles_w,
+    Dtype* output) {
+  const int kAlpha = M + 2;
+  const int num_tiles = tiles_h * tiles_w;
+  const int plane = channels * num_tiles;
+  Dtype m[kAlpha * kAlpha], u[M * kAlpha], y[M];
+  for (int c = 0; c < channels; ++c) {
+    Dtype* image = output + c * height * width;
+    for (int th = 0; th < tiles_h; ++th) {
+      const int y0 = th * M;
+      const int rows = std::min(M, height - y0);
+      for (int tw = 0; tw < tiles_w; ++tw) {
+        const int x0 = tw * M;
+        const int cols = std::min(M, width - x0);
+        const Dtype* in = input + c * num_tiles + th * tiles_w + tw;
+        for (int xi = 0; xi < kAlpha * kAlpha; ++xi) {
+          m[xi] = in[xi * plane];
+        }
+        // Y = A^T m A, by columns and then by rows.
+        for (int j = 0; j < kAlpha; ++j) {
+          Winograd<Dtype, M>::Output(m + j, kAlpha, u + j, kAlpha);
+        }
+        for (int i = 0; i < rows; ++i) {
+          Winograd<Dtype, M>::Output(u + i * kAlpha, 1, y, 1);
+          memcpy(image + (y0 + i) * width + x0, y, cols * sizeof(Dtype));
+        }
+      }
+    }
+  }
+}
+
+// Transform the 3x3 filters, writing the transformed pixel xi of the filter
+// of output channel o and input channel c of each group to
+// output[((group * kAlpha^2 + xi) * out_channels + o) * in_channels + c].
+template <typename Dtype, int M>
+static void WinogradFilter(const Dtype* weights, const int group,
+    const int out_channels, const int in_channels, Dtype* output) {
+  const int kAlpha = M + 2;
+  const int plane = out_channels * in_channels;
+  double g[9], t[kAlpha * 3], u[kAlpha * kAlpha];
+  for (int o = 0; o < group * out_channels; ++o) {
+    for (int c = 0; c < in_channels; ++c) {
+      for (int i = 0; i < 9; ++i) {
+        g[i] = weights[(o * in_channels + c) * 9 + i];
+      }
+      // u = G g G^T, by columns and then by rows.
+      for (int j = 0; j < 3; ++j) {
+        Winograd<Dtype, M>::Filter(g + j, 3, t + j, 3);
+      }
+      for (int i = 0; i < kAlpha; ++i) {
+        Winograd<Dtype, M>::Filter(t + i * 3, 1, u + i * kAlpha, 1);
+      }
+      Dtype* out = output + (o / out_channels) * kAlpha * kAlpha * plane +
+          (o % out_channels) * in_channels + c;
+      for (int xi = 0; xi < kAlpha * kAlpha; ++xi) {
+        out[xi * plane] = u[xi];
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::LayerSetUp(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  ConvolutionLayer<Dtype>::LayerSetUp(bottom, top);
+  tile_ = this->layer_param_.convolution_param().winograd_tile();
+  CHECK(tile_ == 2 || tile_ == 4) << "winograd_tile must be 2 or 4.";
+  keep_transformed_weights_ = false;
+}
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::ParamsChanged() {
+  ConvolutionLayer<Dtype>::ParamsChanged();
+  keep_transformed_weights_ = false;
+}
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::Reshape(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  ConvolutionLayer<Dtype>::Reshape(bottom, top);
+  // Depthwise and INT8 convolutions are left to ConvolutionLayer.
+  use_winograd_ = this->num_spatial_axes_ == 2 && !this->is_depthwise() &&
+      !this->int8_gemm_;
+  for (int i = 0; i < this->num_spatial_axes_ && use_winograd_; ++i) {
+    use_winograd_ = this->kernel_shape_.cpu_data()[i] == 3 &&
+        this->stride_.cpu_data()[i] == 1 &&
+        this->dilation_.cpu_data()[i] == 1;
+  }
+  if (!use_winograd_) {
+    return;
+  }
+  const int alpha = tile_ + 2;
+  tiles_h_ = (this->output_shape_[0] + tile_ - 1) / tile_;
+  tiles_w_ = (this->output_shape_[1] + tile_ - 1) / tile_;
+  const int in_channels = this->channels_ / this->group_;
+  const int out_channels = this->num_output_ / this->group_;
+  vector<int> shape(1, this->group_ * alpha * alpha);
+  shape.push_back(out_channels);
+  shape.push_back(in_channels);
+  transformed_weights_.Reshape(shape);
+  shape[0] = alpha * alpha;
+  shape[1] = in_channels;
+  shape[2] = tiles_h_ * tiles_w_;
+  transformed_input_.Reshape(shape);
+  shape[1] = out_channels;
+  transformed_output_.Reshape(shape);
+}
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::TransformWeights() {
+  if (keep_transformed_weights_) {
+    return;
+  }
+  // The solver updates the weights in place between TRAIN passes.
+  keep_transformed_weights_ = this->phase_ == TEST;
+  const Blob<Dtype>& weights = *this->blobs_[0];
+  const int in_channels = this->channels_ / this->group_;
+  const int out_channels = this->num_output_ / this->group_;
+  if (tile_ == 2) {
+    WinogradFilter<Dtype, 2>(weights.cpu_data(), this->group_, out_channels,
+        in_channels, transformed_weights_.mutable_cpu_data());
+  } else {
+    WinogradFilter<Dtype, 4>(weights.cpu_data(), this->group_, out_channels,
+        in_channels, transformed_weights_.mutable_cpu_data());
+  }
+}
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::Forward_cpu(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  if (!use_winograd_) {
+    ConvolutionLayer<Dtype>::Forward_cpu(bottom, top);
+    return;
+  }
+  TransformWeights();
+  const int alpha = tile_ + 2;
+  const int height = this->conv_input_shape_.cpu_data()[1];
+  const int width = this->conv_input_shape_.cpu_data()[2];
+  const int pad_h = this->pad_.cpu_data()[0];
+  const int pad_w = this->pad_.cpu_data()[1];
+  const int out_height = this->output_shape_[0];
+  const int out_width = this->output_shape_[1];
+  const int in_channels = this->channels_ / this->group_;
+  const int out_channels = this->num_output_ / this->group_;
+  const int num_tiles = tiles_h_ * tiles_w_;
+  const Dtype* weight = transformed_weights_.cpu_data();
+  Dtype* input = transformed_input_.mutable_cpu_data();
+  Dtype* output = transformed_output_.mutable_cpu_data();
+  for (int i = 0; i < bottom.size(); ++i) {
+    const Dtype* bottom_data = bottom[i]->cpu_data();
+    Dtype* top_data = top[i]->mutable_cpu_data();
+    for (int n = 0; n < this->num_; ++n) {
+      for (int g = 0; g < this->group_; ++g) {
+        const Dtype* image = bottom_data + n * this->bottom_dim_ +
+            g * in_channels * height * width;
+        if (tile_ == 2) {
+          WinogradInput<Dtype, 2>(image, in_channels, height, width, pad_h,
+              pad_w, tiles_h_, tiles_w_, input);
+        } else {
+          WinogradInput<Dtype, 4>(image, in_channels, height, width, pad_h,
+              pad_w, tiles_h_, tiles_w_, input);
+        }
+        // One product of the transformed filters and tiles per transformed
+        // pixel.
+        for (int xi = 0; xi < alpha * alpha; ++xi) {
+          caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, out_channels,
+              num_tiles, in_channels, (Dtype)1.,
+              weight + (g * alpha * alpha + xi) * out_channels * in_channels,
+              input + xi * in_channels * num_tiles, (Dtype)0.,
+              output + xi * out_channels * num_tiles);
+        }
+        Dtype* out_image = top_data + n * this->top_dim_ +
+            g * out_channels * out_height * out_width;
+        if (tile_ == 2) {
+          WinogradOutput<Dtype, 2>(output, out_channels, out_height,
+              out_width, tiles_h_, tiles_w_, out_image);
+        } else {
+          WinogradOutput<Dtype, 4>(output, out_channels, out_height,
+              out_width, tiles_h_, tiles_w_, out_image);
+        }
+      }
+      if (this->bias_term_) {
+        const Dtype* bias = this->blobs_[1]->cpu_data();
+        this->forward_cpu_bias(top_data + n * this->top_dim_, bias);
+      }
+    }
+  }
+}
+
+INSTANTIATE_CLASS(WinogradConvolutionLayer);
+
+}  // namespace caffe
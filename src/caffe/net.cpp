@@ -1,10 +1,12 @@
 #include <algorithm>
+#include <cstring>
 #include <map>
 #include <set>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "boost/bind.hpp"
 #include "hdf5.h"
 
 #include "caffe/common.hpp"
@@ -271,9 +273,377 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
   }
   ShareWeights();
   debug_info_ = param.debug_info();
+  activation_memory_pending_ =
+      phase_ == TEST && param.share_activation_memory();
+  concat_memory_pending_ = param.share_concat_memory();
+  concat_views_.clear();
+  forward_threads_ = param.forward_threads();
+  layer_scheduler_.reset();
+  layer_scheduler_pending_ = forward_threads_ > 1;
+  if (layer_scheduler_pending_ && phase_ != TEST) {
+    // The threads of the scheduler have no seeded RNG, and the order of the
+    // draws of Dropout and the like would depend on the threads anyway.
+    LOG(WARNING) << "forward_threads is ignored outside the TEST phase, "
+                 << "to keep the draws of random layers reproducible.";
+    layer_scheduler_pending_ = false;
+  }
+  if (layer_scheduler_pending_ && activation_memory_pending_) {
+    LOG(WARNING) << "forward_threads is ignored with share_activation_memory, "
+                 << "which places the blobs for the order of the layers.";
+    layer_scheduler_pending_ = false;
+  }
+  if (activation_memory_pending_) {
+    // The net inputs and outputs, the tops of layers without bottoms, which
+    // may fill them only once, and the blobs the user asked for keep memory
+    // of their own.
+    blob_keeps_memory_.assign(blobs_.size(), false);
+    for (int i = 0; i < net_input_blob_indices_.size(); ++i) {
+      blob_keeps_memory_[net_input_blob_indices_[i]] = true;
+    }
+    for (int i = 0; i < net_output_blob_indices_.size(); ++i) {
+      blob_keeps_memory_[net_output_blob_indices_[i]] = true;
+    }
+    for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+      if (bottom_id_vecs_[layer_id].empty()) {
+        for (int i = 0; i < top_id_vecs_[layer_id].size(); ++i) {
+          blob_keeps_memory_[top_id_vecs_[layer_id][i]] = true;
+        }
+      }
+    }
+    for (int i = 0; i < param.keep_blob_size(); ++i) {
+      CHECK(has_blob(param.keep_blob(i)))
+          << "Unknown blob " << param.keep_blob(i) << " in keep_blob";
+      blob_keeps_memory_[blob_names_index_[param.keep_blob(i)]] = true;
+    }
+  }
   LOG_IF(INFO, Caffe::root_solver()) << "Network initialization done.";
 }
 
+template <typename Dtype>
+void Net<Dtype>::ShareActivationMemory() {
+  if (Caffe::mode() != Caffe::CPU) {
+    LOG(WARNING) << "share_activation_memory only shares CPU memory; "
+                 << "ignoring it in GPU mode.";
+    return;
+  }
+  // Blobs sharing their data, e.g. the tops of Split or Flatten layers and
+  // their bottom, form a group. Some layers only share in Forward, hence
+  // this runs after the first one. A group lives from the first to the last
+  // layer using one of its blobs.
+  map<SyncedMemory*, int> group_ids;
+  vector<shared_ptr<SyncedMemory> > group_data;
+  vector<int> group_first;
+  vector<int> group_last;
+  vector<bool> group_keep;
+  vector<int> blob_group(blobs_.size(), -1);
+  // The views of share_concat_memory belong to the group of their top.
+  map<SyncedMemory*, shared_ptr<SyncedMemory> > view_tops;
+  for (int i = 0; i < concat_views_.size(); ++i) {
+    if (!concat_views_[i].diff) {
+      view_tops[concat_views_[i].memory.get()] = concat_views_[i].top_memory;
+    }
+  }
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    const vector<int>* blob_ids[2] =
+        {&bottom_id_vecs_[layer_id], &top_id_vecs_[layer_id]};
+    for (int k = 0; k < 2; ++k) {
+      for (int i = 0; i < blob_ids[k]->size(); ++i) {
+        const int blob_id = (*blob_ids[k])[i];
+        if (blobs_[blob_id]->count() == 0) {
+          continue;
+        }
+        shared_ptr<SyncedMemory> data = blobs_[blob_id]->data();
+        while (view_tops.count(data.get())) {
+          data = view_tops[data.get()];
+        }
+        map<SyncedMemory*, int>::const_iterator it = group_ids.find(data.get());
+        int group;
+        if (it == group_ids.end()) {
+          group = group_data.size();
+          group_ids[data.get()] = group;
+          group_data.push_back(data);
+          group_first.push_back(layer_id);
+          group_last.push_back(layer_id);
+          group_keep.push_back(false);
+        } else {
+          group = it->second;
+        }
+        group_last[group] = layer_id;
+        group_keep[group] = group_keep[group] || blob_keeps_memory_[blob_id];
+        blob_group[blob_id] = group;
+      }
+    }
+  }
+
+  // Place the largest groups first, each one at the lowest offset which is
+  // not used by a placed group living at the same time.
+  const size_t kAlignment = 64;
+  vector<pair<size_t, int> > group_sizes;
+  size_t size_needed = 0;
+  for (int group = 0; group < group_data.size(); ++group) {
+    if (!group_keep[group]) {
+      const size_t size = (group_data[group]->size() + kAlignment - 1) /
+          kAlignment * kAlignment;
+      group_sizes.push_back(make_pair(size, group));
+      size_needed += size;
+    }
+  }
+  if (group_sizes.empty()) {
+    return;
+  }
+  std::sort(group_sizes.rbegin(), group_sizes.rend());
+  vector<size_t> group_offsets(group_data.size());
+  size_t total_size = 0;
+  for (int i = 0; i < group_sizes.size(); ++i) {
+    const size_t size = group_sizes[i].first;
+    const int group = group_sizes[i].second;
+    vector<pair<size_t, size_t> > used_ranges;
+    for (int j = 0; j < i; ++j) {
+      const int other = group_sizes[j].second;
+      if (group_first[other] <= group_last[group] &&
+          group_first[group] <= group_last[other]) {
+        used_ranges.push_back(make_pair(group_offsets[other],
+            group_offsets[other] + group_sizes[j].first));
+      }
+    }
+    std::sort(used_ranges.begin(), used_ranges.end());
+    size_t offset = 0;
+    for (int j = 0; j < used_ranges.size(); ++j) {
+      if (offset + size <= used_ranges[j].first) {
+        break;
+      }
+      offset = std::max(offset, used_ranges[j].second);
+    }
+    group_offsets[group] = offset;
+    total_size = std::max(total_size, offset + size);
+  }
+
+  activation_memory_.reset(new SyncedMemory(total_size));
+  char* memory = static_cast<char*>(activation_memory_->mutable_cpu_data());
+  for (int i = 0; i < group_sizes.size(); ++i) {
+    const int group = group_sizes[i].second;
+    group_data[group]->set_cpu_data(memory + group_offsets[group]);
+  }
+  UpdateConcatViews();
+  shared_data_.resize(blobs_.size());
+  for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    const int group = blob_group[blob_id];
+    if (group != -1 && !group_keep[group]) {
+      shared_data_[blob_id] = group_data[group];
+    }
+  }
+  LOG_IF(INFO, Caffe::root_solver())
+      << "Sharing " << total_size << " bytes of memory among activations "
+      << "which need " << size_needed << " bytes.";
+}
+
+template <typename Dtype>
+void Net<Dtype>::ReleaseActivationMemory(const int blob_id) const {
+  if (activation_memory_pending_) {
+    blob_keeps_memory_[blob_id] = true;
+    return;
+  }
+  if (shared_data_.empty() || !shared_data_[blob_id]) {
+    return;
+  }
+  shared_ptr<SyncedMemory> data = shared_data_[blob_id];
+  shared_ptr<SyncedMemory> own_data(new SyncedMemory(data->size()));
+  memcpy(own_data->mutable_cpu_data(), data->cpu_data(), data->size());
+  data->set_cpu_data(own_data->mutable_cpu_data());
+  released_data_.push_back(own_data);
+  UpdateConcatViews();
+  for (int i = 0; i < shared_data_.size(); ++i) {
+    if (shared_data_[i] == data) {
+      shared_data_[i].reset();
+    }
+  }
+}
+
+// The axis of a Concat layer, as in ConcatLayer::Reshape.
+template <typename Dtype>
+static int ConcatAxis(const LayerParameter& param, const Blob<Dtype>& top) {
+  const ConcatParameter& concat_param = param.concat_param();
+  if (concat_param.has_concat_dim()) {
+    return static_cast<int>(concat_param.concat_dim());
+  }
+  return top.CanonicalAxisIndex(concat_param.axis());
+}
+
+template <typename Dtype>
+void Net<Dtype>::ShareConcatMemory() {
+  if (Caffe::mode() != Caffe::CPU) {
+    LOG(WARNING) << "share_concat_memory only shares CPU memory; "
+                 << "ignoring it in GPU mode.";
+    return;
+  }
+  // As with share_activation_memory, blobs sharing their data or diff are
+  // found after the first Forward. A bottom's data can only be a view if no
+  // later layer writes it, nor the top, which no earlier layer may use; its
+  // diff, if only the Concat layer writes it, as Backward runs the earlier
+  // layers after it. Split, Flatten or Reshape layers, whose tops are other
+  // blobs sharing the memory of their bottom, write neither.
+  map<SyncedMemory*, int> first_user;
+  map<SyncedMemory*, int> last_writer;
+  map<SyncedMemory*, int> num_diff_writers;
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    const vector<Blob<Dtype>*>& bottom = bottom_vecs_[layer_id];
+    const vector<Blob<Dtype>*>& top = top_vecs_[layer_id];
+    set<SyncedMemory*> bottom_data;
+    set<SyncedMemory*> top_diff;
+    for (int i = 0; i < top.size(); ++i) {
+      if (std::find(bottom.begin(), bottom.end(), top[i]) == bottom.end()) {
+        top_diff.insert(top[i]->diff().get());
+      }
+    }
+    for (int i = 0; i < bottom.size(); ++i) {
+      if (bottom[i]->count() > 0) {
+        first_user.insert(make_pair(bottom[i]->data().get(), layer_id));
+        bottom_data.insert(bottom[i]->data().get());
+        if (!top_diff.count(bottom[i]->diff().get())) {
+          ++num_diff_writers[bottom[i]->diff().get()];
+        }
+      }
+    }
+    for (int i = 0; i < top.size(); ++i) {
+      if (top[i]->count() == 0) {
+        continue;
+      }
+      first_user.insert(make_pair(top[i]->data().get(), layer_id));
+      const bool in_place =
+          std::find(bottom.begin(), bottom.end(), top[i]) != bottom.end();
+      if (in_place || !bottom_data.count(top[i]->data().get())) {
+        last_writer[top[i]->data().get()] = layer_id;
+      }
+    }
+  }
+  vector<bool> blob_keeps_memory(blobs_.size(), false);
+  for (int i = 0; i < net_input_blob_indices_.size(); ++i) {
+    blob_keeps_memory[net_input_blob_indices_[i]] = true;
+  }
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    if (bottom_id_vecs_[layer_id].empty()) {
+      for (int i = 0; i < top_id_vecs_[layer_id].size(); ++i) {
+        blob_keeps_memory[top_id_vecs_[layer_id][i]] = true;
+      }
+    }
+  }
+
+  // The outer layers first, so that the top of a Concat feeding another one
+  // is made a view before its bottoms are.
+  set<SyncedMemory*> views;
+  const bool share_diff = phase_ == TRAIN;
+  for (int layer_id = layers_.size() - 1; layer_id >= 0; --layer_id) {
+    const vector<Blob<Dtype>*>& bottom = bottom_vecs_[layer_id];
+    if (strcmp(layers_[layer_id]->type(), "Concat") != 0 ||
+        bottom.size() < 2) {
+      continue;
+    }
+    Blob<Dtype>* top = top_vecs_[layer_id][0];
+    const int axis = ConcatAxis(layers_[layer_id]->layer_param(), *top);
+    if (top->count() == 0 || top->count(0, axis) != 1 ||
+        first_user[top->data().get()] != layer_id ||
+        last_writer[top->data().get()] != layer_id) {
+      continue;
+    }
+    set<SyncedMemory*> memory;
+    memory.insert(top->data().get());
+    memory.insert(top->diff().get());
+    bool share_data = true;
+    vector<bool> share_bottom_diff(bottom.size(), share_diff);
+    for (int i = 0; i < bottom.size() && share_data; ++i) {
+      const size_t size = bottom[i]->count() * sizeof(Dtype);
+      SyncedMemory* data = bottom[i]->data().get();
+      SyncedMemory* diff = bottom[i]->diff().get();
+      share_data = size > 0 &&
+          !blob_keeps_memory[bottom_id_vecs_[layer_id][i]] &&
+          data->size() == size && !views.count(data) &&
+          memory.insert(data).second && last_writer[data] < layer_id;
+      share_bottom_diff[i] = share_diff && diff->size() == size &&
+          !views.count(diff) && memory.insert(diff).second &&
+          num_diff_writers[diff] == 1;
+    }
+    if (!share_data) {
+      continue;
+    }
+    for (int k = 0; k < 2; ++k) {
+      const shared_ptr<SyncedMemory>& top_memory =
+          k == 0 ? top->data() : top->diff();
+      size_t offset = 0;
+      for (int i = 0; i < bottom.size(); ++i) {
+        if (k == 1 && !share_bottom_diff[i]) {
+          offset += bottom[i]->count() * sizeof(Dtype);
+          continue;
+        }
+        ConcatView view;
+        view.layer_id = layer_id;
+        view.bottom_id = i;
+        view.diff = k == 1;
+        view.memory = k == 0 ? bottom[i]->data() : bottom[i]->diff();
+        view.top_memory = top_memory;
+        view.offset = offset;
+        offset += view.memory->size();
+        views.insert(view.memory.get());
+        concat_own_memory_.erase(view.memory.get());
+        concat_views_.push_back(view);
+      }
+    }
+  }
+  UpdateConcatViews();
+}
+
+template <typename Dtype>
+void Net<Dtype>::UpdateConcatViews() const {
+  for (int i = 0; i < concat_views_.size(); ++i) {
+    const ConcatView& view = concat_views_[i];
+    view.memory->set_cpu_data(
+        static_cast<char*>(view.top_memory->mutable_cpu_data()) + view.offset);
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::CheckConcatViews() {
+  set<int> moved_layers;
+  for (int i = 0; i < concat_views_.size(); ++i) {
+    const ConcatView& view = concat_views_[i];
+    const Blob<Dtype>* top = top_vecs_[view.layer_id][0];
+    const vector<Blob<Dtype>*>& bottom = bottom_vecs_[view.layer_id];
+    size_t offset = 0;
+    for (int j = 0; j < view.bottom_id; ++j) {
+      offset += bottom[j]->count() * sizeof(Dtype);
+    }
+    const Blob<Dtype>* blob = bottom[view.bottom_id];
+    if (offset != view.offset ||
+        top->count(0, ConcatAxis(layers_[view.layer_id]->layer_param(),
+                                 *top)) != 1 ||
+        (view.diff ? top->diff() : top->data()) != view.top_memory ||
+        (view.diff ? blob->diff() : blob->data()) != view.memory) {
+      moved_layers.insert(view.layer_id);
+    }
+  }
+  if (moved_layers.empty()) {
+    return;
+  }
+  vector<ConcatView> views;
+  for (int i = 0; i < concat_views_.size(); ++i) {
+    const ConcatView& view = concat_views_[i];
+    if (!moved_layers.count(view.layer_id)) {
+      views.push_back(view);
+      continue;
+    }
+    shared_ptr<SyncedMemory> own_memory(
+        new SyncedMemory(view.memory->size()));
+    memcpy(own_memory->mutable_cpu_data(), view.memory->cpu_data(),
+           view.memory->size());
+    view.memory->set_cpu_data(own_memory->mutable_cpu_data());
+    concat_own_memory_[view.memory.get()] = own_memory;
+  }
+  concat_views_.swap(views);
+  UpdateConcatViews();
+  // Share again for the new shapes, unless the activation memory was placed
+  // for the old views.
+  concat_memory_pending_ = !activation_memory_;
+}
+
 template <typename Dtype>
 void Net<Dtype>::FilterNet(const NetParameter& param,
     NetParameter* param_filtered) {
@@ -536,15 +906,107 @@ Dtype Net<Dtype>::ForwardFromTo(int start, int end) {
   CHECK_GE(start, 0);
   CHECK_LT(end, layers_.size());
   Dtype loss = 0;
+  if (profiler_ && start == 0) {
+    profiler_->NextIteration();
+  }
+  if (layer_scheduler_ && !profiler_ && !debug_info_ &&
+      Caffe::mode() == Caffe::CPU) {
+    layer_scheduler_->Run(start, end,
+        boost::bind(&Net<Dtype>::ForwardLayer, this, _1));
+    // Sum in order, so that the loss does not depend on the schedule.
+    for (int i = start; i <= end; ++i) {
+      loss += layer_losses_[i];
+    }
+    CheckConcatViews();
+    return loss;
+  }
   for (int i = start; i <= end; ++i) {
     // LOG(ERROR) << "Forwarding " << layer_names_[i];
+    if (profiler_) { profiler_->Begin(); }
     Dtype layer_loss = layers_[i]->Forward(bottom_vecs_[i], top_vecs_[i]);
+    if (profiler_) {
+      profiler_->End(i, NetProfiler::FORWARD, layers_[i].get(),
+                     bottom_vecs_[i], top_vecs_[i]);
+    }
     loss += layer_loss;
     if (debug_info_) { ForwardDebugInfo(i); }
   }
+  CheckConcatViews();
+  if (start == 0 && end == layers_.size() - 1) {
+    if (concat_memory_pending_) {
+      ShareConcatMemory();
+      concat_memory_pending_ = false;
+    }
+    if (activation_memory_pending_) {
+      ShareActivationMemory();
+      activation_memory_pending_ = false;
+    }
+    if (layer_scheduler_pending_) {
+      InitLayerScheduler();
+      layer_scheduler_pending_ = false;
+    }
+  }
   return loss;
 }
 
+template <typename Dtype>
+void Net<Dtype>::ForwardLayer(const int layer_id) {
+  layer_losses_[layer_id] =
+      layers_[layer_id]->Forward(bottom_vecs_[layer_id], top_vecs_[layer_id]);
+}
+
+template <typename Dtype>
+void Net<Dtype>::InitLayerScheduler() {
+  // Blobs sharing their data, e.g. the tops of Split or Flatten layers and
+  // their bottom, are one resource; some layers only share in Forward, hence
+  // this runs after the first one. A layer depends on the last layer writing
+  // each resource it uses, and on the layers reading one it writes since.
+  map<SyncedMemory*, int> resource_ids;
+  vector<int> blob_resource(blobs_.size());
+  int num_resources = 0;
+  for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    SyncedMemory* data = blobs_[blob_id]->count() > 0 ?
+        blobs_[blob_id]->data().get() : NULL;
+    map<SyncedMemory*, int>::const_iterator it = resource_ids.find(data);
+    if (data != NULL && it != resource_ids.end()) {
+      blob_resource[blob_id] = it->second;
+    } else {
+      if (data != NULL) {
+        resource_ids[data] = num_resources;
+      }
+      blob_resource[blob_id] = num_resources++;
+    }
+  }
+  vector<int> last_writer(num_resources, -1);
+  vector<vector<int> > readers(num_resources);
+  vector<vector<int> > predecessors(layers_.size());
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    set<int> layer_predecessors;
+    for (int i = 0; i < bottom_id_vecs_[layer_id].size(); ++i) {
+      const int resource = blob_resource[bottom_id_vecs_[layer_id][i]];
+      if (last_writer[resource] >= 0) {
+        layer_predecessors.insert(last_writer[resource]);
+      }
+      readers[resource].push_back(layer_id);
+    }
+    for (int i = 0; i < top_id_vecs_[layer_id].size(); ++i) {
+      const int resource = blob_resource[top_id_vecs_[layer_id][i]];
+      if (last_writer[resource] >= 0) {
+        layer_predecessors.insert(last_writer[resource]);
+      }
+      layer_predecessors.insert(readers[resource].begin(),
+                                readers[resource].end());
+      last_writer[resource] = layer_id;
+      readers[resource].clear();
+    }
+    layer_predecessors.erase(layer_id);
+    predecessors[layer_id].assign(layer_predecessors.begin(),
+                                  layer_predecessors.end());
+  }
+  layer_losses_.resize(layers_.size());
+  layer_scheduler_.reset(new LayerScheduler(predecessors, forward_threads_));
+}
+
 template <typename Dtype>
 Dtype Net<Dtype>::ForwardFrom(int start) {
   return ForwardFromTo(start, layers_.size() - 1);
@@ -583,8 +1045,13 @@ void Net<Dtype>::BackwardFromTo(int start, int end) {
   CHECK_LT(start, layers_.size());
   for (int i = start; i >= end; --i) {
     if (layer_need_backward_[i]) {
+      if (profiler_) { profiler_->Begin(); }
       layers_[i]->Backward(
           top_vecs_[i], bottom_need_backward_[i], bottom_vecs_[i]);
+      if (profiler_) {
+        profiler_->End(i, NetProfiler::BACKWARD, layers_[i].get(),
+                       bottom_vecs_[i], top_vecs_[i]);
+      }
       if (debug_info_) { BackwardDebugInfo(i); }
     }
   }
@@ -698,6 +1165,7 @@ void Net<Dtype>::ShareTrainedLayersWith(const Net* other) {
           << target_blobs[j]->shape_string();
       target_blobs[j]->ShareData(*source_blob);
     }
+    layers_[target_layer_id]->ParamsChanged();
   }
 }
 
@@ -772,6 +1240,7 @@ void Net<Dtype>::CopyTrainedLayersFrom(const NetParameter& param) {
       const bool kReshape = false;
       target_blobs[j]->FromProto(source_layer.blobs(j), kReshape);
     }
+    layers_[target_layer_id]->ParamsChanged();
   }
 }
 
@@ -837,6 +1306,7 @@ void Net<Dtype>::CopyTrainedLayersFromHDF5(const string trained_filename) {
       hdf5_load_nd_dataset(layer_hid, dataset_name.c_str(), 0, kMaxBlobAxes,
           target_blobs[j].get());
     }
+    layers_[target_layer_id]->ParamsChanged();
     H5Gclose(layer_hid);
   }
   H5Gclose(data_hid);
@@ -959,7 +1429,9 @@ const shared_ptr<Blob<Dtype> > Net<Dtype>::blob_by_name(
     const string& blob_name) const {
   shared_ptr<Blob<Dtype> > blob_ptr;
   if (has_blob(blob_name)) {
-    blob_ptr = blobs_[blob_names_index_.find(blob_name)->second];
+    const int blob_id = blob_names_index_.find(blob_name)->second;
+    ReleaseActivationMemory(blob_id);
+    blob_ptr = blobs_[blob_id];
   } else {
     blob_ptr.reset((Blob<Dtype>*)(NULL));
     LOG(WARNING) << "Unknown blob name " << blob_name;
@@ -134,13 +134,14 @@ class AnnotatedDataLayerTest : public MultiDeviceTest<TypeParam> {
     db->Close();
   }
 
-  void TestRead() {
+  void TestRead(int num_threads = 1) {
     LayerParameter param;
     param.set_phase(TRAIN);
     DataParameter* data_param = param.mutable_data_param();
     data_param->set_batch_size(num_);
     data_param->set_source(filename_->c_str());
     data_param->set_backend(backend_);
+    param.mutable_annotated_data_param()->set_num_threads(num_threads);
 
     const Dtype scale = 3;
     TransformationParameter* transform_param =
@@ -424,13 +425,14 @@ class AnnotatedDataLayerTest : public MultiDeviceTest<TypeParam> {
     }
   }
 
-  void TestReadCropTrainSequenceSeeded() {
+  void TestReadCropTrainSequenceSeeded(int num_threads = 1) {
     LayerParameter param;
     param.set_phase(TRAIN);
     DataParameter* data_param = param.mutable_data_param();
     data_param->set_batch_size(num_);
     data_param->set_source(filename_->c_str());
     data_param->set_backend(backend_);
+    param.mutable_annotated_data_param()->set_num_threads(num_threads);
 
     TransformationParameter* transform_param =
         param.mutable_transform_param();
@@ -645,6 +647,29 @@ TYPED_TEST(AnnotatedDataLayerTest, TestReadCropTestLevelDB) {
              use_rich_annotation, type);
   this->TestReadCrop(TEST);
 }
+
+TYPED_TEST(AnnotatedDataLayerTest, TestReadMultiThreadLevelDB) {
+  const bool unique_pixel = false;  // images different
+  const bool unique_annotation = true;  // anno different within a group
+  const bool use_rich_annotation = true;
+  AnnotatedDatum_AnnotationType type = AnnotatedDatum_AnnotationType_BBOX;
+  this->Fill(DataParameter_DB_LEVELDB, unique_pixel, unique_annotation,
+             use_rich_annotation, type);
+  this->TestRead(4);
+}
+
+// Test that the sequence of random crops is consistent when the items of a
+// batch are spread over several threads.
+TYPED_TEST(AnnotatedDataLayerTest,
+           TestReadCropTrainSequenceSeededMultiThreadLevelDB) {
+  const bool unique_pixel = true;  // all pixels the same; images different
+  const bool unique_annotation = false;  // all anno the same; groups different
+  const bool use_rich_annotation = false;
+  AnnotatedDatum_AnnotationType type = AnnotatedDatum_AnnotationType_BBOX;
+  this->Fill(DataParameter_DB_LEVELDB, unique_pixel, unique_annotation,
+             use_rich_annotation, type);
+  this->TestReadCropTrainSequenceSeeded(4);
+}
 #endif  // USE_LEVELDB
 
 #ifdef USE_LMDB
@@ -729,6 +754,28 @@ TYPED_TEST(AnnotatedDataLayerTest, TestReadCropTestLMDB) {
   this->TestReadCrop(TEST);
 }
 
+TYPED_TEST(AnnotatedDataLayerTest, TestReadMultiThreadLMDB) {
+  const bool unique_pixel = false;  // images different
+  const bool unique_annotation = true;  // anno different within a group
+  const bool use_rich_annotation = true;
+  AnnotatedDatum_AnnotationType type = AnnotatedDatum_AnnotationType_BBOX;
+  this->Fill(DataParameter_DB_LMDB, unique_pixel, unique_annotation,
+             use_rich_annotation, type);
+  this->TestRead(4);
+}
+
+// Test that the sequence of random crops is consistent when the items of a
+// batch are spread over several threads.
+TYPED_TEST(AnnotatedDataLayerTest,
+           TestReadCropTrainSequenceSeededMultiThreadLMDB) {
+  const bool unique_pixel = true;  // all pixels the same; images different
+  const bool unique_annotation = false;  // all anno the same; groups different
+  const bool use_rich_annotation = false;
+  AnnotatedDatum_AnnotationType type = AnnotatedDatum_AnnotationType_BBOX;
+  this->Fill(DataParameter_DB_LMDB, unique_pixel, unique_annotation,
+             use_rich_annotation, type);
+  this->TestReadCropTrainSequenceSeeded(4);
+}
 #endif  // USE_LMDB
 }  // namespace caffe
 #endif  // USE_OPENCV
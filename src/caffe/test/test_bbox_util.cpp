@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <map>
 #include <utility>
 #include <vector>
@@ -677,6 +678,75 @@ TEST_F(CPUBBoxUtilTest, TestMatchBBoxLableAllPerPredictionEx) {
   EXPECT_NEAR(match_overlaps[5], 0., eps);
 }
 
+TEST_F(CPUBBoxUtilTest, TestMatchBBoxFlat) {
+  const int num_gt = 30;
+  const int num_pred = 250;
+  vector<NormalizedBBox> gt_bboxes, pred_bboxes;
+  FlatBBoxes flat_gt_bboxes, flat_pred_bboxes;
+  flat_gt_bboxes.Resize(num_gt);
+  flat_pred_bboxes.Resize(num_pred);
+  vector<int> gt_labels(num_gt);
+  vector<float> coords((num_gt + num_pred) * 4);
+  caffe_rng_uniform<float>(coords.size(), 0., 1., &coords[0]);
+  for (int i = 0; i < num_gt + num_pred; ++i) {
+    NormalizedBBox bbox;
+    bbox.set_xmin(coords[i * 4]);
+    bbox.set_ymin(coords[i * 4 + 1]);
+    bbox.set_xmax(coords[i * 4] + coords[i * 4 + 2] * 0.4);
+    bbox.set_ymax(coords[i * 4 + 1] + coords[i * 4 + 3] * 0.4);
+    if (i > num_gt && i % 10 == 0) {
+      // Add duplicated predictions to check how ties are broken.
+      bbox = pred_bboxes[(i - num_gt) / 2];
+    }
+    bbox.set_size(BBoxSize(bbox));
+    FlatBBoxes* flat_bboxes = &flat_pred_bboxes;
+    int j = i - num_gt;
+    if (i < num_gt) {
+      bbox.set_label(1 + i % 3);
+      gt_labels[i] = bbox.label();
+      gt_bboxes.push_back(bbox);
+      flat_bboxes = &flat_gt_bboxes;
+      j = i;
+    } else {
+      pred_bboxes.push_back(bbox);
+    }
+    flat_bboxes->xmin[j] = bbox.xmin();
+    flat_bboxes->ymin[j] = bbox.ymin();
+    flat_bboxes->xmax[j] = bbox.xmax();
+    flat_bboxes->ymax[j] = bbox.ymax();
+    flat_bboxes->size[j] = bbox.size();
+  }
+
+  const MatchType match_types[2] = {
+      MultiBoxLossParameter_MatchType_BIPARTITE,
+      MultiBoxLossParameter_MatchType_PER_PREDICTION};
+  const NMSKernel kernels[2] = {NonMaximumSuppressionParameter_Kernel_SCALAR,
+                                NonMaximumSuppressionParameter_Kernel_AUTO};
+  for (int t = 0; t < 2; ++t) {
+    for (int label = -1; label <= 3; ++label) {
+      vector<int> match_indices, flat_match_indices;
+      vector<float> match_overlaps, flat_match_overlaps;
+      MatchBBox(gt_bboxes, pred_bboxes, label, match_types[t], 0.3,
+                &match_indices, &match_overlaps);
+      int num_matches = 0;
+      for (int i = 0; i < num_pred; ++i) {
+        num_matches += match_indices[i] != -1;
+      }
+      if (label != 0) {
+        EXPECT_GT(num_matches, 0);
+      }
+      for (int k = 0; k < 2; ++k) {
+        // The matches must be the same, and the overlaps bit exact.
+        MatchBBox(flat_gt_bboxes, gt_labels, flat_pred_bboxes, label,
+                  match_types[t], 0.3, &flat_match_indices,
+                  &flat_match_overlaps, kernels[k]);
+        EXPECT_TRUE(match_indices == flat_match_indices);
+        EXPECT_TRUE(match_overlaps == flat_match_overlaps);
+      }
+    }
+  }
+}
+
 TEST_F(CPUBBoxUtilTest, TestGetGroundTruth) {
   const int num_gt = 4;
   Blob<float> gt_blob(1, 1, num_gt, 8);
@@ -1022,6 +1092,29 @@ TEST_F(CPUBBoxUtilTest, TestGetMaxConfidenceScores) {
   }
 }
 
+TEST_F(CPUBBoxUtilTest, TestGetMaxConfidenceScoresFast) {
+  const int num_preds_per_class = 203;
+  const int num_classes = 21;
+  vector<float> conf_data(num_preds_per_class * num_classes);
+  caffe_rng_gaussian<float>(conf_data.size(), 0., 10., &conf_data[0]);
+  const ConfLossType loss_type = MultiBoxLossParameter_ConfLossType_SOFTMAX;
+  for (int background_label_id = -1; background_label_id <= 0;
+       ++background_label_id) {
+    vector<vector<float> > max_conf_scores;
+    GetMaxConfidenceScores(&conf_data[0], 1, num_preds_per_class, num_classes,
+                           background_label_id, loss_type, &max_conf_scores);
+    // The fused softmax must be close to the exact one.
+    vector<float> max_scores(num_preds_per_class);
+    GetMaxConfidenceScores(&conf_data[0], num_preds_per_class, num_classes,
+                           background_label_id, loss_type, true,
+                           &max_scores[0]);
+    for (int p = 0; p < num_preds_per_class; ++p) {
+      EXPECT_NEAR(max_conf_scores[0][p], max_scores[p],
+                  1e-6 * max_conf_scores[0][p]);
+    }
+  }
+}
+
 TEST_F(CPUBBoxUtilTest, TestGetPriorBBoxes) {
   const int num_channels = 2;
   const int num_priors = 2;
@@ -1203,6 +1296,273 @@ TEST_F(CPUBBoxUtilTest, TestApplyNMS) {
   }
 }
 
+TEST_F(CPUBBoxUtilTest, TestDecodeBBoxesFlat) {
+  const int num_priors = 50;
+  const int num_loc_classes = 2;
+  Blob<float> prior_blob(1, 2, num_priors * 4, 1);
+  Blob<float> loc_blob(1, num_priors * num_loc_classes * 4, 1, 1);
+  float* prior_data = prior_blob.mutable_cpu_data();
+  caffe_rng_uniform<float>(num_priors * 2, 0., 0.5, prior_data);
+  for (int i = 0; i < num_priors; ++i) {
+    prior_data[i * 4 + 2] = prior_data[i * 4] + 0.1 + 0.01 * (i % 10);
+    prior_data[i * 4 + 3] = prior_data[i * 4 + 1] + 0.1 + 0.02 * (i % 5);
+  }
+  caffe_set<float>(num_priors * 4, 0.1, prior_data + num_priors * 4);
+  caffe_rng_uniform<float>(loc_blob.count(), -1., 1.,
+                           loc_blob.mutable_cpu_data());
+  const float* loc_data = loc_blob.cpu_data();
+
+  vector<NormalizedBBox> prior_bboxes;
+  vector<vector<float> > prior_variances;
+  GetPriorBBoxes(prior_data, num_priors, &prior_bboxes, &prior_variances);
+  FlatBBoxes flat_prior_bboxes;
+  vector<float> flat_prior_variances;
+  GetPriorBBoxes(prior_data, num_priors, &flat_prior_bboxes,
+                 &flat_prior_variances);
+  EXPECT_EQ(flat_prior_bboxes.num(), num_priors);
+  EXPECT_EQ(flat_prior_variances.size(), num_priors * 4);
+
+  vector<LabelBBox> all_loc_preds;
+  GetLocPredictions(loc_data, 1, num_priors, num_loc_classes, false,
+                    &all_loc_preds);
+  const CodeType code_types[2] = {PriorBoxParameter_CodeType_CORNER,
+                                  PriorBoxParameter_CodeType_CENTER_SIZE};
+  for (int t = 0; t < 2; ++t) {
+    for (int c = 0; c < num_loc_classes; ++c) {
+      vector<NormalizedBBox> decode_bboxes;
+      DecodeBBoxes(prior_bboxes, prior_variances, code_types[t], false,
+                   all_loc_preds[0][c], &decode_bboxes);
+      FlatBBoxes flat_decode_bboxes;
+      DecodeBBoxes(loc_data, flat_prior_bboxes, flat_prior_variances,
+                   code_types[t], false, num_loc_classes, c,
+                   &flat_decode_bboxes);
+      EXPECT_EQ(flat_decode_bboxes.num(), num_priors);
+      // The flat decoder must be bit exact w.r.t. the NormalizedBBox one.
+      for (int i = 0; i < num_priors; ++i) {
+        EXPECT_EQ(decode_bboxes[i].xmin(), flat_decode_bboxes.xmin[i]);
+        EXPECT_EQ(decode_bboxes[i].ymin(), flat_decode_bboxes.ymin[i]);
+        EXPECT_EQ(decode_bboxes[i].xmax(), flat_decode_bboxes.xmax[i]);
+        EXPECT_EQ(decode_bboxes[i].ymax(), flat_decode_bboxes.ymax[i]);
+        EXPECT_EQ(decode_bboxes[i].size(), flat_decode_bboxes.size[i]);
+      }
+      for (int i = 0; i < num_priors; ++i) {
+        for (int j = 0; j < num_priors; ++j) {
+          EXPECT_EQ(JaccardOverlap(decode_bboxes[i], decode_bboxes[j]),
+                    JaccardOverlap(flat_decode_bboxes, i, j));
+        }
+      }
+    }
+  }
+}
+
+TEST_F(CPUBBoxUtilTest, TestGetCandidatePriors) {
+  const int num_priors = 4;
+  const int num_classes = 3;
+  // Class major scores, class 0 is the background.
+  const float conf_scores[num_classes * num_priors] = {
+      0.9, 0.9, 0.9, 0.9,
+      0.1, 0.6, 0.2, 0.1,
+      0.1, 0.1, 0.2, 0.7};
+  vector<int> indices;
+  GetCandidatePriors(conf_scores, num_priors, num_classes, 0, -1, 0.5,
+                     &indices);
+  ASSERT_EQ(indices.size(), 2);
+  EXPECT_EQ(indices[0], 1);
+  EXPECT_EQ(indices[1], 3);
+  GetCandidatePriors(conf_scores, num_priors, num_classes, 0, 2, 0.15,
+                     &indices);
+  ASSERT_EQ(indices.size(), 2);
+  EXPECT_EQ(indices[0], 2);
+  EXPECT_EQ(indices[1], 3);
+  GetCandidatePriors(conf_scores, num_priors, num_classes, 0, 1, 0.6,
+                     &indices);
+  EXPECT_EQ(indices.size(), 0);
+}
+
+TEST_F(CPUBBoxUtilTest, TestDecodeBBoxesFlatIndices) {
+  const int num_priors = 20;
+  Blob<float> prior_blob(1, 2, num_priors * 4, 1);
+  Blob<float> loc_blob(1, num_priors * 4, 1, 1);
+  float* prior_data = prior_blob.mutable_cpu_data();
+  caffe_rng_uniform<float>(num_priors * 2, 0., 0.5, prior_data);
+  for (int i = 0; i < num_priors; ++i) {
+    prior_data[i * 4 + 2] = prior_data[i * 4] + 0.2;
+    prior_data[i * 4 + 3] = prior_data[i * 4 + 1] + 0.3;
+  }
+  caffe_set<float>(num_priors * 4, 0.1, prior_data + num_priors * 4);
+  caffe_rng_uniform<float>(loc_blob.count(), -1., 1.,
+                           loc_blob.mutable_cpu_data());
+  const float* loc_data = loc_blob.cpu_data();
+  FlatBBoxes prior_bboxes;
+  vector<float> prior_variances;
+  GetPriorBBoxes(prior_data, num_priors, &prior_bboxes, &prior_variances);
+
+  FlatBBoxes decode_bboxes;
+  DecodeBBoxes(loc_data, prior_bboxes, prior_variances,
+               PriorBoxParameter_CodeType_CENTER_SIZE, false, 1, 0,
+               &decode_bboxes);
+  vector<int> indices;
+  for (int i = 1; i < num_priors; i += 3) {
+    indices.push_back(i);
+  }
+  FlatBBoxes lazy_bboxes;
+  DecodeBBoxes(loc_data, prior_bboxes, prior_variances,
+               PriorBoxParameter_CodeType_CENTER_SIZE, false, 1, 0, indices,
+               &lazy_bboxes);
+  EXPECT_EQ(lazy_bboxes.num(), num_priors);
+  for (int j = 0; j < indices.size(); ++j) {
+    const int i = indices[j];
+    EXPECT_EQ(decode_bboxes.xmin[i], lazy_bboxes.xmin[i]);
+    EXPECT_EQ(decode_bboxes.ymin[i], lazy_bboxes.ymin[i]);
+    EXPECT_EQ(decode_bboxes.xmax[i], lazy_bboxes.xmax[i]);
+    EXPECT_EQ(decode_bboxes.ymax[i], lazy_bboxes.ymax[i]);
+    EXPECT_EQ(decode_bboxes.size[i], lazy_bboxes.size[i]);
+  }
+}
+
+TEST_F(CPUBBoxUtilTest, TestApplyNMSFastFlat) {
+  const int num_bboxes = 200;
+  vector<NormalizedBBox> bboxes;
+  FlatBBoxes flat_bboxes;
+  flat_bboxes.Resize(num_bboxes);
+  vector<float> scores(num_bboxes);
+  vector<float> coords(num_bboxes * 4);
+  caffe_rng_uniform<float>(num_bboxes * 4, 0., 1., &coords[0]);
+  caffe_rng_uniform<float>(num_bboxes, 0., 1., &scores[0]);
+  for (int i = 0; i < num_bboxes; ++i) {
+    NormalizedBBox bbox;
+    bbox.set_xmin(std::min(coords[i * 4], coords[i * 4 + 2]));
+    bbox.set_ymin(std::min(coords[i * 4 + 1], coords[i * 4 + 3]));
+    bbox.set_xmax(std::max(coords[i * 4], coords[i * 4 + 2]));
+    bbox.set_ymax(std::max(coords[i * 4 + 1], coords[i * 4 + 3]));
+    bbox.set_size(BBoxSize(bbox));
+    bboxes.push_back(bbox);
+    flat_bboxes.xmin[i] = bbox.xmin();
+    flat_bboxes.ymin[i] = bbox.ymin();
+    flat_bboxes.xmax[i] = bbox.xmax();
+    flat_bboxes.ymax[i] = bbox.ymax();
+    flat_bboxes.size[i] = bbox.size();
+  }
+  // Make some ties in scores.
+  scores[10] = scores[20];
+  scores[30] = scores[40];
+
+  const float score_thresholds[2] = {-1., 0.3};
+  const float nms_thresholds[2] = {0.1, 0.45};
+  const int top_ks[2] = {-1, 50};
+  for (int s = 0; s < 2; ++s) {
+    for (int n = 0; n < 2; ++n) {
+      for (int k = 0; k < 2; ++k) {
+        vector<int> indices;
+        ApplyNMSFast(bboxes, scores, score_thresholds[s], nms_thresholds[n],
+                     top_ks[k], &indices);
+        vector<int> flat_indices;
+        ApplyNMSFast(flat_bboxes, &scores[0], score_thresholds[s],
+                     nms_thresholds[n], top_ks[k], &flat_indices);
+        EXPECT_GT(indices.size(), 0);
+        EXPECT_EQ(indices.size(), flat_indices.size());
+        for (int i = 0; i < indices.size(); ++i) {
+          EXPECT_EQ(indices[i], flat_indices[i]);
+        }
+      }
+    }
+  }
+}
+
+TEST_F(CPUBBoxUtilTest, TestNMSKernels) {
+  const int num_bboxes = 301;
+  vector<NormalizedBBox> bboxes;
+  FlatBBoxes flat_bboxes;
+  flat_bboxes.Resize(num_bboxes);
+  vector<float> scores(num_bboxes);
+  vector<float> coords(num_bboxes * 4);
+  caffe_rng_uniform<float>(num_bboxes * 4, 0., 1., &coords[0]);
+  caffe_rng_uniform<float>(num_bboxes, 0., 1., &scores[0]);
+  for (int i = 0; i < num_bboxes; ++i) {
+    NormalizedBBox bbox;
+    bbox.set_xmin(coords[i * 4]);
+    bbox.set_ymin(coords[i * 4 + 1]);
+    bbox.set_xmax(coords[i * 4] + coords[i * 4 + 2] * 0.3);
+    bbox.set_ymax(coords[i * 4 + 1] + coords[i * 4 + 3] * 0.3);
+    if (i % 50 == 0) {
+      // Add some small bboxes.
+      bbox.set_xmax(bbox.xmin());
+    }
+    bboxes.push_back(bbox);
+    flat_bboxes.xmin[i] = bbox.xmin();
+    flat_bboxes.ymin[i] = bbox.ymin();
+    flat_bboxes.xmax[i] = bbox.xmax();
+    flat_bboxes.ymax[i] = bbox.ymax();
+    flat_bboxes.size[i] = BBoxSize(bbox);
+  }
+
+  const NMSKernel kernels[3] = {NonMaximumSuppressionParameter_Kernel_AUTO,
+                                NonMaximumSuppressionParameter_Kernel_SSE,
+                                NonMaximumSuppressionParameter_Kernel_AVX2};
+  const NMSKernel scalar = NonMaximumSuppressionParameter_Kernel_SCALAR;
+  map<int, map<int, float> > overlaps;
+  for (int k = 0; k < 3; ++k) {
+    if (!NMSKernelSupported(kernels[k])) {
+      LOG(INFO) << "Skipping unsupported nms kernel "
+                << NonMaximumSuppressionParameter_Kernel_Name(kernels[k]);
+      continue;
+    }
+    // Overlaps must be bit exact w.r.t. JaccardOverlap().
+    vector<float> kernel_overlaps(num_bboxes);
+    for (int i = 0; i < num_bboxes; i += 7) {
+      JaccardOverlaps(flat_bboxes, i, flat_bboxes, 3, num_bboxes, kernels[k],
+                      &kernel_overlaps[0]);
+      for (int j = 3; j < num_bboxes; ++j) {
+        EXPECT_EQ(JaccardOverlap(bboxes[j], bboxes[i]),
+                  kernel_overlaps[j - 3]);
+      }
+    }
+    for (int t = 0; t < 3; ++t) {
+      const float nms_threshold = 0.1 + t * 0.2;
+      const int top_k = t == 1 ? 20 : -1;
+      vector<int> indices, kernel_indices;
+      ApplyNMS(bboxes, scores, nms_threshold, top_k, false, &overlaps,
+               &indices, scalar);
+      ApplyNMS(bboxes, scores, nms_threshold, top_k, false, &overlaps,
+               &kernel_indices, kernels[k]);
+      EXPECT_GT(indices.size(), 0);
+      EXPECT_TRUE(indices == kernel_indices);
+
+      ApplyNMSFast(bboxes, scores, 0.2, nms_threshold, top_k, &indices,
+                   scalar);
+      ApplyNMSFast(bboxes, scores, 0.2, nms_threshold, top_k,
+                   &kernel_indices, kernels[k]);
+      EXPECT_GT(indices.size(), 0);
+      EXPECT_TRUE(indices == kernel_indices);
+
+      ApplyNMSFast(flat_bboxes, &scores[0], 0.2, nms_threshold, top_k,
+                   &kernel_indices, kernels[k]);
+      EXPECT_TRUE(indices == kernel_indices);
+    }
+  }
+}
+
+TEST_F(CPUBBoxUtilTest, TestPartialSortScorePairDescend) {
+  const int num = 200;
+  vector<pair<float, int> > pairs;
+  for (int i = 0; i < num; ++i) {
+    // Use few distinct scores so that there are many ties.
+    pairs.push_back(std::make_pair((i * 7919 % 13) * 0.1f, i));
+  }
+  const int top_ks[] = {-1, 0, 1, 5, 13, num - 1, num, num + 3};
+  for (int k = 0; k < sizeof(top_ks) / sizeof(top_ks[0]); ++k) {
+    vector<pair<float, int> > expected = pairs;
+    std::stable_sort(expected.begin(), expected.end(),
+                     SortScorePairDescend<int>);
+    if (top_ks[k] > -1 && top_ks[k] < num) {
+      expected.resize(top_ks[k]);
+    }
+    vector<pair<float, int> > sorted = pairs;
+    PartialSortScorePairDescend(top_ks[k], &sorted);
+    EXPECT_TRUE(expected == sorted);
+  }
+}
+
 TEST_F(CPUBBoxUtilTest, TestCumSum) {
   vector<pair<float, int> > pairs;
   vector<int> cumsum;
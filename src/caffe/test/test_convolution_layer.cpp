@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cmath>
 #include <vector>
 
 #include "gtest/gtest.h"
@@ -5,7 +7,10 @@
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
+#include "caffe/layer_factory.hpp"
 #include "caffe/layers/conv_layer.hpp"
+#include "caffe/layers/winograd_conv_layer.hpp"
+#include "caffe/util/math_functions.hpp"
 
 #ifdef USE_CUDNN
 #include "caffe/layers/cudnn_conv_layer.hpp"
@@ -495,6 +500,66 @@ TYPED_TEST(ConvolutionLayerTest, TestSimpleConvolutionGroup) {
   }
 }
 
+TYPED_TEST(ConvolutionLayerTest, TestDepthwiseAgainstIm2col) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_h(3);
+  convolution_param->set_kernel_w(2);
+  convolution_param->set_stride_h(1);
+  convolution_param->set_stride_w(2);
+  convolution_param->set_pad_h(2);
+  convolution_param->set_pad_w(1);
+  convolution_param->add_dilation(2);
+  convolution_param->set_num_output(3);
+  convolution_param->set_group(3);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  ConvolutionLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  // The same convolution through im2col.
+  convolution_param->set_force_nd_im2col(true);
+  ConvolutionLayer<Dtype> im2col_layer(layer_param);
+  vector<Blob<Dtype>*> top_vec_2(1, this->blob_top_2_);
+  im2col_layer.SetUp(this->blob_bottom_vec_, top_vec_2);
+  for (int i = 0; i < 2; ++i) {
+    im2col_layer.blobs()[i]->CopyFrom(*layer.blobs()[i]);
+  }
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  im2col_layer.Forward(this->blob_bottom_vec_, top_vec_2);
+  ASSERT_EQ(this->blob_top_->count(), this->blob_top_2_->count());
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(this->blob_top_->cpu_data()[i],
+                this->blob_top_2_->cpu_data()[i], 1e-4);
+  }
+  // Backward with the same top diff, and weight diffs that accumulate.
+  caffe_copy(this->blob_top_->count(), this->blob_top_->cpu_data(),
+             this->blob_top_->mutable_cpu_diff());
+  caffe_copy(this->blob_top_->count(), this->blob_top_->cpu_data(),
+             this->blob_top_2_->mutable_cpu_diff());
+  for (int i = 0; i < 2; ++i) {
+    caffe_set(layer.blobs()[i]->count(), Dtype(1),
+              layer.blobs()[i]->mutable_cpu_diff());
+    caffe_set(im2col_layer.blobs()[i]->count(), Dtype(1),
+              im2col_layer.blobs()[i]->mutable_cpu_diff());
+  }
+  vector<bool> propagate_down(1, true);
+  layer.Backward(this->blob_top_vec_, propagate_down, this->blob_bottom_vec_);
+  this->blob_bottom_2_->CopyFrom(*this->blob_bottom_, true);
+  im2col_layer.Backward(top_vec_2, propagate_down, this->blob_bottom_vec_);
+  for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+    EXPECT_NEAR(this->blob_bottom_2_->cpu_diff()[i],
+                this->blob_bottom_->cpu_diff()[i], 1e-4);
+  }
+  for (int i = 0; i < 2; ++i) {
+    for (int j = 0; j < layer.blobs()[i]->count(); ++j) {
+      EXPECT_NEAR(layer.blobs()[i]->cpu_diff()[j],
+                  im2col_layer.blobs()[i]->cpu_diff()[j], 1e-4);
+    }
+  }
+}
+
 TYPED_TEST(ConvolutionLayerTest, TestSobelConvolution) {
   // Test separable convolution by computing the Sobel operator
   // as a single filter then comparing the result
@@ -811,6 +876,177 @@ TYPED_TEST(ConvolutionLayerTest, TestGradientGroup) {
       this->blob_top_vec_);
 }
 
+TYPED_TEST(ConvolutionLayerTest, TestGradientDepthwise) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_pad(2);
+  convolution_param->add_dilation(2);
+  convolution_param->set_num_output(3);
+  convolution_param->set_group(3);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  ConvolutionLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
+template <typename Dtype>
+class WinogradConvolutionLayerTest : public CPUDeviceTest<Dtype> {
+ protected:
+  WinogradConvolutionLayerTest()
+      : blob_bottom_(new Blob<Dtype>(2, 6, 11, 9)),
+        blob_top_(new Blob<Dtype>()),
+        ref_blob_top_(new Blob<Dtype>()) {}
+  virtual void SetUp() {
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_);
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_top_vec_.push_back(blob_top_);
+  }
+
+  virtual ~WinogradConvolutionLayerTest() {
+    delete blob_bottom_;
+    delete blob_top_;
+    delete ref_blob_top_;
+  }
+
+  // Check the layer output against the reference convolution.
+  void CheckForward(Layer<Dtype>* layer, ConvolutionParameter* conv_param) {
+    layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    this->ref_blob_top_->ReshapeLike(*this->blob_top_);
+    caffe_set(this->ref_blob_top_->count(), Dtype(0),
+        this->ref_blob_top_->mutable_cpu_data());
+    caffe_conv(this->blob_bottom_, conv_param, layer->blobs(),
+        this->ref_blob_top_);
+    const Dtype* top_data = this->blob_top_->cpu_data();
+    const Dtype* ref_top_data = this->ref_blob_top_->cpu_data();
+    for (int i = 0; i < this->blob_top_->count(); ++i) {
+      EXPECT_NEAR(top_data[i], ref_top_data[i],
+          1e-4 * std::max(Dtype(10), std::fabs(ref_top_data[i])));
+    }
+  }
+
+  Blob<Dtype>* const blob_bottom_;
+  Blob<Dtype>* const blob_top_;
+  Blob<Dtype>* const ref_blob_top_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(WinogradConvolutionLayerTest, TestDtypes);
+
+TYPED_TEST(WinogradConvolutionLayerTest, TestEngine) {
+  LayerParameter layer_param;
+  layer_param.set_type("Convolution");
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->set_num_output(4);
+  convolution_param->set_engine(ConvolutionParameter_Engine_WINOGRAD);
+  shared_ptr<Layer<TypeParam> > layer =
+      LayerRegistry<TypeParam>::CreateLayer(layer_param);
+  EXPECT_TRUE(dynamic_cast<WinogradConvolutionLayer<TypeParam>*>(
+      layer.get()) != NULL);
+}
+
+TYPED_TEST(WinogradConvolutionLayerTest, TestConvolution) {
+  // Both tile sizes, with and without padding and groups, on a bottom whose
+  // output is not a multiple of either tile size.
+  for (int tile = 2; tile <= 4; tile += 2) {
+    for (int pad = 0; pad <= 1; ++pad) {
+      for (int group = 1; group <= 3; group += 2) {
+        LayerParameter layer_param;
+        ConvolutionParameter* convolution_param =
+            layer_param.mutable_convolution_param();
+        convolution_param->add_kernel_size(3);
+        convolution_param->add_pad(pad);
+        convolution_param->set_num_output(6);
+        convolution_param->set_group(group);
+        convolution_param->set_winograd_tile(tile);
+        convolution_param->mutable_weight_filler()->set_type("gaussian");
+        convolution_param->mutable_bias_filler()->set_type("gaussian");
+        shared_ptr<Layer<TypeParam> > layer(
+            new WinogradConvolutionLayer<TypeParam>(layer_param));
+        layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+        this->CheckForward(layer.get(), convolution_param);
+      }
+    }
+  }
+}
+
+TYPED_TEST(WinogradConvolutionLayerTest, TestWeightUpdate) {
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_pad(1);
+  convolution_param->set_num_output(5);
+  convolution_param->set_bias_term(false);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  const Phase phases[] = {TRAIN, TEST};
+  for (int i = 0; i < 2; ++i) {
+    layer_param.set_phase(phases[i]);
+    shared_ptr<Layer<TypeParam> > layer(
+        new WinogradConvolutionLayer<TypeParam>(layer_param));
+    layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    this->CheckForward(layer.get(), convolution_param);
+    // The transformed filters follow the weights, which a TEST layer is told
+    // about.
+    Blob<TypeParam>* weights = layer->blobs()[0].get();
+    caffe_scal(weights->count(), TypeParam(-2), weights->mutable_cpu_data());
+    weights->mutable_cpu_data()[weights->count() - 1] = 1;
+    if (phases[i] == TEST) {
+      layer->ParamsChanged();
+    }
+    this->CheckForward(layer.get(), convolution_param);
+  }
+}
+
+TYPED_TEST(WinogradConvolutionLayerTest, TestFallback) {
+  // Strided and 5x5 convolutions use im2col.
+  for (int kernel = 3; kernel <= 5; kernel += 2) {
+    LayerParameter layer_param;
+    ConvolutionParameter* convolution_param =
+        layer_param.mutable_convolution_param();
+    convolution_param->add_kernel_size(kernel);
+    convolution_param->add_stride(5 - kernel + 1);
+    convolution_param->set_num_output(4);
+    convolution_param->mutable_weight_filler()->set_type("gaussian");
+    convolution_param->mutable_bias_filler()->set_type("gaussian");
+    shared_ptr<Layer<TypeParam> > layer(
+        new WinogradConvolutionLayer<TypeParam>(layer_param));
+    layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    this->CheckForward(layer.get(), convolution_param);
+  }
+}
+
+TYPED_TEST(WinogradConvolutionLayerTest, TestGradient) {
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_pad(1);
+  convolution_param->set_num_output(2);
+  // The more precise tiles keep the rounding of the forward pass below the
+  // accuracy of the estimated gradient.
+  convolution_param->set_winograd_tile(2);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  this->blob_bottom_->Reshape(2, 3, 5, 4);
+  FillerParameter filler_param;
+  GaussianFiller<TypeParam> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  WinogradConvolutionLayer<TypeParam> layer(layer_param);
+  GradientChecker<TypeParam> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
 #ifdef USE_CUDNN
 
 template <typename Dtype>
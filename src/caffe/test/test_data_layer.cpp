@@ -40,13 +40,14 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
   // Fill the DB with data: if unique_pixels, each pixel is unique but
   // all images are the same; else each image is unique but all pixels within
   // an image are the same.
-  void Fill(const bool unique_pixels, DataParameter_DB backend) {
+  void Fill(const bool unique_pixels, DataParameter_DB backend,
+            const int num_records = 5) {
     backend_ = backend;
     LOG(INFO) << "Using temporary dataset " << *filename_;
     scoped_ptr<db::DB> db(db::GetDB(backend));
     db->Open(*filename_, db::NEW);
     scoped_ptr<db::Transaction> txn(db->NewTransaction());
-    for (int i = 0; i < 5; ++i) {
+    for (int i = 0; i < num_records; ++i) {
       Datum datum;
       datum.set_label(i);
       datum.set_channels(2);
@@ -67,7 +68,40 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     db->Close();
   }
 
-  void TestRead() {
+  // Deterministic shards are read from in turn, which gives the records in
+  // database order, pass after pass, even when num_shards does not divide
+  // num_records.
+  void TestReadSharded(const int num_records, const int num_shards) {
+    LayerParameter param;
+    param.set_phase(TRAIN);
+    DataParameter* data_param = param.mutable_data_param();
+    data_param->set_batch_size(5);
+    data_param->set_source(filename_->c_str());
+    data_param->set_backend(backend_);
+    data_param->set_num_shards(num_shards);
+    data_param->set_deterministic_shards(true);
+
+    DataLayer<Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec_, blob_top_vec_);
+    vector<int> counts(num_records, 0);
+    int position = 0;
+    for (int iter = 0; iter < 20; ++iter) {
+      layer.Forward(blob_bottom_vec_, blob_top_vec_);
+      for (int i = 0; i < 5; ++i, ++position) {
+        const int label = blob_top_label_->cpu_data()[i];
+        EXPECT_EQ(position % num_records, label)
+            << "debug: iter " << iter << " i " << i;
+        if (label >= 0 && label < num_records) {
+          ++counts[label];
+        }
+      }
+    }
+    for (int i = 0; i < num_records; ++i) {
+      EXPECT_EQ(position / num_records, counts[i]) << "debug: record " << i;
+    }
+  }
+
+  void TestRead(int num_shards = 1) {
     const Dtype scale = 3;
     LayerParameter param;
     param.set_phase(TRAIN);
@@ -75,6 +109,7 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     data_param->set_batch_size(5);
     data_param->set_source(filename_->c_str());
     data_param->set_backend(backend_);
+    data_param->set_num_shards(num_shards);
 
     TransformationParameter* transform_param =
         param.mutable_transform_param();
@@ -356,6 +391,20 @@ TYPED_TEST(DataLayerTest, TestReadLevelDB) {
   this->TestRead();
 }
 
+// With one shard per record, deterministic shards read in database order.
+TYPED_TEST(DataLayerTest, TestReadShardedLevelDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_LEVELDB);
+  this->TestRead(5);
+}
+
+// 3 shards over 10 records, so that each pass starts on another shard.
+TYPED_TEST(DataLayerTest, TestReadShardOrderLevelDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_LEVELDB, 10);
+  this->TestReadSharded(10, 3);
+}
+
 TYPED_TEST(DataLayerTest, TestReshapeLevelDB) {
   this->TestReshape(DataParameter_DB_LEVELDB);
 }
@@ -396,6 +445,20 @@ TYPED_TEST(DataLayerTest, TestReadLMDB) {
   this->TestRead();
 }
 
+// With one shard per record, deterministic shards read in database order.
+TYPED_TEST(DataLayerTest, TestReadShardedLMDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_LMDB);
+  this->TestRead(5);
+}
+
+// 3 shards over 10 records, so that each pass starts on another shard.
+TYPED_TEST(DataLayerTest, TestReadShardOrderLMDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_LMDB, 10);
+  this->TestReadSharded(10, 3);
+}
+
 TYPED_TEST(DataLayerTest, TestReshapeLMDB) {
   this->TestReshape(DataParameter_DB_LMDB);
 }
@@ -312,6 +312,46 @@ TYPED_TEST(DataTransformTest, TestMeanValues) {
   }
 }
 
+TYPED_TEST(DataTransformTest, TestMatMirrorMeanValues) {
+  TransformationParameter transform_param;
+  const int channels = 3;
+  // Wide enough to cover both full SIMD blocks and leftover pixels.
+  const int width = 37;
+  const TypeParam scale = 0.5;
+
+  transform_param.set_mirror(true);
+  transform_param.set_scale(scale);
+  for (int c = 0; c < channels; ++c) {
+    transform_param.add_mean_value(c + 1);
+  }
+  cv::Mat cv_img(this->height_, width, CV_8UC3);
+  for (int h = 0; h < this->height_; ++h) {
+    uchar* ptr = cv_img.ptr<uchar>(h);
+    for (int j = 0; j < width * channels; ++j) {
+      ptr[j] = static_cast<uchar>(h * width * channels + j);
+    }
+  }
+  Blob<TypeParam> blob(1, channels, this->height_, width);
+  DataTransformer<TypeParam> transformer(transform_param, TRAIN);
+  transformer.InitRand();
+  for (int iter = 0; iter < this->num_iter_; ++iter) {
+    NormalizedBBox crop_bbox;
+    bool do_mirror;
+    transformer.Transform(cv_img, &blob, &crop_bbox, &do_mirror);
+    for (int c = 0; c < channels; ++c) {
+      for (int h = 0; h < this->height_; ++h) {
+        const uchar* ptr = cv_img.ptr<uchar>(h);
+        for (int w = 0; w < width; ++w) {
+          const int w_idx = do_mirror ? width - 1 - w : w;
+          EXPECT_EQ(blob.data_at(0, c, h, w_idx),
+                    (static_cast<TypeParam>(ptr[w * channels + c]) - (c + 1))
+                    * scale);
+        }
+      }
+    }
+  }
+}
+
 TYPED_TEST(DataTransformTest, TestMeanFile) {
   TransformationParameter transform_param;
   const bool unique_pixels = true;  // pixels are consecutive ints [0,size]
@@ -455,5 +495,52 @@ TYPED_TEST(DataTransformTest, TestRichLabelCropMirror) {
   }
 }
 
+TYPED_TEST(DataTransformTest, TestRichLabelCropAndTransform) {
+  TransformationParameter transform_param;
+  const bool unique_pixels = true;  // pixels are consecutive ints [0,size]
+  const int label = 0;
+  const bool use_rich_annotation = true;
+  AnnotatedDatum_AnnotationType type = AnnotatedDatum_AnnotationType_BBOX;
+  const int crop_size = 2;
+
+  AnnotatedDatum anno_datum;
+  this->FillAnnotatedDatum(label, unique_pixels, use_rich_annotation, type,
+                           &anno_datum);
+  NormalizedBBox crop_bbox;
+  crop_bbox.set_xmin(0.1);
+  crop_bbox.set_ymin(0.2);
+  crop_bbox.set_xmax(0.7);
+  crop_bbox.set_ymax(0.9);
+
+  transform_param.set_crop_size(crop_size);
+  transform_param.set_mirror(true);
+  DataTransformer<TypeParam> transformer(transform_param, TRAIN);
+  DataTransformer<TypeParam> crop_transformer(transform_param, TRAIN);
+  Caffe::set_random_seed(this->seed_);
+  transformer.InitRand();
+  Caffe::set_random_seed(this->seed_);
+  crop_transformer.InitRand();
+  Blob<TypeParam> blob(1, this->channels_, crop_size, crop_size);
+  Blob<TypeParam> crop_blob(1, this->channels_, crop_size, crop_size);
+  // Cropping and transforming in one go must match cropping a copy first.
+  for (int iter = 0; iter < this->num_iter_; ++iter) {
+    AnnotatedDatum cropped_anno_datum;
+    transformer.CropImage(anno_datum, crop_bbox, &cropped_anno_datum);
+    vector<AnnotationGroup> transformed_anno_vec;
+    transformer.Transform(cropped_anno_datum, &blob, &transformed_anno_vec);
+    vector<AnnotationGroup> crop_transformed_anno_vec;
+    crop_transformer.CropAndTransform(anno_datum, crop_bbox, &crop_blob,
+                                      &crop_transformed_anno_vec);
+    for (int j = 0; j < blob.count(); ++j) {
+      EXPECT_EQ(blob.cpu_data()[j], crop_blob.cpu_data()[j]);
+    }
+    ASSERT_EQ(transformed_anno_vec.size(), crop_transformed_anno_vec.size());
+    for (int g = 0; g < transformed_anno_vec.size(); ++g) {
+      EXPECT_EQ(transformed_anno_vec[g].SerializeAsString(),
+                crop_transformed_anno_vec[g].SerializeAsString());
+    }
+  }
+}
+
 }  // namespace caffe
 #endif  // USE_OPENCV
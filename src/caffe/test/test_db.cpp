@@ -117,6 +117,21 @@ TYPED_TEST(DBTest, TestKeyValue) {
   EXPECT_FALSE(cursor->valid());
 }
 
+TYPED_TEST(DBTest, TestValueData) {
+  scoped_ptr<db::DB> db(db::GetDB(TypeParam::backend));
+  db->Open(this->source_, db::READ);
+  scoped_ptr<db::Cursor> cursor(db->NewCursor());
+  for (; cursor->valid(); cursor->Next()) {
+    const char* data;
+    size_t size;
+    cursor->value_data(&data, &size);
+    EXPECT_EQ(string(data, size), cursor->value());
+    Datum datum;
+    EXPECT_TRUE(datum.ParseFromArray(data, size));
+    EXPECT_EQ(datum.channels(), 3);
+  }
+}
+
 TYPED_TEST(DBTest, TestWrite) {
   scoped_ptr<db::DB> db(db::GetDB(TypeParam::backend));
   db->Open(this->source_, db::WRITE);
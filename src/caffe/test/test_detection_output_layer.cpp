@@ -336,4 +336,35 @@ TYPED_TEST(DetectionOutputLayerTest, TestForwardNoShareLocationNeg0TopK) {
   this->CheckEqual(*(this->blob_top_), 2, "1 1 0.6 0.40 0.40 0.70 0.70");
 }
 
+TYPED_TEST(DetectionOutputLayerTest, TestForwardNoShareLocationMultiThread) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  DetectionOutputParameter* detection_output_param =
+      layer_param.mutable_detection_output_param();
+  detection_output_param->set_num_classes(this->num_classes_);
+  detection_output_param->set_share_location(false);
+  detection_output_param->set_background_label_id(-1);
+  detection_output_param->mutable_nms_param()->set_nms_threshold(
+      this->nms_threshold_);
+  detection_output_param->mutable_nms_param()->set_top_k(this->top_k_);
+  detection_output_param->set_num_threads(3);
+  DetectionOutputLayer<Dtype> layer(layer_param);
+
+  this->FillLocData(false);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+
+  EXPECT_EQ(this->blob_top_->num(), 1);
+  EXPECT_EQ(this->blob_top_->channels(), 1);
+  EXPECT_EQ(this->blob_top_->height(), 6);
+  EXPECT_EQ(this->blob_top_->width(), 7);
+
+  this->CheckEqual(*(this->blob_top_), 0, "0 0 0.6 0.55 0.55 0.85 0.85");
+  this->CheckEqual(*(this->blob_top_), 1, "0 0 0.4 0.15 0.55 0.45 0.85");
+  this->CheckEqual(*(this->blob_top_), 2, "0 1 1.0 0.20 0.20 0.50 0.50");
+  this->CheckEqual(*(this->blob_top_), 3, "0 1 0.8 0.50 0.20 0.80 0.50");
+  this->CheckEqual(*(this->blob_top_), 4, "1 0 1.0 0.25 0.25 0.55 0.55");
+  this->CheckEqual(*(this->blob_top_), 5, "1 1 0.6 0.40 0.40 0.70 0.70");
+}
+
 }  // namespace caffe
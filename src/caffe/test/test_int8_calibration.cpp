@@ -0,0 +1,246 @@
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/net.hpp"
+#include "caffe/util/int8_calibration.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/math_functions.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class Int8CalibrationTest : public CPUDeviceTest<float> {
+ protected:
+  Int8CalibrationTest() : seed_(1701) {}
+
+  // A tiny SSD over an 8x8 image of noise with three bright pixels, the
+  // objects: one 2x2 prior per pixel, located exactly (the loc convolution
+  // is zero), and object scores growing with the brightness of the pixel.
+  // The image and the ground truth are held by Parameter layers.
+  virtual void SetUp() {
+    const string proto =
+        "name: 'TinySSD' "
+        "layer { "
+        "  name: 'data' "
+        "  type: 'Parameter' "
+        "  top: 'data' "
+        "  parameter_param { shape { dim: 1 dim: 3 dim: 8 dim: 8 } } "
+        "} "
+        "layer { "
+        "  name: 'label' "
+        "  type: 'Parameter' "
+        "  top: 'label' "
+        "  parameter_param { shape { dim: 1 dim: 1 dim: 3 dim: 8 } } "
+        "} "
+        "layer { "
+        "  name: 'conv1' "
+        "  type: 'Convolution' "
+        "  bottom: 'data' "
+        "  top: 'conv1' "
+        "  convolution_param { "
+        "    num_output: 8 "
+        "    kernel_size: 3 "
+        "    pad: 1 "
+        "    weight_filler { type: 'gaussian' std: 0.1 } "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'relu1' "
+        "  type: 'ReLU' "
+        "  bottom: 'conv1' "
+        "  top: 'conv1' "
+        "} "
+        "layer { "
+        "  name: 'loc' "
+        "  type: 'Convolution' "
+        "  bottom: 'conv1' "
+        "  top: 'loc' "
+        "  convolution_param { num_output: 4 kernel_size: 1 } "
+        "} "
+        "layer { "
+        "  name: 'loc_perm' "
+        "  type: 'Permute' "
+        "  bottom: 'loc' "
+        "  top: 'loc_perm' "
+        "  permute_param { order: 0 order: 2 order: 3 order: 1 } "
+        "} "
+        "layer { "
+        "  name: 'loc_flat' "
+        "  type: 'Flatten' "
+        "  bottom: 'loc_perm' "
+        "  top: 'loc_flat' "
+        "} "
+        "layer { "
+        "  name: 'conf' "
+        "  type: 'Convolution' "
+        "  bottom: 'conv1' "
+        "  top: 'conf' "
+        "  convolution_param { num_output: 2 kernel_size: 1 } "
+        "} "
+        "layer { "
+        "  name: 'conf_perm' "
+        "  type: 'Permute' "
+        "  bottom: 'conf' "
+        "  top: 'conf_perm' "
+        "  permute_param { order: 0 order: 2 order: 3 order: 1 } "
+        "} "
+        "layer { "
+        "  name: 'conf_reshape' "
+        "  type: 'Reshape' "
+        "  bottom: 'conf_perm' "
+        "  top: 'conf_reshape' "
+        "  reshape_param { shape { dim: 0 dim: -1 dim: 2 } } "
+        "} "
+        "layer { "
+        "  name: 'conf_softmax' "
+        "  type: 'Softmax' "
+        "  bottom: 'conf_reshape' "
+        "  top: 'conf_softmax' "
+        "  softmax_param { axis: 2 } "
+        "} "
+        "layer { "
+        "  name: 'conf_flat' "
+        "  type: 'Flatten' "
+        "  bottom: 'conf_softmax' "
+        "  top: 'conf_flat' "
+        "} "
+        "layer { "
+        "  name: 'priorbox' "
+        "  type: 'PriorBox' "
+        "  bottom: 'conv1' "
+        "  bottom: 'data' "
+        "  top: 'priorbox' "
+        "  prior_box_param { "
+        "    min_size: 2 "
+        "    variance: 0.1 variance: 0.1 variance: 0.2 variance: 0.2 "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'detection_out' "
+        "  type: 'DetectionOutput' "
+        "  bottom: 'loc_flat' "
+        "  bottom: 'conf_flat' "
+        "  bottom: 'priorbox' "
+        "  top: 'detection_out' "
+        "  detection_output_param { "
+        "    num_classes: 2 "
+        "    share_location: true "
+        "    background_label_id: 0 "
+        "    nms_param { nms_threshold: 0.45 top_k: 64 } "
+        "    keep_top_k: 32 "
+        "    code_type: CENTER_SIZE "
+        "    confidence_threshold: 0.01 "
+        "  } "
+        "} "
+        "layer { "
+        "  name: 'detection_eval' "
+        "  type: 'DetectionEvaluate' "
+        "  bottom: 'detection_out' "
+        "  bottom: 'label' "
+        "  top: 'detection_eval' "
+        "  detection_evaluate_param { "
+        "    num_classes: 2 "
+        "    background_label_id: 0 "
+        "    overlap_threshold: 0.5 "
+        "  } "
+        "} ";
+    CHECK(google::protobuf::TextFormat::ParseFromString(proto, &net_param_));
+    net_param_.mutable_state()->set_phase(TEST);
+
+    Caffe::set_random_seed(seed_);
+    Net<float> net(net_param_);
+    Blob<float>& data = *net.layer_by_name("data")->blobs()[0];
+    FillerParameter filler_param;
+    filler_param.set_std(0.5);
+    GaussianFiller<float> filler(filler_param);
+    filler.Fill(&data);
+    // Each channel of conv1 mostly passes a channel of the data on, and the
+    // object score is the sum of the channels.
+    Blob<float>& conv1 = *net.layer_by_name("conv1")->blobs()[0];
+    for (int i = 0; i < conv1.num(); ++i) {
+      conv1.mutable_cpu_data()[conv1.offset(i, i % 3, 1, 1)] += 1;
+    }
+    Blob<float>& conf = *net.layer_by_name("conf")->blobs()[0];
+    caffe_set(conf.count(1), 1.f, conf.mutable_cpu_data() + conf.offset(1));
+    float* label = net.layer_by_name("label")->blobs()[0]->mutable_cpu_data();
+    const int priors[3][2] = {{1, 1}, {4, 2}, {6, 5}};
+    for (int i = 0; i < 3; ++i) {
+      for (int c = 0; c < 3; ++c) {
+        data.mutable_cpu_data()[data.offset(0, c, priors[i][1],
+                                            priors[i][0])] += 3;
+      }
+      const float x = (priors[i][0] + 0.5) / 8;
+      const float y = (priors[i][1] + 0.5) / 8;
+      const float gt[8] = {0, 1, i, x - 0.125f, y - 0.125f, x + 0.125f,
+                           y + 0.125f, 0};
+      std::copy(gt, gt + 8, label + i * 8);
+    }
+    NetParameter weights;
+    net.ToProto(&weights);
+    MakeTempFilename(&weights_filename_);
+    WriteProtoToBinaryFile(weights, weights_filename_);
+  }
+
+  // The FP32 and INT8 mAP over the same images.
+  void TestMAP(const NetParameter& int8_param, float* map, float* int8_map) {
+    vector<string> output_names;
+    vector<bool> is_map;
+    vector<float> scores = TestNetOutputs(net_param_, weights_filename_,
+        kIterations, "Integral", &output_names, &is_map);
+    ASSERT_EQ(1, scores.size());
+    EXPECT_EQ("detection_eval", output_names[0]);
+    EXPECT_TRUE(is_map[0]);
+    *map = scores[0];
+    scores = TestNetOutputs(int8_param, weights_filename_, kIterations,
+        "Integral", &output_names, &is_map);
+    *int8_map = scores[0];
+  }
+
+  static const int kIterations = 4;
+  int seed_;
+  NetParameter net_param_;
+  string weights_filename_;
+};
+
+TEST_F(Int8CalibrationTest, TestCalibrate) {
+  NetParameter int8_param;
+  CalibrateInt8(net_param_, weights_filename_, kIterations, &int8_param);
+  ASSERT_EQ(net_param_.layer_size(), int8_param.layer_size());
+  for (int i = 0; i < int8_param.layer_size(); ++i) {
+    const LayerParameter& layer_param = int8_param.layer(i);
+    EXPECT_EQ(layer_param.type() == "Convolution",
+              layer_param.quantization_param().has_bottom_max())
+        << layer_param.name();
+  }
+  EXPECT_GT(int8_param.layer(2).quantization_param().bottom_max(), 1);
+
+  float map, int8_map;
+  TestMAP(int8_param, &map, &int8_map);
+  EXPECT_GT(map, 0.9);
+  EXPECT_LE(map - int8_map, 0.02);
+  EXPECT_TRUE(CheckInt8Accuracy(net_param_, int8_param, weights_filename_,
+      kIterations, "Integral", 0.02));
+}
+
+TEST_F(Int8CalibrationTest, TestCheckAccuracyFails) {
+  // Clip the bottom of conf far below its range, which ties the scores.
+  NetParameter int8_param;
+  CalibrateInt8(net_param_, weights_filename_, kIterations, &int8_param);
+  ASSERT_EQ("conf", int8_param.layer(7).name());
+  int8_param.mutable_layer(7)->mutable_quantization_param()->set_bottom_max(
+      0.01);
+  float map, int8_map;
+  TestMAP(int8_param, &map, &int8_map);
+  ASSERT_GT(map - int8_map, 0.02);
+  EXPECT_FALSE(CheckInt8Accuracy(net_param_, int8_param, weights_filename_,
+      kIterations, "Integral", 0.02));
+}
+
+}  // namespace caffe
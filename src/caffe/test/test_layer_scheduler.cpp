@@ -0,0 +1,89 @@
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/util/layer_scheduler.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+// Record the order in which the layers run.
+static void RecordLayer(boost::mutex* mutex, vector<int>* order,
+    int layer_id) {
+  boost::mutex::scoped_lock lock(*mutex);
+  order->push_back(layer_id);
+}
+
+class LayerSchedulerTest : public ::testing::Test {
+ protected:
+  // A diamond 0 -> {1, 2, 3} -> 4, then a chain 4 -> 5 -> 6, and 7 alone.
+  LayerSchedulerTest() : predecessors_(8) {
+    predecessors_[1].push_back(0);
+    predecessors_[2].push_back(0);
+    predecessors_[3].push_back(0);
+    predecessors_[4].push_back(1);
+    predecessors_[4].push_back(2);
+    predecessors_[4].push_back(3);
+    predecessors_[5].push_back(4);
+    predecessors_[6].push_back(5);
+  }
+
+  boost::function<void(int)> record_layer() {
+    return boost::bind(&RecordLayer, &mutex_, &order_, _1);
+  }
+
+  // Each layer of the range ran once, after its predecessors in the range.
+  void CheckOrder(int start, int end) {
+    ASSERT_EQ(end - start + 1, order_.size());
+    vector<int> position(predecessors_.size(), -1);
+    for (int i = 0; i < order_.size(); ++i) {
+      ASSERT_GE(order_[i], start);
+      ASSERT_LE(order_[i], end);
+      EXPECT_EQ(-1, position[order_[i]]);
+      position[order_[i]] = i;
+    }
+    for (int i = start; i <= end; ++i) {
+      for (int j = 0; j < predecessors_[i].size(); ++j) {
+        if (predecessors_[i][j] >= start) {
+          EXPECT_LT(position[predecessors_[i][j]], position[i]);
+        }
+      }
+    }
+    order_.clear();
+  }
+
+  vector<vector<int> > predecessors_;
+  boost::mutex mutex_;
+  vector<int> order_;
+};
+
+TEST_F(LayerSchedulerTest, TestSingleThreadInOrder) {
+  LayerScheduler scheduler(predecessors_, 1);
+  scheduler.Run(0, 7, record_layer());
+  for (int i = 0; i < 8; ++i) {
+    EXPECT_EQ(i, order_[i]);
+  }
+}
+
+TEST_F(LayerSchedulerTest, TestDependencies) {
+  LayerScheduler scheduler(predecessors_, 4);
+  EXPECT_EQ(4, scheduler.num_threads());
+  for (int k = 0; k < 100; ++k) {
+    scheduler.Run(0, 7, record_layer());
+    CheckOrder(0, 7);
+  }
+}
+
+TEST_F(LayerSchedulerTest, TestRange) {
+  LayerScheduler scheduler(predecessors_, 4);
+  const int ranges[][2] = {{2, 5}, {4, 4}, {5, 7}, {1, 3}};
+  for (int k = 0; k < 4; ++k) {
+    scheduler.Run(ranges[k][0], ranges[k][1], record_layer());
+    CheckOrder(ranges[k][0], ranges[k][1]);
+  }
+}
+
+}  // namespace caffe
@@ -441,4 +441,60 @@ TYPED_TEST(MultiBoxLossLayerTest, TestConfGradient) {
   }
 }
 
+TYPED_TEST(MultiBoxLossLayerTest, TestForwardBackwardMultiThread) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  layer_param.add_propagate_down(true);
+  layer_param.add_propagate_down(true);
+  vector<bool> propagate_down(4, false);
+  propagate_down[0] = true;
+  propagate_down[1] = true;
+  MultiBoxLossParameter* multibox_loss_param =
+      layer_param.mutable_multibox_loss_param();
+  multibox_loss_param->set_num_classes(this->num_classes_);
+  for (int i = 0; i < 2; ++i) {
+    bool share_location = kBoolChoices[i];
+    this->Fill(share_location);
+    for (int j = 0; j < 2; ++j) {
+      MultiBoxLossParameter_MatchType match_type = kMatchTypes[j];
+      for (int k = 0; k < 2; ++k) {
+        bool use_prior = kBoolChoices[k];
+        for (int m = 0; m < 2; ++m) {
+          bool do_neg_mining = kBoolChoices[m];
+          if (!share_location && do_neg_mining) {
+            continue;
+          }
+          multibox_loss_param->set_share_location(share_location);
+          multibox_loss_param->set_match_type(match_type);
+          multibox_loss_param->set_use_prior_for_matching(use_prior);
+          multibox_loss_param->set_do_neg_mining(do_neg_mining);
+          // Images are matched independently, so the loss and the gradients
+          // must not depend on the number of threads.
+          vector<Dtype> losses, diffs;
+          for (int t = 1; t <= 4; t += 3) {
+            multibox_loss_param->set_num_threads(t);
+            MultiBoxLossLayer<Dtype> layer(layer_param);
+            layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+            layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+            losses.push_back(this->blob_top_loss_->cpu_data()[0]);
+            this->blob_top_loss_->mutable_cpu_diff()[0] = 1;
+            layer.Backward(this->blob_top_vec_, propagate_down,
+                           this->blob_bottom_vec_);
+            for (int b = 0; b < 2; ++b) {
+              const Blob<Dtype>* bottom = this->blob_bottom_vec_[b];
+              diffs.insert(diffs.end(), bottom->cpu_diff(),
+                           bottom->cpu_diff() + bottom->count());
+            }
+          }
+          EXPECT_EQ(losses[0], losses[1]);
+          const int count = diffs.size() / 2;
+          for (int d = 0; d < count; ++d) {
+            EXPECT_EQ(diffs[d], diffs[count + d]);
+          }
+        }
+      }
+    }
+  }
+}
+
 }  // namespace caffe
@@ -1,3 +1,5 @@
+#include <fstream>  // NOLINT(readability/streams)
+#include <iterator>
 #include <string>
 #include <utility>
 #include <vector>
@@ -9,7 +11,9 @@
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
 #include "caffe/net.hpp"
+#include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/net_profiler.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
 #include "caffe/test/test_gradient_check_util.hpp"
@@ -2378,6 +2382,537 @@ TYPED_TEST(NetTest, TestReshape) {
   EXPECT_FALSE(same_spatial_shape);
 }
 
+TYPED_TEST(NetTest, TestShareActivationMemory) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_mode(Caffe::CPU);
+  // conv1 is shared with flat, and ip1 with its split tops.
+  const string proto =
+      "name: 'ShareActivationMemoryNet' "
+      "layer { "
+      "  name: 'data' "
+      "  type: 'Input' "
+      "  top: 'data' "
+      "  input_param { shape { dim: 2 dim: 3 dim: 6 dim: 5 } } "
+      "} "
+      "layer { "
+      "  name: 'conv1' "
+      "  type: 'Convolution' "
+      "  bottom: 'data' "
+      "  top: 'conv1' "
+      "  convolution_param { "
+      "    num_output: 4 "
+      "    kernel_size: 3 "
+      "    pad: 1 "
+      "    weight_filler { type: 'gaussian' std: 0.1 } "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'relu1' "
+      "  type: 'ReLU' "
+      "  bottom: 'conv1' "
+      "  top: 'conv1' "
+      "} "
+      "layer { "
+      "  name: 'flat' "
+      "  type: 'Flatten' "
+      "  bottom: 'conv1' "
+      "  top: 'flat' "
+      "} "
+      "layer { "
+      "  name: 'ip1' "
+      "  type: 'InnerProduct' "
+      "  bottom: 'flat' "
+      "  top: 'ip1' "
+      "  inner_product_param { "
+      "    num_output: 8 "
+      "    weight_filler { type: 'gaussian' std: 0.1 } "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'sigmoid' "
+      "  type: 'Sigmoid' "
+      "  bottom: 'ip1' "
+      "  top: 'sigmoid' "
+      "} "
+      "layer { "
+      "  name: 'tanh' "
+      "  type: 'TanH' "
+      "  bottom: 'ip1' "
+      "  top: 'tanh' "
+      "} "
+      "layer { "
+      "  name: 'sum' "
+      "  type: 'Eltwise' "
+      "  bottom: 'sigmoid' "
+      "  bottom: 'tanh' "
+      "  top: 'sum' "
+      "} "
+      "layer { "
+      "  name: 'ip2' "
+      "  type: 'InnerProduct' "
+      "  bottom: 'sum' "
+      "  top: 'ip2' "
+      "  inner_product_param { "
+      "    num_output: 3 "
+      "    weight_filler { type: 'gaussian' std: 0.1 } "
+      "  } "
+      "} ";
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  param.mutable_state()->set_phase(TEST);
+  Net<Dtype> net(param);
+  EXPECT_EQ(net.activation_memory_size(), 0);
+  param.set_share_activation_memory(true);
+  param.add_keep_blob("sigmoid");
+  Net<Dtype> shared_net(param);
+  shared_net.ShareTrainedLayersWith(&net);
+  // Nothing is shared by a TRAIN net.
+  param.mutable_state()->set_phase(TRAIN);
+  Net<Dtype> train_net(param);
+  train_net.Forward();
+  EXPECT_EQ(train_net.activation_memory_size(), 0);
+
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  for (int iter = 0; iter < 2; ++iter) {
+    filler.Fill(net.input_blobs()[0]);
+    caffe_copy(net.input_blobs()[0]->count(), net.input_blobs()[0]->cpu_data(),
+               shared_net.input_blobs()[0]->mutable_cpu_data());
+    if (iter == 1) {
+      // Blobs asked for by name keep their data.
+      shared_net.blob_by_name("ip1");
+    }
+    net.Forward();
+    if (iter == 0) {
+      EXPECT_EQ(shared_net.activation_memory_size(), 0);
+    }
+    shared_net.Forward();
+    if (iter == 0) {
+      // The memory is shared from the first Forward on. Without data, sigmoid
+      // and ip2, at most conv1 and two of the small blobs are used at the
+      // same time.
+      size_t activation_size = 0;
+      const vector<shared_ptr<Blob<Dtype> > >& blobs = net.blobs();
+      for (int i = 0; i < blobs.size(); ++i) {
+        activation_size += blobs[i]->count() * sizeof(Dtype);
+      }
+      EXPECT_GT(shared_net.activation_memory_size(), 0);
+      EXPECT_LT(shared_net.activation_memory_size(), activation_size / 2);
+    }
+    const char* kept_blobs[3] = {"ip2", "sigmoid", "ip1"};
+    for (int k = 0; k < iter + 2; ++k) {
+      const Blob<Dtype>* blob = net.blob_by_name(kept_blobs[k]).get();
+      const Blob<Dtype>* shared_blob =
+          shared_net.blob_by_name(kept_blobs[k]).get();
+      ASSERT_EQ(blob->count(), shared_blob->count());
+      for (int i = 0; i < blob->count(); ++i) {
+        EXPECT_EQ(blob->cpu_data()[i], shared_blob->cpu_data()[i]);
+      }
+    }
+  }
+}
+
+TYPED_TEST(NetTest, TestForwardThreads) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_mode(Caffe::CPU);
+  // Three branches from the split tops of conv1, one of them with an in-place
+  // ReLU on a Flatten top sharing the data of its bottom, joined by a Concat.
+  const string proto =
+      "name: 'ForwardThreadsNet' "
+      "layer { "
+      "  name: 'data' "
+      "  type: 'Input' "
+      "  top: 'data' "
+      "  input_param { shape { dim: 2 dim: 3 dim: 6 dim: 5 } } "
+      "} "
+      "layer { "
+      "  name: 'conv1' "
+      "  type: 'Convolution' "
+      "  bottom: 'data' "
+      "  top: 'conv1' "
+      "  convolution_param { "
+      "    num_output: 4 "
+      "    kernel_size: 3 "
+      "    pad: 1 "
+      "    weight_filler { type: 'gaussian' std: 0.1 } "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'conv_a' "
+      "  type: 'Convolution' "
+      "  bottom: 'conv1' "
+      "  top: 'conv_a' "
+      "  convolution_param { "
+      "    num_output: 6 "
+      "    kernel_size: 1 "
+      "    weight_filler { type: 'gaussian' std: 0.1 } "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'flat_a' "
+      "  type: 'Flatten' "
+      "  bottom: 'conv_a' "
+      "  top: 'flat_a' "
+      "} "
+      "layer { "
+      "  name: 'relu_a' "
+      "  type: 'ReLU' "
+      "  bottom: 'flat_a' "
+      "  top: 'flat_a' "
+      "} "
+      "layer { "
+      "  name: 'conv_b' "
+      "  type: 'Convolution' "
+      "  bottom: 'conv1' "
+      "  top: 'conv_b' "
+      "  convolution_param { "
+      "    num_output: 5 "
+      "    kernel_size: 3 "
+      "    pad: 1 "
+      "    weight_filler { type: 'gaussian' std: 0.1 } "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'flat_b' "
+      "  type: 'Flatten' "
+      "  bottom: 'conv_b' "
+      "  top: 'flat_b' "
+      "} "
+      "layer { "
+      "  name: 'pool_c' "
+      "  type: 'Pooling' "
+      "  bottom: 'conv1' "
+      "  top: 'pool_c' "
+      "  pooling_param { pool: MAX kernel_size: 2 stride: 2 } "
+      "} "
+      "layer { "
+      "  name: 'flat_c' "
+      "  type: 'Flatten' "
+      "  bottom: 'pool_c' "
+      "  top: 'flat_c' "
+      "} "
+      "layer { "
+      "  name: 'concat' "
+      "  type: 'Concat' "
+      "  bottom: 'flat_a' "
+      "  bottom: 'flat_b' "
+      "  bottom: 'flat_c' "
+      "  top: 'concat' "
+      "} "
+      "layer { "
+      "  name: 'ip' "
+      "  type: 'InnerProduct' "
+      "  bottom: 'concat' "
+      "  top: 'ip' "
+      "  inner_product_param { "
+      "    num_output: 3 "
+      "    weight_filler { type: 'gaussian' std: 0.1 } "
+      "  } "
+      "} ";
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  param.mutable_state()->set_phase(TEST);
+  Net<Dtype> net(param);
+  param.set_forward_threads(4);
+  Net<Dtype> parallel_net(param);
+  parallel_net.ShareTrainedLayersWith(&net);
+
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  // The first Forward runs in order, and the next ones on the threads.
+  for (int iter = 0; iter < 5; ++iter) {
+    filler.Fill(net.input_blobs()[0]);
+    caffe_copy(net.input_blobs()[0]->count(), net.input_blobs()[0]->cpu_data(),
+               parallel_net.input_blobs()[0]->mutable_cpu_data());
+    net.Forward();
+    parallel_net.Forward();
+    const vector<shared_ptr<Blob<Dtype> > >& blobs = net.blobs();
+    for (int j = 0; j < blobs.size(); ++j) {
+      const Blob<Dtype>* blob = blobs[j].get();
+      const Blob<Dtype>* parallel_blob = parallel_net.blobs()[j].get();
+      ASSERT_EQ(blob->count(), parallel_blob->count());
+      for (int i = 0; i < blob->count(); ++i) {
+        EXPECT_EQ(blob->cpu_data()[i], parallel_blob->cpu_data()[i])
+            << net.blob_names()[j];
+      }
+    }
+  }
+  // Partial ranges run on the threads too.
+  const int concat_id = parallel_net.layer_names().size() - 2;
+  EXPECT_EQ("concat", parallel_net.layer_names()[concat_id]);
+  caffe_set(parallel_net.blob_by_name("concat")->count(), Dtype(0),
+            parallel_net.blob_by_name("concat")->mutable_cpu_data());
+  parallel_net.ForwardFromTo(1, concat_id);
+  const Blob<Dtype>& concat = *net.blob_by_name("concat");
+  for (int i = 0; i < concat.count(); ++i) {
+    EXPECT_EQ(concat.cpu_data()[i],
+              parallel_net.blob_by_name("concat")->cpu_data()[i]);
+  }
+}
+
+TYPED_TEST(NetTest, TestForwardThreadsTrainDropout) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_mode(Caffe::CPU);
+  // Two independent branches drawing Dropout masks, large enough for the
+  // threads to interleave.
+  const string proto =
+      "name: 'ForwardThreadsDropoutNet' "
+      "layer { "
+      "  name: 'data' "
+      "  type: 'Input' "
+      "  top: 'data' "
+      "  input_param { shape { dim: 2 dim: 3 dim: 64 dim: 64 } } "
+      "} "
+      "layer { "
+      "  name: 'conv_a' "
+      "  type: 'Convolution' "
+      "  bottom: 'data' "
+      "  top: 'conv_a' "
+      "  convolution_param { "
+      "    num_output: 4 "
+      "    kernel_size: 1 "
+      "    weight_filler { type: 'gaussian' std: 0.1 } "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'drop_a' "
+      "  type: 'Dropout' "
+      "  bottom: 'conv_a' "
+      "  top: 'conv_a' "
+      "} "
+      "layer { "
+      "  name: 'conv_b' "
+      "  type: 'Convolution' "
+      "  bottom: 'data' "
+      "  top: 'conv_b' "
+      "  convolution_param { "
+      "    num_output: 5 "
+      "    kernel_size: 1 "
+      "    weight_filler { type: 'gaussian' std: 0.1 } "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'drop_b' "
+      "  type: 'Dropout' "
+      "  bottom: 'conv_b' "
+      "  top: 'conv_b' "
+      "} "
+      "layer { "
+      "  name: 'concat' "
+      "  type: 'Concat' "
+      "  bottom: 'conv_a' "
+      "  bottom: 'conv_b' "
+      "  top: 'concat' "
+      "} ";
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  param.mutable_state()->set_phase(TRAIN);
+  Net<Dtype> net(param);
+  param.set_forward_threads(4);
+  Net<Dtype> parallel_net(param);
+  parallel_net.ShareTrainedLayersWith(&net);
+
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  // With the same seed, the masks are the same as in order.
+  for (int iter = 0; iter < 5; ++iter) {
+    filler.Fill(net.input_blobs()[0]);
+    caffe_copy(net.input_blobs()[0]->count(), net.input_blobs()[0]->cpu_data(),
+               parallel_net.input_blobs()[0]->mutable_cpu_data());
+    Caffe::set_random_seed(this->seed_ + iter);
+    net.Forward();
+    Caffe::set_random_seed(this->seed_ + iter);
+    parallel_net.Forward();
+    const Blob<Dtype>& concat = *net.blob_by_name("concat");
+    const Blob<Dtype>& parallel_concat = *parallel_net.blob_by_name("concat");
+    for (int i = 0; i < concat.count(); ++i) {
+      EXPECT_EQ(concat.cpu_data()[i], parallel_concat.cpu_data()[i]);
+    }
+  }
+}
+
+TYPED_TEST(NetTest, TestShareConcatMemory) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_mode(Caffe::CPU);
+  // Three flattened branches joined by a Concat along axis 1, one of them
+  // with an in-place ReLU on the Flatten top.
+  const string proto =
+      "name: 'ShareConcatMemoryNet' "
+      "layer { "
+      "  name: 'data' "
+      "  type: 'Input' "
+      "  top: 'data' "
+      "  input_param { shape { dim: 1 dim: 3 dim: 6 dim: 5 } } "
+      "} "
+      "layer { "
+      "  name: 'conv1' "
+      "  type: 'Convolution' "
+      "  bottom: 'data' "
+      "  top: 'conv1' "
+      "  convolution_param { "
+      "    num_output: 4 "
+      "    kernel_size: 3 "
+      "    pad: 1 "
+      "    weight_filler { type: 'gaussian' std: 0.1 } "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'conv_a' "
+      "  type: 'Convolution' "
+      "  bottom: 'conv1' "
+      "  top: 'conv_a' "
+      "  convolution_param { "
+      "    num_output: 6 "
+      "    kernel_size: 1 "
+      "    weight_filler { type: 'gaussian' std: 0.1 } "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'flat_a' "
+      "  type: 'Flatten' "
+      "  bottom: 'conv_a' "
+      "  top: 'flat_a' "
+      "} "
+      "layer { "
+      "  name: 'relu_a' "
+      "  type: 'ReLU' "
+      "  bottom: 'flat_a' "
+      "  top: 'flat_a' "
+      "} "
+      "layer { "
+      "  name: 'conv_b' "
+      "  type: 'Convolution' "
+      "  bottom: 'conv1' "
+      "  top: 'conv_b' "
+      "  convolution_param { "
+      "    num_output: 5 "
+      "    kernel_size: 3 "
+      "    pad: 1 "
+      "    weight_filler { type: 'gaussian' std: 0.1 } "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'flat_b' "
+      "  type: 'Flatten' "
+      "  bottom: 'conv_b' "
+      "  top: 'flat_b' "
+      "} "
+      "layer { "
+      "  name: 'ip_c' "
+      "  type: 'InnerProduct' "
+      "  bottom: 'conv1' "
+      "  top: 'ip_c' "
+      "  inner_product_param { "
+      "    num_output: 7 "
+      "    weight_filler { type: 'gaussian' std: 0.1 } "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'concat' "
+      "  type: 'Concat' "
+      "  bottom: 'flat_a' "
+      "  bottom: 'flat_b' "
+      "  bottom: 'ip_c' "
+      "  top: 'concat' "
+      "} "
+      "layer { "
+      "  name: 'ip' "
+      "  type: 'InnerProduct' "
+      "  bottom: 'concat' "
+      "  top: 'ip' "
+      "  loss_weight: 1 "
+      "  inner_product_param { "
+      "    num_output: 3 "
+      "    weight_filler { type: 'gaussian' std: 0.1 } "
+      "  } "
+      "} ";
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  param.mutable_state()->set_phase(TRAIN);
+  Net<Dtype> net(param);
+  param.set_share_concat_memory(true);
+  Net<Dtype> shared_net(param);
+  shared_net.ShareTrainedLayersWith(&net);
+
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  // One image, then two, whose regions are not contiguous, then one again,
+  // in blobs keeping the memory of two, which the top has no room for.
+  const int batch_sizes[] = {1, 1, 1, 2, 2, 1, 1};
+  for (int iter = 0; iter < 7; ++iter) {
+    vector<int> shape = net.input_blobs()[0]->shape();
+    shape[0] = batch_sizes[iter];
+    net.input_blobs()[0]->Reshape(shape);
+    shared_net.input_blobs()[0]->Reshape(shape);
+    filler.Fill(net.input_blobs()[0]);
+    caffe_copy(net.input_blobs()[0]->count(), net.input_blobs()[0]->cpu_data(),
+               shared_net.input_blobs()[0]->mutable_cpu_data());
+    net.ClearParamDiffs();
+    shared_net.ClearParamDiffs();
+    net.Forward();
+    net.Backward();
+    shared_net.Forward();
+    shared_net.Backward();
+    for (int j = 0; j < net.blobs().size(); ++j) {
+      const Blob<Dtype>* blob = net.blobs()[j].get();
+      const Blob<Dtype>* shared_blob = shared_net.blobs()[j].get();
+      ASSERT_EQ(blob->count(), shared_blob->count());
+      for (int i = 0; i < blob->count(); ++i) {
+        EXPECT_EQ(blob->cpu_data()[i], shared_blob->cpu_data()[i])
+            << net.blob_names()[j];
+        EXPECT_EQ(blob->cpu_diff()[i], shared_blob->cpu_diff()[i])
+            << net.blob_names()[j];
+      }
+    }
+    for (int j = 0; j < net.learnable_params().size(); ++j) {
+      const Blob<Dtype>* param_blob = net.learnable_params()[j];
+      const Blob<Dtype>* shared_param = shared_net.learnable_params()[j];
+      for (int i = 0; i < param_blob->count(); ++i) {
+        EXPECT_EQ(param_blob->cpu_diff()[i], shared_param->cpu_diff()[i]);
+      }
+    }
+    // The layers producing the bottoms, through the Flatten layers, write
+    // straight into the top once the first Forward has shared it, and so do
+    // the Backward of the layers using them, except the in-place ReLU, which
+    // would overwrite the diff of the top.
+    const Blob<Dtype>& concat = *shared_net.blob_by_name("concat");
+    const char* bottom_names[] = {"conv_a", "conv_b", "ip_c"};
+    const bool shared = iter < 3;
+    int offset = 0;
+    for (int i = 0; i < 3; ++i) {
+      const Blob<Dtype>& bottom = *shared_net.blob_by_name(bottom_names[i]);
+      EXPECT_EQ(shared, bottom.cpu_data() == concat.cpu_data() + offset)
+          << iter;
+      EXPECT_EQ(shared && i > 0,
+                bottom.cpu_diff() == concat.cpu_diff() + offset) << iter;
+      offset += bottom.count();
+    }
+  }
+
+  // The views follow the top into the memory shared by the activations.
+  param.mutable_state()->set_phase(TEST);
+  param.set_share_activation_memory(true);
+  Net<Dtype> test_net(param);
+  test_net.ShareTrainedLayersWith(&net);
+  vector<int> shape = net.input_blobs()[0]->shape();
+  shape[0] = 1;
+  net.input_blobs()[0]->Reshape(shape);
+  for (int iter = 0; iter < 2; ++iter) {
+    filler.Fill(net.input_blobs()[0]);
+    caffe_copy(net.input_blobs()[0]->count(), net.input_blobs()[0]->cpu_data(),
+               test_net.input_blobs()[0]->mutable_cpu_data());
+    net.Forward();
+    test_net.Forward();
+    const Blob<Dtype>& ip = *net.output_blobs()[0];
+    for (int i = 0; i < ip.count(); ++i) {
+      EXPECT_EQ(ip.cpu_data()[i], test_net.output_blobs()[0]->cpu_data()[i]);
+    }
+  }
+  EXPECT_GT(test_net.activation_memory_size(), 0);
+  EXPECT_EQ(test_net.blob_by_name("concat")->cpu_data(),
+            test_net.blob_by_name("conv_a")->cpu_data());
+}
+
 TYPED_TEST(NetTest, TestSkipPropagateDown) {
   // check bottom_need_backward if propagate_down is true
   this->InitSkipPropNet(false);
@@ -2473,4 +3008,114 @@ TYPED_TEST(NetTest, TestForcePropagateDown) {
   }
 }
 
+TYPED_TEST(NetTest, TestProfiler) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->InitTinyNetEuclidean();
+  shared_ptr<NetProfiler> profiler(new NetProfiler());
+  this->net_->set_profiler(profiler);
+  const int kIterations = 3;
+  for (int i = 0; i < kIterations; ++i) {
+    this->net_->Forward();
+    this->net_->Backward();
+  }
+  this->net_->set_profiler(shared_ptr<NetProfiler>());
+  this->net_->Forward();
+  // The data layer does not need backward.
+  const vector<NetProfiler::Event>& events = profiler->events();
+  EXPECT_EQ(kIterations * 5, events.size());
+  ASSERT_EQ(3, profiler->layers().size());
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_EQ(this->net_->layer_names()[i], profiler->layers()[i].name);
+    EXPECT_EQ(kIterations,
+              profiler->Durations(i, NetProfiler::FORWARD).size());
+  }
+  EXPECT_EQ(0, profiler->Durations(0, NetProfiler::BACKWARD).size());
+  EXPECT_EQ(kIterations, profiler->Durations(1, NetProfiler::BACKWARD).size());
+  EXPECT_EQ(kIterations, profiler->Durations(-1, NetProfiler::FORWARD).size());
+  for (int i = 0; i < events.size(); ++i) {
+    EXPECT_EQ(i / 5, events[i].iteration);
+    EXPECT_GE(events[i].duration_us, 0);
+  }
+  const NetProfiler::LayerInfo& innerproduct = profiler->layers()[1];
+  EXPECT_EQ("InnerProduct", innerproduct.type);
+  ASSERT_EQ(1, innerproduct.bottom_shapes.size());
+  EXPECT_EQ(this->net_->blob_by_name("data")->shape(),
+            innerproduct.bottom_shapes[0]);
+  // 5 outputs of 24 multiply-adds each.
+  EXPECT_EQ(2 * 5 * 24, innerproduct.flops[NetProfiler::FORWARD]);
+  EXPECT_EQ(2 * 2 * 5 * 24, innerproduct.flops[NetProfiler::BACKWARD]);
+  // The data and diff of the top, weights and bias.
+  EXPECT_EQ((2 * 5 + 2 * 24 + 2 * 1) * sizeof(Dtype), innerproduct.bytes);
+
+  string csv_filename;
+  MakeTempFilename(&csv_filename);
+  profiler->WriteCSV(csv_filename);
+  std::ifstream csv(csv_filename.c_str());
+  string line;
+  int num_lines = 0;
+  while (std::getline(csv, line)) {
+    ++num_lines;
+  }
+  EXPECT_EQ(1 + events.size(), num_lines);
+  string trace_filename;
+  MakeTempFilename(&trace_filename);
+  profiler->WriteChromeTrace(trace_filename);
+  std::ifstream trace(trace_filename.c_str());
+  const string json((std::istreambuf_iterator<char>(trace)),
+                    std::istreambuf_iterator<char>());
+  EXPECT_EQ(0, json.find("{\"traceEvents\": ["));
+  EXPECT_NE(string::npos, json.find("\"name\": \"innerproduct\""));
+  EXPECT_NE(string::npos, json.find("\"top_shapes\": \"5x1\""));
+}
+
+TYPED_TEST(NetTest, TestProfilerEscapesNames) {
+  const string& proto =
+      "name: 'EscapeNet' "
+      "layer { "
+      "  name: 'a,\"b\"\\n\\tc' "
+      "  type: 'DummyData' "
+      "  dummy_data_param { "
+      "    shape { dim: 2 dim: 3 } "
+      "  } "
+      "  top: 'data' "
+      "} ";
+  this->InitNetFromProtoString(proto);
+  shared_ptr<NetProfiler> profiler(new NetProfiler());
+  this->net_->set_profiler(profiler);
+  this->net_->Forward();
+  ASSERT_EQ(1, profiler->layers().size());
+  EXPECT_EQ("a,\"b\"\n\tc", profiler->layers()[0].name);
+
+  string csv_filename;
+  MakeTempFilename(&csv_filename);
+  profiler->WriteCSV(csv_filename);
+  std::ifstream csv(csv_filename.c_str());
+  const string csv_text((std::istreambuf_iterator<char>(csv)),
+                        std::istreambuf_iterator<char>());
+  EXPECT_NE(string::npos,
+            csv_text.find("\n0,0,\"a,\"\"b\"\"\n\tc\",DummyData,forward,"));
+  string trace_filename;
+  MakeTempFilename(&trace_filename);
+  profiler->WriteChromeTrace(trace_filename);
+  std::ifstream trace(trace_filename.c_str());
+  const string json((std::istreambuf_iterator<char>(trace)),
+                    std::istreambuf_iterator<char>());
+  EXPECT_NE(string::npos,
+            json.find("\"name\": \"a,\\\"b\\\"\\u000a\\u0009c\""));
+}
+
+TYPED_TEST(NetTest, TestProfilerPercentile) {
+  vector<double> values;
+  values.push_back(5);
+  values.push_back(1);
+  values.push_back(4);
+  values.push_back(2);
+  values.push_back(3);
+  EXPECT_EQ(1, NetProfiler::Percentile(values, 20));
+  EXPECT_EQ(3, NetProfiler::Percentile(values, 50));
+  EXPECT_EQ(5, NetProfiler::Percentile(values, 90));
+  EXPECT_EQ(5, NetProfiler::Percentile(values, 100));
+  EXPECT_EQ(3, NetProfiler::Mean(values));
+}
+
 }  // namespace caffe
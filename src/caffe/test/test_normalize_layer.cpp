@@ -225,6 +225,41 @@ TYPED_TEST(NormalizeLayerTest, TestForwardEltWiseScaleChannel) {
   }
 }
 
+TYPED_TEST(NormalizeLayerTest, TestForwardEltWiseScaleEachChannel) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  NormalizeParameter* norm_param = layer_param.mutable_norm_param();
+  norm_param->set_across_spatial(false);
+  norm_param->set_channel_shared(false);
+  norm_param->mutable_scale_filler()->set_type("uniform");
+  norm_param->mutable_scale_filler()->set_min(1);
+  norm_param->mutable_scale_filler()->set_max(3);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  NormalizeLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  const Dtype* scale = layer.blobs()[0]->cpu_data();
+  const Dtype eps = norm_param->eps();
+  for (int i = 0; i < this->blob_bottom_->num(); ++i) {
+    for (int k = 0; k < this->blob_bottom_->height(); ++k) {
+      for (int l = 0; l < this->blob_bottom_->width(); ++l) {
+        Dtype sum = 0;
+        for (int j = 0; j < this->blob_bottom_->channels(); ++j) {
+          Dtype data = this->blob_bottom_->data_at(i, j, k, l);
+          sum += data * data;
+        }
+        for (int j = 0; j < this->blob_bottom_->channels(); ++j) {
+          EXPECT_NEAR(this->blob_bottom_->data_at(i, j, k, l) * scale[j] /
+                      sqrt(sum + eps), this->blob_top_->data_at(i, j, k, l),
+                      1e-5);
+        }
+      }
+    }
+  }
+}
+
 TYPED_TEST(NormalizeLayerTest, TestGradient) {
   typedef typename TypeParam::Dtype Dtype;
   LayerParameter layer_param;
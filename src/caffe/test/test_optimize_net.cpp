@@ -0,0 +1,292 @@
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/net.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/optimize_net.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class OptimizeNetTest : public CPUDeviceTest<Dtype> {
+ protected:
+  void RunOptimizeNetTest(const string& input_param_string,
+      const string& output_param_string) {
+    NetParameter input_param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(
+        input_param_string, &input_param));
+    NetParameter expected_output_param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(
+        output_param_string, &expected_output_param));
+    NetParameter actual_output_param;
+    OptimizeNetForInference(input_param, &actual_output_param);
+    EXPECT_EQ(expected_output_param.DebugString(),
+        actual_output_param.DebugString());
+  }
+};
+
+TYPED_TEST_CASE(OptimizeNetTest, TestDtypes);
+
+TYPED_TEST(OptimizeNetTest, TestDropoutAndReLU) {
+  const string& input_proto =
+      "name: 'TestNetwork' "
+      "layer { "
+      "  name: 'data' "
+      "  type: 'Input' "
+      "  top: 'data' "
+      "  input_param { shape { dim: 2 dim: 3 } } "
+      "} "
+      "layer { "
+      "  name: 'drop0' "
+      "  type: 'Dropout' "
+      "  bottom: 'data' "
+      "  top: 'drop0' "
+      "} "
+      "layer { "
+      "  name: 'ip1' "
+      "  type: 'InnerProduct' "
+      "  bottom: 'drop0' "
+      "  top: 'ip1' "
+      "  inner_product_param { num_output: 4 } "
+      "} "
+      "layer { "
+      "  name: 'drop1' "
+      "  type: 'Dropout' "
+      "  bottom: 'ip1' "
+      "  top: 'drop1' "
+      "} "
+      "layer { "
+      "  name: 'relu1' "
+      "  type: 'ReLU' "
+      "  bottom: 'drop1' "
+      "  top: 'relu1' "
+      "} "
+      "layer { "
+      "  name: 'ip2' "
+      "  type: 'InnerProduct' "
+      "  bottom: 'relu1' "
+      "  top: 'ip2' "
+      "  inner_product_param { num_output: 4 } "
+      "} "
+      "layer { "
+      "  name: 'relu2' "
+      "  type: 'ReLU' "
+      "  bottom: 'ip2' "
+      "  top: 'relu2' "
+      "} "
+      "layer { "
+      "  name: 'loss' "
+      "  type: 'EuclideanLoss' "
+      "  bottom: 'ip2' "
+      "  bottom: 'relu2' "
+      "  top: 'loss' "
+      "} ";
+  // The net input keeps its name, and relu2 cannot work in place as its
+  // bottom is also read by the loss.
+  const string& expected_output_proto =
+      "name: 'TestNetwork' "
+      "layer { "
+      "  name: 'data' "
+      "  type: 'Input' "
+      "  top: 'data' "
+      "  input_param { shape { dim: 2 dim: 3 } } "
+      "} "
+      "layer { "
+      "  name: 'ip1' "
+      "  type: 'InnerProduct' "
+      "  bottom: 'data' "
+      "  top: 'relu1' "
+      "  inner_product_param { num_output: 4 } "
+      "} "
+      "layer { "
+      "  name: 'relu1' "
+      "  type: 'ReLU' "
+      "  bottom: 'relu1' "
+      "  top: 'relu1' "
+      "} "
+      "layer { "
+      "  name: 'ip2' "
+      "  type: 'InnerProduct' "
+      "  bottom: 'relu1' "
+      "  top: 'ip2' "
+      "  inner_product_param { num_output: 4 } "
+      "} "
+      "layer { "
+      "  name: 'relu2' "
+      "  type: 'ReLU' "
+      "  bottom: 'ip2' "
+      "  top: 'relu2' "
+      "} "
+      "layer { "
+      "  name: 'loss' "
+      "  type: 'EuclideanLoss' "
+      "  bottom: 'ip2' "
+      "  bottom: 'relu2' "
+      "  top: 'loss' "
+      "} ";
+  this->RunOptimizeNetTest(input_proto, expected_output_proto);
+}
+
+TYPED_TEST(OptimizeNetTest, TestFoldBatchNormAndScale) {
+  typedef TypeParam Dtype;
+  const string& proto =
+      "name: 'TestNetwork' "
+      "layer { "
+      "  name: 'data' "
+      "  type: 'Input' "
+      "  top: 'data' "
+      "  input_param { shape { dim: 2 dim: 3 dim: 6 dim: 5 } } "
+      "} "
+      "layer { "
+      "  name: 'conv1' "
+      "  type: 'Convolution' "
+      "  bottom: 'data' "
+      "  top: 'conv1' "
+      "  convolution_param { "
+      "    num_output: 4 "
+      "    kernel_size: 3 "
+      "    pad: 1 "
+      "    bias_term: false "
+      "    weight_filler { type: 'gaussian' std: 0.3 } "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'bn1' "
+      "  type: 'BatchNorm' "
+      "  bottom: 'conv1' "
+      "  top: 'conv1' "
+      "} "
+      "layer { "
+      "  name: 'scale1' "
+      "  type: 'Scale' "
+      "  bottom: 'conv1' "
+      "  top: 'conv1' "
+      "  scale_param { "
+      "    bias_term: true "
+      "    filler { type: 'gaussian' std: 1 } "
+      "    bias_filler { type: 'gaussian' std: 1 } "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'relu1' "
+      "  type: 'ReLU' "
+      "  bottom: 'conv1' "
+      "  top: 'relu1' "
+      "} "
+      "layer { "
+      "  name: 'drop1' "
+      "  type: 'Dropout' "
+      "  bottom: 'relu1' "
+      "  top: 'drop1' "
+      "} "
+      "layer { "
+      "  name: 'conv2' "
+      "  type: 'Convolution' "
+      "  bottom: 'drop1' "
+      "  top: 'conv2' "
+      "  convolution_param { "
+      "    num_output: 4 "
+      "    kernel_size: 1 "
+      "    group: 2 "
+      "    weight_filler { type: 'gaussian' std: 0.3 } "
+      "    bias_filler { type: 'gaussian' std: 0.3 } "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'bn2' "
+      "  type: 'BatchNorm' "
+      "  bottom: 'conv2' "
+      "  top: 'bn2' "
+      "} "
+      "layer { "
+      "  name: 'sum' "
+      "  type: 'Eltwise' "
+      "  bottom: 'conv2' "
+      "  bottom: 'bn2' "
+      "  top: 'sum' "
+      "} "
+      "layer { "
+      "  name: 'ip1' "
+      "  type: 'InnerProduct' "
+      "  bottom: 'sum' "
+      "  top: 'ip1' "
+      "  inner_product_param { "
+      "    num_output: 5 "
+      "    transpose: true "
+      "    weight_filler { type: 'gaussian' std: 0.3 } "
+      "    bias_filler { type: 'gaussian' std: 0.3 } "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'bn3' "
+      "  type: 'BatchNorm' "
+      "  bottom: 'ip1' "
+      "  top: 'bn3' "
+      "} "
+      "layer { "
+      "  name: 'scale3' "
+      "  type: 'Scale' "
+      "  bottom: 'bn3' "
+      "  top: 'out' "
+      "  scale_param { filler { type: 'gaussian' std: 1 } } "
+      "} ";
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  Net<Dtype> net(param);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler_param.set_min(0.5);
+  filler_param.set_max(2);
+  UniformFiller<Dtype> variance_filler(filler_param);
+  const char* bn_names[3] = {"bn1", "bn2", "bn3"};
+  for (int i = 0; i < 3; ++i) {
+    const vector<shared_ptr<Blob<Dtype> > >& blobs =
+        net.layer_by_name(bn_names[i])->blobs();
+    filler.Fill(blobs[0].get());
+    variance_filler.Fill(blobs[1].get());
+    blobs[2]->mutable_cpu_data()[0] = 0.5 + i;
+  }
+  NetParameter trained_param;
+  net.ToProto(&trained_param);
+  NetParameter optimized_param;
+  OptimizeNetForInference(trained_param, &optimized_param);
+
+  // bn2 stays since the split of conv2 also feeds sum.
+  const char* expected_types[8] = {"Input", "Convolution", "ReLU",
+      "Convolution", "Split", "BatchNorm", "Eltwise", "InnerProduct"};
+  ASSERT_EQ(optimized_param.layer_size(), 8);
+  for (int i = 0; i < 8; ++i) {
+    EXPECT_EQ(optimized_param.layer(i).type(), expected_types[i]);
+  }
+  EXPECT_EQ(optimized_param.layer(2).bottom(0), "drop1");
+  EXPECT_EQ(optimized_param.layer(2).top(0), "drop1");
+  EXPECT_EQ(optimized_param.layer(3).bottom(0), "drop1");
+
+  Net<Dtype> optimized_net(optimized_param);
+  ASSERT_EQ(optimized_net.num_outputs(), 1);
+  EXPECT_EQ(optimized_net.blob_names()[optimized_net.output_blob_indices()[0]],
+            "out");
+  filler.Fill(net.input_blobs()[0]);
+  caffe_copy(net.input_blobs()[0]->count(), net.input_blobs()[0]->cpu_data(),
+             optimized_net.input_blobs()[0]->mutable_cpu_data());
+  const Blob<Dtype>* out = net.Forward()[0];
+  const Blob<Dtype>* optimized_out = optimized_net.Forward()[0];
+  ASSERT_EQ(out->count(), optimized_out->count());
+  for (int i = 0; i < out->count(); ++i) {
+    const Dtype expected = out->cpu_data()[i];
+    EXPECT_NEAR(expected, optimized_out->cpu_data()[i],
+                1e-4 * std::max(Dtype(1), std::fabs(expected)));
+  }
+}
+
+}  // namespace caffe
@@ -6,6 +6,7 @@
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
 #include "caffe/layers/permute_layer.hpp"
+#include "caffe/util/math_functions.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
 #include "caffe/test/test_gradient_check_util.hpp"
@@ -242,6 +243,55 @@ TYPED_TEST(PermuteLayerTest, TestTwoPermute) {
   }
 }
 
+TYPED_TEST(PermuteLayerTest, TestTransposeTiles) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Several tiles with partial 8 x 8 blocks at their edges, in both
+  // directions, compared with the generic permute.
+  const int orders[][4] = {{0, 2, 3, 1}, {0, 3, 1, 2}};
+  for (int k = 0; k < 2; ++k) {
+    LayerParameter layer_param;
+    PermuteParameter* permute_param = layer_param.mutable_permute_param();
+    for (int i = 0; i < 4; ++i) {
+      permute_param->add_order(orders[k][i]);
+    }
+    permute_param->set_num_threads(3);
+    PermuteLayer<Dtype> layer(layer_param);
+    this->blob_bottom_->Reshape(2, 19, 7, 11);
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+
+    int old_steps[4];
+    int new_steps[4];
+    for (int i = 0; i < 4; ++i) {
+      old_steps[i] = this->blob_bottom_->count(i + 1);
+      new_steps[i] = this->blob_top_->count(i + 1);
+    }
+    const int count = this->blob_top_->count();
+    Blob<Dtype> expected(this->blob_top_->shape());
+    Permute(count, this->blob_bottom_->mutable_cpu_data(), true, orders[k],
+            old_steps, new_steps, 4, expected.mutable_cpu_data());
+    for (int i = 0; i < count; ++i) {
+      EXPECT_EQ(expected.cpu_data()[i], this->blob_top_->cpu_data()[i]);
+    }
+
+    filler.Fill(this->blob_top_);
+    caffe_copy(count, this->blob_top_->cpu_data(),
+               this->blob_top_->mutable_cpu_diff());
+    layer.Backward(this->blob_top_vec_, vector<bool>(1, true),
+                   this->blob_bottom_vec_);
+    Blob<Dtype> expected_diff(this->blob_bottom_->shape());
+    Permute(count, expected_diff.mutable_cpu_data(), false, orders[k],
+            old_steps, new_steps, 4, this->blob_top_->mutable_cpu_diff());
+    for (int i = 0; i < count; ++i) {
+      EXPECT_EQ(expected_diff.cpu_data()[i],
+                this->blob_bottom_->cpu_diff()[i]);
+    }
+  }
+}
+
 TYPED_TEST(PermuteLayerTest, TestGradient) {
   typedef typename TypeParam::Dtype Dtype;
   LayerParameter layer_param;
@@ -363,4 +363,34 @@ TYPED_TEST(PriorBoxLayerTest, TestCPUAspectRatio) {
   }
 }
 
+TYPED_TEST(PriorBoxLayerTest, TestCPUReshapeImage) {
+  LayerParameter layer_param;
+  PriorBoxParameter* prior_box_param = layer_param.mutable_prior_box_param();
+  prior_box_param->set_min_size(this->min_size_);
+  prior_box_param->set_max_size(this->max_size_);
+  prior_box_param->add_aspect_ratio(2.);
+  PriorBoxLayer<TypeParam> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  // The priors of the same shapes must not change between passes, and must
+  // follow a change of the image size.
+  const int img_sizes[3] = {100, 100, 300};
+  for (int i = 0; i < 3; ++i) {
+    this->blob_data_->Reshape(10, 3, img_sizes[i], img_sizes[i]);
+    Blob<TypeParam> top_ref;
+    vector<Blob<TypeParam>*> top_ref_vec(1, &top_ref);
+    PriorBoxLayer<TypeParam> layer_ref(layer_param);
+    layer_ref.SetUp(this->blob_bottom_vec_, top_ref_vec);
+    layer_ref.Forward(this->blob_bottom_vec_, top_ref_vec);
+    layer.Reshape(this->blob_bottom_vec_, this->blob_top_vec_);
+    caffe_set(this->blob_top_->count(), TypeParam(0),
+              this->blob_top_->mutable_cpu_data());
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    ASSERT_EQ(this->blob_top_->count(), top_ref.count());
+    for (int j = 0; j < top_ref.count(); ++j) {
+      EXPECT_EQ(this->blob_top_->cpu_data()[j], top_ref.cpu_data()[j]);
+    }
+  }
+}
+
 }  // namespace caffe
@@ -0,0 +1,166 @@
+#include <stdint.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/layers/conv_layer.hpp"
+#include "caffe/layers/inner_product_layer.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/quantization.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class QuantizationTest : public CPUDeviceTest<Dtype> {
+ protected:
+  QuantizationTest()
+      : blob_bottom_(new Blob<Dtype>(2, 5, 9, 7)),
+        blob_top_(new Blob<Dtype>()),
+        blob_top_int8_(new Blob<Dtype>()) {}
+  virtual void SetUp() {
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(blob_bottom_);
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_top_vec_.push_back(blob_top_);
+    blob_top_int8_vec_.push_back(blob_top_int8_);
+  }
+  virtual ~QuantizationTest() {
+    delete blob_bottom_;
+    delete blob_top_;
+    delete blob_top_int8_;
+  }
+
+  static Dtype MaxAbs(const Blob<Dtype>* blob) {
+    Dtype max_abs = 0;
+    for (int i = 0; i < blob->count(); ++i) {
+      max_abs = std::max(max_abs, std::fabs(blob->cpu_data()[i]));
+    }
+    return max_abs;
+  }
+
+  // The int8 output is within a few percent of the largest float output.
+  void CheckInt8Output() {
+    ASSERT_EQ(blob_top_->count(), blob_top_int8_->count());
+    const Dtype max_abs = MaxAbs(blob_top_);
+    for (int i = 0; i < blob_top_->count(); ++i) {
+      EXPECT_NEAR(blob_top_->cpu_data()[i], blob_top_int8_->cpu_data()[i],
+                  0.03 * max_abs);
+    }
+  }
+
+  Blob<Dtype>* const blob_bottom_;
+  Blob<Dtype>* const blob_top_;
+  Blob<Dtype>* const blob_top_int8_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+  vector<Blob<Dtype>*> blob_top_int8_vec_;
+};
+
+TYPED_TEST_CASE(QuantizationTest, TestDtypes);
+
+TYPED_TEST(QuantizationTest, TestKernels) {
+  typedef TypeParam Dtype;
+  const int M = 7, N = 5, K = 150;
+  Blob<Dtype> weights(1, 1, M, K);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&weights);
+  QuantizationParameter param;
+  param.set_bottom_max(3);
+  param.set_kernel(QuantizationParameter_Kernel_SCALAR);
+  Int8Gemm<Dtype> scalar_gemm(param);
+  scalar_gemm.SetWeights(M, K, 3, weights.cpu_data());
+  const int padded_k = scalar_gemm.padded_k();
+  EXPECT_EQ(padded_k % 64, 0);
+  vector<uint8_t> input(N * padded_k);
+  for (int i = 0; i < input.size(); ++i) {
+    input[i] = (i * 37 + 11) % 256;
+  }
+  vector<Dtype> expected(N * M), output(N * M);
+  scalar_gemm.Forward(N, &input[0], weights.cpu_data(), &expected[0], M, 1);
+  const Int8Kernel kernels[2] = {QuantizationParameter_Kernel_AVX2,
+      QuantizationParameter_Kernel_AVX512_VNNI};
+  for (int i = 0; i < 2; ++i) {
+    if (!Int8KernelSupported(kernels[i])) {
+      LOG(INFO) << "Skipping unsupported INT8 kernel "
+                << QuantizationParameter_Kernel_Name(kernels[i]);
+      continue;
+    }
+    param.set_kernel(kernels[i]);
+    Int8Gemm<Dtype> gemm(param);
+    gemm.SetWeights(M, K, 3, weights.cpu_data());
+    // Outputs are transposed, channel-major this time.
+    gemm.Forward(N, &input[0], weights.cpu_data(), &output[0], 1, N);
+    for (int n = 0; n < N; ++n) {
+      for (int m = 0; m < M; ++m) {
+        EXPECT_EQ(expected[n * M + m], output[m * N + n]);
+      }
+    }
+  }
+}
+
+TYPED_TEST(QuantizationTest, TestConvolution) {
+  typedef TypeParam Dtype;
+  LayerParameter layer_param;
+  layer_param.set_phase(TEST);
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_stride(2);
+  convolution_param->add_pad(1);
+  convolution_param->set_num_output(6);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  ConvolutionLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer_param.mutable_quantization_param()->set_bottom_max(
+      this->MaxAbs(this->blob_bottom_));
+  ConvolutionLayer<Dtype> int8_layer(layer_param);
+  int8_layer.SetUp(this->blob_bottom_vec_, this->blob_top_int8_vec_);
+  for (int i = 0; i < 2; ++i) {
+    int8_layer.blobs()[i]->ShareData(*layer.blobs()[i]);
+  }
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  int8_layer.Forward(this->blob_bottom_vec_, this->blob_top_int8_vec_);
+  this->CheckInt8Output();
+  // The weights are quantized again once the layer is told they changed.
+  caffe_scal(layer.blobs()[0]->count(), Dtype(-2),
+             layer.blobs()[0]->mutable_cpu_data());
+  int8_layer.ParamsChanged();
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  int8_layer.Forward(this->blob_bottom_vec_, this->blob_top_int8_vec_);
+  this->CheckInt8Output();
+}
+
+TYPED_TEST(QuantizationTest, TestInnerProduct) {
+  typedef TypeParam Dtype;
+  LayerParameter layer_param;
+  layer_param.set_phase(TEST);
+  InnerProductParameter* inner_product_param =
+      layer_param.mutable_inner_product_param();
+  inner_product_param->set_num_output(10);
+  inner_product_param->mutable_weight_filler()->set_type("gaussian");
+  inner_product_param->mutable_bias_filler()->set_type("gaussian");
+  InnerProductLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer_param.mutable_quantization_param()->set_bottom_max(
+      this->MaxAbs(this->blob_bottom_));
+  InnerProductLayer<Dtype> int8_layer(layer_param);
+  int8_layer.SetUp(this->blob_bottom_vec_, this->blob_top_int8_vec_);
+  for (int i = 0; i < 2; ++i) {
+    int8_layer.blobs()[i]->ShareData(*layer.blobs()[i]);
+  }
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  int8_layer.Forward(this->blob_bottom_vec_, this->blob_top_int8_vec_);
+  this->CheckInt8Output();
+}
+
+}  // namespace caffe
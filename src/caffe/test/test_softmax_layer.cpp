@@ -1,4 +1,6 @@
+#include <algorithm>
 #include <cmath>
+#include <limits>
 #include <vector>
 
 #include "gtest/gtest.h"
@@ -83,6 +85,86 @@ TYPED_TEST(SoftmaxLayerTest, TestGradient) {
       this->blob_top_vec_);
 }
 
+TYPED_TEST(SoftmaxLayerTest, TestForwardLastAxis) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Enough rows for several tasks, with scores spread wide enough for the
+  // exponentials to underflow.
+  vector<int> shape(3);
+  shape[0] = 2;
+  shape[1] = 300;
+  shape[2] = 21;
+  this->blob_bottom_->Reshape(shape);
+  FillerParameter filler_param;
+  filler_param.set_std(20);
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  LayerParameter layer_param;
+  layer_param.mutable_softmax_param()->set_axis(-1);
+  layer_param.mutable_softmax_param()->set_num_threads(3);
+  layer_param.mutable_softmax_param()->set_fast_exp(true);
+  SoftmaxLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  const Dtype* bottom_data = this->blob_bottom_->cpu_data();
+  const Dtype* top_data = this->blob_top_->cpu_data();
+  for (int i = 0; i < shape[0] * shape[1]; ++i) {
+    const Dtype* x = bottom_data + i * shape[2];
+    const Dtype* y = top_data + i * shape[2];
+    Dtype maxval = x[0];
+    for (int j = 1; j < shape[2]; ++j) {
+      maxval = std::max(maxval, x[j]);
+    }
+    Dtype scale = 0;
+    for (int j = 0; j < shape[2]; ++j) {
+      scale += exp(x[j] - maxval);
+    }
+    for (int j = 0; j < shape[2]; ++j) {
+      EXPECT_NEAR(exp(x[j] - maxval) / scale, y[j], 1e-4)
+          << "debug: " << i << " " << j;
+    }
+  }
+}
+
+// A NaN score makes its whole softmax NaN, with or without fast_exp, and
+// leaves the other softmaxes alone.
+TYPED_TEST(SoftmaxLayerTest, TestForwardLastAxisNaN) {
+  typedef typename TypeParam::Dtype Dtype;
+  vector<int> shape(2);
+  shape[0] = 3;
+  shape[1] = 21;
+  this->blob_bottom_->Reshape(shape);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  this->blob_bottom_->mutable_cpu_data()[shape[1] + 5] =
+      std::numeric_limits<Dtype>::quiet_NaN();
+  for (int fast_exp = 0; fast_exp < 2; ++fast_exp) {
+    LayerParameter layer_param;
+    layer_param.mutable_softmax_param()->set_axis(-1);
+    layer_param.mutable_softmax_param()->set_fast_exp(fast_exp);
+    SoftmaxLayer<Dtype> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    const Dtype* top_data = this->blob_top_->cpu_data();
+    for (int i = 0; i < shape[0]; ++i) {
+      for (int j = 0; j < shape[1]; ++j) {
+        EXPECT_EQ(i == 1, std::isnan(top_data[i * shape[1] + j]))
+            << "debug: fast_exp " << fast_exp << " " << i << " " << j;
+      }
+    }
+  }
+}
+
+TYPED_TEST(SoftmaxLayerTest, TestGradientLastAxis) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  layer_param.mutable_softmax_param()->set_axis(-1);
+  SoftmaxLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
 #ifdef USE_CUDNN
 template <typename Dtype>
 class CuDNNSoftmaxLayerTest : public GPUDeviceTest<Dtype> {
@@ -0,0 +1,48 @@
+#include <boost/bind.hpp>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/util/thread_pool.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class ThreadPoolTest : public ::testing::Test {};
+
+static void CountTask(vector<int>* counts, int i) {
+  ++(*counts)[i];
+}
+
+TEST_F(ThreadPoolTest, TestSingleThread) {
+  ThreadPool pool(1);
+  EXPECT_EQ(pool.num_threads(), 1);
+  vector<int> counts(10, 0);
+  pool.Run(counts.size(), boost::bind(&CountTask, &counts, _1));
+  for (int i = 0; i < counts.size(); ++i) {
+    EXPECT_EQ(counts[i], 1);
+  }
+}
+
+TEST_F(ThreadPoolTest, TestRunEachTaskOnce) {
+  ThreadPool pool(4);
+  EXPECT_EQ(pool.num_threads(), 4);
+  // Every call must run each task exactly once, also when the batches are
+  // smaller or larger than the pool.
+  const int sizes[] = {0, 1, 3, 4, 100, 1000};
+  for (int k = 0; k < sizeof(sizes) / sizeof(sizes[0]); ++k) {
+    vector<int> counts(sizes[k], 0);
+    pool.Run(counts.size(), boost::bind(&CountTask, &counts, _1));
+    for (int i = 0; i < counts.size(); ++i) {
+      EXPECT_EQ(counts[i], 1);
+    }
+  }
+}
+
+TEST_F(ThreadPoolTest, TestHardwareConcurrency) {
+  ThreadPool pool(0);
+  EXPECT_GE(pool.num_threads(), 1);
+}
+
+}  // namespace caffe
@@ -1,5 +1,8 @@
 #include <algorithm>
+#include <cfloat>
+#include <cmath>
 #include <csignal>
+#include <cstring>
 #include <ctime>
 #include <map>
 #include <string>
@@ -10,6 +13,13 @@
 
 #include "caffe/util/bbox_util.hpp"
 
+// The SSE and AVX2 nms kernels are compiled with function level target
+// attributes and picked at runtime, so no extra compiler flag is needed.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define USE_X86_NMS_KERNELS
+#endif
+
 namespace caffe {
 
 bool SortBBoxAscend(const NormalizedBBox& bbox1, const NormalizedBBox& bbox2) {
@@ -44,6 +54,54 @@ template bool SortScorePairDescend(const pair<float, int>& pair1,
 template bool SortScorePairDescend(const pair<float, pair<int, int> >& pair1,
                                    const pair<float, pair<int, int> >& pair2);
 
+// Order positions of score pairs by descending score and break ties by the
+// position, which is the order std::stable_sort keeps equal scores in.
+template <typename T>
+class ScorePositionDescend {
+ public:
+  explicit ScorePositionDescend(const vector<pair<float, T> >& score_pairs)
+      : score_pairs_(score_pairs) {}
+  bool operator()(const int i, const int j) const {
+    const float score1 = score_pairs_[i].first;
+    const float score2 = score_pairs_[j].first;
+    return score1 > score2 || (!(score2 > score1) && i < j);
+  }
+
+ private:
+  const vector<pair<float, T> >& score_pairs_;
+};
+
+template <typename T>
+void PartialSortScorePairDescend(const int top_k,
+      vector<pair<float, T> >* score_pairs) {
+  const int num = score_pairs->size();
+  if (top_k <= -1 || top_k >= num) {
+    std::stable_sort(score_pairs->begin(), score_pairs->end(),
+                     SortScorePairDescend<T>);
+    return;
+  }
+  // Select the top_k positions, then only sort those.
+  vector<int> positions(num);
+  for (int i = 0; i < num; ++i) {
+    positions[i] = i;
+  }
+  ScorePositionDescend<T> comp(*score_pairs);
+  std::nth_element(positions.begin(), positions.begin() + top_k,
+                   positions.end(), comp);
+  std::sort(positions.begin(), positions.begin() + top_k, comp);
+  vector<pair<float, T> > top_pairs(top_k);
+  for (int i = 0; i < top_k; ++i) {
+    top_pairs[i] = (*score_pairs)[positions[i]];
+  }
+  score_pairs->swap(top_pairs);
+}
+
+// Explicit initialization.
+template void PartialSortScorePairDescend(const int top_k,
+      vector<pair<float, int> >* score_pairs);
+template void PartialSortScorePairDescend(const int top_k,
+      vector<pair<float, pair<int, int> > >* score_pairs);
+
 NormalizedBBox UnitBBox() {
   NormalizedBBox unit_bbox;
   unit_bbox.set_xmin(0.);
@@ -166,6 +224,178 @@ float JaccardOverlap(const NormalizedBBox& bbox1, const NormalizedBBox& bbox2,
   }
 }
 
+float JaccardOverlap(const FlatBBoxes& bboxes, const int i, const int j) {
+  if (bboxes.xmin[j] > bboxes.xmax[i] || bboxes.xmax[j] < bboxes.xmin[i] ||
+      bboxes.ymin[j] > bboxes.ymax[i] || bboxes.ymax[j] < bboxes.ymin[i]) {
+    return 0.;
+  }
+  const float intersect_width =
+      std::min(bboxes.xmax[i], bboxes.xmax[j]) -
+      std::max(bboxes.xmin[i], bboxes.xmin[j]);
+  const float intersect_height =
+      std::min(bboxes.ymax[i], bboxes.ymax[j]) -
+      std::max(bboxes.ymin[i], bboxes.ymin[j]);
+  if (intersect_width > 0 && intersect_height > 0) {
+    const float intersect_size = intersect_width * intersect_height;
+    return intersect_size /
+        (bboxes.size[i] + bboxes.size[j] - intersect_size);
+  } else {
+    return 0.;
+  }
+}
+
+bool NMSKernelSupported(const NMSKernel kernel) {
+  switch (kernel) {
+    case NonMaximumSuppressionParameter_Kernel_AUTO:
+    case NonMaximumSuppressionParameter_Kernel_SCALAR:
+      return true;
+#ifdef USE_X86_NMS_KERNELS
+    case NonMaximumSuppressionParameter_Kernel_SSE:
+      return __builtin_cpu_supports("sse2");
+    case NonMaximumSuppressionParameter_Kernel_AVX2:
+      return __builtin_cpu_supports("avx2");
+#endif
+    default:
+      return false;
+  }
+}
+
+// Resolve AUTO to the widest kernel supported by the running CPU.
+static NMSKernel GetNMSKernel(const NMSKernel kernel) {
+  if (kernel == NonMaximumSuppressionParameter_Kernel_AUTO) {
+    static const NMSKernel best_kernel =
+        NMSKernelSupported(NonMaximumSuppressionParameter_Kernel_AVX2) ?
+        NonMaximumSuppressionParameter_Kernel_AVX2 :
+        NMSKernelSupported(NonMaximumSuppressionParameter_Kernel_SSE) ?
+        NonMaximumSuppressionParameter_Kernel_SSE :
+        NonMaximumSuppressionParameter_Kernel_SCALAR;
+    return best_kernel;
+  }
+  CHECK(NMSKernelSupported(kernel))
+      << "The " << NonMaximumSuppressionParameter_Kernel_Name(kernel)
+      << " nms kernel is not supported by this CPU.";
+  return kernel;
+}
+
+// The kernels below compute the overlap between the bbox (xmin, ymin, xmax,
+// ymax, size) and others[j] for j in [start, end). They use the same
+// operations, in the same order, as JaccardOverlap() so that all of them give
+// bit exact results.
+static void JaccardOverlapsScalar(const float xmin, const float ymin,
+    const float xmax, const float ymax, const float size,
+    const FlatBBoxes& others, const int start, const int end,
+    float* overlaps) {
+  for (int j = start; j < end; ++j) {
+    const float intersect_width = std::min(others.xmax[j], xmax) -
+        std::max(others.xmin[j], xmin);
+    const float intersect_height = std::min(others.ymax[j], ymax) -
+        std::max(others.ymin[j], ymin);
+    if (intersect_width > 0 && intersect_height > 0) {
+      const float intersect_size = intersect_width * intersect_height;
+      overlaps[j - start] =
+          intersect_size / (others.size[j] + size - intersect_size);
+    } else {
+      overlaps[j - start] = 0.;
+    }
+  }
+}
+
+#ifdef USE_X86_NMS_KERNELS
+__attribute__((target("sse2")))
+static void JaccardOverlapsSSE(const float xmin, const float ymin,
+    const float xmax, const float ymax, const float size,
+    const FlatBBoxes& others, const int start, const int end,
+    float* overlaps) {
+  const __m128 bbox_xmin = _mm_set1_ps(xmin);
+  const __m128 bbox_ymin = _mm_set1_ps(ymin);
+  const __m128 bbox_xmax = _mm_set1_ps(xmax);
+  const __m128 bbox_ymax = _mm_set1_ps(ymax);
+  const __m128 bbox_size = _mm_set1_ps(size);
+  const __m128 zero = _mm_setzero_ps();
+  int j = start;
+  for (; j + 4 <= end; j += 4) {
+    // _mm_min_ps(a, b) is (a < b ? a : b), which matches std::min(b, a).
+    const __m128 intersect_width = _mm_sub_ps(
+        _mm_min_ps(bbox_xmax, _mm_loadu_ps(&others.xmax[j])),
+        _mm_max_ps(bbox_xmin, _mm_loadu_ps(&others.xmin[j])));
+    const __m128 intersect_height = _mm_sub_ps(
+        _mm_min_ps(bbox_ymax, _mm_loadu_ps(&others.ymax[j])),
+        _mm_max_ps(bbox_ymin, _mm_loadu_ps(&others.ymin[j])));
+    const __m128 intersect_size =
+        _mm_mul_ps(intersect_width, intersect_height);
+    const __m128 overlap = _mm_div_ps(intersect_size, _mm_sub_ps(
+        _mm_add_ps(_mm_loadu_ps(&others.size[j]), bbox_size),
+        intersect_size));
+    const __m128 valid = _mm_and_ps(_mm_cmpgt_ps(intersect_width, zero),
+                                    _mm_cmpgt_ps(intersect_height, zero));
+    _mm_storeu_ps(overlaps + j - start, _mm_and_ps(valid, overlap));
+  }
+  JaccardOverlapsScalar(xmin, ymin, xmax, ymax, size, others, j, end,
+                        overlaps + j - start);
+}
+
+__attribute__((target("avx2")))
+static void JaccardOverlapsAVX2(const float xmin, const float ymin,
+    const float xmax, const float ymax, const float size,
+    const FlatBBoxes& others, const int start, const int end,
+    float* overlaps) {
+  const __m256 bbox_xmin = _mm256_set1_ps(xmin);
+  const __m256 bbox_ymin = _mm256_set1_ps(ymin);
+  const __m256 bbox_xmax = _mm256_set1_ps(xmax);
+  const __m256 bbox_ymax = _mm256_set1_ps(ymax);
+  const __m256 bbox_size = _mm256_set1_ps(size);
+  const __m256 zero = _mm256_setzero_ps();
+  int j = start;
+  for (; j + 8 <= end; j += 8) {
+    const __m256 intersect_width = _mm256_sub_ps(
+        _mm256_min_ps(bbox_xmax, _mm256_loadu_ps(&others.xmax[j])),
+        _mm256_max_ps(bbox_xmin, _mm256_loadu_ps(&others.xmin[j])));
+    const __m256 intersect_height = _mm256_sub_ps(
+        _mm256_min_ps(bbox_ymax, _mm256_loadu_ps(&others.ymax[j])),
+        _mm256_max_ps(bbox_ymin, _mm256_loadu_ps(&others.ymin[j])));
+    const __m256 intersect_size =
+        _mm256_mul_ps(intersect_width, intersect_height);
+    const __m256 overlap = _mm256_div_ps(intersect_size, _mm256_sub_ps(
+        _mm256_add_ps(_mm256_loadu_ps(&others.size[j]), bbox_size),
+        intersect_size));
+    const __m256 valid = _mm256_and_ps(
+        _mm256_cmp_ps(intersect_width, zero, _CMP_GT_OQ),
+        _mm256_cmp_ps(intersect_height, zero, _CMP_GT_OQ));
+    _mm256_storeu_ps(overlaps + j - start, _mm256_and_ps(valid, overlap));
+  }
+  JaccardOverlapsScalar(xmin, ymin, xmax, ymax, size, others, j, end,
+                        overlaps + j - start);
+}
+#endif  // USE_X86_NMS_KERNELS
+
+void JaccardOverlaps(const FlatBBoxes& bboxes, const int i,
+    const FlatBBoxes& others, const int start, const int end,
+    const NMSKernel kernel, float* overlaps) {
+  CHECK_GE(start, 0);
+  CHECK_LE(end, others.num());
+  const float xmin = bboxes.xmin[i];
+  const float ymin = bboxes.ymin[i];
+  const float xmax = bboxes.xmax[i];
+  const float ymax = bboxes.ymax[i];
+  const float size = bboxes.size[i];
+  switch (GetNMSKernel(kernel)) {
+#ifdef USE_X86_NMS_KERNELS
+    case NonMaximumSuppressionParameter_Kernel_AVX2:
+      JaccardOverlapsAVX2(xmin, ymin, xmax, ymax, size, others, start, end,
+                          overlaps);
+      break;
+    case NonMaximumSuppressionParameter_Kernel_SSE:
+      JaccardOverlapsSSE(xmin, ymin, xmax, ymax, size, others, start, end,
+                         overlaps);
+      break;
+#endif  // USE_X86_NMS_KERNELS
+    default:
+      JaccardOverlapsScalar(xmin, ymin, xmax, ymax, size, others, start, end,
+                            overlaps);
+      break;
+  }
+}
+
 float BBoxCoverage(const NormalizedBBox& bbox1, const NormalizedBBox& bbox2) {
   NormalizedBBox intersect_bbox;
   IntersectBBox(bbox1, bbox2, &intersect_bbox);
@@ -261,65 +491,79 @@ void EncodeBBox(
   }
 }
 
-void DecodeBBox(
-    const NormalizedBBox& prior_bbox, const vector<float>& prior_variance,
+// Decode a bbox given by its raw coordinates. It is shared by the
+// NormalizedBBox and the flat decoders so that both give identical results.
+static void DecodeBBox(const float* prior_bbox, const float* prior_variance,
     const CodeType code_type, const bool variance_encoded_in_target,
-    const NormalizedBBox& bbox, NormalizedBBox* decode_bbox) {
+    const float* bbox, float* decode_bbox) {
   if (code_type == PriorBoxParameter_CodeType_CORNER) {
     if (variance_encoded_in_target) {
       // variance is encoded in target, we simply need to add the offset
       // predictions.
-      decode_bbox->set_xmin(prior_bbox.xmin() + bbox.xmin());
-      decode_bbox->set_ymin(prior_bbox.ymin() + bbox.ymin());
-      decode_bbox->set_xmax(prior_bbox.xmax() + bbox.xmax());
-      decode_bbox->set_ymax(prior_bbox.ymax() + bbox.ymax());
+      decode_bbox[0] = prior_bbox[0] + bbox[0];
+      decode_bbox[1] = prior_bbox[1] + bbox[1];
+      decode_bbox[2] = prior_bbox[2] + bbox[2];
+      decode_bbox[3] = prior_bbox[3] + bbox[3];
     } else {
       // variance is encoded in bbox, we need to scale the offset accordingly.
-      decode_bbox->set_xmin(
-          prior_bbox.xmin() + prior_variance[0] * bbox.xmin());
-      decode_bbox->set_ymin(
-          prior_bbox.ymin() + prior_variance[1] * bbox.ymin());
-      decode_bbox->set_xmax(
-          prior_bbox.xmax() + prior_variance[2] * bbox.xmax());
-      decode_bbox->set_ymax(
-          prior_bbox.ymax() + prior_variance[3] * bbox.ymax());
+      decode_bbox[0] = prior_bbox[0] + prior_variance[0] * bbox[0];
+      decode_bbox[1] = prior_bbox[1] + prior_variance[1] * bbox[1];
+      decode_bbox[2] = prior_bbox[2] + prior_variance[2] * bbox[2];
+      decode_bbox[3] = prior_bbox[3] + prior_variance[3] * bbox[3];
     }
   } else if (code_type == PriorBoxParameter_CodeType_CENTER_SIZE) {
-    float prior_width = prior_bbox.xmax() - prior_bbox.xmin();
+    float prior_width = prior_bbox[2] - prior_bbox[0];
     CHECK_GT(prior_width, 0);
-    float prior_height = prior_bbox.ymax() - prior_bbox.ymin();
+    float prior_height = prior_bbox[3] - prior_bbox[1];
     CHECK_GT(prior_height, 0);
-    float prior_center_x = (prior_bbox.xmin() + prior_bbox.xmax()) / 2.;
-    float prior_center_y = (prior_bbox.ymin() + prior_bbox.ymax()) / 2.;
+    float prior_center_x = (prior_bbox[0] + prior_bbox[2]) / 2.;
+    float prior_center_y = (prior_bbox[1] + prior_bbox[3]) / 2.;
 
     float decode_bbox_center_x, decode_bbox_center_y;
     float decode_bbox_width, decode_bbox_height;
     if (variance_encoded_in_target) {
       // variance is encoded in target, we simply need to retore the offset
       // predictions.
-      decode_bbox_center_x = bbox.xmin() * prior_width + prior_center_x;
-      decode_bbox_center_y = bbox.ymin() * prior_height + prior_center_y;
-      decode_bbox_width = exp(bbox.xmax()) * prior_width;
-      decode_bbox_height = exp(bbox.ymax()) * prior_height;
+      decode_bbox_center_x = bbox[0] * prior_width + prior_center_x;
+      decode_bbox_center_y = bbox[1] * prior_height + prior_center_y;
+      decode_bbox_width = exp(bbox[2]) * prior_width;
+      decode_bbox_height = exp(bbox[3]) * prior_height;
     } else {
       // variance is encoded in bbox, we need to scale the offset accordingly.
       decode_bbox_center_x =
-          prior_variance[0] * bbox.xmin() * prior_width + prior_center_x;
+          prior_variance[0] * bbox[0] * prior_width + prior_center_x;
       decode_bbox_center_y =
-          prior_variance[1] * bbox.ymin() * prior_height + prior_center_y;
+          prior_variance[1] * bbox[1] * prior_height + prior_center_y;
       decode_bbox_width =
-          exp(prior_variance[2] * bbox.xmax()) * prior_width;
+          exp(prior_variance[2] * bbox[2]) * prior_width;
       decode_bbox_height =
-          exp(prior_variance[3] * bbox.ymax()) * prior_height;
+          exp(prior_variance[3] * bbox[3]) * prior_height;
     }
 
-    decode_bbox->set_xmin(decode_bbox_center_x - decode_bbox_width / 2.);
-    decode_bbox->set_ymin(decode_bbox_center_y - decode_bbox_height / 2.);
-    decode_bbox->set_xmax(decode_bbox_center_x + decode_bbox_width / 2.);
-    decode_bbox->set_ymax(decode_bbox_center_y + decode_bbox_height / 2.);
+    decode_bbox[0] = decode_bbox_center_x - decode_bbox_width / 2.;
+    decode_bbox[1] = decode_bbox_center_y - decode_bbox_height / 2.;
+    decode_bbox[2] = decode_bbox_center_x + decode_bbox_width / 2.;
+    decode_bbox[3] = decode_bbox_center_y + decode_bbox_height / 2.;
   } else {
     LOG(FATAL) << "Unknown LocLossType.";
   }
+}
+
+void DecodeBBox(
+    const NormalizedBBox& prior_bbox, const vector<float>& prior_variance,
+    const CodeType code_type, const bool variance_encoded_in_target,
+    const NormalizedBBox& bbox, NormalizedBBox* decode_bbox) {
+  const float prior_coords[4] = {prior_bbox.xmin(), prior_bbox.ymin(),
+                                 prior_bbox.xmax(), prior_bbox.ymax()};
+  const float bbox_coords[4] = {bbox.xmin(), bbox.ymin(),
+                                bbox.xmax(), bbox.ymax()};
+  float decode_coords[4];
+  DecodeBBox(prior_coords, prior_variance.data(), code_type,
+             variance_encoded_in_target, bbox_coords, decode_coords);
+  decode_bbox->set_xmin(decode_coords[0]);
+  decode_bbox->set_ymin(decode_coords[1]);
+  decode_bbox->set_xmax(decode_coords[2]);
+  decode_bbox->set_ymax(decode_coords[3]);
   float bbox_size = BBoxSize(*decode_bbox);
   decode_bbox->set_size(bbox_size);
 }
@@ -377,6 +621,127 @@ void DecodeBBoxesAll(const vector<LabelBBox>& all_loc_preds,
   }
 }
 
+// Decode the bbox of prior p into decode_bboxes.
+template <typename Dtype>
+static inline void DecodeFlatBBox(const Dtype* loc_data,
+    const FlatBBoxes& prior_bboxes, const vector<float>& prior_variances,
+    const CodeType code_type, const bool variance_encoded_in_target,
+    const int num_loc_classes, const int loc_class, const int p,
+    FlatBBoxes* decode_bboxes) {
+  const int start_idx = (p * num_loc_classes + loc_class) * 4;
+  const float prior_coords[4] = {
+      prior_bboxes.xmin[p], prior_bboxes.ymin[p],
+      prior_bboxes.xmax[p], prior_bboxes.ymax[p]};
+  const float bbox_coords[4] = {
+      static_cast<float>(loc_data[start_idx]),
+      static_cast<float>(loc_data[start_idx + 1]),
+      static_cast<float>(loc_data[start_idx + 2]),
+      static_cast<float>(loc_data[start_idx + 3])};
+  float decode_coords[4];
+  DecodeBBox(prior_coords, &prior_variances[p * 4], code_type,
+             variance_encoded_in_target, bbox_coords, decode_coords);
+  const float xmin = decode_coords[0];
+  const float ymin = decode_coords[1];
+  const float xmax = decode_coords[2];
+  const float ymax = decode_coords[3];
+  decode_bboxes->xmin[p] = xmin;
+  decode_bboxes->ymin[p] = ymin;
+  decode_bboxes->xmax[p] = xmax;
+  decode_bboxes->ymax[p] = ymax;
+  if (xmax < xmin || ymax < ymin) {
+    decode_bboxes->size[p] = 0;
+  } else {
+    decode_bboxes->size[p] = (xmax - xmin) * (ymax - ymin);
+  }
+}
+
+template <typename Dtype>
+void DecodeBBoxes(const Dtype* loc_data, const FlatBBoxes& prior_bboxes,
+    const vector<float>& prior_variances, const CodeType code_type,
+    const bool variance_encoded_in_target, const int num_loc_classes,
+    const int loc_class, FlatBBoxes* decode_bboxes) {
+  const int num_priors = prior_bboxes.num();
+  CHECK_EQ(prior_variances.size(), num_priors * 4);
+  CHECK_LT(loc_class, num_loc_classes);
+  decode_bboxes->Resize(num_priors);
+  for (int p = 0; p < num_priors; ++p) {
+    DecodeFlatBBox(loc_data, prior_bboxes, prior_variances, code_type,
+                   variance_encoded_in_target, num_loc_classes, loc_class, p,
+                   decode_bboxes);
+  }
+}
+
+// Explicit initialization.
+template void DecodeBBoxes(const float* loc_data,
+    const FlatBBoxes& prior_bboxes, const vector<float>& prior_variances,
+    const CodeType code_type, const bool variance_encoded_in_target,
+    const int num_loc_classes, const int loc_class,
+    FlatBBoxes* decode_bboxes);
+template void DecodeBBoxes(const double* loc_data,
+    const FlatBBoxes& prior_bboxes, const vector<float>& prior_variances,
+    const CodeType code_type, const bool variance_encoded_in_target,
+    const int num_loc_classes, const int loc_class,
+    FlatBBoxes* decode_bboxes);
+
+template <typename Dtype>
+void DecodeBBoxes(const Dtype* loc_data, const FlatBBoxes& prior_bboxes,
+    const vector<float>& prior_variances, const CodeType code_type,
+    const bool variance_encoded_in_target, const int num_loc_classes,
+    const int loc_class, const vector<int>& indices,
+    FlatBBoxes* decode_bboxes) {
+  const int num_priors = prior_bboxes.num();
+  CHECK_EQ(prior_variances.size(), num_priors * 4);
+  CHECK_LT(loc_class, num_loc_classes);
+  decode_bboxes->Resize(num_priors);
+  for (int i = 0; i < indices.size(); ++i) {
+    DecodeFlatBBox(loc_data, prior_bboxes, prior_variances, code_type,
+                   variance_encoded_in_target, num_loc_classes, loc_class,
+                   indices[i], decode_bboxes);
+  }
+}
+
+// Explicit initialization.
+template void DecodeBBoxes(const float* loc_data,
+    const FlatBBoxes& prior_bboxes, const vector<float>& prior_variances,
+    const CodeType code_type, const bool variance_encoded_in_target,
+    const int num_loc_classes, const int loc_class, const vector<int>& indices,
+    FlatBBoxes* decode_bboxes);
+template void DecodeBBoxes(const double* loc_data,
+    const FlatBBoxes& prior_bboxes, const vector<float>& prior_variances,
+    const CodeType code_type, const bool variance_encoded_in_target,
+    const int num_loc_classes, const int loc_class, const vector<int>& indices,
+    FlatBBoxes* decode_bboxes);
+
+void GetCandidatePriors(const float* conf_scores, const int num_priors,
+    const int num_classes, const int background_label_id, const int label,
+    const float threshold, vector<int>* indices) {
+  indices->clear();
+  if (label > -1) {
+    const float* scores = conf_scores + label * num_priors;
+    for (int p = 0; p < num_priors; ++p) {
+      if (scores[p] > threshold) {
+        indices->push_back(p);
+      }
+    }
+    return;
+  }
+  vector<char> is_candidate(num_priors, false);
+  for (int c = 0; c < num_classes; ++c) {
+    if (c == background_label_id) {
+      continue;
+    }
+    const float* scores = conf_scores + c * num_priors;
+    for (int p = 0; p < num_priors; ++p) {
+      is_candidate[p] |= scores[p] > threshold;
+    }
+  }
+  for (int p = 0; p < num_priors; ++p) {
+    if (is_candidate[p]) {
+      indices->push_back(p);
+    }
+  }
+}
+
 void MatchBBox(const vector<NormalizedBBox>& gt_bboxes,
     const vector<NormalizedBBox>& pred_bboxes, const int label,
     const MatchType match_type, const float overlap_threshold,
@@ -510,6 +875,135 @@ void MatchBBox(const vector<NormalizedBBox>& gt_bboxes,
   return;
 }
 
+// Find the unmatched prediction which overlaps the most with a ground truth,
+// taking the lowest index on ties. overlaps holds the overlap with each
+// prediction. Return -1 if no unmatched prediction overlaps with it.
+static int FindBestPrediction(const float* overlaps, const int num_pred,
+    const vector<int>& match_indices, float* best_overlap) {
+  int best_idx = -1;
+  *best_overlap = -1;
+  for (int i = 0; i < num_pred; ++i) {
+    if (match_indices[i] == -1 && overlaps[i] > 1e-6 &&
+        overlaps[i] > *best_overlap) {
+      best_idx = i;
+      *best_overlap = overlaps[i];
+    }
+  }
+  return best_idx;
+}
+
+void MatchBBox(const FlatBBoxes& gt_bboxes, const vector<int>& gt_labels,
+    const FlatBBoxes& pred_bboxes, const int label,
+    const MatchType match_type, const float overlap_threshold,
+    vector<int>* match_indices, vector<float>* match_overlaps,
+    const NMSKernel kernel) {
+  const int num_pred = pred_bboxes.num();
+  match_indices->assign(num_pred, -1);
+  match_overlaps->assign(num_pred, 0.);
+
+  vector<int> gt_indices;
+  for (int i = 0; i < gt_bboxes.num(); ++i) {
+    // label -1 means comparing against all ground truth.
+    if (label == -1 || gt_labels[i] == label) {
+      gt_indices.push_back(i);
+    }
+  }
+  const int num_gt = gt_indices.size();
+  if (num_gt == 0 || num_pred == 0) {
+    return;
+  }
+
+  // overlaps[j * num_pred + i] is the overlap between the j-th ground truth
+  // and the i-th prediction. Only overlaps above 1e-6 are positive.
+  vector<float> overlaps(num_gt * num_pred);
+  for (int j = 0; j < num_gt; ++j) {
+    float* gt_overlaps = &overlaps[j * num_pred];
+    JaccardOverlaps(gt_bboxes, gt_indices[j], pred_bboxes, 0, num_pred,
+                    kernel, gt_overlaps);
+    for (int i = 0; i < num_pred; ++i) {
+      if (gt_overlaps[i] > 1e-6) {
+        (*match_overlaps)[i] = std::max((*match_overlaps)[i], gt_overlaps[i]);
+      }
+    }
+  }
+
+  // Bipartite matching. Keep the best unmatched prediction of each gt in the
+  // pool, so that only the gts whose best prediction just got matched need
+  // to be scanned again.
+  vector<int> best_idx(num_gt);
+  vector<float> best_overlap(num_gt);
+  for (int j = 0; j < num_gt; ++j) {
+    best_idx[j] = FindBestPrediction(&overlaps[j * num_pred], num_pred,
+                                     *match_indices, &best_overlap[j]);
+  }
+  vector<bool> in_pool(num_gt, true);
+  while (true) {
+    // Find the most overlapped pair, taking the lowest prediction index and
+    // then the lowest gt index on ties, as the NormalizedBBox version does.
+    int max_idx = -1;
+    int max_gt_idx = -1;
+    float max_overlap = -1;
+    for (int j = 0; j < num_gt; ++j) {
+      if (!in_pool[j] || best_idx[j] == -1) {
+        continue;
+      }
+      if (best_overlap[j] > max_overlap ||
+          (best_overlap[j] == max_overlap && best_idx[j] < max_idx)) {
+        max_idx = best_idx[j];
+        max_gt_idx = j;
+        max_overlap = best_overlap[j];
+      }
+    }
+    if (max_idx == -1) {
+      // Cannot find good match.
+      break;
+    }
+    (*match_indices)[max_idx] = gt_indices[max_gt_idx];
+    (*match_overlaps)[max_idx] = max_overlap;
+    in_pool[max_gt_idx] = false;
+    for (int j = 0; j < num_gt; ++j) {
+      if (in_pool[j] && best_idx[j] == max_idx) {
+        best_idx[j] = FindBestPrediction(&overlaps[j * num_pred], num_pred,
+                                         *match_indices, &best_overlap[j]);
+      }
+    }
+  }
+
+  switch (match_type) {
+    case MultiBoxLossParameter_MatchType_BIPARTITE:
+      // Already done.
+      break;
+    case MultiBoxLossParameter_MatchType_PER_PREDICTION: {
+      // Get most overlaped gt for the rest prediction bboxes. Walk the gts in
+      // order so that ties go to the lowest gt index.
+      vector<int> max_gt_idx(num_pred, -1);
+      vector<float> max_overlap(num_pred, -1);
+      for (int j = 0; j < num_gt; ++j) {
+        const float* gt_overlaps = &overlaps[j * num_pred];
+        for (int i = 0; i < num_pred; ++i) {
+          const float overlap = gt_overlaps[i];
+          if ((*match_indices)[i] == -1 && overlap > 1e-6 &&
+              overlap >= overlap_threshold && overlap > max_overlap[i]) {
+            max_gt_idx[i] = j;
+            max_overlap[i] = overlap;
+          }
+        }
+      }
+      for (int i = 0; i < num_pred; ++i) {
+        if (max_gt_idx[i] != -1) {
+          // Found a matched ground truth.
+          (*match_indices)[i] = gt_indices[max_gt_idx[i]];
+          (*match_overlaps)[i] = max_overlap[i];
+        }
+      }
+      break;
+    }
+    default:
+      LOG(FATAL) << "Unknown matching type.";
+      break;
+  }
+}
+
 template <typename Dtype>
 void GetGroundTruth(const Dtype* gt_data, const int num_gt,
       const int background_label_id, const bool use_difficult_gt,
@@ -685,40 +1179,133 @@ template void GetConfidenceScores(const double* conf_data, const int num,
       const bool class_major, vector<map<int, vector<float> > >* conf_preds);
 
 template <typename Dtype>
-void GetMaxConfidenceScores(const Dtype* conf_data, const int num,
+void GetConfidenceScores(const Dtype* conf_data,
       const int num_preds_per_class, const int num_classes,
-      const int background_label_id, const ConfLossType loss_type,
-      vector<vector<float> >* all_max_scores) {
-  all_max_scores->clear();
-  for (int i = 0; i < num; ++i) {
-    vector<float> max_scores;
-    for (int p = 0; p < num_preds_per_class; ++p) {
-      int start_idx = p * num_classes;
-      Dtype maxval = -FLT_MAX;
-      Dtype maxval_pos = -FLT_MAX;
+      vector<float>* conf_scores) {
+  conf_scores->resize(num_preds_per_class * num_classes);
+  float* scores = conf_scores->data();
+  for (int p = 0; p < num_preds_per_class; ++p) {
+    int start_idx = p * num_classes;
+    for (int c = 0; c < num_classes; ++c) {
+      scores[c * num_preds_per_class + p] = conf_data[start_idx + c];
+    }
+  }
+}
+
+// Explicit initialization.
+template void GetConfidenceScores(const float* conf_data,
+      const int num_preds_per_class, const int num_classes,
+      vector<float>* conf_scores);
+template void GetConfidenceScores(const double* conf_data,
+      const int num_preds_per_class, const int num_classes,
+      vector<float>* conf_scores);
+
+// Fused softmax for GetMaxConfidenceScores(). The confidences of a block of
+// priors are shifted by their max, exponentiated at once and summed.
+template <typename Dtype>
+static void GetMaxSoftmaxScoresFast(const Dtype* conf_data,
+      const int num_preds_per_class, const int num_classes,
+      const int background_label_id, float* max_scores) {
+  // Small enough for the block to stay in cache.
+  const int block_size = 64;
+  vector<float> block(block_size * num_classes);
+  vector<int> pos_labels(block_size);
+  for (int start = 0; start < num_preds_per_class; start += block_size) {
+    const int end = std::min(start + block_size, num_preds_per_class);
+    for (int p = start; p < end; ++p) {
+      const Dtype* cur_conf_data = conf_data + p * num_classes;
+      float* x = &block[(p - start) * num_classes];
+      float maxval = -FLT_MAX;
+      float maxval_pos = -FLT_MAX;
+      int pos_label = -1;
       for (int c = 0; c < num_classes; ++c) {
-        maxval = std::max<Dtype>(conf_data[start_idx + c], maxval);
-        if (c != background_label_id) {
+        x[c] = cur_conf_data[c];
+        maxval = std::max(x[c], maxval);
+        if (c != background_label_id && x[c] > maxval_pos) {
           // Find maximum scores for positive classes.
-          maxval_pos = std::max<Dtype>(conf_data[start_idx + c], maxval_pos);
+          maxval_pos = x[c];
+          pos_label = c;
         }
       }
-      if (loss_type == MultiBoxLossParameter_ConfLossType_SOFTMAX) {
-        // Compute softmax probability.
-        Dtype sum = 0.;
-        for (int c = 0; c < num_classes; ++c) {
-          sum += std::exp(conf_data[start_idx + c] - maxval);
-        }
-        maxval_pos = std::exp(maxval_pos - maxval) / sum;
-      } else if (loss_type == MultiBoxLossParameter_ConfLossType_LOGISTIC) {
-        maxval_pos = 1. / (1. + exp(-maxval_pos));
-      } else {
-        LOG(FATAL) << "Unknown conf loss type.";
+      for (int c = 0; c < num_classes; ++c) {
+        x[c] -= maxval;
       }
-      max_scores.push_back(maxval_pos);
+      pos_labels[p - start] = pos_label;
     }
+    caffe_exp_nonpositive((end - start) * num_classes, &block[0]);
+    for (int p = start; p < end; ++p) {
+      const float* x = &block[(p - start) * num_classes];
+      float sum = 0.;
+      for (int c = 0; c < num_classes; ++c) {
+        sum += x[c];
+      }
+      const int pos_label = pos_labels[p - start];
+      max_scores[p] = pos_label == -1 ? 0. : x[pos_label] / sum;
+    }
+  }
+}
+
+template <typename Dtype>
+void GetMaxConfidenceScores(const Dtype* conf_data,
+      const int num_preds_per_class, const int num_classes,
+      const int background_label_id, const ConfLossType loss_type,
+      const bool fast_softmax, float* max_scores) {
+  if (fast_softmax && loss_type == MultiBoxLossParameter_ConfLossType_SOFTMAX) {
+    GetMaxSoftmaxScoresFast(conf_data, num_preds_per_class, num_classes,
+                            background_label_id, max_scores);
+    return;
+  }
+  for (int p = 0; p < num_preds_per_class; ++p) {
+    int start_idx = p * num_classes;
+    Dtype maxval = -FLT_MAX;
+    Dtype maxval_pos = -FLT_MAX;
+    for (int c = 0; c < num_classes; ++c) {
+      maxval = std::max<Dtype>(conf_data[start_idx + c], maxval);
+      if (c != background_label_id) {
+        // Find maximum scores for positive classes.
+        maxval_pos = std::max<Dtype>(conf_data[start_idx + c], maxval_pos);
+      }
+    }
+    if (loss_type == MultiBoxLossParameter_ConfLossType_SOFTMAX) {
+      // Compute softmax probability.
+      Dtype sum = 0.;
+      for (int c = 0; c < num_classes; ++c) {
+        sum += std::exp(conf_data[start_idx + c] - maxval);
+      }
+      maxval_pos = std::exp(maxval_pos - maxval) / sum;
+    } else if (loss_type == MultiBoxLossParameter_ConfLossType_LOGISTIC) {
+      maxval_pos = 1. / (1. + exp(-maxval_pos));
+    } else {
+      LOG(FATAL) << "Unknown conf loss type.";
+    }
+    max_scores[p] = maxval_pos;
+  }
+}
+
+// Explicit initialization.
+template void GetMaxConfidenceScores(const float* conf_data,
+      const int num_preds_per_class, const int num_classes,
+      const int background_label_id, const ConfLossType loss_type,
+      const bool fast_softmax, float* max_scores);
+template void GetMaxConfidenceScores(const double* conf_data,
+      const int num_preds_per_class, const int num_classes,
+      const int background_label_id, const ConfLossType loss_type,
+      const bool fast_softmax, float* max_scores);
+
+template <typename Dtype>
+void GetMaxConfidenceScores(const Dtype* conf_data, const int num,
+      const int num_preds_per_class, const int num_classes,
+      const int background_label_id, const ConfLossType loss_type,
+      vector<vector<float> >* all_max_scores) {
+  all_max_scores->clear();
+  all_max_scores->resize(num);
+  for (int i = 0; i < num; ++i) {
+    vector<float>& max_scores = (*all_max_scores)[i];
+    max_scores.resize(num_preds_per_class);
+    GetMaxConfidenceScores(conf_data, num_preds_per_class, num_classes,
+                           background_label_id, loss_type, false,
+                           max_scores.data());
     conf_data += num_preds_per_class * num_classes;
-    all_max_scores->push_back(max_scores);
   }
 }
 
@@ -768,6 +1355,36 @@ template void GetPriorBBoxes(const double* prior_data, const int num_priors,
       vector<NormalizedBBox>* prior_bboxes,
       vector<vector<float> >* prior_variances);
 
+template <typename Dtype>
+void GetPriorBBoxes(const Dtype* prior_data, const int num_priors,
+      FlatBBoxes* prior_bboxes, vector<float>* prior_variances) {
+  prior_bboxes->Resize(num_priors);
+  for (int i = 0; i < num_priors; ++i) {
+    int start_idx = i * 4;
+    const float xmin = prior_data[start_idx];
+    const float ymin = prior_data[start_idx + 1];
+    const float xmax = prior_data[start_idx + 2];
+    const float ymax = prior_data[start_idx + 3];
+    prior_bboxes->xmin[i] = xmin;
+    prior_bboxes->ymin[i] = ymin;
+    prior_bboxes->xmax[i] = xmax;
+    prior_bboxes->ymax[i] = ymax;
+    if (xmax < xmin || ymax < ymin) {
+      prior_bboxes->size[i] = 0;
+    } else {
+      prior_bboxes->size[i] = (xmax - xmin) * (ymax - ymin);
+    }
+  }
+  prior_variances->assign(prior_data + num_priors * 4,
+                          prior_data + num_priors * 8);
+}
+
+// Explicit initialization.
+template void GetPriorBBoxes(const float* prior_data, const int num_priors,
+      FlatBBoxes* prior_bboxes, vector<float>* prior_variances);
+template void GetPriorBBoxes(const double* prior_data, const int num_priors,
+      FlatBBoxes* prior_bboxes, vector<float>* prior_variances);
+
 template <typename Dtype>
 void GetDetectionResults(const Dtype* det_data, const int num_det,
       const int background_label_id,
@@ -811,19 +1428,54 @@ void GetTopKScoreIndex(const vector<float>& scores, const vector<int>& indices,
     score_index_vec->push_back(std::make_pair(scores[i], indices[i]));
   }
 
-  // Sort the score pair according to the scores in descending order
-  std::stable_sort(score_index_vec->begin(), score_index_vec->end(),
-                   SortScorePairDescend<int>);
+  // Sort the score pair according to the scores in descending order and keep
+  // top_k scores if needed.
+  PartialSortScorePairDescend(top_k, score_index_vec);
+}
 
-  // Keep top_k scores if needed.
-  if (top_k > -1 && top_k < score_index_vec->size()) {
-    score_index_vec->resize(top_k);
+// Do greedy nms on candidates, which are sorted by score in descending order.
+// Each kept bbox is compared against all the remaining candidates at once with
+// the given kernel, and the ones overlapping it by more than threshold are
+// dropped from candidates.
+//    max_kept: if not -1, stop after keeping max_kept bboxes.
+//    candidate_indices: the original index of each candidate.
+static void ApplyNMSSorted(const float threshold, const int max_kept,
+      const NMSKernel kernel, FlatBBoxes* candidates,
+      vector<int>* candidate_indices, vector<int>* indices) {
+  indices->clear();
+  int num_left = candidates->num();
+  vector<float> overlaps(num_left);
+  for (int k = 0; k < num_left; ++k) {
+    indices->push_back((*candidate_indices)[k]);
+    if (max_kept > -1 && indices->size() >= max_kept) {
+      break;
+    }
+    JaccardOverlaps(*candidates, k, *candidates, k + 1, num_left, kernel,
+                    overlaps.data());
+    // Compact the candidates which survive the current kept bbox, starting
+    // from the first suppressed one.
+    int num_survived = k + 1;
+    while (num_survived < num_left &&
+           overlaps[num_survived - k - 1] <= threshold) {
+      ++num_survived;
+    }
+    for (int j = num_survived + 1; j < num_left; ++j) {
+      candidates->xmin[num_survived] = candidates->xmin[j];
+      candidates->ymin[num_survived] = candidates->ymin[j];
+      candidates->xmax[num_survived] = candidates->xmax[j];
+      candidates->ymax[num_survived] = candidates->ymax[j];
+      candidates->size[num_survived] = candidates->size[j];
+      (*candidate_indices)[num_survived] = (*candidate_indices)[j];
+      num_survived += overlaps[j - k - 1] <= threshold;
+    }
+    num_left = num_survived;
   }
 }
 
 void ApplyNMS(const vector<NormalizedBBox>& bboxes, const vector<float>& scores,
       const float threshold, const int top_k, const bool reuse_overlaps,
-      map<int, map<int, float> >* overlaps, vector<int>* indices) {
+      map<int, map<int, float> >* overlaps, vector<int>* indices,
+      const NMSKernel kernel) {
   // Sanity check.
   CHECK_EQ(bboxes.size(), scores.size())
       << "bboxes and scores have different size.";
@@ -834,6 +1486,34 @@ void ApplyNMS(const vector<NormalizedBBox>& bboxes, const vector<float>& scores,
   vector<pair<float, int> > score_index_vec;
   GetTopKScoreIndex(scores, idx, top_k, &score_index_vec);
 
+  if (!reuse_overlaps &&
+      GetNMSKernel(kernel) != NonMaximumSuppressionParameter_Kernel_SCALAR) {
+    // Gather the candidates in score order. Small boxes are never kept and
+    // never suppress others, so they are dropped upfront.
+    FlatBBoxes candidates;
+    candidates.Resize(score_index_vec.size());
+    vector<int> candidate_indices(score_index_vec.size());
+    int num_candidates = 0;
+    for (int i = 0; i < score_index_vec.size(); ++i) {
+      const NormalizedBBox& bbox = bboxes[score_index_vec[i].second];
+      const float bbox_size = BBoxSize(bbox);
+      if (bbox_size < 1e-5) {
+        continue;
+      }
+      candidates.xmin[num_candidates] = bbox.xmin();
+      candidates.ymin[num_candidates] = bbox.ymin();
+      candidates.xmax[num_candidates] = bbox.xmax();
+      candidates.ymax[num_candidates] = bbox.ymax();
+      candidates.size[num_candidates] = bbox_size;
+      candidate_indices[num_candidates] = score_index_vec[i].second;
+      ++num_candidates;
+    }
+    candidates.Resize(num_candidates);
+    ApplyNMSSorted(threshold, top_k, kernel, &candidates, &candidate_indices,
+                   indices);
+    return;
+  }
+
   // Do nms.
   indices->clear();
   while (score_index_vec.size() != 0) {
@@ -930,19 +1610,15 @@ void GetMaxScoreIndex(const vector<float>& scores, const float threshold,
     }
   }
 
-  // Sort the score pair according to the scores in descending order
-  std::stable_sort(score_index_vec->begin(), score_index_vec->end(),
-                   SortScorePairDescend<int>);
-
-  // Keep top_k scores if needed.
-  if (top_k > -1 && top_k < score_index_vec->size()) {
-    score_index_vec->resize(top_k);
-  }
+  // Sort the score pair according to the scores in descending order and keep
+  // top_k scores if needed.
+  PartialSortScorePairDescend(top_k, score_index_vec);
 }
 
 void ApplyNMSFast(const vector<NormalizedBBox>& bboxes,
       const vector<float>& scores, const float score_threshold,
-      const float nms_threshold, const int top_k, vector<int>* indices) {
+      const float nms_threshold, const int top_k, vector<int>* indices,
+      const NMSKernel kernel) {
   // Sanity check.
   CHECK_EQ(bboxes.size(), scores.size())
       << "bboxes and scores have different size.";
@@ -951,6 +1627,26 @@ void ApplyNMSFast(const vector<NormalizedBBox>& bboxes,
   vector<pair<float, int> > score_index_vec;
   GetMaxScoreIndex(scores, score_threshold, top_k, &score_index_vec);
 
+  if (GetNMSKernel(kernel) != NonMaximumSuppressionParameter_Kernel_SCALAR) {
+    // Gather the candidates in score order.
+    const int num_candidates = score_index_vec.size();
+    FlatBBoxes candidates;
+    candidates.Resize(num_candidates);
+    vector<int> candidate_indices(num_candidates);
+    for (int i = 0; i < num_candidates; ++i) {
+      const NormalizedBBox& bbox = bboxes[score_index_vec[i].second];
+      candidates.xmin[i] = bbox.xmin();
+      candidates.ymin[i] = bbox.ymin();
+      candidates.xmax[i] = bbox.xmax();
+      candidates.ymax[i] = bbox.ymax();
+      candidates.size[i] = BBoxSize(bbox);
+      candidate_indices[i] = score_index_vec[i].second;
+    }
+    ApplyNMSSorted(nms_threshold, -1, kernel, &candidates, &candidate_indices,
+                   indices);
+    return;
+  }
+
   // Do nms.
   indices->clear();
   while (score_index_vec.size() != 0) {
@@ -972,6 +1668,67 @@ void ApplyNMSFast(const vector<NormalizedBBox>& bboxes,
   }
 }
 
+void GetMaxScoreIndex(const float* scores, const int num,
+      const float threshold, const int top_k,
+      vector<pair<float, int> >* score_index_vec) {
+  // Generate index score pairs.
+  for (int i = 0; i < num; ++i) {
+    if (scores[i] > threshold) {
+      score_index_vec->push_back(std::make_pair(scores[i], i));
+    }
+  }
+
+  // Sort the score pair according to the scores in descending order and keep
+  // top_k scores if needed.
+  PartialSortScorePairDescend(top_k, score_index_vec);
+}
+
+void ApplyNMSFast(const FlatBBoxes& bboxes, const float* scores,
+      const float score_threshold, const float nms_threshold, const int top_k,
+      vector<int>* indices, const NMSKernel kernel) {
+  // Get top_k scores (with corresponding indices).
+  vector<pair<float, int> > score_index_vec;
+  GetMaxScoreIndex(scores, bboxes.num(), score_threshold, top_k,
+                   &score_index_vec);
+
+  if (GetNMSKernel(kernel) != NonMaximumSuppressionParameter_Kernel_SCALAR) {
+    // Gather the candidates in score order.
+    const int num_candidates = score_index_vec.size();
+    FlatBBoxes candidates;
+    candidates.Resize(num_candidates);
+    vector<int> candidate_indices(num_candidates);
+    for (int i = 0; i < num_candidates; ++i) {
+      const int idx = score_index_vec[i].second;
+      candidates.xmin[i] = bboxes.xmin[idx];
+      candidates.ymin[i] = bboxes.ymin[idx];
+      candidates.xmax[i] = bboxes.xmax[idx];
+      candidates.ymax[i] = bboxes.ymax[idx];
+      candidates.size[i] = bboxes.size[idx];
+      candidate_indices[i] = idx;
+    }
+    ApplyNMSSorted(nms_threshold, -1, kernel, &candidates, &candidate_indices,
+                   indices);
+    return;
+  }
+
+  // Do nms.
+  indices->clear();
+  for (int i = 0; i < score_index_vec.size(); ++i) {
+    const int idx = score_index_vec[i].second;
+    bool keep = true;
+    for (int k = 0; k < indices->size(); ++k) {
+      const int kept_idx = (*indices)[k];
+      keep = JaccardOverlap(bboxes, idx, kept_idx) <= nms_threshold;
+      if (!keep) {
+        break;
+      }
+    }
+    if (keep) {
+      indices->push_back(idx);
+    }
+  }
+}
+
 void CumSum(const vector<pair<float, int> >& pairs, vector<int>* cumsum) {
   // Sort the pairs based on first item of the pair.
   vector<pair<float, int> > sort_pairs = pairs;
@@ -0,0 +1,185 @@
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "caffe/net.hpp"
+#include "caffe/util/bbox_util.hpp"
+#include "caffe/util/int8_calibration.hpp"
+
+namespace caffe {
+
+// Whether the layer runs with int8 arithmetic when it has bottom_max, as
+// checked by ConvolutionLayer and InnerProductLayer.
+static bool SupportsInt8(const LayerParameter& param,
+    const Blob<float>& bottom) {
+  if (param.type() == "Convolution") {
+    const ConvolutionParameter& conv_param = param.convolution_param();
+    return conv_param.group() == 1 && !conv_param.force_nd_im2col() &&
+        bottom.num_axes() == 4 && bottom.CanonicalAxisIndex(conv_param.axis())
+        == 1;
+  }
+  if (param.type() == "InnerProduct") {
+    return !param.inner_product_param().transpose();
+  }
+  return false;
+}
+
+void CalibrateInt8(const NetParameter& net_param, const string& weights,
+    const int iterations, NetParameter* int8_param) {
+  // Run the layers one at a time, so that each bottom is read before any
+  // in-place layer that follows overwrites it.
+  map<string, float> bottom_max;
+  {
+    Net<float> net(net_param);
+    net.CopyTrainedLayersFrom(weights);
+    vector<int> layer_ids;
+    for (int i = 0; i < net.layers().size(); ++i) {
+      const LayerParameter& param = net.layers()[i]->layer_param();
+      if (net.bottom_vecs()[i].size() == 1 &&
+          SupportsInt8(param, *net.bottom_vecs()[i][0])) {
+        layer_ids.push_back(i);
+        bottom_max[param.name()] = 0;
+      }
+    }
+    for (int iter = 0; iter < iterations; ++iter) {
+      int start = 0;
+      for (int i = 0; i < layer_ids.size(); ++i) {
+        if (layer_ids[i] > start) {
+          net.ForwardFromTo(start, layer_ids[i] - 1);
+        }
+        const Blob<float>& bottom = *net.bottom_vecs()[layer_ids[i]][0];
+        float& max_abs = bottom_max[net.layer_names()[layer_ids[i]]];
+        for (int k = 0; k < bottom.count(); ++k) {
+          max_abs = std::max(max_abs, std::fabs(bottom.cpu_data()[k]));
+        }
+        start = layer_ids[i];
+      }
+      net.ForwardFromTo(start, net.layers().size() - 1);
+    }
+  }
+
+  int8_param->CopyFrom(net_param);
+  for (int i = 0; i < int8_param->layer_size(); ++i) {
+    LayerParameter* layer_param = int8_param->mutable_layer(i);
+    map<string, float>::const_iterator it =
+        bottom_max.find(layer_param->name());
+    if (it == bottom_max.end()) {
+      continue;
+    }
+    if (it->second > 0) {
+      layer_param->mutable_quantization_param()->set_bottom_max(it->second);
+      LOG(INFO) << "Layer " << it->first << ": bottom_max = " << it->second;
+    } else {
+      LOG(WARNING) << "Layer " << it->first << " keeps FP32, its bottom is 0";
+    }
+  }
+}
+
+vector<float> TestNetOutputs(const NetParameter& net_param,
+    const string& weights, const int iterations, const string& ap_version,
+    vector<string>* output_names, vector<bool>* is_map) {
+  // The net is deleted on return, so that the next one reads the same data.
+  Net<float> net(net_param);
+  net.CopyTrainedLayersFrom(weights);
+  const int num_outputs = net.num_outputs();
+  output_names->clear();
+  is_map->assign(num_outputs, false);
+  for (int j = 0; j < num_outputs; ++j) {
+    const int blob_id = net.output_blob_indices()[j];
+    output_names->push_back(net.blob_names()[blob_id]);
+    for (int i = 0; i < net.layers().size(); ++i) {
+      const vector<int>& top_ids = net.top_ids(i);
+      if (string(net.layers()[i]->type()) == "DetectionEvaluate" &&
+          std::find(top_ids.begin(), top_ids.end(), blob_id) !=
+          top_ids.end()) {
+        (*is_map)[j] = true;
+      }
+    }
+  }
+  vector<float> scores(num_outputs, 0);
+  vector<map<int, vector<pair<float, int> > > > true_pos(num_outputs);
+  vector<map<int, vector<pair<float, int> > > > false_pos(num_outputs);
+  vector<map<int, int> > num_pos(num_outputs);
+  for (int iter = 0; iter < iterations; ++iter) {
+    const vector<Blob<float>*>& result = net.Forward();
+    for (int j = 0; j < num_outputs; ++j) {
+      const float* result_vec = result[j]->cpu_data();
+      if (!(*is_map)[j]) {
+        for (int k = 0; k < result[j]->count(); ++k) {
+          scores[j] += result_vec[k] / result[j]->count();
+        }
+        continue;
+      }
+      CHECK_EQ(result[j]->width(), 5);
+      for (int k = 0; k < result[j]->height(); ++k) {
+        const int item_id = static_cast<int>(result_vec[k * 5]);
+        const int label = static_cast<int>(result_vec[k * 5 + 1]);
+        if (item_id == -1) {
+          // Special row of storing number of positives for a label.
+          num_pos[j][label] += static_cast<int>(result_vec[k * 5 + 2]);
+          continue;
+        }
+        const float score = result_vec[k * 5 + 2];
+        const int tp = static_cast<int>(result_vec[k * 5 + 3]);
+        const int fp = static_cast<int>(result_vec[k * 5 + 4]);
+        if (tp == 0 && fp == 0) {
+          // A detection matched to a difficult gt bbox.
+          continue;
+        }
+        true_pos[j][label].push_back(std::make_pair(score, tp));
+        false_pos[j][label].push_back(std::make_pair(score, fp));
+      }
+    }
+  }
+  for (int j = 0; j < num_outputs; ++j) {
+    if (!(*is_map)[j]) {
+      scores[j] /= iterations;
+      continue;
+    }
+    for (map<int, int>::const_iterator it = num_pos[j].begin();
+         it != num_pos[j].end(); ++it) {
+      const int label = it->first;
+      if (true_pos[j].find(label) == true_pos[j].end()) {
+        LOG(WARNING) << "Missing true_pos for label: " << label;
+        continue;
+      }
+      vector<float> prec, rec;
+      float ap;
+      ComputeAP(true_pos[j][label], it->second, false_pos[j][label],
+                ap_version, &prec, &rec, &ap);
+      scores[j] += ap;
+    }
+    if (!num_pos[j].empty()) {
+      scores[j] /= num_pos[j].size();
+    }
+  }
+  return scores;
+}
+
+bool CheckInt8Accuracy(const NetParameter& net_param,
+    const NetParameter& int8_param, const string& weights,
+    const int iterations, const string& ap_version, const float max_map_drop) {
+  vector<string> output_names;
+  vector<bool> is_map;
+  const vector<float> scores = TestNetOutputs(net_param, weights, iterations,
+      ap_version, &output_names, &is_map);
+  const vector<float> int8_scores = TestNetOutputs(int8_param, weights,
+      iterations, ap_version, &output_names, &is_map);
+  bool accurate = true;
+  for (int j = 0; j < scores.size(); ++j) {
+    LOG(INFO) << "Output #" << j << ": " << output_names[j] << " = "
+              << scores[j] << " (FP32), " << int8_scores[j] << " (INT8)";
+    if (is_map[j] && scores[j] - int8_scores[j] > max_map_drop) {
+      LOG(ERROR) << "The INT8 mAP of " << output_names[j] << " drops by "
+                 << scores[j] - int8_scores[j] << ", more than "
+                 << max_map_drop;
+      accurate = false;
+    }
+  }
+  return accurate;
+}
+
+}  // namespace caffe
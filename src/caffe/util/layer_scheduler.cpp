@@ -0,0 +1,97 @@
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+#include "caffe/util/layer_scheduler.hpp"
+
+namespace caffe {
+
+class LayerScheduler::sync {
+ public:
+  boost::mutex mutex_;
+  // Signaled when a layer becomes ready or the last one finishes.
+  boost::condition_variable condition_;
+};
+
+LayerScheduler::LayerScheduler(const vector<vector<int> >& predecessors,
+    int num_threads)
+    : successors_(predecessors.size()), pool_(num_threads),
+      sync_(new sync()), run_layer_(NULL), start_(0), end_(-1),
+      num_unfinished_(0) {
+  for (int i = 0; i < predecessors.size(); ++i) {
+    for (int j = 0; j < predecessors[i].size(); ++j) {
+      CHECK_LT(predecessors[i][j], i) << "Layers depend on earlier layers.";
+      successors_[predecessors[i][j]].push_back(i);
+    }
+  }
+  num_waiting_.resize(predecessors.size());
+}
+
+void LayerScheduler::Run(int start, int end,
+    const boost::function<void(int)>& run_layer) {
+  CHECK_GE(start, 0);
+  CHECK_LT(end, successors_.size());
+  if (start > end) {
+    return;
+  }
+  {
+    boost::mutex::scoped_lock lock(sync_->mutex_);
+    run_layer_ = &run_layer;
+    start_ = start;
+    end_ = end;
+    std::fill(num_waiting_.begin() + start, num_waiting_.begin() + end + 1,
+              0);
+    for (int i = start; i <= end; ++i) {
+      for (int j = 0; j < successors_[i].size(); ++j) {
+        if (successors_[i][j] <= end) {
+          ++num_waiting_[successors_[i][j]];
+        }
+      }
+    }
+    ready_.clear();
+    for (int i = start; i <= end; ++i) {
+      if (num_waiting_[i] == 0) {
+        ready_.push_back(i);
+      }
+    }
+    std::make_heap(ready_.begin(), ready_.end(), std::greater<int>());
+    num_unfinished_ = end - start + 1;
+  }
+  pool_.Run(pool_.num_threads(),
+            boost::bind(&LayerScheduler::RunLayers, this, _1));
+  run_layer_ = NULL;
+}
+
+void LayerScheduler::RunLayers(int thread_id) {
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  while (true) {
+    while (ready_.empty() && num_unfinished_ > 0) {
+      sync_->condition_.wait(lock);
+    }
+    if (num_unfinished_ == 0) {
+      return;
+    }
+    std::pop_heap(ready_.begin(), ready_.end(), std::greater<int>());
+    const int layer_id = ready_.back();
+    ready_.pop_back();
+    lock.unlock();
+    (*run_layer_)(layer_id);
+    lock.lock();
+    bool notify = --num_unfinished_ == 0;
+    for (int j = 0; j < successors_[layer_id].size(); ++j) {
+      const int successor = successors_[layer_id][j];
+      if (successor <= end_ && --num_waiting_[successor] == 0) {
+        ready_.push_back(successor);
+        std::push_heap(ready_.begin(), ready_.end(), std::greater<int>());
+        notify = true;
+      }
+    }
+    if (notify) {
+      sync_->condition_.notify_all();
+    }
+  }
+}
+
+}  // namespace caffe
@@ -1,12 +1,21 @@
 #include <boost/math/special_functions/next.hpp>
 #include <boost/random.hpp>
 
+#include <cmath>
+#include <cstring>
 #include <limits>
 
 #include "caffe/common.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/util/rng.hpp"
 
+// The AVX2 exp kernel is compiled with a function level target attribute and
+// picked at runtime, so no extra compiler flag is needed.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define USE_X86_EXP_KERNELS
+#endif
+
 namespace caffe {
 
 template<>
@@ -217,6 +226,85 @@ void caffe_log<double>(const int n, const double* a, double* y) {
   vdLn(n, a, y);
 }
 
+// Compute exp(x) in place for x <= 0 with the cephes polynomial of expf(). It
+// is within a few ulps of std::exp() and, unlike it, can be vectorized. The
+// AVX2 kernel uses the same operations, in the same order, as the scalar one.
+// Both clamp the inputs below without turning NaNs into numbers, so that NaNs
+// still propagate as with std::exp().
+static void ExpNonPositiveScalar(const int n, float* x) {
+  for (int i = 0; i < n; ++i) {
+    if (std::isnan(x[i])) {
+      continue;
+    }
+    float v = !(x[i] < -87.3365f) ? x[i] : -87.3365f;
+    const float fx = std::floor(v * 1.44269504088896341f + 0.5f);
+    v = v - fx * 0.693359375f;
+    v = v - fx * -2.12194440e-4f;
+    const float z = v * v;
+    float y = 1.9875691500e-4f;
+    y = y * v + 1.3981999507e-3f;
+    y = y * v + 8.3334519073e-3f;
+    y = y * v + 4.1665795894e-2f;
+    y = y * v + 1.6666665459e-1f;
+    y = y * v + 5.0000001201e-1f;
+    y = y * z + v + 1.f;
+    // Scale by 2^fx through the exponent bits.
+    const int bits = (static_cast<int>(fx) + 127) << 23;
+    float pow2;
+    memcpy(&pow2, &bits, sizeof(pow2));
+    x[i] = y * pow2;
+  }
+}
+
+#ifdef USE_X86_EXP_KERNELS
+__attribute__((target("avx2")))
+static void ExpNonPositiveAVX2(const int n, float* x) {
+  const __m256 min_x = _mm256_set1_ps(-87.3365f);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    // maxps returns its second operand when either is NaN.
+    __m256 v = _mm256_max_ps(min_x, _mm256_loadu_ps(x + i));
+    const __m256 fx = _mm256_floor_ps(_mm256_add_ps(
+        _mm256_mul_ps(v, _mm256_set1_ps(1.44269504088896341f)),
+        _mm256_set1_ps(0.5f)));
+    v = _mm256_sub_ps(v, _mm256_mul_ps(fx, _mm256_set1_ps(0.693359375f)));
+    v = _mm256_sub_ps(v, _mm256_mul_ps(fx, _mm256_set1_ps(-2.12194440e-4f)));
+    const __m256 z = _mm256_mul_ps(v, v);
+    __m256 y = _mm256_set1_ps(1.9875691500e-4f);
+    y = _mm256_add_ps(_mm256_mul_ps(y, v), _mm256_set1_ps(1.3981999507e-3f));
+    y = _mm256_add_ps(_mm256_mul_ps(y, v), _mm256_set1_ps(8.3334519073e-3f));
+    y = _mm256_add_ps(_mm256_mul_ps(y, v), _mm256_set1_ps(4.1665795894e-2f));
+    y = _mm256_add_ps(_mm256_mul_ps(y, v), _mm256_set1_ps(1.6666665459e-1f));
+    y = _mm256_add_ps(_mm256_mul_ps(y, v), _mm256_set1_ps(5.0000001201e-1f));
+    y = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(y, z), v),
+                      _mm256_set1_ps(1.f));
+    const __m256i bits = _mm256_slli_epi32(_mm256_add_epi32(
+        _mm256_cvttps_epi32(fx), _mm256_set1_epi32(127)), 23);
+    _mm256_storeu_ps(x + i, _mm256_mul_ps(y, _mm256_castsi256_ps(bits)));
+  }
+  ExpNonPositiveScalar(n - i, x + i);
+}
+#endif  // USE_X86_EXP_KERNELS
+
+template <>
+void caffe_exp_nonpositive<float>(const int n, float* x) {
+#ifdef USE_X86_EXP_KERNELS
+  static const bool use_avx2 = __builtin_cpu_supports("avx2");
+  if (use_avx2) {
+    ExpNonPositiveAVX2(n, x);
+    return;
+  }
+#endif  // USE_X86_EXP_KERNELS
+  ExpNonPositiveScalar(n, x);
+}
+
+template <>
+void caffe_exp_nonpositive<double>(const int n, double* x) {
+  for (int i = 0; i < n; ++i) {
+    x[i] = std::exp(x[i]);
+  }
+}
+
 template <>
 void caffe_abs<float>(const int n, const float* a, float* y) {
     vsAbs(n, a, y);
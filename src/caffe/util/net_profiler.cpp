@@ -0,0 +1,284 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>  // NOLINT(readability/streams)
+#include <map>
+#include <string>
+#include <vector>
+
+#include "caffe/util/net_profiler.hpp"
+
+namespace caffe {
+
+static const char* const kPassNames[2] = {"forward", "backward"};
+
+// The bytes of the data and diff of the blob that have been allocated.
+template <typename Dtype>
+static size_t AllocatedBytes(const Blob<Dtype>& blob) {
+  size_t bytes = 0;
+  if (blob.count() == 0) {
+    return bytes;
+  }
+  if (blob.data()->head() != SyncedMemory::UNINITIALIZED) {
+    bytes += blob.data()->size();
+  }
+  if (blob.diff()->head() != SyncedMemory::UNINITIALIZED) {
+    bytes += blob.diff()->size();
+  }
+  return bytes;
+}
+
+// Multiply-adds count as 2 FLOPs. Layers without weights are counted as one
+// operation per output.
+template <typename Dtype>
+static int64_t ForwardFLOPs(Layer<Dtype>* layer,
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  const string type = layer->type();
+  int64_t flops = 0;
+  if (type == "Convolution" && layer->blobs().size() > 0) {
+    for (int i = 0; i < top.size(); ++i) {
+      flops += 2 * static_cast<int64_t>(top[i]->count()) *
+          layer->blobs()[0]->count(1);
+    }
+  } else if (type == "Deconvolution" && layer->blobs().size() > 0) {
+    for (int i = 0; i < bottom.size(); ++i) {
+      flops += 2 * static_cast<int64_t>(bottom[i]->count()) *
+          layer->blobs()[0]->count(1);
+    }
+  } else if (type == "InnerProduct" && layer->blobs().size() > 0) {
+    const int num_output =
+        layer->layer_param().inner_product_param().num_output();
+    flops = 2 * static_cast<int64_t>(top[0]->count()) *
+        (layer->blobs()[0]->count() / num_output);
+  } else {
+    for (int i = 0; i < top.size(); ++i) {
+      flops += top[i]->count();
+    }
+  }
+  return flops;
+}
+
+static string ShapesString(const vector<vector<int> >& shapes) {
+  ostringstream stream;
+  for (int i = 0; i < shapes.size(); ++i) {
+    if (i > 0) {
+      stream << " ";
+    }
+    for (int j = 0; j < shapes[i].size(); ++j) {
+      stream << (j > 0 ? "x" : "") << shapes[i][j];
+    }
+  }
+  return stream.str();
+}
+
+NetProfiler::NetProfiler()
+    : origin_(boost::posix_time::microsec_clock::local_time()),
+      iteration_(-1) {}
+
+void NetProfiler::Begin() {
+#ifndef CPU_ONLY
+  if (Caffe::mode() == Caffe::GPU) {
+    CUDA_CHECK(cudaDeviceSynchronize());
+  }
+#endif
+  start_ = boost::posix_time::microsec_clock::local_time();
+}
+
+template <typename Dtype>
+void NetProfiler::End(const int layer_id, const Pass pass,
+    Layer<Dtype>* layer, const vector<Blob<Dtype>*>& bottom,
+    const vector<Blob<Dtype>*>& top) {
+#ifndef CPU_ONLY
+  if (Caffe::mode() == Caffe::GPU) {
+    CUDA_CHECK(cudaDeviceSynchronize());
+  }
+#endif
+  const boost::posix_time::ptime end =
+      boost::posix_time::microsec_clock::local_time();
+  Event event;
+  event.layer_id = layer_id;
+  event.pass = pass;
+  event.iteration = std::max(iteration_, 0);
+  event.start_us = (start_ - origin_).total_microseconds();
+  event.duration_us = (end - start_).total_microseconds();
+  events_.push_back(event);
+
+  // The shapes and FLOPs only change on reshape; the bytes also change when
+  // diffs get allocated by the first backward.
+  if (layer_id >= layers_.size()) {
+    layers_.resize(layer_id + 1);
+  }
+  LayerInfo& info = layers_[layer_id];
+  bool reshaped = info.name.empty() ||
+      info.bottom_shapes.size() != bottom.size() ||
+      info.top_shapes.size() != top.size();
+  for (int i = 0; i < bottom.size() && !reshaped; ++i) {
+    reshaped = info.bottom_shapes[i] != bottom[i]->shape();
+  }
+  for (int i = 0; i < top.size() && !reshaped; ++i) {
+    reshaped = info.top_shapes[i] != top[i]->shape();
+  }
+  if (reshaped) {
+    info.name = layer->layer_param().name();
+    info.type = layer->type();
+    info.bottom_shapes.resize(bottom.size());
+    for (int i = 0; i < bottom.size(); ++i) {
+      info.bottom_shapes[i] = bottom[i]->shape();
+    }
+    info.top_shapes.resize(top.size());
+    for (int i = 0; i < top.size(); ++i) {
+      info.top_shapes[i] = top[i]->shape();
+    }
+    info.flops[FORWARD] = ForwardFLOPs(layer, bottom, top);
+    info.flops[BACKWARD] =
+        (layer->blobs().empty() ? 1 : 2) * info.flops[FORWARD];
+  }
+  info.bytes = 0;
+  for (int i = 0; i < top.size(); ++i) {
+    info.bytes += AllocatedBytes(*top[i]);
+  }
+  for (int i = 0; i < layer->blobs().size(); ++i) {
+    info.bytes += AllocatedBytes(*layer->blobs()[i]);
+  }
+}
+
+void NetProfiler::Clear() {
+  events_.clear();
+}
+
+vector<double> NetProfiler::Durations(const int layer_id,
+    const Pass pass) const {
+  vector<double> durations;
+  if (layer_id >= 0) {
+    for (int i = 0; i < events_.size(); ++i) {
+      if (events_[i].layer_id == layer_id && events_[i].pass == pass) {
+        durations.push_back(events_[i].duration_us);
+      }
+    }
+    return durations;
+  }
+  map<int, double> totals;
+  for (int i = 0; i < events_.size(); ++i) {
+    if (events_[i].pass == pass) {
+      totals[events_[i].iteration] += events_[i].duration_us;
+    }
+  }
+  for (map<int, double>::const_iterator it = totals.begin();
+       it != totals.end(); ++it) {
+    durations.push_back(it->second);
+  }
+  return durations;
+}
+
+double NetProfiler::Percentile(const vector<double>& values, const double p) {
+  CHECK_GT(p, 0);
+  CHECK_LE(p, 100);
+  if (values.empty()) {
+    return 0;
+  }
+  vector<double> sorted(values);
+  const int rank = std::max(0,
+      static_cast<int>(std::ceil(p / 100 * sorted.size())) - 1);
+  std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+  return sorted[rank];
+}
+
+double NetProfiler::Mean(const vector<double>& values) {
+  if (values.empty()) {
+    return 0;
+  }
+  double sum = 0;
+  for (int i = 0; i < values.size(); ++i) {
+    sum += values[i];
+  }
+  return sum / values.size();
+}
+
+// Layer names and types come from the net definition, and are escaped in
+// case they hold quotes, backslashes or control characters.
+static string JSONString(const string& value) {
+  string escaped("\"");
+  for (int i = 0; i < value.size(); ++i) {
+    const unsigned char c = value[i];
+    if (c < 0x20) {
+      char code[7];
+      snprintf(code, sizeof(code), "\\u%04x", c);
+      escaped += code;
+      continue;
+    }
+    if (c == '"' || c == '\\') {
+      escaped += '\\';
+    }
+    escaped += value[i];
+  }
+  return escaped + "\"";
+}
+
+// Quote CSV fields holding separators, quotes or line breaks (RFC 4180).
+static string CSVField(const string& value) {
+  if (value.find_first_of(",\"\r\n") == string::npos) {
+    return value;
+  }
+  string quoted("\"");
+  for (int i = 0; i < value.size(); ++i) {
+    if (value[i] == '"') {
+      quoted += '"';
+    }
+    quoted += value[i];
+  }
+  return quoted + "\"";
+}
+
+void NetProfiler::WriteChromeTrace(const string& filename) const {
+  std::ofstream output(filename.c_str());
+  CHECK(output) << "Failed to open " << filename;
+  output << "{\"traceEvents\": [";
+  for (int i = 0; i < events_.size(); ++i) {
+    const Event& event = events_[i];
+    const LayerInfo& info = layers_[event.layer_id];
+    output << (i > 0 ? ",\n" : "\n")
+        << "{\"name\": " << JSONString(info.name)
+        << ", \"cat\": \"" << kPassNames[event.pass] << "\""
+        << ", \"ph\": \"X\", \"pid\": 0, \"tid\": 0"
+        << ", \"ts\": " << static_cast<int64_t>(event.start_us)
+        << ", \"dur\": " << static_cast<int64_t>(event.duration_us)
+        << ", \"args\": {\"iteration\": " << event.iteration
+        << ", \"type\": " << JSONString(info.type)
+        << ", \"bottom_shapes\": " << JSONString(
+            ShapesString(info.bottom_shapes))
+        << ", \"top_shapes\": " << JSONString(ShapesString(info.top_shapes))
+        << ", \"flops\": " << info.flops[event.pass]
+        << ", \"bytes\": " << info.bytes << "}}";
+  }
+  output << "\n], \"displayTimeUnit\": \"ms\"}\n";
+  CHECK(output) << "Failed to write " << filename;
+}
+
+void NetProfiler::WriteCSV(const string& filename) const {
+  std::ofstream output(filename.c_str());
+  CHECK(output) << "Failed to open " << filename;
+  output << "iteration,layer_id,layer,type,pass,start_us,duration_us,"
+      << "flops,bytes,bottom_shapes,top_shapes\n";
+  for (int i = 0; i < events_.size(); ++i) {
+    const Event& event = events_[i];
+    const LayerInfo& info = layers_[event.layer_id];
+    output << event.iteration << "," << event.layer_id << ","
+        << CSVField(info.name) << "," << CSVField(info.type) << ","
+        << kPassNames[event.pass]
+        << "," << static_cast<int64_t>(event.start_us) << ","
+        << static_cast<int64_t>(event.duration_us) << ","
+        << info.flops[event.pass] << "," << info.bytes << ","
+        << ShapesString(info.bottom_shapes) << ","
+        << ShapesString(info.top_shapes) << "\n";
+  }
+  CHECK(output) << "Failed to write " << filename;
+}
+
+template void NetProfiler::End(const int layer_id, const Pass pass,
+    Layer<float>* layer, const vector<Blob<float>*>& bottom,
+    const vector<Blob<float>*>& top);
+template void NetProfiler::End(const int layer_id, const Pass pass,
+    Layer<double>* layer, const vector<Blob<double>*>& bottom,
+    const vector<Blob<double>*>& top);
+
+}  // namespace caffe
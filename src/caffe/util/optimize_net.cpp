@@ -0,0 +1,338 @@
+#include <cmath>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/optimize_net.hpp"
+
+namespace caffe {
+
+// Where each bottom of each layer comes from: the layer and top index which
+// last wrote its name, or (-1, i) for the i-th net input given by
+// NetParameter.input. A top is consumed by the layers reading it.
+struct BlobVersions {
+  vector<vector<pair<int, int> > > producers;
+  map<pair<int, int>, vector<int> > consumers;
+};
+
+static void FindBlobVersions(const NetParameter& param,
+    BlobVersions* versions) {
+  map<string, pair<int, int> > last_writer;
+  for (int i = 0; i < param.input_size(); ++i) {
+    last_writer[param.input(i)] = make_pair(-1, i);
+  }
+  versions->producers.resize(param.layer_size());
+  versions->consumers.clear();
+  for (int i = 0; i < param.layer_size(); ++i) {
+    const LayerParameter& layer_param = param.layer(i);
+    versions->producers[i].resize(layer_param.bottom_size());
+    for (int j = 0; j < layer_param.bottom_size(); ++j) {
+      const string& blob_name = layer_param.bottom(j);
+      map<string, pair<int, int> >::const_iterator it =
+          last_writer.find(blob_name);
+      CHECK(it != last_writer.end()) << "Unknown bottom blob '" << blob_name
+          << "' (layer '" << layer_param.name() << "', bottom index " << j
+          << ")";
+      versions->producers[i][j] = it->second;
+      vector<int>& consumers = versions->consumers[it->second];
+      if (consumers.empty() || consumers.back() != i) {
+        consumers.push_back(i);
+      }
+    }
+    for (int j = 0; j < layer_param.top_size(); ++j) {
+      last_writer[layer_param.top(j)] = make_pair(i, j);
+    }
+  }
+}
+
+static bool SingleConsumer(const BlobVersions& versions,
+    const pair<int, int>& top, const int layer_id) {
+  map<pair<int, int>, vector<int> >::const_iterator it =
+      versions.consumers.find(top);
+  return it != versions.consumers.end() && it->second.size() == 1 &&
+      it->second[0] == layer_id;
+}
+
+static bool BlobUsedBetween(const NetParameter& param, const int begin,
+    const int end, const string& blob_name) {
+  for (int i = begin; i < end; ++i) {
+    const LayerParameter& layer_param = param.layer(i);
+    for (int j = 0; j < layer_param.bottom_size(); ++j) {
+      if (layer_param.bottom(j) == blob_name) { return true; }
+    }
+    for (int j = 0; j < layer_param.top_size(); ++j) {
+      if (layer_param.top(j) == blob_name) { return true; }
+    }
+  }
+  return false;
+}
+
+// Layer layer_id reads one blob and writes another. It can work in place on
+// its top if the layer producing its bottom writes the top instead: the
+// bottom must be read by no one else, and the top name must not be used in
+// between. The net inputs keep their names.
+static bool CanRenameProducerTop(const NetParameter& param,
+    const BlobVersions& versions, const int layer_id) {
+  const pair<int, int>& producer = versions.producers[layer_id][0];
+  return producer.first >= 0 &&
+      param.layer(producer.first).type() != "Input" &&
+      SingleConsumer(versions, producer, layer_id) &&
+      !BlobUsedBetween(param, producer.first, layer_id,
+                       param.layer(layer_id).top(0));
+}
+
+static void RenameProducerTop(NetParameter* param,
+    const BlobVersions& versions, const int layer_id) {
+  const pair<int, int>& producer = versions.producers[layer_id][0];
+  const string& top_name = param->layer(layer_id).top(0);
+  param->mutable_layer(producer.first)->set_top(producer.second, top_name);
+  param->mutable_layer(layer_id)->set_bottom(0, top_name);
+}
+
+// Layer layer_id copies its bottom to its top. Its consumers can read the
+// bottom instead if nothing writes the bottom name before the last of them.
+// A top nobody reads is a net output and keeps its name.
+static bool CanRenameConsumerBottoms(const NetParameter& param,
+    const BlobVersions& versions, const int layer_id) {
+  map<pair<int, int>, vector<int> >::const_iterator it =
+      versions.consumers.find(make_pair(layer_id, 0));
+  if (it == versions.consumers.end()) {
+    return false;
+  }
+  const string& bottom_name = param.layer(layer_id).bottom(0);
+  for (int i = layer_id + 1; i < it->second.back(); ++i) {
+    const LayerParameter& layer_param = param.layer(i);
+    for (int j = 0; j < layer_param.top_size(); ++j) {
+      if (layer_param.top(j) == bottom_name) { return false; }
+    }
+  }
+  return true;
+}
+
+static void RenameConsumerBottoms(NetParameter* param,
+    const BlobVersions& versions, const int layer_id) {
+  const vector<int>& consumers =
+      versions.consumers.find(make_pair(layer_id, 0))->second;
+  const string bottom_name = param->layer(layer_id).bottom(0);
+  for (int i = 0; i < consumers.size(); ++i) {
+    LayerParameter* layer_param = param->mutable_layer(consumers[i]);
+    for (int j = 0; j < layer_param->bottom_size(); ++j) {
+      if (versions.producers[consumers[i]][j] == make_pair(layer_id, 0)) {
+        layer_param->set_bottom(j, bottom_name);
+      }
+    }
+  }
+}
+
+// Remove layer layer_id, which copies its only bottom to its only top.
+static bool RemoveIdentityLayer(NetParameter* param,
+    const BlobVersions& versions, const int layer_id) {
+  const LayerParameter& layer_param = param->layer(layer_id);
+  if (layer_param.bottom(0) != layer_param.top(0)) {
+    if (CanRenameProducerTop(*param, versions, layer_id)) {
+      RenameProducerTop(param, versions, layer_id);
+    } else if (CanRenameConsumerBottoms(*param, versions, layer_id)) {
+      RenameConsumerBottoms(param, versions, layer_id);
+    } else {
+      return false;
+    }
+  }
+  param->mutable_layer()->DeleteSubrange(layer_id, 1);
+  return true;
+}
+
+static int BlobCount(const BlobProto& blob) {
+  return blob.double_data_size() > 0 ? blob.double_data_size() :
+      blob.data_size();
+}
+
+static double BlobValue(const BlobProto& blob, const int index) {
+  return blob.double_data_size() > 0 ? blob.double_data(index) :
+      blob.data(index);
+}
+
+static void SetBlobValue(BlobProto* blob, const int index, const double value) {
+  if (blob->double_data_size() > 0) {
+    blob->set_double_data(index, value);
+  } else {
+    blob->set_data(index, value);
+  }
+}
+
+// The number of outputs of the Convolution or InnerProduct layer producing
+// the bottom of layer layer_id, if that layer can absorb a per channel affine
+// transformation of its top: it has its blobs, shares none of them, and
+// nothing else reads its top. Otherwise 0.
+static int FoldableOutputs(const NetParameter& param,
+    const BlobVersions& versions, const int layer_id) {
+  const pair<int, int>& producer = versions.producers[layer_id][0];
+  if (producer.first < 0 || !SingleConsumer(versions, producer, layer_id)) {
+    return 0;
+  }
+  const LayerParameter& layer_param = param.layer(producer.first);
+  int num_output;
+  bool bias_term;
+  if (layer_param.type() == "Convolution" &&
+      layer_param.convolution_param().axis() == 1) {
+    num_output = layer_param.convolution_param().num_output();
+    bias_term = layer_param.convolution_param().bias_term();
+  } else if (layer_param.type() == "InnerProduct" &&
+      layer_param.inner_product_param().axis() == 1) {
+    num_output = layer_param.inner_product_param().num_output();
+    bias_term = layer_param.inner_product_param().bias_term();
+  } else {
+    return 0;
+  }
+  if (layer_param.top_size() != 1 ||
+      layer_param.blobs_size() != (bias_term ? 2 : 1)) {
+    return 0;
+  }
+  for (int i = 0; i < layer_param.param_size(); ++i) {
+    if (layer_param.param(i).name() != "") {
+      return 0;
+    }
+  }
+  // Once folded, the layer is removed by making it work in place.
+  const LayerParameter& fold_param = param.layer(layer_id);
+  if (fold_param.bottom(0) != fold_param.top(0) &&
+      !CanRenameProducerTop(param, versions, layer_id)) {
+    return 0;
+  }
+  return num_output;
+}
+
+// Replace the output y[c] of a Convolution or InnerProduct layer by
+// y[c] * scale[c] + shift[c], adding a bias if it has none.
+static void FoldAffine(const vector<double>& scale, const vector<double>& shift,
+    LayerParameter* layer_param) {
+  const int num_output = scale.size();
+  const bool transpose = layer_param->type() == "InnerProduct" &&
+      layer_param->inner_product_param().transpose();
+  BlobProto* weights = layer_param->mutable_blobs(0);
+  const int count = BlobCount(*weights);
+  const int dim = count / num_output;
+  CHECK_EQ(count, num_output * dim);
+  for (int i = 0; i < count; ++i) {
+    const int c = transpose ? i % num_output : i / dim;
+    SetBlobValue(weights, i, BlobValue(*weights, i) * scale[c]);
+  }
+  if (layer_param->blobs_size() == 1) {
+    if (layer_param->type() == "InnerProduct") {
+      layer_param->mutable_inner_product_param()->set_bias_term(true);
+    } else {
+      layer_param->mutable_convolution_param()->set_bias_term(true);
+    }
+    const bool double_data = layer_param->blobs(0).double_data_size() > 0;
+    BlobProto* bias = layer_param->add_blobs();
+    bias->mutable_shape()->add_dim(num_output);
+    for (int c = 0; c < num_output; ++c) {
+      if (double_data) {
+        bias->add_double_data(0);
+      } else {
+        bias->add_data(0);
+      }
+    }
+  }
+  BlobProto* bias = layer_param->mutable_blobs(1);
+  CHECK_EQ(BlobCount(*bias), num_output);
+  for (int c = 0; c < num_output; ++c) {
+    SetBlobValue(bias, c, BlobValue(*bias, c) * scale[c] + shift[c]);
+  }
+}
+
+// y = (x - mean) / sqrt(variance + eps), with the stored statistics, which
+// BatchNormLayer uses in TEST unless told otherwise.
+static bool BatchNormAffine(const LayerParameter& layer_param,
+    const int channels, vector<double>* scale, vector<double>* shift) {
+  const BatchNormParameter& bn_param = layer_param.batch_norm_param();
+  if (layer_param.blobs_size() != 3 ||
+      (bn_param.has_use_global_stats() && !bn_param.use_global_stats()) ||
+      BlobCount(layer_param.blobs(0)) != channels ||
+      BlobCount(layer_param.blobs(1)) != channels ||
+      BlobCount(layer_param.blobs(2)) != 1) {
+    return false;
+  }
+  const double scale_factor = BlobValue(layer_param.blobs(2), 0);
+  const double factor = scale_factor == 0 ? 0 : 1 / scale_factor;
+  scale->resize(channels);
+  shift->resize(channels);
+  for (int c = 0; c < channels; ++c) {
+    const double mean = BlobValue(layer_param.blobs(0), c) * factor;
+    const double variance = BlobValue(layer_param.blobs(1), c) * factor;
+    (*scale)[c] = 1 / std::sqrt(variance + bn_param.eps());
+    (*shift)[c] = -mean * (*scale)[c];
+  }
+  return true;
+}
+
+// y = x * scale + bias, with a learned scale per channel.
+static bool ScaleAffine(const LayerParameter& layer_param, const int channels,
+    vector<double>* scale, vector<double>* shift) {
+  const ScaleParameter& scale_param = layer_param.scale_param();
+  if (scale_param.axis() != 1 || scale_param.num_axes() != 1 ||
+      layer_param.blobs_size() != (scale_param.bias_term() ? 2 : 1) ||
+      BlobCount(layer_param.blobs(0)) != channels ||
+      (scale_param.bias_term() &&
+       BlobCount(layer_param.blobs(1)) != channels)) {
+    return false;
+  }
+  scale->resize(channels);
+  shift->resize(channels);
+  for (int c = 0; c < channels; ++c) {
+    (*scale)[c] = BlobValue(layer_param.blobs(0), c);
+    (*shift)[c] = scale_param.bias_term() ?
+        BlobValue(layer_param.blobs(1), c) : 0;
+  }
+  return true;
+}
+
+// Apply the first possible optimization, if any.
+static bool OptimizeOnce(NetParameter* param) {
+  BlobVersions versions;
+  FindBlobVersions(*param, &versions);
+  for (int i = 0; i < param->layer_size(); ++i) {
+    const LayerParameter& layer_param = param->layer(i);
+    if (layer_param.bottom_size() != 1 || layer_param.top_size() != 1) {
+      continue;
+    }
+    const string layer_name = layer_param.name();
+    if (layer_param.type() == "Dropout") {
+      if (RemoveIdentityLayer(param, versions, i)) {
+        LOG(INFO) << "Removed Dropout layer " << layer_name;
+        return true;
+      }
+    } else if (layer_param.type() == "BatchNorm" ||
+               layer_param.type() == "Scale") {
+      const int channels = FoldableOutputs(*param, versions, i);
+      vector<double> scale, shift;
+      if (channels > 0 && (layer_param.type() == "BatchNorm" ?
+          BatchNormAffine(layer_param, channels, &scale, &shift) :
+          ScaleAffine(layer_param, channels, &scale, &shift))) {
+        LayerParameter* producer_param =
+            param->mutable_layer(versions.producers[i][0].first);
+        FoldAffine(scale, shift, producer_param);
+        LOG(INFO) << "Folded " << layer_param.type() << " layer "
+                  << layer_name << " into " << producer_param->name();
+        CHECK(RemoveIdentityLayer(param, versions, i));
+        return true;
+      }
+    } else if (layer_param.type() == "ReLU" &&
+               layer_param.bottom(0) != layer_param.top(0) &&
+               CanRenameProducerTop(*param, versions, i)) {
+      RenameProducerTop(param, versions, i);
+      LOG(INFO) << "Made ReLU layer " << layer_name << " work in place";
+      return true;
+    }
+  }
+  return false;
+}
+
+void OptimizeNetForInference(const NetParameter& param,
+    NetParameter* param_optimized) {
+  param_optimized->CopyFrom(param);
+  while (OptimizeOnce(param_optimized)) {}
+}
+
+}  // namespace caffe
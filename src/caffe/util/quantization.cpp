@@ -0,0 +1,239 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "caffe/util/quantization.hpp"
+
+// The AVX2 and AVX512 VNNI kernels are compiled with function level target
+// attributes and picked at runtime, so no extra compiler flag is needed.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define USE_X86_INT8_KERNELS
+#endif
+
+namespace caffe {
+
+// The activation and weight rows are padded to a multiple of the widest
+// kernel step, and are processed by blocks of kBlockN x kBlockM rows.
+static const int kPaddedKAlign = 64;
+static const int kBlockN = 2;
+static const int kBlockM = 4;
+// The weight rows used with each block of activation rows are sized to stay
+// in the L2 cache.
+static const int kWeightBlockBytes = 128 * 1024;
+
+typedef void (*Int8DotBlock)(const uint8_t* const* input,
+    const int8_t* const* weights, const int padded_k,
+    int32_t sums[kBlockN][kBlockM]);
+
+static void Int8DotBlockScalar(const uint8_t* const* input,
+    const int8_t* const* weights, const int padded_k,
+    int32_t sums[kBlockN][kBlockM]) {
+  for (int n = 0; n < kBlockN; ++n) {
+    for (int m = 0; m < kBlockM; ++m) {
+      int32_t sum = 0;
+      for (int k = 0; k < padded_k; ++k) {
+        sum += static_cast<int32_t>(input[n][k]) * weights[m][k];
+      }
+      sums[n][m] = sum;
+    }
+  }
+}
+
+#ifdef USE_X86_INT8_KERNELS
+__attribute__((target("avx2")))
+static inline int32_t HorizontalSumAVX2(const __m256i x) {
+  __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(x),
+                              _mm256_extracti128_si256(x, 1));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtsi128_si32(sum);
+}
+
+// Without VNNI the bytes are widened to int16, whose pairwise products
+// _mm256_madd_epi16 sums into int32 without saturation.
+__attribute__((target("avx2")))
+static void Int8DotBlockAVX2(const uint8_t* const* input,
+    const int8_t* const* weights, const int padded_k,
+    int32_t sums[kBlockN][kBlockM]) {
+  __m256i acc[kBlockN][kBlockM];
+  for (int n = 0; n < kBlockN; ++n) {
+    for (int m = 0; m < kBlockM; ++m) {
+      acc[n][m] = _mm256_setzero_si256();
+    }
+  }
+  for (int k = 0; k < padded_k; k += 16) {
+    __m256i in[kBlockN];
+    for (int n = 0; n < kBlockN; ++n) {
+      in[n] = _mm256_cvtepu8_epi16(_mm_loadu_si128(
+          reinterpret_cast<const __m128i*>(input[n] + k)));
+    }
+    for (int m = 0; m < kBlockM; ++m) {
+      const __m256i w = _mm256_cvtepi8_epi16(_mm_loadu_si128(
+          reinterpret_cast<const __m128i*>(weights[m] + k)));
+      for (int n = 0; n < kBlockN; ++n) {
+        acc[n][m] = _mm256_add_epi32(acc[n][m], _mm256_madd_epi16(in[n], w));
+      }
+    }
+  }
+  for (int n = 0; n < kBlockN; ++n) {
+    for (int m = 0; m < kBlockM; ++m) {
+      sums[n][m] = HorizontalSumAVX2(acc[n][m]);
+    }
+  }
+}
+
+// _mm512_dpbusd_epi32 multiplies unsigned by signed bytes and adds each
+// group of 4 products to an int32 lane.
+__attribute__((target("avx512f,avx512bw,avx512vnni")))
+static void Int8DotBlockAVX512VNNI(const uint8_t* const* input,
+    const int8_t* const* weights, const int padded_k,
+    int32_t sums[kBlockN][kBlockM]) {
+  __m512i acc[kBlockN][kBlockM];
+  for (int n = 0; n < kBlockN; ++n) {
+    for (int m = 0; m < kBlockM; ++m) {
+      acc[n][m] = _mm512_setzero_si512();
+    }
+  }
+  for (int k = 0; k < padded_k; k += 64) {
+    __m512i in[kBlockN];
+    for (int n = 0; n < kBlockN; ++n) {
+      in[n] = _mm512_loadu_si512(input[n] + k);
+    }
+    for (int m = 0; m < kBlockM; ++m) {
+      const __m512i w = _mm512_loadu_si512(weights[m] + k);
+      for (int n = 0; n < kBlockN; ++n) {
+        acc[n][m] = _mm512_dpbusd_epi32(acc[n][m], in[n], w);
+      }
+    }
+  }
+  for (int n = 0; n < kBlockN; ++n) {
+    for (int m = 0; m < kBlockM; ++m) {
+      sums[n][m] = _mm512_reduce_add_epi32(acc[n][m]);
+    }
+  }
+}
+#endif  // USE_X86_INT8_KERNELS
+
+bool Int8KernelSupported(const Int8Kernel kernel) {
+  switch (kernel) {
+    case QuantizationParameter_Kernel_AUTO:
+    case QuantizationParameter_Kernel_SCALAR:
+      return true;
+#ifdef USE_X86_INT8_KERNELS
+    case QuantizationParameter_Kernel_AVX2:
+      return __builtin_cpu_supports("avx2");
+    case QuantizationParameter_Kernel_AVX512_VNNI:
+      return __builtin_cpu_supports("avx512f") &&
+          __builtin_cpu_supports("avx512bw") &&
+          __builtin_cpu_supports("avx512vnni");
+#endif
+    default:
+      return false;
+  }
+}
+
+template <typename Dtype>
+Int8Gemm<Dtype>::Int8Gemm(const QuantizationParameter& param)
+    : kernel_(param.kernel()), M_(0), K_(0), padded_k_(0) {
+  CHECK(param.has_bottom_max()) << "INT8 inference needs bottom_max.";
+  CHECK_GT(param.bottom_max(), 0);
+  CHECK(Int8KernelSupported(kernel_))
+      << "INT8 kernel " << QuantizationParameter_Kernel_Name(kernel_)
+      << " is not supported by this CPU.";
+  // Resolve AUTO to the widest kernel supported by the running CPU.
+  if (kernel_ == QuantizationParameter_Kernel_AUTO) {
+    kernel_ =
+        Int8KernelSupported(QuantizationParameter_Kernel_AVX512_VNNI) ?
+        QuantizationParameter_Kernel_AVX512_VNNI :
+        Int8KernelSupported(QuantizationParameter_Kernel_AVX2) ?
+        QuantizationParameter_Kernel_AVX2 :
+        QuantizationParameter_Kernel_SCALAR;
+  }
+  scale_ = param.bottom_max() / 127.f;
+  inv_scale_ = 127.f / param.bottom_max();
+}
+
+template <typename Dtype>
+void Int8Gemm<Dtype>::SetWeights(const int M, const int K,
+    const int spatial_dim, const Dtype* weights) {
+  CHECK_EQ(K % spatial_dim, 0);
+  M_ = M;
+  K_ = K;
+  padded_k_ = (K + kPaddedKAlign - 1) / kPaddedKAlign * kPaddedKAlign;
+  weights_.assign(M * padded_k_, 0);
+  scales_.resize(M);
+  sums_.resize(M);
+  const int channels = K / spatial_dim;
+  for (int m = 0; m < M; ++m) {
+    const Dtype* row = weights + m * K;
+    float max_abs = 0;
+    for (int k = 0; k < K; ++k) {
+      max_abs = std::max(max_abs, std::fabs(static_cast<float>(row[k])));
+    }
+    const float scale = max_abs > 0 ? max_abs / 127.f : 1.f;
+    int8_t* quantized_row = &weights_[m * padded_k_];
+    int32_t sum = 0;
+    for (int c = 0; c < channels; ++c) {
+      for (int s = 0; s < spatial_dim; ++s) {
+        const int q = static_cast<int>(std::floor(
+            static_cast<float>(row[c * spatial_dim + s]) / scale + 0.5f));
+        quantized_row[s * channels + c] =
+            static_cast<int8_t>(std::max(-127, std::min(127, q)));
+        sum += quantized_row[s * channels + c];
+      }
+    }
+    scales_[m] = scale * scale_;
+    sums_[m] = sum;
+  }
+}
+
+template <typename Dtype>
+void Int8Gemm<Dtype>::Forward(const int N, const uint8_t* input,
+    const Dtype* bias, Dtype* output, const int n_stride,
+    const int m_stride) const {
+  CHECK_GT(M_, 0) << "SetWeights() must be called first.";
+  Int8DotBlock dot_block = Int8DotBlockScalar;
+#ifdef USE_X86_INT8_KERNELS
+  if (kernel_ == QuantizationParameter_Kernel_AVX512_VNNI) {
+    dot_block = Int8DotBlockAVX512VNNI;
+  } else if (kernel_ == QuantizationParameter_Kernel_AVX2) {
+    dot_block = Int8DotBlockAVX2;
+  }
+#endif
+  const int weight_block = std::max(kBlockM,
+      kWeightBlockBytes / padded_k_ / kBlockM * kBlockM);
+  const uint8_t* input_rows[kBlockN];
+  const int8_t* weight_rows[kBlockM];
+  int32_t sums[kBlockN][kBlockM];
+  for (int m_begin = 0; m_begin < M_; m_begin += weight_block) {
+    const int m_end = std::min(M_, m_begin + weight_block);
+    for (int n = 0; n < N; n += kBlockN) {
+      // The rows past the end repeat the last one, and are not written.
+      const int block_n = std::min(kBlockN, N - n);
+      for (int i = 0; i < kBlockN; ++i) {
+        input_rows[i] = input + (n + std::min(i, block_n - 1)) * padded_k_;
+      }
+      for (int m = m_begin; m < m_end; m += kBlockM) {
+        const int block_m = std::min(kBlockM, m_end - m);
+        for (int j = 0; j < kBlockM; ++j) {
+          weight_rows[j] =
+              &weights_[(m + std::min(j, block_m - 1)) * padded_k_];
+        }
+        dot_block(input_rows, weight_rows, padded_k_, sums);
+        for (int i = 0; i < block_n; ++i) {
+          for (int j = 0; j < block_m; ++j) {
+            const float value =
+                (sums[i][j] - 128 * sums_[m + j]) * scales_[m + j];
+            output[(n + i) * n_stride + (m + j) * m_stride] =
+                bias ? value + bias[m + j] : value;
+          }
+        }
+      }
+    }
+  }
+}
+
+INSTANTIATE_CLASS(Int8Gemm);
+
+}  // namespace caffe
@@ -0,0 +1,121 @@
+#include <boost/thread.hpp>
+#include <algorithm>
+#include <exception>
+
+#include "caffe/util/thread_pool.hpp"
+
+namespace caffe {
+
+class ThreadPool::sync {
+ public:
+  boost::mutex mutex_;
+  // Signaled when a new batch starts or the pool stops.
+  boost::condition_variable work_condition_;
+  // Signaled when the last task of a batch finishes.
+  boost::condition_variable done_condition_;
+};
+
+ThreadPool::ThreadPool(int num_threads)
+    : num_threads_(num_threads), sync_(new sync()), func_(NULL),
+      num_tasks_(0), next_task_(0), num_unfinished_(0), generation_(0),
+      stop_(false) {
+  if (num_threads_ <= 0) {
+    num_threads_ = std::max<int>(boost::thread::hardware_concurrency(), 1);
+  }
+  Caffe::Brew mode = Caffe::mode();
+  int solver_count = Caffe::solver_count();
+  bool root_solver = Caffe::root_solver();
+  try {
+    for (int i = 1; i < num_threads_; ++i) {
+      threads_.push_back(shared_ptr<boost::thread>(new boost::thread(
+          &ThreadPool::entry, this, mode, solver_count, root_solver)));
+    }
+  } catch (std::exception& e) {
+    LOG(FATAL) << "Thread exception: " << e.what();
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    boost::mutex::scoped_lock lock(sync_->mutex_);
+    stop_ = true;
+  }
+  sync_->work_condition_.notify_all();
+  for (int i = 0; i < threads_.size(); ++i) {
+    try {
+      threads_[i]->join();
+    } catch (std::exception& e) {
+      LOG(FATAL) << "Thread exception: " << e.what();
+    }
+  }
+}
+
+void ThreadPool::Run(int n, const boost::function<void(int)>& func) {
+  if (threads_.empty() || n <= 1) {
+    for (int i = 0; i < n; ++i) {
+      func(i);
+    }
+    return;
+  }
+  {
+    boost::mutex::scoped_lock lock(sync_->mutex_);
+    func_ = &func;
+    num_tasks_ = n;
+    next_task_ = 0;
+    num_unfinished_ = n;
+    ++generation_;
+  }
+  sync_->work_condition_.notify_all();
+  RunTasks();
+  // Tasks may still refer to the caller's state, so do not let an interrupt
+  // of the calling thread (e.g. a stopping prefetch thread) cut the wait.
+  boost::this_thread::disable_interruption no_interruption;
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  while (num_unfinished_ > 0) {
+    sync_->done_condition_.wait(lock);
+  }
+  func_ = NULL;
+}
+
+void ThreadPool::entry(Caffe::Brew mode, int solver_count, bool root_solver) {
+  Caffe::set_mode(mode);
+  Caffe::set_solver_count(solver_count);
+  Caffe::set_root_solver(root_solver);
+
+  int generation = 0;
+  while (true) {
+    {
+      boost::mutex::scoped_lock lock(sync_->mutex_);
+      while (!stop_ && generation_ == generation) {
+        sync_->work_condition_.wait(lock);
+      }
+      if (stop_) {
+        return;
+      }
+      generation = generation_;
+    }
+    RunTasks();
+  }
+}
+
+void ThreadPool::RunTasks() {
+  while (true) {
+    const boost::function<void(int)>* func;
+    int task;
+    {
+      boost::mutex::scoped_lock lock(sync_->mutex_);
+      if (next_task_ >= num_tasks_) {
+        return;
+      }
+      func = func_;
+      task = next_task_++;
+    }
+    (*func)(task);
+    boost::mutex::scoped_lock lock(sync_->mutex_);
+    if (--num_unfinished_ == 0) {
+      sync_->done_condition_.notify_all();
+    }
+  }
+}
+
+}  // namespace caffe
@@ -18,6 +18,7 @@ namespace bp = boost::python;
 using caffe::Blob;
 using caffe::Caffe;
 using caffe::Net;
+using caffe::NetProfiler;
 using caffe::Layer;
 using caffe::Solver;
 using caffe::shared_ptr;
@@ -41,6 +42,12 @@ DEFINE_string(weights, "",
     "separated by ','. Cannot be set simultaneously with snapshot.");
 DEFINE_int32(iterations, 50,
     "The number of iterations to run.");
+DEFINE_string(profile_trace, "",
+    "Optional; the file to write the layer times of 'caffe time' to, in "
+    "the Chrome trace_event JSON format.");
+DEFINE_string(profile_csv, "",
+    "Optional; the file to write the layer times of 'caffe time' to, as "
+    "CSV.");
 DEFINE_string(sigint_effect, "stop",
              "Optional; action to take when a SIGINT signal is received: "
               "snapshot, stop or none.");
@@ -326,61 +333,66 @@ int time() {
   LOG(INFO) << "Performing Backward";
   caffe_net.Backward();
 
-  const vector<shared_ptr<Layer<float> > >& layers = caffe_net.layers();
-  const vector<vector<Blob<float>*> >& bottom_vecs = caffe_net.bottom_vecs();
-  const vector<vector<Blob<float>*> >& top_vecs = caffe_net.top_vecs();
-  const vector<vector<bool> >& bottom_need_backward =
-      caffe_net.bottom_need_backward();
   LOG(INFO) << "*** Benchmark begins ***";
   LOG(INFO) << "Testing for " << FLAGS_iterations << " iterations.";
+  shared_ptr<NetProfiler> profiler(new NetProfiler());
+  caffe_net.set_profiler(profiler);
   Timer total_timer;
   total_timer.Start();
-  Timer forward_timer;
-  Timer backward_timer;
-  Timer timer;
-  std::vector<double> forward_time_per_layer(layers.size(), 0.0);
-  std::vector<double> backward_time_per_layer(layers.size(), 0.0);
-  double forward_time = 0.0;
-  double backward_time = 0.0;
   for (int j = 0; j < FLAGS_iterations; ++j) {
     Timer iter_timer;
     iter_timer.Start();
-    forward_timer.Start();
-    for (int i = 0; i < layers.size(); ++i) {
-      timer.Start();
-      layers[i]->Forward(bottom_vecs[i], top_vecs[i]);
-      forward_time_per_layer[i] += timer.MicroSeconds();
-    }
-    forward_time += forward_timer.MicroSeconds();
-    backward_timer.Start();
-    for (int i = layers.size() - 1; i >= 0; --i) {
-      timer.Start();
-      layers[i]->Backward(top_vecs[i], bottom_need_backward[i],
-                          bottom_vecs[i]);
-      backward_time_per_layer[i] += timer.MicroSeconds();
-    }
-    backward_time += backward_timer.MicroSeconds();
+    caffe_net.Forward();
+    caffe_net.Backward();
     LOG(INFO) << "Iteration: " << j + 1 << " forward-backward time: "
       << iter_timer.MilliSeconds() << " ms.";
   }
-  LOG(INFO) << "Average time per layer: ";
-  for (int i = 0; i < layers.size(); ++i) {
-    const caffe::string& layername = layers[i]->layer_param().name();
-    LOG(INFO) << std::setfill(' ') << std::setw(10) << layername <<
-      "\tforward: " << forward_time_per_layer[i] / 1000 /
-      FLAGS_iterations << " ms.";
-    LOG(INFO) << std::setfill(' ') << std::setw(10) << layername  <<
-      "\tbackward: " << backward_time_per_layer[i] / 1000 /
-      FLAGS_iterations << " ms.";
-  }
   total_timer.Stop();
-  LOG(INFO) << "Average Forward pass: " << forward_time / 1000 /
-    FLAGS_iterations << " ms.";
-  LOG(INFO) << "Average Backward pass: " << backward_time / 1000 /
-    FLAGS_iterations << " ms.";
+  caffe_net.set_profiler(shared_ptr<NetProfiler>());
+  const NetProfiler::Pass passes[2] = {NetProfiler::FORWARD,
+                                       NetProfiler::BACKWARD};
+  LOG(INFO) << "Time per layer, mean / p50 / p90 / p99: ";
+  for (int i = 0; i < profiler->layers().size(); ++i) {
+    const NetProfiler::LayerInfo& info = profiler->layers()[i];
+    if (info.name.empty()) {
+      continue;
+    }
+    for (int k = 0; k < 2; ++k) {
+      const vector<double> durations = profiler->Durations(i, passes[k]);
+      if (durations.empty()) {
+        continue;
+      }
+      LOG(INFO) << std::setfill(' ') << std::setw(10) << info.name
+        << (passes[k] == NetProfiler::FORWARD ? "\tforward: " :
+            "\tbackward: ")
+        << NetProfiler::Mean(durations) / 1000 << " / "
+        << NetProfiler::Percentile(durations, 50) / 1000 << " / "
+        << NetProfiler::Percentile(durations, 90) / 1000 << " / "
+        << NetProfiler::Percentile(durations, 99) / 1000 << " ms, "
+        << info.flops[passes[k]] / 1e9 << " GFLOPs, "
+        << info.bytes / 1e6 << " MB.";
+    }
+  }
+  for (int k = 0; k < 2; ++k) {
+    const vector<double> durations = profiler->Durations(-1, passes[k]);
+    LOG(INFO) << (passes[k] == NetProfiler::FORWARD ? "Forward" : "Backward")
+      << " pass: mean " << NetProfiler::Mean(durations) / 1000
+      << " ms, p50 " << NetProfiler::Percentile(durations, 50) / 1000
+      << " ms, p90 " << NetProfiler::Percentile(durations, 90) / 1000
+      << " ms, p99 " << NetProfiler::Percentile(durations, 99) / 1000
+      << " ms.";
+  }
   LOG(INFO) << "Average Forward-Backward: " << total_timer.MilliSeconds() /
     FLAGS_iterations << " ms.";
   LOG(INFO) << "Total Time: " << total_timer.MilliSeconds() << " ms.";
+  if (FLAGS_profile_trace.size()) {
+    profiler->WriteChromeTrace(FLAGS_profile_trace);
+    LOG(INFO) << "Wrote Chrome trace to " << FLAGS_profile_trace;
+  }
+  if (FLAGS_profile_csv.size()) {
+    profiler->WriteCSV(FLAGS_profile_csv);
+    LOG(INFO) << "Wrote layer times to " << FLAGS_profile_csv;
+  }
   LOG(INFO) << "*** Benchmark ends ***";
   return 0;
 }
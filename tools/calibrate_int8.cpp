@@ -0,0 +1,73 @@
+// This program calibrates the INT8 inference of a net, see
+// QuantizationParameter. It runs the TEST data of the net, e.g. an LMDB of
+// calibration images, through the FP32 net, records the largest absolute
+// value of the bottom of each Convolution and InnerProduct layer that
+// supports int8, and writes the net with these as quantization_param. The
+// weights are quantized when the net is loaded, so the weights file is used
+// as is.
+// With -test_iterations, the FP32 and INT8 nets are then both tested, and
+// their outputs compared; the outputs of DetectionEvaluate layers are
+// reported as mAP, as the solver does, and the program fails if the INT8 mAP
+// is more than -max_map_drop below the FP32 one.
+// Usage:
+//    calibrate_int8 [FLAGS] NET_PROTO WEIGHTS INT8_NET_PROTO
+
+#include <string>
+
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include "caffe/caffe.hpp"
+#include "caffe/util/int8_calibration.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+DEFINE_int32(iterations, 50,
+    "The number of calibration iterations.");
+DEFINE_int32(test_iterations, 0,
+    "The number of iterations to test the FP32 and INT8 nets with.");
+DEFINE_string(ap_version, "Integral",
+    "The way to compute the mAP of DetectionEvaluate outputs "
+    "{11point, MaxIntegral, Integral}.");
+DEFINE_double(max_map_drop, 0.01,
+    "With -test_iterations, fail if the mAP of a DetectionEvaluate output "
+    "drops by more than this with INT8.");
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+  // Print output to stderr (while still logging)
+  FLAGS_alsologtostderr = 1;
+#ifndef GFLAGS_GFLAGS_H_
+  namespace gflags = google;
+#endif
+  gflags::SetUsageMessage("Calibrate the INT8 inference of a net.\n"
+        "Usage:\n"
+        "    calibrate_int8 [FLAGS] NET_PROTO WEIGHTS INT8_NET_PROTO\n");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  if (argc != 4) {
+    gflags::ShowUsageWithFlagsRestrict(argv[0], "tools/calibrate_int8");
+    return 1;
+  }
+  Caffe::set_mode(Caffe::CPU);
+  NetParameter net_param;
+  ReadNetParamsFromTextFileOrDie(argv[1], &net_param);
+  net_param.mutable_state()->set_phase(TEST);
+
+  NetParameter int8_param;
+  CalibrateInt8(net_param, argv[2], FLAGS_iterations, &int8_param);
+  int8_param.clear_state();
+  WriteProtoToTextFile(int8_param, argv[3]);
+  LOG(INFO) << "Wrote INT8 NetParameter text proto to " << argv[3];
+
+  if (FLAGS_test_iterations > 0) {
+    int8_param.mutable_state()->set_phase(TEST);
+    if (!CheckInt8Accuracy(net_param, int8_param, argv[2],
+        FLAGS_test_iterations, FLAGS_ap_version, FLAGS_max_map_drop)) {
+      LOG(ERROR) << "The INT8 net is not accurate enough, see above.";
+      return 1;
+    }
+  }
+  return 0;
+}
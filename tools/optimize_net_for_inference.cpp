@@ -0,0 +1,74 @@
+// This is a script to fold BatchNorm and Scale layers into the preceding
+// Convolution or InnerProduct layers of a TEST net, and to drop its Dropout
+// layers and run its ReLU layers in place, see util/optimize_net.hpp.
+// Usage:
+//    optimize_net_for_inference net_proto_file_in net_proto_file_out
+//    optimize_net_for_inference net_proto_file_in weights_file_in
+//        net_proto_file_out weights_file_out
+// Without weights, BatchNorm and Scale layers are kept.
+
+#include <map>
+#include <string>
+
+#include "caffe/caffe.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/optimize_net.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+int main(int argc, char** argv) {
+  FLAGS_alsologtostderr = 1;  // Print output to stderr (while still logging)
+  ::google::InitGoogleLogging(argv[0]);
+  if (argc != 3 && argc != 5) {
+    LOG(ERROR) << "Usage: optimize_net_for_inference net_proto_file_in "
+        << "[weights_file_in] net_proto_file_out [weights_file_out]";
+    return 1;
+  }
+  const bool with_weights = argc == 5;
+
+  NetParameter net_param;
+  ReadNetParamsFromTextFileOrDie(argv[1], &net_param);
+  net_param.mutable_state()->set_phase(TEST);
+  NetParameter filtered_param;
+  Net<float>::FilterNet(net_param, &filtered_param);
+  if (with_weights) {
+    // Attach the trained blobs to the layers of the same name, as
+    // Net::CopyTrainedLayersFrom does.
+    NetParameter weights_param;
+    ReadNetParamsFromBinaryFileOrDie(argv[2], &weights_param);
+    map<string, const LayerParameter*> trained_layers;
+    for (int i = 0; i < weights_param.layer_size(); ++i) {
+      trained_layers[weights_param.layer(i).name()] = &weights_param.layer(i);
+    }
+    for (int i = 0; i < filtered_param.layer_size(); ++i) {
+      LayerParameter* layer_param = filtered_param.mutable_layer(i);
+      map<string, const LayerParameter*>::const_iterator it =
+          trained_layers.find(layer_param->name());
+      if (it == trained_layers.end()) {
+        LOG(INFO) << "Ignoring layer " << layer_param->name()
+                  << ", which has no trained weights";
+        continue;
+      }
+      layer_param->mutable_blobs()->CopyFrom(it->second->blobs());
+    }
+  }
+
+  NetParameter optimized_param;
+  OptimizeNetForInference(filtered_param, &optimized_param);
+  LOG(INFO) << "Optimized " << filtered_param.layer_size() << " layers into "
+            << optimized_param.layer_size();
+
+  if (with_weights) {
+    WriteProtoToBinaryFile(optimized_param, argv[4]);
+    LOG(INFO) << "Wrote optimized weights to " << argv[4];
+  }
+  for (int i = 0; i < optimized_param.layer_size(); ++i) {
+    optimized_param.mutable_layer(i)->clear_blobs();
+  }
+  optimized_param.clear_state();
+  WriteProtoToTextFile(optimized_param, with_weights ? argv[3] : argv[2]);
+  LOG(INFO) << "Wrote optimized NetParameter text proto to "
+            << (with_weights ? argv[3] : argv[2]);
+  return 0;
+}